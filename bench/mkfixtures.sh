@@ -0,0 +1,180 @@
+#!/bin/sh
+# Build the nkbench fixture images from the reference tree.
+#
+#   mkfixtures.sh NKBENCH OUTDIR [gen options]
+#
+# Every image holds the same tree, written by "nkbench gen", with fixed
+# times and owners.  Formats whose tools are missing are skipped with a
+# note, run "nkbench OUTDIR/*" on whatever was built.
+
+set -u
+
+if [ $# -lt 2 ]; then
+	echo "Usage: $0 NKBENCH OUTDIR [-n FILES] [-s MIB]" >&2
+	exit 1
+fi
+NKBENCH=$1
+OUT=$2
+shift 2
+
+EPOCH=1700000000
+UUID=6e6b6172-632d-4265-6e63-680000000001
+TREE=$OUT/tree
+
+export SOURCE_DATE_EPOCH=$EPOCH
+export E2FSPROGS_FAKE_TIME=$EPOCH
+export LC_ALL=C
+export TZ=UTC
+
+have() {
+	command -v "$1" >/dev/null 2>&1
+}
+
+skip() {
+	echo "skip $1: $2" >&2
+}
+
+built() {
+	echo "built $1" >&2
+}
+
+mkdir -p "$OUT" || exit 1
+rm -rf "$TREE"
+"$NKBENCH" gen "$TREE" "$@" || exit 1
+
+# Room for the tree plus filesystem metadata, in MiB.
+SIZE=$(( $(du -sm "$TREE" | cut -f1) * 3 / 2 + 64 ))
+
+# ext4, also the payload of the virtual disk images.
+if have mke2fs; then
+	rm -f "$OUT/ext4.img"
+	if mke2fs -q -t ext4 -U "$UUID" -E root_owner=0:0,hash_seed=$UUID \
+		-d "$TREE" "$OUT/ext4.img" "${SIZE}M" >/dev/null; then
+		built ext4.img
+	fi
+else
+	skip ext4 "mke2fs not found"
+fi
+
+# NTFS has no tool that fills an unmounted image with a directory tree.
+if have mkntfs && have ntfs-3g && [ "$(id -u)" = 0 ]; then
+	rm -f "$OUT/ntfs.img"
+	truncate -s "${SIZE}M" "$OUT/ntfs.img"
+	MNT=$(mktemp -d)
+	if mkntfs -q -F -Q -s 512 "$OUT/ntfs.img" >/dev/null \
+		&& ntfs-3g "$OUT/ntfs.img" "$MNT"; then
+		cp -a "$TREE/." "$MNT/"
+		umount "$MNT" && built ntfs.img
+	fi
+	rmdir "$MNT"
+else
+	skip ntfs "needs mkntfs, ntfs-3g and root"
+fi
+
+# btrfs with zstd when mkfs.btrfs can compress --rootdir.
+if have mkfs.btrfs; then
+	rm -f "$OUT/btrfs-zstd.img"
+	truncate -s "${SIZE}M" "$OUT/btrfs-zstd.img"
+	if mkfs.btrfs --help 2>&1 | grep -q -- --compress; then
+		COMPRESS="--compress zstd"
+	else
+		COMPRESS=
+		echo "note btrfs-zstd.img: mkfs.btrfs can't compress, data is stored plain" >&2
+	fi
+	if mkfs.btrfs -q -f -U "$UUID" $COMPRESS --rootdir "$TREE" "$OUT/btrfs-zstd.img" >/dev/null; then
+		built btrfs-zstd.img
+	fi
+else
+	skip btrfs "mkfs.btrfs not found"
+fi
+
+# XFS from a protofile listing the tree.
+proto_dir() {
+	for f in "$1"/*; do
+		name=${f##*/}
+		if [ -d "$f" ]; then
+			echo "$name d--755 0 0"
+			proto_dir "$f"
+			echo '$'
+		else
+			echo "$name ---644 0 0 $f"
+		fi
+	done
+}
+if have mkfs.xfs; then
+	rm -f "$OUT/xfs.img"
+	truncate -s "$(( SIZE > 300 ? SIZE : 300 ))M" "$OUT/xfs.img"
+	TREE_ABS=$(cd "$TREE" && pwd)
+	{
+		echo /dev/null
+		echo 0 0
+		echo "d--755 0 0"
+		proto_dir "$TREE_ABS"
+		echo '$'
+	} > "$OUT/xfs.proto"
+	if mkfs.xfs -q -f -m uuid="$UUID" -p "$OUT/xfs.proto" "$OUT/xfs.img"; then
+		built xfs.img
+	fi
+	rm -f "$OUT/xfs.proto"
+else
+	skip xfs "mkfs.xfs not found"
+fi
+
+if have mksquashfs; then
+	rm -f "$OUT/squashfs-xz.sqfs"
+	if mksquashfs "$TREE" "$OUT/squashfs-xz.sqfs" -quiet -no-progress -comp xz \
+		-noappend -all-root -mkfs-time $EPOCH -all-time $EPOCH >/dev/null; then
+		built squashfs-xz.sqfs
+	fi
+else
+	skip squashfs "mksquashfs not found"
+fi
+
+if have tar && have gzip; then
+	if tar --sort=name --mtime=@$EPOCH --owner=0 --group=0 --numeric-owner \
+		-C "$TREE" -cf - . | gzip -n -6 > "$OUT/tar.tar.gz"; then
+		built tar.tar.gz
+	fi
+else
+	skip tar.gz "tar or gzip not found"
+fi
+
+if have zip; then
+	rm -f "$OUT/zip.zip"
+	ZIP_OUT=$(cd "$OUT" && pwd)/zip.zip
+	if (cd "$TREE" && find . -mindepth 1 | sort | zip -q -X -@ "$ZIP_OUT"); then
+		built zip.zip
+	fi
+else
+	skip zip "zip not found"
+fi
+
+if have wimlib-imagex; then
+	rm -f "$OUT/wim-lzx.wim"
+	if wimlib-imagex capture "$TREE" "$OUT/wim-lzx.wim" nkbench --compress=LZX \
+		--no-acls >/dev/null; then
+		built wim-lzx.wim
+	fi
+else
+	skip wim "wimlib-imagex not found"
+fi
+
+# Virtual disks wrap the ext4 image.
+if [ -f "$OUT/ext4.img" ] && have qemu-img; then
+	qemu-img convert -f raw -O vhdx "$OUT/ext4.img" "$OUT/ext4.vhdx" && built ext4.vhdx
+	qemu-img convert -f raw -O qcow2 "$OUT/ext4.img" "$OUT/ext4.qcow2" && built ext4.qcow2
+else
+	skip vhdx/qcow2 "needs ext4.img and qemu-img"
+fi
+
+if [ -f "$OUT/ext4.img" ] && have hdiutil; then
+	rm -f "$OUT/ext4.dmg"
+	hdiutil convert -quiet -format UDZO -o "$OUT/ext4.dmg" "$OUT/ext4.img" && built ext4.dmg
+elif [ -f "$OUT/ext4.img" ] && have dmg; then
+	# libdmg-hfsplus
+	dmg build "$OUT/ext4.img" "$OUT/ext4.dmg" >/dev/null && built ext4.dmg
+else
+	skip dmg "needs ext4.img and hdiutil or dmg (libdmg-hfsplus)"
+fi
+
+rm -rf "$TREE"
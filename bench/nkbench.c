@@ -0,0 +1,741 @@
+/*
+ *  NkArc
+ *  Copyright (C) 2023 A1ive
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark of the grub filesystem and filter code over fixture images.
+ *
+ * "nkbench gen DIR" writes the reference tree that mkfixtures.sh packs into
+ * every image format, "nkbench IMAGE..." measures each image in a child
+ * process and prints one JSON object per line:
+ *
+ *   mount_us     grub_disk_open and grub_fs_probe with cold caches
+ *   dir_cold_us  grub_fs_dir of the large directory with cold caches
+ *   dir_warm_us  the same with warm caches
+ *   lookup_us    grub_file_open and close of the deepest file, warm
+ *   rand4k_us    a 4 KiB grub_file_read at a random offset of the big file
+ *   seq_mib_s    grub_file_read of the whole big file with cold caches
+ *   peak_rss_kib peak resident memory of the child
+ *
+ * Times are medians over the runs.  Cold means the grub disk, probe and
+ * partition caches are invalidated and the image is dropped from the page
+ * cache, unless --no-drop is given.
+ */
+
+#include <dl.h>
+#include <hostdisk.h>
+#include <loopback.h>
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/disk.h>
+#include <grub/fs.h>
+#include <grub/file.h>
+#include <grub/partition.h>
+#include <grub/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define BENCH_LOOP_NAME "bench"
+#define BENCH_MTIME 1700000000
+
+/* Layout of the reference tree.  */
+#define TREE_BIG_FILE "/big.bin"
+#define TREE_LARGE_DIR "/large"
+#define TREE_DEEP_DIR "/deep"
+#define TREE_DEEP_LEVELS 32
+#define TREE_DEEP_FILE "leaf.txt"
+
+#define SEQ_BUF_SIZE (1024 * 1024)
+#define RAND_READ_SIZE 4096
+
+static struct
+{
+	unsigned runs;
+	unsigned rand_reads;
+	grub_uint64_t rand_budget_us;
+	int drop;
+	const char* part;
+	const char* dir;
+	const char* file;
+	char* deep;
+} m_opt =
+{
+	.runs = 5,
+	.rand_reads = 1000,
+	.rand_budget_us = 2000000,
+	.drop = 1,
+};
+
+/* How the image under test is reached.  */
+static struct
+{
+	const char* image;
+	char* host_path;
+	int loop;
+	unsigned long id;
+	char* device;
+} m_img;
+
+static grub_uint64_t m_rng = 0x9E3779B97F4A7C15ULL;
+
+static grub_uint64_t
+xorshift64(void)
+{
+	m_rng ^= m_rng << 13;
+	m_rng ^= m_rng >> 7;
+	m_rng ^= m_rng << 17;
+	return m_rng;
+}
+
+static int
+cmp_u64(const void* a, const void* b)
+{
+	grub_uint64_t x = *(const grub_uint64_t*)a;
+	grub_uint64_t y = *(const grub_uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static grub_uint64_t
+median(grub_uint64_t* v, unsigned n)
+{
+	qsort(v, n, sizeof(v[0]), cmp_u64);
+	return v[n / 2];
+}
+
+static int
+fail(const char* what)
+{
+	if (grub_errno != GRUB_ERR_NONE)
+		fprintf(stderr, "nkbench: %s: %s\n", what, grub_errmsg);
+	else
+		fprintf(stderr, "nkbench: %s: %s\n", what, strerror(errno));
+	grub_errno = GRUB_ERR_NONE;
+	return 1;
+}
+
+/* Reference tree.  */
+
+static int
+write_file(const char* path, const void* data, size_t len)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return fail(path);
+	if (fwrite(data, 1, len, f) != len)
+	{
+		fclose(f);
+		return fail(path);
+	}
+	if (fclose(f) != 0)
+		return fail(path);
+	return 0;
+}
+
+static void
+set_mtime(const char* path)
+{
+	struct timeval tv[2] = { { BENCH_MTIME, 0 }, { BENCH_MTIME, 0 } };
+	utimes(path, tv);
+}
+
+/* Alternate incompressible and highly compressible 64 KiB blocks, so the
+   compression filters have real work to do.  */
+static int
+gen_big_file(const char* path, unsigned mib)
+{
+	static const char text[] = "The quick brown fox jumps over the lazy dog.\n";
+	grub_uint64_t block[8192];
+	FILE* f;
+	unsigned i;
+	unsigned j;
+
+	f = fopen(path, "wb");
+	if (!f)
+		return fail(path);
+	for (i = 0; i < mib * 16; i++)
+	{
+		if (i & 1)
+		{
+			for (j = 0; j < sizeof(block); j++)
+				((char*)block)[j] = text[j % (sizeof(text) - 1)];
+		}
+		else
+		{
+			for (j = 0; j < ARRAY_SIZE(block); j++)
+				block[j] = xorshift64();
+		}
+		if (fwrite(block, 1, sizeof(block), f) != sizeof(block))
+		{
+			fclose(f);
+			return fail(path);
+		}
+	}
+	if (fclose(f) != 0)
+		return fail(path);
+	set_mtime(path);
+	return 0;
+}
+
+static int
+cmd_gen(int argc, char* argv[])
+{
+	unsigned files = 10000;
+	unsigned mib = 64;
+	const char* root = NULL;
+	char path[PATH_MAX];
+	char data[256];
+	size_t len;
+	unsigned i;
+	int n;
+
+	for (n = 0; n < argc; n++)
+	{
+		if (strcmp(argv[n], "-n") == 0 && n + 1 < argc)
+			files = strtoul(argv[++n], NULL, 0);
+		else if (strcmp(argv[n], "-s") == 0 && n + 1 < argc)
+			mib = strtoul(argv[++n], NULL, 0);
+		else
+			root = argv[n];
+	}
+	if (!root)
+	{
+		fprintf(stderr, "Usage: nkbench gen DIR [-n FILES] [-s MIB]\n");
+		return 1;
+	}
+
+	if (mkdir(root, 0755) != 0 && errno != EEXIST)
+		return fail(root);
+
+	snprintf(path, sizeof(path), "%s" TREE_BIG_FILE, root);
+	if (gen_big_file(path, mib))
+		return 1;
+
+	snprintf(path, sizeof(path), "%s" TREE_LARGE_DIR, root);
+	if (mkdir(path, 0755) != 0 && errno != EEXIST)
+		return fail(path);
+	for (i = 0; i < files; i++)
+	{
+		/* Names and sizes vary a little, like real directories.  */
+		snprintf(path, sizeof(path), "%s" TREE_LARGE_DIR "/file-%06u-%x.txt",
+			root, i, (unsigned)(xorshift64() & 0xfff));
+		len = 16 + (size_t)(xorshift64() % (sizeof(data) - 16));
+		n = snprintf(data, sizeof(data), "file %u\n", i);
+		memset(data + n, 'a' + i % 26, len - n);
+		if (write_file(path, data, len))
+			return 1;
+		set_mtime(path);
+	}
+	snprintf(path, sizeof(path), "%s" TREE_LARGE_DIR, root);
+	set_mtime(path);
+
+	len = snprintf(path, sizeof(path), "%s" TREE_DEEP_DIR, root);
+	for (i = 0; i <= TREE_DEEP_LEVELS; i++)
+	{
+		if (i)
+			len += snprintf(path + len, sizeof(path) - len, "/d%02u", i);
+		if (mkdir(path, 0755) != 0 && errno != EEXIST)
+			return fail(path);
+	}
+	snprintf(path + len, sizeof(path) - len, "/" TREE_DEEP_FILE);
+	if (write_file(path, "leaf\n", 5))
+		return 1;
+	/* Directory times last, creating entries updates them.  */
+	for (i = TREE_DEEP_LEVELS + 2; i > 0; i--)
+	{
+		set_mtime(path);
+		*strrchr(path, '/') = '\0';
+	}
+	set_mtime(root);
+	return 0;
+}
+
+/* Measurements.  */
+
+static void
+drop_page_cache(void)
+{
+	int fd;
+
+	if (!m_opt.drop)
+		return;
+	fd = open(m_img.image, O_RDONLY);
+	if (fd < 0)
+		return;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static void
+drop_caches(void)
+{
+	grub_disk_cache_invalidate_all();
+	drop_page_cache();
+}
+
+/* Forget the probed filesystem and partitions.  Loop mounts are added again,
+   so the filters parse their headers again.  */
+static grub_err_t
+remap(void)
+{
+	if (!m_img.loop)
+	{
+		grub_fs_probe_invalidate(GRUB_DISK_DEVICE_HOSTDISK_ID, m_img.id);
+		grub_partition_cache_invalidate(GRUB_DISK_DEVICE_HOSTDISK_ID, m_img.id);
+		return GRUB_ERR_NONE;
+	}
+	grub_loopback_delete(BENCH_LOOP_NAME);
+	grub_errno = GRUB_ERR_NONE;
+	return grub_loopback_add(BENCH_LOOP_NAME, m_img.host_path, 1);
+}
+
+static char*
+bench_path(const char* path)
+{
+	return grub_xasprintf("(%s)%s", m_img.device, path);
+}
+
+static grub_fs_t
+probe(grub_disk_t* disk)
+{
+	grub_fs_t fs;
+
+	*disk = grub_disk_open(m_img.device);
+	if (!*disk)
+		return NULL;
+	fs = grub_fs_probe(*disk);
+	if (!fs)
+	{
+		grub_disk_close(*disk);
+		*disk = NULL;
+	}
+	return fs;
+}
+
+/* Map the image as a disk, or loop mount it through the filters if no
+   filesystem is found on the raw image.  */
+static grub_fs_t
+open_image(void)
+{
+	char real[PATH_MAX];
+	grub_disk_t disk;
+	grub_fs_t fs;
+
+	if (grub_hostdisk_add(m_img.image, &m_img.id) != GRUB_ERR_NONE)
+		return NULL;
+	m_img.device = grub_xasprintf("hd%lu%s%s", m_img.id, m_opt.part ? "," : "",
+		m_opt.part ? m_opt.part : "");
+	fs = probe(&disk);
+	if (fs)
+	{
+		grub_disk_close(disk);
+		return fs;
+	}
+	grub_errno = GRUB_ERR_NONE;
+
+	if (!realpath(m_img.image, real))
+		return NULL;
+	m_img.loop = 1;
+	m_img.host_path = grub_xasprintf("(host)%s", real);
+	grub_free(m_img.device);
+	m_img.device = grub_xasprintf(BENCH_LOOP_NAME "%s%s", m_opt.part ? "," : "",
+		m_opt.part ? m_opt.part : "");
+	if (!m_img.host_path || !m_img.device
+		|| grub_loopback_add(BENCH_LOOP_NAME, m_img.host_path, 1) != GRUB_ERR_NONE)
+		return NULL;
+	fs = probe(&disk);
+	if (fs)
+		grub_disk_close(disk);
+	return fs;
+}
+
+static int
+callback_count(const char* filename,
+	const struct grub_dirhook_info* info __attribute__((unused)), void* data)
+{
+	if (strcmp(filename, ".") && strcmp(filename, ".."))
+		(*(unsigned*)data)++;
+	return 0;
+}
+
+static grub_uint64_t
+bench_mount(void)
+{
+	grub_uint64_t* t = calloc(m_opt.runs, sizeof(*t));
+	grub_uint64_t start;
+	grub_disk_t disk;
+	grub_uint64_t ret = 0;
+	unsigned i;
+
+	for (i = 0; t && i < m_opt.runs; i++)
+	{
+		drop_caches();
+		start = grub_get_time_us();
+		if (remap() || !probe(&disk))
+			goto out;
+		t[i] = grub_get_time_us() - start;
+		grub_disk_close(disk);
+	}
+	ret = median(t, m_opt.runs);
+out:
+	free(t);
+	return ret;
+}
+
+static int
+bench_dir(grub_uint64_t* cold, grub_uint64_t* warm, unsigned* count)
+{
+	grub_uint64_t* t = calloc(m_opt.runs * 2, sizeof(*t));
+	grub_uint64_t start;
+	grub_disk_t disk;
+	grub_fs_t fs;
+	unsigned i;
+	int ret = 1;
+
+	for (i = 0; t && i < m_opt.runs; i++)
+	{
+		if (remap() || !(fs = probe(&disk)))
+			goto out;
+		drop_caches();
+
+		*count = 0;
+		start = grub_get_time_us();
+		fs->fs_dir(disk, m_opt.dir, callback_count, count);
+		t[i] = grub_get_time_us() - start;
+
+		start = grub_get_time_us();
+		fs->fs_dir(disk, m_opt.dir, callback_count, count);
+		t[m_opt.runs + i] = grub_get_time_us() - start;
+		grub_disk_close(disk);
+		if (grub_errno != GRUB_ERR_NONE)
+			goto out;
+		*count /= 2;
+	}
+	*cold = median(t, m_opt.runs);
+	*warm = median(t + m_opt.runs, m_opt.runs);
+	ret = 0;
+out:
+	free(t);
+	return ret;
+}
+
+static int
+bench_lookup(grub_uint64_t* us)
+{
+	grub_uint64_t* t = calloc(m_opt.runs, sizeof(*t));
+	char* path = bench_path(m_opt.deep);
+	grub_uint64_t start;
+	grub_file_t file;
+	unsigned i;
+	int ret = 1;
+
+	if (!t || !path)
+		goto out;
+	/* Warm up.  */
+	file = grub_file_open(path, GRUB_FILE_TYPE_CAT | GRUB_FILE_TYPE_NO_DECOMPRESS);
+	if (!file)
+		goto out;
+	grub_file_close(file);
+	for (i = 0; i < m_opt.runs; i++)
+	{
+		start = grub_get_time_us();
+		file = grub_file_open(path, GRUB_FILE_TYPE_CAT | GRUB_FILE_TYPE_NO_DECOMPRESS);
+		if (!file)
+			goto out;
+		grub_file_close(file);
+		t[i] = grub_get_time_us() - start;
+	}
+	*us = median(t, m_opt.runs);
+	ret = 0;
+out:
+	grub_free(path);
+	free(t);
+	return ret;
+}
+
+/* Random 4 KiB reads until RAND_READS are done or the time budget is spent,
+   stream filters have to decompress from the start on every backward seek.  */
+static int
+bench_rand(grub_uint64_t* us, unsigned* reads)
+{
+	char* path = bench_path(m_opt.file);
+	char* buf = malloc(RAND_READ_SIZE);
+	grub_uint64_t* t = calloc(m_opt.rand_reads, sizeof(*t));
+	grub_uint64_t begin;
+	grub_uint64_t start;
+	grub_file_t file = NULL;
+	unsigned i;
+	int ret = 1;
+
+	if (!path || !buf || !t)
+		goto out;
+	file = grub_file_open(path, GRUB_FILE_TYPE_CAT | GRUB_FILE_TYPE_NO_DECOMPRESS);
+	if (!file || file->size < RAND_READ_SIZE)
+		goto out;
+	begin = grub_get_time_us();
+	for (i = 0; i < m_opt.rand_reads; i++)
+	{
+		grub_off_t ofs = xorshift64() % (file->size - RAND_READ_SIZE + 1);
+		start = grub_get_time_us();
+		grub_file_seek(file, ofs);
+		if (grub_file_read(file, buf, RAND_READ_SIZE) != RAND_READ_SIZE)
+			goto out;
+		t[i] = grub_get_time_us() - start;
+		if (t[i] + start - begin > m_opt.rand_budget_us)
+		{
+			i++;
+			break;
+		}
+	}
+	*reads = i;
+	*us = median(t, i);
+	ret = 0;
+out:
+	if (file)
+		grub_file_close(file);
+	grub_free(path);
+	free(buf);
+	free(t);
+	return ret;
+}
+
+static int
+bench_seq(grub_uint64_t* bytes, grub_uint64_t* us)
+{
+	grub_uint64_t* t = calloc(m_opt.runs, sizeof(*t));
+	char* path = bench_path(m_opt.file);
+	char* buf = malloc(SEQ_BUF_SIZE);
+	grub_uint64_t start;
+	grub_file_t file;
+	grub_ssize_t r;
+	unsigned i;
+	int ret = 1;
+
+	if (!t || !path || !buf)
+		goto out;
+	for (i = 0; i < m_opt.runs; i++)
+	{
+		drop_caches();
+		if (remap())
+			goto out;
+		*bytes = 0;
+		start = grub_get_time_us();
+		file = grub_file_open(path, GRUB_FILE_TYPE_CAT | GRUB_FILE_TYPE_NO_DECOMPRESS);
+		if (!file)
+			goto out;
+		while ((r = grub_file_read(file, buf, SEQ_BUF_SIZE)) > 0)
+			*bytes += r;
+		grub_file_close(file);
+		t[i] = grub_get_time_us() - start;
+		if (r < 0)
+			goto out;
+	}
+	*us = median(t, m_opt.runs);
+	ret = 0;
+out:
+	grub_free(path);
+	free(buf);
+	free(t);
+	return ret;
+}
+
+static void
+json_string(const char* key, const char* s)
+{
+	printf("\"%s\":\"", key);
+	for (; *s; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	printf("\",");
+}
+
+static void
+json_error(const char* metric)
+{
+	char key[32];
+
+	snprintf(key, sizeof(key), "%s_error", metric);
+	json_string(key, grub_errno ? grub_errmsg : "failed");
+	grub_errno = GRUB_ERR_NONE;
+}
+
+/* Measure one image, run in its own process so peak_rss_kib is per image.  */
+static int
+bench_image(const char* image)
+{
+	grub_uint64_t cold;
+	grub_uint64_t warm;
+	grub_uint64_t us = 0;
+	grub_uint64_t bytes = 0;
+	unsigned count;
+	struct rusage ru;
+	grub_fs_t fs;
+
+	m_img.image = image;
+	printf("{");
+	json_string("image", image);
+
+	fs = open_image();
+	if (!fs)
+	{
+		json_error("open");
+		printf("\"ok\":false}\n");
+		return 1;
+	}
+	json_string("access", m_img.loop ? "loop" : "disk");
+	json_string("fs", fs->name);
+
+	us = bench_mount();
+	if (us)
+		printf("\"mount_us\":%llu,", (unsigned long long)us);
+	else
+		json_error("mount");
+
+	if (bench_dir(&cold, &warm, &count) == 0)
+		printf("\"dir_entries\":%u,\"dir_cold_us\":%llu,\"dir_warm_us\":%llu,",
+			count, (unsigned long long)cold, (unsigned long long)warm);
+	else
+		json_error("dir");
+
+	if (bench_lookup(&us) == 0)
+		printf("\"lookup_us\":%llu,", (unsigned long long)us);
+	else
+		json_error("lookup");
+
+	if (bench_rand(&us, &count) == 0)
+		printf("\"rand4k_reads\":%u,\"rand4k_us\":%llu,", count, (unsigned long long)us);
+	else
+		json_error("rand4k");
+
+	if (bench_seq(&bytes, &us) == 0)
+		printf("\"seq_bytes\":%llu,\"seq_us\":%llu,\"seq_mib_s\":%.1f,",
+			(unsigned long long)bytes, (unsigned long long)us,
+			us ? (double)bytes / 1048576.0 * 1000000.0 / (double)us : 0.0);
+	else
+		json_error("seq");
+
+	getrusage(RUSAGE_SELF, &ru);
+	printf("\"runs\":%u,\"peak_rss_kib\":%ld,\"ok\":true}\n", m_opt.runs, ru.ru_maxrss);
+	return 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: nkbench gen DIR [-n FILES] [-s MIB]\n"
+		"       nkbench [OPTIONS] IMAGE...\n"
+		"\n"
+		"Options:\n"
+		"  -r RUNS       Runs per measurement, the median is reported (5).\n"
+		"  -p PART       Partition of the images, like gpt1.\n"
+		"  --dir PATH    Large directory to enumerate (" TREE_LARGE_DIR ").\n"
+		"  --file PATH   File for random and sequential reads (" TREE_BIG_FILE ").\n"
+		"  --deep PATH   File for the path lookup.\n"
+		"  --rand N      Random 4 KiB reads (1000), stopped after 2 seconds.\n"
+		"  --no-drop     Keep the images in the page cache for cold runs.\n");
+}
+
+int
+main(int argc, char* argv[])
+{
+	int ret = 0;
+	int i;
+	size_t len;
+
+	if (argc > 1 && strcmp(argv[1], "gen") == 0)
+		return cmd_gen(argc - 2, argv + 2);
+
+	m_opt.dir = TREE_LARGE_DIR;
+	m_opt.file = TREE_BIG_FILE;
+	m_opt.deep = malloc(sizeof(TREE_DEEP_DIR) + TREE_DEEP_LEVELS * 4 + sizeof(TREE_DEEP_FILE) + 1);
+	if (!m_opt.deep)
+		return 1;
+	len = sprintf(m_opt.deep, TREE_DEEP_DIR);
+	for (i = 1; i <= TREE_DEEP_LEVELS; i++)
+		len += sprintf(m_opt.deep + len, "/d%02d", i);
+	sprintf(m_opt.deep + len, "/" TREE_DEEP_FILE);
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++)
+	{
+		if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			m_opt.runs = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			m_opt.part = argv[++i];
+		else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+			m_opt.dir = argv[++i];
+		else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc)
+			m_opt.file = argv[++i];
+		else if (strcmp(argv[i], "--deep") == 0 && i + 1 < argc)
+			m_opt.deep = argv[++i];
+		else if (strcmp(argv[i], "--rand") == 0 && i + 1 < argc)
+			m_opt.rand_reads = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--no-drop") == 0)
+			m_opt.drop = 0;
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+	if (i >= argc || m_opt.runs == 0 || m_opt.rand_reads == 0)
+	{
+		usage();
+		return 1;
+	}
+
+	for (; i < argc; i++)
+	{
+		pid_t pid;
+		int status;
+
+		fflush(stdout);
+		pid = fork();
+		if (pid < 0)
+			return fail("fork");
+		if (pid == 0)
+		{
+			grub_module_init();
+			status = bench_image(argv[i]);
+			fflush(stdout);
+			grub_module_fini();
+			_exit(status);
+		}
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+			ret = 1;
+	}
+	return ret;
+}
@@ -0,0 +1,1414 @@
+/*
+ *  NkArc
+ *  Copyright (C) 2023 A1ive
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dl.h>
+#include <hostdisk.h>
+#include <loopback.h>
+#include <version.h>
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/disk.h>
+#include <grub/fs.h>
+#include <grub/file.h>
+#include <grub/crypto.h>
+#include <grub/datetime.h>
+#include <grub/extract.h>
+#include <grub/find.h>
+#include <grub/hashtree.h>
+#include <grub/manifest.h>
+#include <grub/thread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define COPY_BUF_SIZE (1024 * 1024)
+
+static char* m_copy_buf;
+
+/* Host paths of the images added with -i, (hdN) is entry N.  */
+#define MAX_IMAGES 64
+static const char* m_images[MAX_IMAGES];
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"%s v%s\n"
+		"Usage: nkarc [OPTIONS] COMMAND [ARGS]\n"
+		"\n"
+		"Options:\n"
+		"  -i IMAGE        Map the image file or block device IMAGE as (hdN).\n"
+		"  -l NAME=FILE    Mount FILE as loopback device (NAME), decompressing it\n"
+		"                  and opening virtual disk formats.  FILE is a grub path\n"
+		"                  or a host path.\n"
+		"\n"
+		"Commands:\n"
+		"  ls [-l] [PATH]             List devices, or the directory PATH.\n"
+		"  cat PATH...                Write files to stdout.\n"
+		"  extract [-r] [-j N] [-S] [-x] [-D STORE] PATH DEST\n"
+		"                             Copy a file, or a directory tree with -r, to\n"
+		"                             DEST with N writer threads (default 4).\n"
+		"                             Holes of sparse files stay holes, -S also\n"
+		"                             leaves holes for blocks of zeros.  -x copies\n"
+		"                             the disk in a virtual disk image and the data\n"
+		"                             of compressed files.  -D keeps one copy of\n"
+		"                             each file in the directory STORE and links\n"
+		"                             files already there instead of writing them.\n"
+		"                             DEST - writes a file to stdout.\n"
+		"  hash [-a ALGO] [-r] PATH...\n"
+		"                             Print checksums, ALGO is md5, sha1, sha256\n"
+		"                             (default), crc32, crc64 or adler32.  -r\n"
+		"                             hashes every file under a directory PATH.\n"
+		"  stat PATH                  Show details of a file, directory or device.\n"
+		"  manifest update [-a ALGO,...] DISK\n"
+		"                             Record every file of the image DISK with its\n"
+		"                             digests (default sha256) in IMAGE" GRUB_MANIFEST_EXT ",\n"
+		"                             hashing only files changed since the last\n"
+		"                             update.  hash uses it while the image is\n"
+		"                             unchanged.\n"
+		"  manifest dups DISK         List files with the same content.\n"
+		"  manifest diff DISK1 DISK2  List files added (A), deleted (D) or\n"
+		"                             modified (M) from DISK1 to DISK2.\n"
+		"  find [-e] [-i] [-t f|d] [-s MIN[:MAX]] [-j N] PATH [PATTERN...]\n"
+		"                             List everything under the directory PATH\n"
+		"                             whose name matches the glob PATTERN, or\n"
+		"                             the regular expression with -e, walking\n"
+		"                             with N threads.  -i ignores case, -t keeps\n"
+		"                             files or directories, -s keeps files of\n"
+		"                             MIN to MAX bytes (K, M, G suffixes).  Each\n"
+		"                             PATTERN after the first reuses the names\n"
+		"                             found by the first walk.\n"
+		"  stress [-j N] PATH...      Hash every file under the directories PATH\n"
+		"                             on one thread, then read them all again\n"
+		"                             with N threads at once (default 8) and\n"
+		"                             check that the digests match.\n"
+		"\n"
+		"Paths look like (hd0,gpt1)/dir/file.  Errors exit with status 1.\n",
+		NKGUI_NAME, NKGUI_VERSION_STR);
+}
+
+static int
+report_error(const char* what)
+{
+	if (grub_errno != GRUB_ERR_NONE)
+		fprintf(stderr, "nkarc: %s: %s\n", what, grub_errmsg);
+	else
+		fprintf(stderr, "nkarc: %s: %s\n", what, strerror(errno));
+	grub_errno = GRUB_ERR_NONE;
+	return 1;
+}
+
+static int
+is_hidden_file(const char* filename)
+{
+	return strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0;
+}
+
+/* Split "(dev)/path" into the device name and the path on it.  */
+static grub_err_t
+split_path(const char* path, char** disk_name, const char** file_name)
+{
+	const char* p;
+
+	if (path[0] != '(' || !(p = grub_strchr(path, ')')))
+		return grub_error(GRUB_ERR_BAD_FILENAME, "`%s' is not a (device)/path", path);
+	*disk_name = grub_strndup(path + 1, p - path - 1);
+	if (!*disk_name)
+		return grub_errno;
+	*file_name = p[1] ? p + 1 : "/";
+	return GRUB_ERR_NONE;
+}
+
+static const char*
+format_time(grub_int64_t mtime)
+{
+	static char buf[32];
+	struct grub_datetime dt;
+
+	grub_unixtime2datetime(mtime, &dt);
+	grub_snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d",
+		dt.year, dt.month, dt.day, dt.hour, dt.minute, dt.second);
+	return buf;
+}
+
+/* Size of the file PATH, or -1 if it can't be opened.  */
+static grub_int64_t
+get_file_size(const char* path)
+{
+	grub_file_t file;
+	grub_int64_t size;
+
+	file = grub_file_open(path, GRUB_FILE_TYPE_GET_SIZE | GRUB_FILE_TYPE_NO_DECOMPRESS);
+	if (!file)
+	{
+		grub_errno = GRUB_ERR_NONE;
+		return -1;
+	}
+	size = (grub_int64_t)file->size;
+	grub_file_close(file);
+	return size;
+}
+
+/* Directory entries collected by fs_dir, so that files can be opened after
+   the filesystem is done with the directory.  */
+struct dir_ent
+{
+	struct dir_ent* next;
+	struct grub_dirhook_info info;
+	char name[];
+};
+
+static int
+callback_collect(const char* filename,
+	const struct grub_dirhook_info* info, void* data)
+{
+	struct dir_ent*** tail = data;
+	struct dir_ent* p;
+	grub_size_t len;
+
+	if (is_hidden_file(filename))
+		return 0;
+	len = grub_strlen(filename);
+	p = grub_malloc(sizeof(*p) + len + 1);
+	if (!p)
+		return 1;
+	p->next = NULL;
+	p->info = *info;
+	grub_memcpy(p->name, filename, len + 1);
+	**tail = p;
+	*tail = &p->next;
+	return 0;
+}
+
+static void
+free_dir(struct dir_ent* p)
+{
+	while (p)
+	{
+		struct dir_ent* next = p->next;
+		grub_free(p);
+		p = next;
+	}
+}
+
+/* Read the directory PATH on DISK.  */
+static struct dir_ent*
+read_dir(grub_disk_t disk, grub_fs_t fs, const char* path)
+{
+	struct dir_ent* head = NULL;
+	struct dir_ent** tail = &head;
+
+	if ((fs->fs_dir) (disk, path, callback_collect, &tail) != GRUB_ERR_NONE
+		|| grub_errno != GRUB_ERR_NONE)
+	{
+		free_dir(head);
+		return NULL;
+	}
+	return head;
+}
+
+/* Open the device of PATH and probe its filesystem.  */
+static grub_disk_t
+open_fs(const char* path, grub_fs_t* fs, const char** file_name)
+{
+	char* disk_name;
+	grub_disk_t disk;
+
+	if (split_path(path, &disk_name, file_name))
+		return NULL;
+	disk = grub_disk_open(disk_name);
+	grub_free(disk_name);
+	if (!disk)
+		return NULL;
+	*fs = grub_fs_probe(disk);
+	if (!*fs)
+	{
+		grub_disk_close(disk);
+		return NULL;
+	}
+	return disk;
+}
+
+static int
+callback_ls_disk(const char* name, void* data)
+{
+	grub_disk_t disk;
+	grub_fs_t fs;
+	char* label = NULL;
+
+	(void)data;
+	disk = grub_disk_open(name);
+	if (!disk)
+	{
+		grub_errno = GRUB_ERR_NONE;
+		return 0;
+	}
+	fs = grub_fs_probe(disk);
+	if (fs && fs->fs_label)
+		fs->fs_label(disk, &label);
+	printf("(%s)\t%s\t%s\t%s\n", name,
+		grub_get_human_size(grub_disk_native_sectors(disk) << GRUB_DISK_SECTOR_BITS, GRUB_HUMAN_SIZE_SHORT),
+		fs ? fs->name : "-", label ? label : "");
+	grub_free(label);
+	grub_disk_close(disk);
+	grub_errno = GRUB_ERR_NONE;
+	return 0;
+}
+
+static int
+cmd_ls(int argc, char* argv[])
+{
+	int longfmt = 0;
+	const char* path = NULL;
+	const char* dir;
+	grub_disk_t disk;
+	grub_fs_t fs;
+	struct dir_ent* ents;
+	struct dir_ent* p;
+	int i;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-l") == 0)
+			longfmt = 1;
+		else
+			path = argv[i];
+	}
+	if (!path)
+	{
+		grub_disk_iterate(callback_ls_disk, NULL);
+		return 0;
+	}
+
+	disk = open_fs(path, &fs, &dir);
+	if (!disk)
+		return report_error(path);
+	ents = read_dir(disk, fs, dir);
+	if (grub_errno != GRUB_ERR_NONE)
+	{
+		grub_disk_close(disk);
+		return report_error(path);
+	}
+	grub_disk_close(disk);
+
+	for (p = ents; p; p = p->next)
+	{
+		if (!longfmt)
+		{
+			printf("%s%s\n", p->name, p->info.dir ? "/" : "");
+			continue;
+		}
+		if (p->info.dir || p->info.symlink)
+			printf("%c %12s", p->info.dir ? 'd' : 'l', "-");
+		else
+		{
+			char* file = grub_xasprintf("%s%s%s", path,
+				path[grub_strlen(path) - 1] == '/' ? "" : "/", p->name);
+			printf("- %12lld", file ? (long long)get_file_size(file) : -1LL);
+			grub_free(file);
+		}
+		printf(" %s %s%s\n", p->info.mtimeset ? format_time(p->info.mtime) : "-                  ",
+			p->name, p->info.dir ? "/" : "");
+	}
+	free_dir(ents);
+	return 0;
+}
+
+/* Copy FILE to OUT.  */
+static int
+copy_file(grub_file_t file, FILE* out, const char* name)
+{
+	while (1)
+	{
+		grub_ssize_t r = grub_file_read(file, m_copy_buf, COPY_BUF_SIZE);
+		if (r < 0)
+			return report_error(name);
+		if (r == 0)
+			break;
+		if (fwrite(m_copy_buf, 1, r, out) != (size_t)r)
+			return report_error(name);
+	}
+	return 0;
+}
+
+static int
+cmd_cat(int argc, char* argv[])
+{
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < argc; i++)
+	{
+		grub_file_t file = grub_file_open(argv[i], GRUB_FILE_TYPE_CAT | GRUB_FILE_TYPE_NO_DECOMPRESS);
+		if (!file)
+		{
+			ret = report_error(argv[i]);
+			continue;
+		}
+		ret |= copy_file(file, stdout, argv[i]);
+		grub_file_close(file);
+	}
+	if (fflush(stdout) != 0)
+		ret = report_error("stdout");
+	return ret;
+}
+
+static void
+extract_error(const char* path, const char* msg, void* data __attribute__((unused)))
+{
+	fprintf(stderr, "nkarc: %s: %s\n", path, msg);
+}
+
+static int
+extract_progress(const struct grub_extract_stats* stats, void* data __attribute__((unused)))
+{
+	fprintf(stderr, "\r%llu/%llu%s files, %s ",
+		(unsigned long long)stats->files, (unsigned long long)stats->total_files,
+		stats->walk_done ? "" : "+",
+		grub_get_human_size(stats->bytes, GRUB_HUMAN_SIZE_SHORT));
+	return 0;
+}
+
+static int
+cmd_extract(int argc, char* argv[])
+{
+	struct grub_extract_options options = { .error = extract_error };
+	struct grub_extract_stats stats;
+	struct grub_extract_item item;
+	int recursive = 0;
+	const char* src = NULL;
+	const char* dest = NULL;
+	char* target = NULL;
+	grub_uint64_t ms;
+	int i;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-r") == 0)
+			recursive = 1;
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			options.writers = (unsigned)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-S") == 0)
+			options.flags |= GRUB_EXTRACT_ZEROS;
+		else if (strcmp(argv[i], "-x") == 0)
+			options.flags |= GRUB_EXTRACT_EXPAND;
+		else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc)
+			options.store = argv[++i];
+		else if (!src)
+			src = argv[i];
+		else
+			dest = argv[i];
+	}
+	if (!src || !dest)
+	{
+		usage();
+		return 1;
+	}
+
+	if (strcmp(dest, "-") == 0)
+	{
+		grub_file_t file;
+		int ret;
+
+		if (options.flags & GRUB_EXTRACT_EXPAND)
+			file = grub_file_open(src, GRUB_FILE_TYPE_CAT | GRUB_FILE_TYPE_FILTER_VDISK);
+		else
+			file = grub_file_open(src, GRUB_FILE_TYPE_CAT | GRUB_FILE_TYPE_NO_DECOMPRESS);
+		if (!file)
+			return report_error(src);
+		ret = copy_file(file, stdout, src);
+		grub_file_close(file);
+		if (fflush(stdout) != 0)
+			ret = report_error("stdout");
+		return ret;
+	}
+
+	if (!recursive)
+	{
+		struct stat st;
+		const char* name;
+
+		/* Like cp, a file copied to a directory keeps its name.  */
+		if (stat(dest, &st) == 0 && S_ISDIR(st.st_mode))
+		{
+			name = grub_strrchr(src, '/');
+			name = name ? name + 1 : src;
+			target = grub_xasprintf("%s/%s", dest, name);
+			if (!target)
+				return report_error(src);
+			dest = target;
+		}
+	}
+
+	if (isatty(fileno(stderr)))
+		options.progress = extract_progress;
+	item.src = src;
+	item.dest = dest;
+	grub_extract(&item, 1, &options, &stats);
+	if (options.progress)
+		fprintf(stderr, "\r");
+	grub_free(target);
+	if (grub_errno != GRUB_ERR_NONE && !stats.errors)
+		return report_error(src);
+
+	ms = stats.elapsed_us / 1000;
+	fprintf(stderr, "%llu files, %llu directories, %s in %llu.%03llu s",
+		(unsigned long long)stats.files, (unsigned long long)stats.dirs,
+		grub_get_human_size(stats.bytes, GRUB_HUMAN_SIZE_SHORT),
+		(unsigned long long)(ms / 1000), (unsigned long long)(ms % 1000));
+	/* GRUB_HUMAN_SIZE_SPEED takes hundredths of bytes per second.  */
+	fprintf(stderr, ", %s", grub_get_human_size(grub_divmod64(stats.bytes * 100000ULL,
+		ms ? ms : 1, 0), GRUB_HUMAN_SIZE_SPEED));
+	if (stats.holes)
+		fprintf(stderr, ", %s in holes", grub_get_human_size(stats.holes, GRUB_HUMAN_SIZE_SHORT));
+	if (stats.linked)
+		fprintf(stderr, ", %llu linked (%s)", (unsigned long long)stats.linked,
+			grub_get_human_size(stats.linked_bytes, GRUB_HUMAN_SIZE_SHORT));
+	if (stats.skipped)
+		fprintf(stderr, ", %llu skipped", (unsigned long long)stats.skipped);
+	if (stats.errors)
+		fprintf(stderr, ", %llu failed", (unsigned long long)stats.errors);
+	fprintf(stderr, "\n");
+	grub_errno = GRUB_ERR_NONE;
+	return stats.errors ? 1 : 0;
+}
+
+/* IMAGE.nkm of the disk hdN added with -i, ST gets the image.  */
+static char*
+manifest_path(const char* disk, struct stat* st)
+{
+	const char* end;
+	unsigned long n;
+
+	if (grub_strncmp(disk, "hd", 2) != 0 || !grub_isdigit(disk[2]))
+		goto fail;
+	n = grub_strtoul(disk + 2, &end, 10);
+	if (*end || n >= MAX_IMAGES || !m_images[n])
+		goto fail;
+	if (stat(m_images[n], st) != 0)
+	{
+		grub_error(GRUB_ERR_FILE_NOT_FOUND, "cannot stat `%s': %s", m_images[n], strerror(errno));
+		return NULL;
+	}
+	return grub_xasprintf("%s" GRUB_MANIFEST_EXT, m_images[n]);
+
+fail:
+	grub_error(GRUB_ERR_BAD_DEVICE, "`%s' is not an image added with -i", disk);
+	return NULL;
+}
+
+/* The manifest of DISK, *CURRENT is set if the image did not change since
+   it was written.  */
+static grub_manifest_t
+load_manifest(const char* disk, int* current)
+{
+	grub_manifest_t manifest;
+	struct stat st;
+	char* path;
+
+	path = manifest_path(disk, &st);
+	if (!path)
+		return NULL;
+	manifest = grub_manifest_load(path);
+	grub_free(path);
+	if (manifest)
+		*current = grub_manifest_same_source(manifest, st.st_size, st.st_mtime);
+	return manifest;
+}
+
+/* Manifest of the disk last looked at by hash.  */
+struct ctx_hash_manifest
+{
+	char* disk;
+	grub_manifest_t manifest;
+};
+
+/* Copy the digest HASH of PATH to RESULT if the manifest of its image has
+   it and is current.  */
+static int
+hash_from_manifest(struct ctx_hash_manifest* ctx, const char* path,
+	const gcry_md_spec_t* hash, void* result)
+{
+	grub_uint32_t algo = grub_manifest_algo_by_name(hash->name);
+	const grub_uint8_t* digest = NULL;
+	const char* file_name;
+	char* disk = NULL;
+	grub_ssize_t index;
+
+	if (!algo || split_path(path, &disk, &file_name) != GRUB_ERR_NONE)
+		goto out;
+	if (!ctx->disk || strcmp(ctx->disk, disk) != 0)
+	{
+		int current = 0;
+		grub_free(ctx->disk);
+		grub_manifest_free(ctx->manifest);
+		ctx->disk = disk;
+		disk = NULL;
+		ctx->manifest = load_manifest(ctx->disk, &current);
+		if (ctx->manifest && !current)
+		{
+			grub_manifest_free(ctx->manifest);
+			ctx->manifest = NULL;
+		}
+	}
+	if (!ctx->manifest)
+		goto out;
+	index = grub_manifest_find(ctx->manifest, file_name);
+	if (index >= 0)
+		digest = grub_manifest_digest(ctx->manifest, index, algo);
+	if (digest)
+		grub_memcpy(result, digest, hash->mdlen);
+
+out:
+	grub_free(disk);
+	grub_errno = GRUB_ERR_NONE;
+	return digest != NULL;
+}
+
+struct ctx_hash
+{
+	grub_size_t mdlen;
+	int failed;
+};
+
+static void
+print_digest(const void* digest, grub_size_t mdlen, const char* path)
+{
+	grub_size_t j;
+
+	for (j = 0; j < mdlen; j++)
+		printf("%02x", ((const grub_uint8_t*)digest)[j]);
+	printf("  %s\n", path);
+}
+
+static int
+callback_hash(const struct grub_hashtree_entry* entry, void* data)
+{
+	struct ctx_hash* ctx = data;
+
+	if (!entry->digest)
+	{
+		fprintf(stderr, "nkarc: %s: %s\n", entry->path, entry->error);
+		ctx->failed = 1;
+		return 0;
+	}
+	print_digest(entry->digest, ctx->mdlen, entry->path);
+	return 0;
+}
+
+static int
+cmd_hash(int argc, char* argv[])
+{
+	const gcry_md_spec_t* hash = GRUB_MD_SHA256;
+	struct ctx_hash_manifest cached = { 0 };
+	void* context;
+	int recursive = 0;
+	int ret = 0;
+	int i;
+
+	GRUB_PROPERLY_ALIGNED_ARRAY(result, GRUB_CRYPTO_MAX_MDLEN);
+
+	while (argc >= 1 && argv[0][0] == '-')
+	{
+		if (strcmp(argv[0], "-r") == 0)
+			recursive = 1;
+		else if (argc >= 2 && strcmp(argv[0], "-a") == 0)
+		{
+			hash = grub_crypto_lookup_md_by_name(argv[1]);
+			if (!hash)
+			{
+				fprintf(stderr, "nkarc: unknown hash `%s'\n", argv[1]);
+				return 1;
+			}
+			argc--;
+			argv++;
+		}
+		else
+			break;
+		argc--;
+		argv++;
+	}
+
+	if (recursive)
+	{
+		struct ctx_hash ctx = { .mdlen = hash->mdlen };
+		for (i = 0; i < argc; i++)
+		{
+			if (grub_hash_tree(argv[i], &hash, 1, NULL, callback_hash, &ctx) != GRUB_ERR_NONE)
+				ret = report_error(argv[i]);
+		}
+		return (ret || ctx.failed) ? 1 : 0;
+	}
+
+	context = grub_zalloc(hash->contextsize);
+	if (!context)
+		return report_error("hash");
+
+	for (i = 0; i < argc; i++)
+	{
+		grub_file_t file;
+
+		if (hash_from_manifest(&cached, argv[i], hash, result))
+		{
+			print_digest(result, hash->mdlen, argv[i]);
+			continue;
+		}
+		file = grub_file_open(argv[i], GRUB_FILE_TYPE_HASHLIST | GRUB_FILE_TYPE_NO_DECOMPRESS);
+		if (!file)
+		{
+			ret = report_error(argv[i]);
+			continue;
+		}
+		hash->init(context);
+		while (1)
+		{
+			grub_ssize_t r = grub_file_read(file, m_copy_buf, COPY_BUF_SIZE);
+			if (r <= 0)
+				break;
+			hash->write(context, m_copy_buf, r);
+		}
+		grub_file_close(file);
+		if (grub_errno != GRUB_ERR_NONE)
+		{
+			ret = report_error(argv[i]);
+			continue;
+		}
+		hash->final(context);
+		grub_memcpy(result, hash->read(context), hash->mdlen);
+		print_digest(result, hash->mdlen, argv[i]);
+	}
+
+	grub_free(context);
+	grub_free(cached.disk);
+	grub_manifest_free(cached.manifest);
+	return ret;
+}
+
+/* The files under the paths given to stress, with their digests from one
+   walk on a single thread.  */
+struct ctx_stress
+{
+	const gcry_md_spec_t* hash;
+	grub_size_t count;
+	grub_size_t alloc;
+	char** paths;
+	grub_uint8_t* digests;
+	int failed;
+};
+
+struct stress_thread
+{
+	struct ctx_stress* ctx;
+	grub_thread_t thread;
+	/* Each thread starts at another file so that they read different
+	   parts of the image at once.  */
+	grub_size_t first;
+	grub_uint64_t bytes;
+	grub_size_t mismatched;
+	grub_size_t failed;
+};
+
+static int
+callback_stress(const struct grub_hashtree_entry* entry, void* data)
+{
+	struct ctx_stress* ctx = data;
+	grub_size_t mdlen = ctx->hash->mdlen;
+
+	if (!entry->digest)
+	{
+		fprintf(stderr, "nkarc: %s: %s\n", entry->path, entry->error);
+		ctx->failed = 1;
+		return 0;
+	}
+	if (ctx->count == ctx->alloc)
+	{
+		grub_size_t alloc = ctx->alloc ? ctx->alloc * 2 : 256;
+		char** paths = grub_realloc(ctx->paths, alloc * sizeof(char*));
+		grub_uint8_t* digests;
+		if (!paths)
+			return 1;
+		ctx->paths = paths;
+		digests = grub_realloc(ctx->digests, alloc * mdlen);
+		if (!digests)
+			return 1;
+		ctx->digests = digests;
+		ctx->alloc = alloc;
+	}
+	ctx->paths[ctx->count] = grub_strdup(entry->path);
+	if (!ctx->paths[ctx->count])
+		return 1;
+	grub_memcpy(ctx->digests + ctx->count * mdlen, entry->digest, mdlen);
+	ctx->count++;
+	return 0;
+}
+
+static void
+stress_worker(void* data)
+{
+	struct stress_thread* t = data;
+	struct ctx_stress* ctx = t->ctx;
+	const gcry_md_spec_t* hash = ctx->hash;
+	void* context = grub_zalloc(hash->contextsize);
+	char* buf = grub_malloc(COPY_BUF_SIZE);
+	grub_size_t i;
+
+	if (!context || !buf)
+	{
+		report_error("stress");
+		t->failed = ctx->count;
+		goto out;
+	}
+	for (i = 0; i < ctx->count; i++)
+	{
+		const char* path = ctx->paths[(t->first + i) % ctx->count];
+		const grub_uint8_t* digest = ctx->digests + (t->first + i) % ctx->count * hash->mdlen;
+		grub_file_t file;
+		grub_ssize_t r;
+
+		file = grub_file_open(path, GRUB_FILE_TYPE_TO_HASH | GRUB_FILE_TYPE_NO_DECOMPRESS);
+		if (!file)
+		{
+			report_error(path);
+			t->failed++;
+			continue;
+		}
+		hash->init(context);
+		while ((r = grub_file_read(file, buf, COPY_BUF_SIZE)) > 0)
+		{
+			hash->write(context, buf, r);
+			t->bytes += r;
+		}
+		grub_file_close(file);
+		if (grub_errno != GRUB_ERR_NONE)
+		{
+			report_error(path);
+			t->failed++;
+			continue;
+		}
+		hash->final(context);
+		if (grub_memcmp(hash->read(context), digest, hash->mdlen) != 0)
+		{
+			fprintf(stderr, "nkarc: %s: digest differs from the single-threaded read\n", path);
+			t->mismatched++;
+		}
+	}
+
+out:
+	grub_free(buf);
+	grub_free(context);
+}
+
+static int
+cmd_stress(int argc, char* argv[])
+{
+	struct ctx_stress ctx = { .hash = GRUB_MD_SHA256 };
+	struct stress_thread* threads;
+	unsigned count = 8;
+	grub_uint64_t bytes = 0;
+	grub_size_t mismatched = 0, failed = 0;
+	unsigned started;
+	grub_size_t i;
+	int ret = 0;
+
+	if (argc >= 2 && strcmp(argv[0], "-j") == 0)
+	{
+		count = (unsigned)strtoul(argv[1], NULL, 10);
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 1 || count == 0)
+	{
+		usage();
+		return 1;
+	}
+
+	for (i = 0; i < (grub_size_t)argc; i++)
+	{
+		if (grub_hash_tree(argv[i], &ctx.hash, 1, NULL, callback_stress, &ctx) != GRUB_ERR_NONE)
+			ret = report_error(argv[i]);
+	}
+	if (ret || ctx.failed || ctx.count == 0)
+	{
+		if (!ret && !ctx.failed)
+			fprintf(stderr, "nkarc: no files to read\n");
+		ret = 1;
+		goto out;
+	}
+
+	threads = grub_calloc(count, sizeof(*threads));
+	if (!threads)
+	{
+		ret = report_error("stress");
+		goto out;
+	}
+	for (started = 0; started < count; started++)
+	{
+		threads[started].ctx = &ctx;
+		threads[started].first = ctx.count * started / count;
+		threads[started].thread = grub_thread_create(stress_worker, &threads[started]);
+		if (!threads[started].thread)
+		{
+			ret = report_error("stress");
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+	{
+		grub_thread_join(threads[i].thread);
+		bytes += threads[i].bytes;
+		mismatched += threads[i].mismatched;
+		failed += threads[i].failed;
+	}
+	grub_free(threads);
+
+	fprintf(stderr, "%llu files read by %u threads (%s)",
+		(unsigned long long)ctx.count, started,
+		grub_get_human_size(bytes, GRUB_HUMAN_SIZE_SHORT));
+	if (mismatched)
+		fprintf(stderr, ", %llu differ", (unsigned long long)mismatched);
+	if (failed)
+		fprintf(stderr, ", %llu failed", (unsigned long long)failed);
+	fprintf(stderr, "\n");
+	if (mismatched || failed)
+		ret = 1;
+
+out:
+	for (i = 0; i < ctx.count; i++)
+		grub_free(ctx.paths[i]);
+	grub_free(ctx.paths);
+	grub_free(ctx.digests);
+	return ret;
+}
+
+struct ctx_stat
+{
+	const char* name;
+	int found;
+	struct grub_dirhook_info info;
+};
+
+static int
+callback_stat(const char* filename,
+	const struct grub_dirhook_info* info, void* data)
+{
+	struct ctx_stat* ctx = data;
+
+	if ((info->case_insensitive ? grub_strcasecmp(filename, ctx->name)
+		: grub_strcmp(filename, ctx->name)) != 0)
+		return 0;
+	ctx->found = 1;
+	ctx->info = *info;
+	return 1;
+}
+
+static int
+cmd_stat(int argc, char* argv[])
+{
+	struct ctx_stat ctx = { 0 };
+	const char* path;
+	const char* file_name;
+	grub_disk_t disk;
+	grub_fs_t fs;
+	char* dir;
+	char* name;
+	grub_size_t len;
+
+	if (argc != 1)
+	{
+		usage();
+		return 1;
+	}
+	path = argv[0];
+	disk = open_fs(path, &fs, &file_name);
+	if (!disk)
+		return report_error(path);
+
+	printf("Device: %s\n", disk->name);
+	printf("Filesystem: %s\n", fs->name);
+
+	/* The device itself.  */
+	len = grub_strlen(file_name);
+	while (len > 0 && file_name[len - 1] == '/')
+		len--;
+	if (len == 0)
+	{
+		char* str = NULL;
+		grub_int64_t mtime;
+
+		printf("Size: %llu\n", (unsigned long long)(grub_disk_native_sectors(disk) << GRUB_DISK_SECTOR_BITS));
+		if (fs->fs_label && fs->fs_label(disk, &str) == GRUB_ERR_NONE && str && str[0])
+			printf("Label: %s\n", str);
+		grub_free(str);
+		str = NULL;
+		if (fs->fs_uuid && fs->fs_uuid(disk, &str) == GRUB_ERR_NONE && str)
+			printf("UUID: %s\n", str);
+		grub_free(str);
+		if (fs->fs_mtime && fs->fs_mtime(disk, &mtime) == GRUB_ERR_NONE)
+			printf("Modify: %s\n", format_time(mtime));
+		grub_disk_close(disk);
+		grub_errno = GRUB_ERR_NONE;
+		return 0;
+	}
+
+	/* Look the last component up in its parent directory.  */
+	dir = grub_strndup(file_name, len);
+	if (!dir)
+	{
+		grub_disk_close(disk);
+		return report_error(path);
+	}
+	name = grub_strrchr(dir, '/');
+	*name++ = '\0';
+	ctx.name = name;
+	(fs->fs_dir) (disk, dir[0] ? dir : "/", callback_stat, &ctx);
+	grub_disk_close(disk);
+	grub_free(dir);
+	if (grub_errno == GRUB_ERR_NONE && !ctx.found)
+		grub_error(GRUB_ERR_FILE_NOT_FOUND, "file `%s' not found", path);
+	if (grub_errno != GRUB_ERR_NONE)
+		return report_error(path);
+
+	printf("Path: %s\n", path);
+	printf("Type: %s\n", ctx.info.dir ? "directory" : (ctx.info.symlink ? "symlink" : "file"));
+	if (!ctx.info.dir && !ctx.info.symlink)
+		printf("Size: %lld\n", (long long)get_file_size(path));
+	if (ctx.info.mtimeset)
+		printf("Modify: %s\n", format_time(ctx.info.mtime));
+	if (ctx.info.inodeset)
+		printf("Inode: %llu\n", (unsigned long long)ctx.info.inode);
+	if (ctx.info.case_insensitive)
+		printf("Case insensitive: yes\n");
+	return 0;
+}
+
+static void
+callback_manifest_error(const char* path, const char* msg, void* data)
+{
+	(void)data;
+	fprintf(stderr, "nkarc: %s: %s\n", path, msg);
+}
+
+static int
+manifest_update(int argc, char* argv[])
+{
+	grub_uint32_t algos = 0;
+	struct grub_manifest_stats stats;
+	grub_manifest_t manifest;
+	struct stat st;
+	char* path;
+	int ret;
+
+	if (argc >= 2 && strcmp(argv[0], "-a") == 0)
+	{
+		char* list = grub_strdup(argv[1]);
+		char* name;
+		char* next;
+		if (!list)
+			return report_error("manifest");
+		for (name = list; name; name = next)
+		{
+			grub_uint32_t algo;
+			next = grub_strchr(name, ',');
+			if (next)
+				*next++ = '\0';
+			algo = grub_manifest_algo_by_name(name);
+			if (!algo)
+			{
+				fprintf(stderr, "nkarc: manifests hold md5, sha1 and sha256, not `%s'\n", name);
+				grub_free(list);
+				return 1;
+			}
+			algos |= algo;
+		}
+		grub_free(list);
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc != 1)
+	{
+		usage();
+		return 1;
+	}
+
+	path = manifest_path(argv[0], &st);
+	if (!path)
+		return report_error(argv[0]);
+	manifest = grub_manifest_load(path);
+	if (!manifest && (grub_errno == GRUB_ERR_FILE_NOT_FOUND
+		|| grub_errno == GRUB_ERR_BAD_FILE_TYPE))
+	{
+		/* Damaged ones are rebuilt.  */
+		if (grub_errno == GRUB_ERR_BAD_FILE_TYPE)
+			report_error(path);
+		grub_errno = GRUB_ERR_NONE;
+		manifest = grub_manifest_new(algos ? algos : GRUB_MANIFEST_SHA256);
+	}
+	if (!manifest)
+	{
+		ret = report_error(path);
+		grub_free(path);
+		return ret;
+	}
+
+	ret = 0;
+	if (grub_manifest_update(manifest, argv[0], algos, &stats,
+		callback_manifest_error, NULL) != GRUB_ERR_NONE)
+		ret = report_error(argv[0]);
+	else
+	{
+		grub_manifest_set_source(manifest, st.st_size, st.st_mtime);
+		if (grub_manifest_save(manifest, path) != GRUB_ERR_NONE)
+			ret = report_error(path);
+		fprintf(stderr, "%llu files, %llu hashed (%s)",
+			(unsigned long long)stats.files, (unsigned long long)stats.hashed,
+			grub_get_human_size(stats.bytes_hashed, GRUB_HUMAN_SIZE_SHORT));
+		if (stats.removed)
+			fprintf(stderr, ", %llu removed", (unsigned long long)stats.removed);
+		if (stats.errors)
+			fprintf(stderr, ", %llu failed", (unsigned long long)stats.errors);
+		fprintf(stderr, "\n");
+		if (stats.errors)
+			ret = 1;
+	}
+	grub_manifest_free(manifest);
+	grub_free(path);
+	return ret;
+}
+
+/* A manifest that must exist, stale ones are used with a warning.  */
+static grub_manifest_t
+open_manifest(const char* disk)
+{
+	grub_manifest_t manifest;
+	int current = 0;
+
+	manifest = load_manifest(disk, &current);
+	if (!manifest)
+	{
+		report_error(disk);
+		return NULL;
+	}
+	if (!current)
+		fprintf(stderr, "nkarc: %s changed since its manifest was updated\n", disk);
+	return manifest;
+}
+
+static int
+callback_manifest_dups(grub_manifest_t manifest,
+	const grub_size_t* index, grub_size_t count, void* data)
+{
+	struct grub_manifest_entry entry;
+	grub_size_t i;
+
+	(void)data;
+	grub_manifest_get(manifest, index[0], &entry);
+	printf("%llu files of %llu bytes:\n", (unsigned long long)count,
+		(unsigned long long)entry.size);
+	for (i = 0; i < count; i++)
+	{
+		grub_manifest_get(manifest, index[i], &entry);
+		printf("  %s\n", entry.path);
+	}
+	return 0;
+}
+
+struct ctx_manifest_diff
+{
+	grub_manifest_t a;
+	grub_manifest_t b;
+};
+
+static int
+callback_manifest_diff(enum grub_manifest_change change,
+	grub_ssize_t a_index, grub_ssize_t b_index, void* data)
+{
+	struct ctx_manifest_diff* ctx = data;
+	struct grub_manifest_entry entry;
+
+	if (b_index >= 0)
+		grub_manifest_get(ctx->b, b_index, &entry);
+	else
+		grub_manifest_get(ctx->a, a_index, &entry);
+	printf("%c %s\n", change == GRUB_MANIFEST_ADDED ? 'A' :
+		(change == GRUB_MANIFEST_REMOVED ? 'D' : 'M'), entry.path);
+	return 0;
+}
+
+static int
+cmd_manifest(int argc, char* argv[])
+{
+	if (argc >= 1 && strcmp(argv[0], "update") == 0)
+		return manifest_update(argc - 1, argv + 1);
+	if (argc == 2 && strcmp(argv[0], "dups") == 0)
+	{
+		grub_manifest_t manifest = open_manifest(argv[1]);
+		if (!manifest)
+			return 1;
+		grub_manifest_duplicates(manifest, callback_manifest_dups, NULL);
+		grub_manifest_free(manifest);
+		return 0;
+	}
+	if (argc == 3 && strcmp(argv[0], "diff") == 0)
+	{
+		struct ctx_manifest_diff ctx;
+		ctx.a = open_manifest(argv[1]);
+		if (!ctx.a)
+			return 1;
+		ctx.b = open_manifest(argv[2]);
+		if (!ctx.b)
+		{
+			grub_manifest_free(ctx.a);
+			return 1;
+		}
+		grub_manifest_diff(ctx.a, ctx.b, callback_manifest_diff, &ctx);
+		grub_manifest_free(ctx.a);
+		grub_manifest_free(ctx.b);
+		return 0;
+	}
+	usage();
+	return 1;
+}
+
+/* A size with an optional K, M or G suffix.  */
+static int
+parse_size(const char* s, grub_uint64_t* size)
+{
+	char* end;
+
+	*size = strtoull(s, &end, 10);
+	if (end == s)
+		return 0;
+	switch (*end)
+	{
+	case 'K': case 'k':
+		*size <<= 10;
+		end++;
+		break;
+	case 'M': case 'm':
+		*size <<= 20;
+		end++;
+		break;
+	case 'G': case 'g':
+		*size <<= 30;
+		end++;
+		break;
+	}
+	return *end == '\0' || *end == ':';
+}
+
+static int
+callback_find(const struct grub_find_entry* entry, void* data)
+{
+	(void)data;
+	if (entry->sizeset)
+		printf("%12llu  %s\n", (unsigned long long)entry->size, entry->path);
+	else
+		printf("%12s  %s\n", entry->dir ? "<DIR>" : "", entry->path);
+	return 0;
+}
+
+static int
+cmd_find(int argc, char* argv[])
+{
+	struct grub_find_options options = { .flags = GRUB_FIND_STAT };
+	struct grub_find_stats stats;
+	const char* path;
+	int ret = 0;
+	int i;
+
+	while (argc >= 1 && argv[0][0] == '-')
+	{
+		if (strcmp(argv[0], "-e") == 0)
+			options.flags |= GRUB_FIND_REGEX;
+		else if (strcmp(argv[0], "-i") == 0)
+			options.flags |= GRUB_FIND_NOCASE;
+		else if (argc >= 2 && strcmp(argv[0], "-t") == 0)
+		{
+			if (strcmp(argv[1], "f") == 0)
+				options.flags |= GRUB_FIND_FILES;
+			else if (strcmp(argv[1], "d") == 0)
+				options.flags |= GRUB_FIND_DIRS;
+			else
+			{
+				fprintf(stderr, "nkarc: -t expects f or d\n");
+				return 1;
+			}
+			argc--;
+			argv++;
+		}
+		else if (argc >= 2 && strcmp(argv[0], "-s") == 0)
+		{
+			const char* max = strchr(argv[1], ':');
+			if (!parse_size(argv[1], &options.min_size) || (max && !parse_size(max + 1, &options.max_size)))
+			{
+				fprintf(stderr, "nkarc: bad size `%s'\n", argv[1]);
+				return 1;
+			}
+			options.flags |= GRUB_FIND_SIZE;
+			argc--;
+			argv++;
+		}
+		else if (argc >= 2 && strcmp(argv[0], "-j") == 0)
+		{
+			options.threads = (unsigned)strtoul(argv[1], NULL, 10);
+			argc--;
+			argv++;
+		}
+		else
+			break;
+		argc--;
+		argv++;
+	}
+	if (argc < 1)
+	{
+		usage();
+		return 1;
+	}
+
+	/* The patterns after the first are answered from the index of the
+	   first walk.  */
+	path = argv[0];
+	for (i = 1; i < argc || i == 1; i++)
+	{
+		options.pattern = (i < argc) ? argv[i] : NULL;
+		if (grub_find(path, &options, callback_find, NULL, &stats) != GRUB_ERR_NONE)
+		{
+			ret = report_error(options.pattern ? options.pattern : path);
+			continue;
+		}
+		fprintf(stderr, "%llu matches, %llu entries in %llu directories%s\n",
+			(unsigned long long)stats.matches, (unsigned long long)stats.entries,
+			(unsigned long long)stats.dirs, stats.indexed ? " (indexed)" : "");
+	}
+	return ret;
+}
+
+/* Mount NAME=FILE, FILE not starting with ( is a host path.  */
+static int
+add_loopback(const char* arg)
+{
+	const char* eq = strchr(arg, '=');
+	char* name;
+	char* path;
+	char real[PATH_MAX];
+
+	if (!eq || eq == arg || !eq[1])
+	{
+		fprintf(stderr, "nkarc: -l expects NAME=FILE\n");
+		return 1;
+	}
+	name = grub_strndup(arg, eq - arg);
+	if (eq[1] == '(')
+		path = grub_strdup(eq + 1);
+	else if (realpath(eq + 1, real))
+		path = grub_xasprintf("(host)%s", real);
+	else
+	{
+		grub_free(name);
+		return report_error(eq + 1);
+	}
+	if (!name || !path || grub_loopback_add(name, path, 1) != GRUB_ERR_NONE)
+	{
+		grub_free(name);
+		grub_free(path);
+		return report_error(arg);
+	}
+	grub_free(name);
+	grub_free(path);
+	return 0;
+}
+
+static const struct
+{
+	const char* name;
+	int (*func) (int argc, char* argv[]);
+} m_cmds[] =
+{
+	{ "ls", cmd_ls },
+	{ "cat", cmd_cat },
+	{ "extract", cmd_extract },
+	{ "hash", cmd_hash },
+	{ "stat", cmd_stat },
+	{ "manifest", cmd_manifest },
+	{ "find", cmd_find },
+	{ "stress", cmd_stress },
+};
+
+int
+main(int argc, char* argv[])
+{
+	int ret = 1;
+	int i;
+	grub_size_t j;
+
+	grub_module_init();
+	m_copy_buf = grub_malloc(COPY_BUF_SIZE);
+	if (!m_copy_buf)
+		goto out;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+		{
+			unsigned long id;
+			if (grub_hostdisk_add(argv[++i], &id) != GRUB_ERR_NONE)
+			{
+				report_error(argv[i]);
+				goto out;
+			}
+			if (id < MAX_IMAGES)
+				m_images[id] = argv[i];
+		}
+		else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+		{
+			if (add_loopback(argv[++i]))
+				goto out;
+		}
+		else
+			break;
+	}
+	if (i >= argc)
+	{
+		usage();
+		goto out;
+	}
+
+	for (j = 0; j < ARRAY_SIZE(m_cmds); j++)
+	{
+		if (strcmp(argv[i], m_cmds[j].name) == 0)
+		{
+			ret = m_cmds[j].func(argc - i - 1, argv + i + 1);
+			break;
+		}
+	}
+	if (j == ARRAY_SIZE(m_cmds))
+		usage();
+
+out:
+	grub_free(m_copy_buf);
+	grub_module_fini();
+	return ret;
+}
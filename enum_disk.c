@@ -20,32 +20,146 @@
 #include <grub/misc.h>
 #include <grub/disk.h>
 #include <grub/fs.h>
+#include <grub/partition.h>
 
 #include <nkctx.h>
 #include <lang.h>
 
-static int
-callback_enum_disk(const char* name, void* data)
+/* Probe results keyed by device identity, so unchanged disks are not
+   probed again on refresh.  Entries not seen by the last enumeration are
+   dropped.  */
+struct disk_cache
+{
+	struct disk_cache* next;
+	unsigned long dev_id;
+	unsigned long disk_id;
+	grub_disk_addr_t start;
+	grub_uint64_t size;
+	const char* fs;
+	char* label;
+	DWORD generation;
+};
+
+struct enum_job
+{
+	char* name;
+	DWORD index;
+	DWORD generation;
+};
+
+static BOOL enum_inited;
+static CRITICAL_SECTION enum_lock;
+static HANDLE enum_idle;
+static volatile LONG enum_pending;
+static volatile DWORD enum_generation;
+static struct nkctx_disk* enum_done;
+static struct disk_cache* disk_cache;
+static char* enum_select;
+
+static void
+enum_job_done(void)
+{
+	if (InterlockedDecrement(&enum_pending) == 0)
+	{
+		struct disk_cache** pp;
+
+		EnterCriticalSection(&enum_lock);
+		for (pp = &disk_cache; *pp;)
+		{
+			struct disk_cache* p = *pp;
+			if (p->generation == enum_generation)
+			{
+				pp = &p->next;
+				continue;
+			}
+			*pp = p->next;
+			free(p->label);
+			free(p);
+		}
+		LeaveCriticalSection(&enum_lock);
+		SetEvent(enum_idle);
+	}
+	PostMessageW(nk.wnd, WM_NULL, 0, 0);
+}
+
+static void
+probe_disk(grub_disk_t disk, struct nkctx_disk* info, DWORD generation)
 {
+	struct disk_cache* p;
+	grub_disk_addr_t start = 0;
+	grub_fs_t fs;
+
+	if (disk->partition)
+		start = grub_partition_get_start(disk->partition);
+
+	EnterCriticalSection(&enum_lock);
+	for (p = disk_cache; p; p = p->next)
+	{
+		if (p->dev_id == disk->dev->id && p->disk_id == disk->id
+			&& p->start == start && p->size == info->size)
+			break;
+	}
+	if (p)
+	{
+		p->generation = generation;
+		info->fs = p->fs;
+		if (p->label)
+			info->label = grub_strdup(p->label);
+	}
+	LeaveCriticalSection(&enum_lock);
+	if (p)
+		return;
+
+	fs = grub_fs_probe(disk);
+	if (fs)
+	{
+		info->fs = fs->name;
+		if (fs->fs_label)
+			fs->fs_label(disk, &info->label);
+	}
+	grub_errno = GRUB_ERR_NONE;
+
+	p = calloc(1, sizeof(struct disk_cache));
+	if (!p)
+		return;
+	p->dev_id = disk->dev->id;
+	p->disk_id = disk->id;
+	p->start = start;
+	p->size = info->size;
+	p->fs = info->fs;
+	p->label = info->label ? grub_strdup(info->label) : NULL;
+	p->generation = generation;
+	EnterCriticalSection(&enum_lock);
+	p->next = disk_cache;
+	disk_cache = p;
+	LeaveCriticalSection(&enum_lock);
+}
+
+static void CALLBACK
+enum_disk_worker(PTP_CALLBACK_INSTANCE instance, PVOID data)
+{
+	struct enum_job* job = data;
 	grub_disk_t disk = NULL;
-	grub_fs_t fs = NULL;
-	struct nkctx_disk** tail = (struct nkctx_disk**)data;
 	struct nkctx_disk* info = calloc(1, sizeof(struct nkctx_disk));
+	NK_UNUSED(instance);
 
 	if (!info)
-		return 0;
+		goto out;
 
-	disk = grub_disk_open(name);
+	/* Skip disks of an enumeration that has been thrown away.  */
+	if (job->generation == enum_generation)
+		disk = grub_disk_open(job->name);
 	if (!disk)
 	{
+		grub_errno = GRUB_ERR_NONE;
 		free(info);
-		return 0;
+		goto out;
 	}
 
-	info->index = ++nk.disk_count;
-	info->name = grub_strdup(name);
+	info->index = job->index;
+	info->name = grub_strdup(job->name);
 
-	info->path = grub_xasprintf("(%s)/", name);
+	info->path = grub_xasprintf("(%s)/", job->name);
 	info->icon = IDR_PNG_UNKNOWN;
 
 	if (disk->partition)
@@ -63,15 +177,12 @@ callback_enum_disk(const char* name, void* data)
 		strcpy_s(info->desc, ARRAY_SIZE(info->desc),
 			grub_get_human_size(info->size << GRUB_DISK_SECTOR_BITS, GRUB_HUMAN_SIZE_SHORT));
 
-	fs = grub_fs_probe(disk);
-	if (fs)
+	probe_disk(disk, info, job->generation);
+	if (info->fs)
 	{
 		info->icon = IDR_PNG_HDD;
-		info->fs = fs->name;
 		strcat_s(info->desc, ARRAY_SIZE(info->desc), " ");
-		strcat_s(info->desc, ARRAY_SIZE(info->desc), fs->name);
-		if (fs->fs_label)
-			fs->fs_label(disk, &info->label);
+		strcat_s(info->desc, ARRAY_SIZE(info->desc), info->fs);
 		if (info->label && info->label[0])
 		{
 			strcat_s(info->desc, ARRAY_SIZE(info->desc), " [");
@@ -97,30 +208,191 @@ callback_enum_disk(const char* name, void* data)
 	}
 
 	grub_disk_close(disk);
+	grub_errno = GRUB_ERR_NONE;
 
-	if (*tail)
-		(*tail)->next = info;
-	else
-		nk.disks = info;
-	*tail = info;
+	EnterCriticalSection(&enum_lock);
+	if (job->generation == enum_generation)
+	{
+		info->next = enum_done;
+		enum_done = info;
+		info = NULL;
+	}
+	LeaveCriticalSection(&enum_lock);
 
-	grub_errno = GRUB_ERR_NONE;
+	if (info)
+	{
+		free(info->name);
+		free(info->path);
+		free(info->label);
+		free(info);
+	}
+
+out:
+	free(job->name);
+	free(job);
+	enum_job_done();
+}
+
+struct enum_scan_ctx
+{
+	DWORD index;
+	DWORD generation;
+};
+
+static int
+callback_enum_disk(const char* name, void* data)
+{
+	struct enum_scan_ctx* ctx = data;
+	struct enum_job* job = calloc(1, sizeof(struct enum_job));
+
+	if (!job)
+		return 0;
+	job->name = grub_strdup(name);
+	if (!job->name)
+	{
+		free(job);
+		return 0;
+	}
+	job->index = ++ctx->index;
+	job->generation = ctx->generation;
+
+	InterlockedIncrement(&enum_pending);
+	if (!TrySubmitThreadpoolCallback(enum_disk_worker, job, NULL))
+	{
+		free(job->name);
+		free(job);
+		enum_job_done();
+	}
 	return 0;
 }
 
+static void CALLBACK
+enum_scan_worker(PTP_CALLBACK_INSTANCE instance, PVOID data)
+{
+	struct enum_scan_ctx ctx = { 0, (DWORD)(ULONG_PTR)data };
+	NK_UNUSED(instance);
+
+	if (ctx.generation == enum_generation)
+		grub_disk_iterate(callback_enum_disk, &ctx);
+	grub_errno = GRUB_ERR_NONE;
+
+	enum_job_done();
+}
+
+/* Probe the disks on the thread pool.  Results are merged into nk.disks by
+   nkctx_enum_disk_poll as they arrive.  */
 void
 nkctx_enum_disk(void)
 {
-	struct nkctx_disk* tail = NULL;
+	if (!enum_inited)
+	{
+		InitializeCriticalSection(&enum_lock);
+		enum_idle = CreateEventW(NULL, TRUE, TRUE, NULL);
+		enum_inited = TRUE;
+	}
+
 	nk.disk_count = 0;
-	grub_disk_iterate(callback_enum_disk, &tail);
-	grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Found %lu disk(s)", nk.disk_count);
+	EnterCriticalSection(&enum_lock);
+	enum_generation++;
+	LeaveCriticalSection(&enum_lock);
+
+	ResetEvent(enum_idle);
+	InterlockedIncrement(&enum_pending);
+	if (!TrySubmitThreadpoolCallback(enum_scan_worker, (PVOID)(ULONG_PTR)enum_generation, NULL))
+		enum_job_done();
+	grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Scanning disks ...");
+}
+
+/* Open the disk NAME once the running enumeration finds it.  */
+void
+nkctx_enum_disk_select(const char* name)
+{
+	free(enum_select);
+	enum_select = grub_strdup(name);
+}
+
+void
+nkctx_enum_disk_poll(void)
+{
+	struct nkctx_disk* done;
+	static BOOL scanning;
+	BOOL changed = FALSE;
+
+	if (!enum_inited)
+		return;
+
+	EnterCriticalSection(&enum_lock);
+	done = enum_done;
+	enum_done = NULL;
+	LeaveCriticalSection(&enum_lock);
+
+	while (done)
+	{
+		struct nkctx_disk* info = done;
+		struct nkctx_disk** pp;
+		done = done->next;
+
+		/* Keep the order of grub_disk_iterate.  */
+		for (pp = &nk.disks; *pp && (*pp)->index < info->index; pp = &(*pp)->next)
+			;
+		info->next = *pp;
+		*pp = info;
+		nk.disk_count++;
+		changed = TRUE;
+
+		if (enum_select && grub_strcmp(enum_select, info->name) == 0)
+		{
+			free(enum_select);
+			enum_select = NULL;
+			nk.disk_index = info->index;
+			nkctx_enum_file(info->path);
+		}
+	}
+
+	if (enum_pending)
+	{
+		scanning = TRUE;
+		if (changed && !nk.path)
+			grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Scanning disks ... %lu", nk.disk_count);
+	}
+	else if (scanning || changed)
+	{
+		scanning = FALSE;
+		if (!nk.path)
+			grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Found %lu disk(s)", nk.disk_count);
+	}
+}
+
+/* Wait for the workers of a thrown away enumeration to leave grub.  */
+void
+nkctx_enum_disk_wait(void)
+{
+	if (enum_inited)
+		WaitForSingleObject(enum_idle, INFINITE);
 }
 
 void
 nkctx_free_disk(void)
 {
 	struct nkctx_disk* p = nk.disks;
+
+	if (enum_inited)
+	{
+		/* Results still in flight belong to the old list.  */
+		EnterCriticalSection(&enum_lock);
+		enum_generation++;
+		if (enum_done)
+		{
+			struct nkctx_disk* q = enum_done;
+			while (q->next)
+				q = q->next;
+			q->next = p;
+			p = enum_done;
+			enum_done = NULL;
+		}
+		LeaveCriticalSection(&enum_lock);
+	}
+
 	while (p)
 	{
 		struct nkctx_disk* next = p->next;
@@ -135,4 +407,3 @@ nkctx_free_disk(void)
 	nk.disk_index = 0;
 	nkctx_unset_path();
 }
-
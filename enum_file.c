@@ -19,9 +19,11 @@
 #include <grub/types.h>
 #include <grub/misc.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
 #include <grub/fs.h>
 #include <grub/file.h>
 #include <grub/datetime.h>
+#include <grub/find.h>
 
 #include <nkctx.h>
 #include <stdlib.h>
@@ -37,19 +39,6 @@ nkctx_is_hidden_file(const char* filename)
 	return FALSE;
 }
 
-static int
-callback_count_file(const char* filename,
-	const struct grub_dirhook_info* info,
-	void* data)
-{
-	if (nkctx_is_hidden_file(filename))
-		return 0;
-	if (info->dir)
-		nk.dir_count++;
-	nk.file_count++;
-	return 0;
-}
-
 static void
 check_extension(struct nkctx_file* info)
 {
@@ -111,158 +100,914 @@ check_extension(struct nkctx_file* info)
 		info->icon = IDR_PNG_WIN;
 }
 
-struct
-ctx_enum_file
+/* Entries go from the loader to the window in batches, a batch that is
+   not full is sent anyway after FILE_BATCH_DELAY ms.  */
+#define FILE_BATCH_SIZE 256
+#define FILE_BATCH_DELAY 100
+
+struct file_batch
 {
+	struct file_batch* volatile next;
+	DWORD count;
+	struct nkctx_file files[FILE_BATCH_SIZE];
+};
+
+/* Names of a listing are packed in chunks that are never moved, so the
+   window can show them while the loader adds more.  */
+#define FILE_POOL_SIZE 65536
+
+struct file_pool
+{
+	struct file_pool* next;
+	grub_size_t used;
+	grub_size_t size;
+	char data[0];
+};
+
+struct file_sort_key
+{
+	const char* name;
+	BOOL is_dir;
 	DWORD index;
 };
 
+/* A directory read on the thread pool.  The loader is the only producer of
+   the batch queue and the window its only consumer, so the queue is a list
+   linked at the tail by one and followed from the head by the other, with
+   no lock.  The loader sorts the names it has seen once the walk is over
+   and publishes the order with DONE.  The load lives as long as its
+   entries are listed, they point into its POOL.  */
+struct file_load
+{
+	volatile LONG refs;
+	volatile LONG cancel;
+	volatile LONG done;
+	BOOL failed;
+	char* path;
+	struct file_pool* pool;
+	/* Path of the entry being read.  */
+	char* file_path;
+	grub_size_t file_path_size;
+	/* Last batch taken by the window.  */
+	struct file_batch* head;
+	/* Last batch queued by the loader.  */
+	struct file_batch* tail;
+	/* Batch being filled.  */
+	struct file_batch* batch;
+	ULONGLONG batch_time;
+	struct file_sort_key* keys;
+	DWORD key_count;
+	DWORD key_alloc;
+	/* Arrival index of the entry at each place of the sorted list.  */
+	DWORD* order;
+	DWORD order_count;
+	/* A search of everything under PATH, the entries are named by their
+	   path below it.  */
+	char* pattern;
+	unsigned find_flags;
+	char* error;
+	/* The disk the directory was read from.  */
+	unsigned long dev_id;
+	unsigned long disk_id;
+	grub_disk_addr_t start;
+
+	/* The rest belongs to the window.  */
+	struct nkctx_file* files;
+	DWORD file_count;
+	DWORD dir_count;
+	DWORD file_alloc;
+	BOOL loaded;
+	BOOL sorted;
+	/* Next in the cache, most recently used first.  */
+	struct file_load* next;
+};
+
+/* Listings kept for going back to a directory without reading it again.  */
+#define FILE_CACHE_SIZE 16
+#define FILE_CACHE_FILES 1000000
+
+static BOOL load_inited;
+static HANDLE load_idle;
+static volatile LONG load_pending;
+/* The listing shown, and the one that replaces it on refresh.  */
+static struct file_load* file_load;
+static struct file_load* file_refresh;
+static struct file_load* file_cache;
+
+static void
+file_load_unref(struct file_load* load)
+{
+	struct file_batch* batch;
+
+	if (InterlockedDecrement(&load->refs) != 0)
+		return;
+	for (batch = load->head; batch;)
+	{
+		struct file_batch* next = batch->next;
+		free(batch);
+		batch = next;
+	}
+	while (load->pool)
+	{
+		struct file_pool* next = load->pool->next;
+		free(load->pool);
+		load->pool = next;
+	}
+	free(load->batch);
+	free(load->files);
+	free(load->file_path);
+	free(load->keys);
+	free(load->order);
+	free(load->path);
+	grub_free(load->pattern);
+	grub_free(load->error);
+	free(load);
+}
+
+static void
+file_load_push(struct file_load* load)
+{
+	struct file_batch* batch = load->batch;
+
+	load->batch = NULL;
+	load->batch_time = GetTickCount64();
+	if (!batch)
+		return;
+	if (batch->count == 0)
+	{
+		free(batch);
+		return;
+	}
+	/* The entries must be visible before the link is.  */
+	InterlockedExchangePointer((PVOID volatile*)&load->tail->next, batch);
+	load->tail = batch;
+	PostMessageW(nk.wnd, WM_NULL, 0, 0);
+}
+
+static struct file_batch*
+file_load_pop(struct file_load* load)
+{
+	struct file_batch* next;
+
+	next = InterlockedCompareExchangePointer((PVOID volatile*)&load->head->next, NULL, NULL);
+	if (!next)
+		return NULL;
+	/* The loader links only to the tail, the old head is ours now.  */
+	free(load->head);
+	load->head = next;
+	return next;
+}
+
+static const char*
+file_pool_add(struct file_load* load, const char* name, grub_size_t len)
+{
+	struct file_pool* pool = load->pool;
+	char* p;
+
+	len++;
+	if (!pool || pool->size - pool->used < len)
+	{
+		grub_size_t size = len > FILE_POOL_SIZE ? len : FILE_POOL_SIZE;
+		pool = malloc(sizeof(struct file_pool) + size);
+		if (!pool)
+			return NULL;
+		pool->next = load->pool;
+		pool->used = 0;
+		pool->size = size;
+		load->pool = pool;
+	}
+	p = pool->data + pool->used;
+	memcpy(p, name, len - 1);
+	p[len - 1] = '\0';
+	pool->used += len;
+	return p;
+}
+
+/* LOAD->path + NAME in a buffer kept for the whole walk.  */
+static const char*
+get_load_path(struct file_load* load, const char* name)
+{
+	grub_size_t size = strlen(load->path) + strlen(name) + 1;
+
+	if (size > load->file_path_size)
+	{
+		char* buf = realloc(load->file_path, size);
+		if (!buf)
+			return NULL;
+		load->file_path = buf;
+		load->file_path_size = size;
+	}
+	grub_snprintf(load->file_path, size, "%s%s", load->path, name);
+	return load->file_path;
+}
+
+/* A new entry NAME in the batch being filled, the caller sets the rest and
+   queues it with file_load_next.  */
+static struct nkctx_file*
+file_load_add(struct file_load* load, const char* name, grub_size_t len, BOOL is_dir)
+{
+	struct nkctx_file* p;
+
+	if (!load->batch)
+	{
+		load->batch = calloc(1, sizeof(struct file_batch));
+		if (!load->batch)
+			return NULL;
+	}
+	if (load->key_count == load->key_alloc)
+	{
+		DWORD alloc = load->key_alloc ? load->key_alloc * 2 : FILE_BATCH_SIZE;
+		struct file_sort_key* keys = realloc(load->keys, alloc * sizeof(struct file_sort_key));
+		if (!keys)
+			return NULL;
+		load->keys = keys;
+		load->key_alloc = alloc;
+	}
+
+	p = &load->batch->files[load->batch->count];
+	memset(p, 0, sizeof(struct nkctx_file));
+	p->name = file_pool_add(load, name, len);
+	if (!p->name)
+		return NULL;
+	p->is_dir = is_dir;
+	if (is_dir)
+		p->icon = IDR_PNG_DIR;
+	else
+		check_extension(p);
+	return p;
+}
+
+static void
+file_load_next(struct file_load* load)
+{
+	struct nkctx_file* p = &load->batch->files[load->batch->count];
+
+	load->keys[load->key_count].name = p->name;
+	load->keys[load->key_count].is_dir = p->is_dir;
+	load->keys[load->key_count].index = load->key_count;
+	load->key_count++;
+
+	if (++load->batch->count == FILE_BATCH_SIZE
+		|| GetTickCount64() - load->batch_time >= FILE_BATCH_DELAY)
+		file_load_push(load);
+}
+
 static int
 callback_enum_file(const char* filename,
 	const struct grub_dirhook_info* info,
 	void* data)
 {
+	struct file_load* load = data;
+	struct nkctx_file* p;
+
+	if (load->cancel)
+		return 1;
 	if (nkctx_is_hidden_file(filename))
 		return 0;
 
-	struct ctx_enum_file* ctx = (struct ctx_enum_file*)data;
-	struct nkctx_file* p = &nk.files[ctx->index++];
-
-	p->name = grub_strdup(filename);
+	p = file_load_add(load, filename, strlen(filename), info->dir);
+	if (!p)
+		return 1;
 
-	if (info->dir)
-	{
-		p->is_dir = TRUE;
-		p->icon = IDR_PNG_DIR;
-		p->path = grub_xasprintf("%s%s/", nk.path, filename);
-		strcpy_s(p->human_size, ARRAY_SIZE(p->human_size), GET_STR(LANG_STR_DIR));
-	}
-	else
+	if (!info->dir)
 	{
-		p->is_dir = FALSE;
-		check_extension(p);
-		p->path = grub_xasprintf("%s%s", nk.path, filename);
-		grub_file_t file = grub_file_open(p->path, GRUB_FILE_TYPE_GET_SIZE | GRUB_FILE_TYPE_NO_DECOMPRESS);
+		const char* path = get_load_path(load, filename);
+		grub_file_t file = NULL;
+
+		if (path)
+			file = grub_file_open(path, GRUB_FILE_TYPE_GET_SIZE | GRUB_FILE_TYPE_NO_DECOMPRESS);
 		if (file)
 		{
 			p->size = grub_file_size(file);
-			strcpy_s(p->human_size, ARRAY_SIZE(p->human_size), grub_get_human_size(p->size, GRUB_HUMAN_SIZE_SHORT));
+			p->sizeset = TRUE;
 			grub_file_close(file);
 		}
-		else
-			strcpy_s(p->human_size, ARRAY_SIZE(p->human_size), GET_STR(LANG_STR_UNKNOWN));
-	}
-	p->time[0] = '\0';
-	if (info->mtimeset)
-	{
-		struct grub_datetime datetime;
-		grub_unixtime2datetime(info->mtime, &datetime);
-		if (datetime.year < 3000)
-			grub_snprintf(p->time, ARRAY_SIZE(p->time), "%04d-%02d-%02d %02d:%02d:%02d",
-				datetime.year, datetime.month, datetime.day,
-				datetime.hour, datetime.minute, datetime.second);
 	}
+	p->mtimeset = info->mtimeset;
+	p->mtime = info->mtime;
 	if (info->symlink)
 		p->icon = IDR_PNG_LINK;
 	grub_errno = GRUB_ERR_NONE;
+
+	file_load_next(load);
 	return 0;
 }
 
+/* Entries found by grub_find are under LOAD->path, their path below it is
+   their name.  */
 static int
-callback_sort_file(const void* a, const void* b)
+callback_find_file(const struct grub_find_entry* entry, void* data)
 {
-	struct nkctx_file* pa = (struct nkctx_file*)a;
-	struct nkctx_file* pb = (struct nkctx_file*)b;
-	if (pa->is_dir && !pb->is_dir)
+	struct file_load* load = data;
+	grub_size_t ofs = strlen(load->path);
+	grub_size_t len = strlen(entry->path);
+	struct nkctx_file* p;
+
+	if (load->cancel)
+		return 1;
+	if (len <= ofs)
+		return 0;
+	if (entry->dir)
+		len--;
+	p = file_load_add(load, entry->path + ofs, len - ofs, entry->dir);
+	if (!p)
+		return 1;
+	p->sizeset = entry->sizeset;
+	p->size = entry->size;
+	p->mtimeset = entry->mtimeset;
+	p->mtime = entry->mtime;
+
+	file_load_next(load);
+	return 0;
+}
+
+/* Directories first, then by name.  */
+static int
+compare_file(BOOL a_dir, const char* a, BOOL b_dir, const char* b)
+{
+	if (a_dir && !b_dir)
 		return -1;
-	if (!pa->is_dir && pb->is_dir)
+	if (!a_dir && b_dir)
 		return 1;
-	return strcmp(pa->name, pb->name);
+	return strcmp(a, b);
+}
+
+static int
+callback_sort_file(const void* a, const void* b)
+{
+	const struct file_sort_key* pa = a;
+	const struct file_sort_key* pb = b;
+	return compare_file(pa->is_dir, pa->name, pb->is_dir, pb->name);
 }
 
 static void
-remove_duplicated_dir(void)
+sort_files(struct file_load* load)
 {
-	const char* prev = "";
-	for (DWORD i = 0; i < nk.dir_count; i++)
+	if (load->key_count == 0)
+		return;
+	qsort(load->keys, load->key_count, sizeof(struct file_sort_key), callback_sort_file);
+	load->order = malloc(load->key_count * sizeof(DWORD));
+	if (!load->order)
+		return;
+	for (DWORD i = 0; i < load->key_count; i++)
+		load->order[i] = load->keys[i].index;
+	load->order_count = load->key_count;
+}
+
+static void CALLBACK
+file_load_worker(PTP_CALLBACK_INSTANCE instance, PVOID data)
+{
+	struct file_load* load = data;
+	char* disk_name;
+	grub_disk_t disk;
+	grub_fs_t fs = NULL;
+	const char* path;
+	NK_UNUSED(instance);
+
+	load->batch_time = GetTickCount64();
+	disk_name = grub_file_get_disk_name(load->path);
+	disk = grub_disk_open(disk_name);
+	grub_free(disk_name);
+	if (disk)
+	{
+		load->dev_id = disk->dev->id;
+		load->disk_id = disk->id;
+		if (disk->partition)
+			load->start = grub_partition_get_start(disk->partition);
+		fs = grub_fs_probe(disk);
+	}
+	grub_errno = GRUB_ERR_NONE;
+	path = grub_strchr(load->path, ')');
+	if (!path)
+		path = load->path;
+	else
+		path++;
+
+	if (!fs)
+		load->failed = TRUE;
+	else if (load->pattern)
 	{
-		if (strcmp(prev, nk.files[i].name) == 0)
+		struct grub_find_options options =
+		{
+			.pattern = load->pattern,
+			.flags = load->find_flags | GRUB_FIND_STAT,
+			/* LONG is an int on Windows.  */
+			.cancel = (const volatile int*)&load->cancel,
+		};
+		/* The walkers open the disk again.  */
+		grub_disk_close(disk);
+		disk = NULL;
+		if (grub_find(load->path, &options, callback_find_file, load, NULL) != GRUB_ERR_NONE)
 		{
-			free(nk.files[i].name);
-			free(nk.files[i].path);
-			nk.files[i].name = NULL;
-			nk.files[i].path = NULL;
+			load->failed = TRUE;
+			load->error = grub_strdup(grub_errmsg);
 		}
-		else
-			prev = nk.files[i].name;
 	}
+	else
+		fs->fs_dir(disk, path, callback_enum_file, load);
+	grub_errno = GRUB_ERR_NONE;
+	if (disk)
+		grub_disk_close(disk);
+
+	file_load_push(load);
+	if (!load->cancel)
+		sort_files(load);
+	free(load->keys);
+	load->keys = NULL;
+	InterlockedExchange(&load->done, 1);
+	PostMessageW(nk.wnd, WM_NULL, 0, 0);
+
+	file_load_unref(load);
+	if (InterlockedDecrement(&load_pending) == 0)
+		SetEvent(load_idle);
+}
+
+/* Put the entries in the order found by the loader.  */
+static BOOL
+apply_order(struct file_load* load)
+{
+	struct nkctx_file* files;
+
+	if (load->file_count == 0)
+		return TRUE;
+	/* Entries were dropped if the window ran out of memory.  */
+	if (!load->order || load->order_count != load->file_count)
+		return FALSE;
+	files = malloc(load->file_count * sizeof(struct nkctx_file));
+	if (!files)
+		return FALSE;
+	for (DWORD i = 0; i < load->file_count; i++)
+		files[i] = load->files[load->order[i]];
+	free(load->files);
+	load->files = files;
+	load->file_alloc = load->file_count;
+	return TRUE;
+}
+
+/* Drop the repeated directories some file systems report, the list is
+   kept without holes so that the window can find a row by its index.  */
+static void
+remove_duplicated_dir(struct file_load* load)
+{
+	struct nkctx_file* files = load->files;
+	DWORD i, n = 0;
+	for (i = 0; i < load->file_count; i++)
+	{
+		if (i < load->dir_count && n > 0 && strcmp(files[n - 1].name, files[i].name) == 0)
+			continue;
+		files[n++] = files[i];
+	}
+	load->dir_count -= load->file_count - n;
+	load->file_count = n;
+}
+
+/* Move the batches queued so far to the entries of LOAD, returns TRUE once
+   the loader is done with it.  */
+static BOOL
+file_load_take(struct file_load* load)
+{
+	struct file_batch* batch;
+	LONG done;
+
+	/* Batches queued before DONE was set are all seen below.  */
+	done = InterlockedCompareExchange(&load->done, 0, 0);
+	while ((batch = file_load_pop(load)) != NULL)
+	{
+		if (load->file_count + batch->count > load->file_alloc)
+		{
+			DWORD alloc = load->file_alloc ? load->file_alloc : FILE_BATCH_SIZE;
+			while (alloc < load->file_count + batch->count)
+				alloc *= 2;
+			struct nkctx_file* files = realloc(load->files, alloc * sizeof(struct nkctx_file));
+			if (!files)
+			{
+				/* Keep what fits and stop the loader.  */
+				InterlockedExchange(&load->cancel, 1);
+				batch->count = 0;
+				continue;
+			}
+			load->files = files;
+			load->file_alloc = alloc;
+		}
+		for (DWORD i = 0; i < batch->count; i++)
+		{
+			if (batch->files[i].is_dir)
+				load->dir_count++;
+			load->files[load->file_count++] = batch->files[i];
+		}
+		/* The entries belong to the list now.  */
+		batch->count = 0;
+	}
+	if (!done)
+		return FALSE;
+
+	load->loaded = TRUE;
+	if (!load->failed && !load->cancel && apply_order(load))
+	{
+		remove_duplicated_dir(load);
+		load->sorted = TRUE;
+	}
+	return TRUE;
+}
+
+/* Read DIR, or search under it for PATTERN with the GRUB_FIND_* FLAGS.  */
+static struct file_load*
+file_load_start(const char* dir, const char* pattern, unsigned flags)
+{
+	struct file_load* load;
+
+	if (!load_inited)
+	{
+		load_idle = CreateEventW(NULL, TRUE, TRUE, NULL);
+		load_inited = TRUE;
+	}
+
+	load = calloc(1, sizeof(struct file_load));
+	if (!load)
+		return NULL;
+	load->path = grub_strdup(dir);
+	load->head = calloc(1, sizeof(struct file_batch));
+	if (pattern)
+		load->pattern = grub_strdup(pattern);
+	load->find_flags = flags;
+	if (!load->path || !load->head || (pattern && !load->pattern))
+	{
+		grub_free(load->pattern);
+		free(load->path);
+		free(load->head);
+		free(load);
+		return NULL;
+	}
+	load->tail = load->head;
+	/* One for the window, one for the loader.  */
+	load->refs = 2;
+
+	InterlockedIncrement(&load_pending);
+	ResetEvent(load_idle);
+	if (!TrySubmitThreadpoolCallback(file_load_worker, load, NULL))
+	{
+		if (InterlockedDecrement(&load_pending) == 0)
+			SetEvent(load_idle);
+		load->refs = 1;
+		file_load_unref(load);
+		return NULL;
+	}
+	return load;
 }
 
+static void
+file_load_cancel(struct file_load* load)
+{
+	InterlockedExchange(&load->cancel, 1);
+	file_load_unref(load);
+}
+
+static void
+show_load(struct file_load* load)
+{
+	file_load = load;
+	nk.files = load->files;
+	nk.file_count = load->file_count;
+	nk.dir_count = load->dir_count;
+}
+
+static void
+show_status(struct file_load* load)
+{
+	if (load->pattern && !load->loaded)
+		grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Searching %s for %s ... %lu item(s)",
+			nk.path, load->pattern, nk.file_count);
+	else if (load->pattern && load->failed)
+		grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Can't search %s: %s",
+			nk.path, load->error ? load->error : "");
+	else if (load->pattern)
+		grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Found %lu dir(s), %lu item(s) matching %s",
+			nk.dir_count, nk.file_count, load->pattern);
+	else if (!load->loaded)
+		grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Loading %s ... %lu item(s)", nk.path, nk.file_count);
+	else if (load->failed)
+		grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Can't open %s", nk.path);
+	else
+		grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Found %lu dir(s), %lu item(s)", nk.dir_count, nk.file_count);
+}
+
+/* Drop the least recently used listings beyond the limits.  */
+static void
+file_cache_put(struct file_load* load)
+{
+	struct file_load** pp;
+	DWORD count = 0;
+	DWORD files = 0;
+
+	for (DWORD i = 0; i < load->file_count; i++)
+		load->files[i].selected = FALSE;
+	load->next = file_cache;
+	file_cache = load;
+	for (pp = &file_cache; *pp;)
+	{
+		struct file_load* p = *pp;
+		count++;
+		files += p->file_count;
+		if (count > FILE_CACHE_SIZE || files > FILE_CACHE_FILES)
+		{
+			*pp = p->next;
+			file_load_unref(p);
+			continue;
+		}
+		pp = &p->next;
+	}
+}
+
+/* A loopback device mounted again, or a partition that moved, has another
+   identity than the disk the listing was read from.  */
+static BOOL
+file_load_same_disk(struct file_load* load)
+{
+	char* disk_name = grub_file_get_disk_name(load->path);
+	grub_disk_t disk = grub_disk_open(disk_name);
+	BOOL ret = FALSE;
+
+	grub_free(disk_name);
+	if (disk)
+	{
+		grub_disk_addr_t start = 0;
+		if (disk->partition)
+			start = grub_partition_get_start(disk->partition);
+		ret = disk->dev->id == load->dev_id && disk->id == load->disk_id && start == load->start;
+		grub_disk_close(disk);
+	}
+	grub_errno = GRUB_ERR_NONE;
+	return ret;
+}
+
+static struct file_load*
+file_cache_get(const char* dir)
+{
+	struct file_load** pp;
+	struct file_load* load;
+
+	for (pp = &file_cache; *pp; pp = &(*pp)->next)
+	{
+		if (strcmp((*pp)->path, dir) == 0)
+			break;
+	}
+	load = *pp;
+	if (!load)
+		return NULL;
+	*pp = load->next;
+	load->next = NULL;
+	if (!file_load_same_disk(load))
+	{
+		file_load_unref(load);
+		return NULL;
+	}
+	return load;
+}
+
+/* Forget the listings and search indexes of DISK and of its partitions.  */
+void
+nkctx_drop_file_cache(const char* disk)
+{
+	grub_size_t len = strlen(disk);
+	struct file_load** pp;
+
+	grub_find_flush(disk);
+	for (pp = &file_cache; *pp;)
+	{
+		struct file_load* p = *pp;
+		if (p->path[0] == '(' && strncmp(p->path + 1, disk, len) == 0
+			&& (p->path[len + 1] == ')' || p->path[len + 1] == ','))
+		{
+			*pp = p->next;
+			file_load_unref(p);
+			continue;
+		}
+		pp = &p->next;
+	}
+}
+
+/* Show DIR from the cache, or read it on the thread pool.  Its entries are
+   then added to nk.files by nkctx_enum_file_poll as they arrive.  */
 void
 nkctx_enum_file(const char* dir)
 {
-	char* disk_name = NULL;
-	grub_fs_t fs;
-	const char* path;
-	grub_disk_t disk;
+	struct file_load* load;
 
 	nkctx_set_path(dir);
 	nkctx_free_file();
 
-	disk_name = grub_file_get_disk_name(nk.path);
-	disk = grub_disk_open(disk_name);
-	grub_free(disk_name);
-	if (!disk)
-		goto fail;
+	load = file_cache_get(nk.path);
+	if (!load)
+		load = file_load_start(nk.path, NULL, 0);
+	if (!load)
+	{
+		grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Can't open %s", nk.path);
+		return;
+	}
+	show_load(load);
+	show_status(load);
+}
 
-	fs = grub_fs_probe(disk);
-	grub_errno = GRUB_ERR_NONE;
-	path = grub_strchr(nk.path, ')');
-	if (!path)
-		path = nk.path;
+/* List everything under nk.path whose name matches PATTERN.  The results
+   replace the list and are named by their path below nk.path.  */
+void
+nkctx_search_file(const char* pattern, unsigned flags)
+{
+	struct file_load* load;
+	char* text = grub_strdup(pattern);
+
+	if (!nk.path || !text)
+	{
+		grub_free(text);
+		return;
+	}
+	nkctx_free_file();
+	load = file_load_start(nk.path, text, flags & ~GRUB_FIND_REBUILD);
+	grub_free(text);
+	if (!load)
+	{
+		grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Can't search %s", nk.path);
+		return;
+	}
+	show_load(load);
+	show_status(load);
+}
+
+/* Read nk.path again while its list stays up, the new list replaces it
+   once sorted and keeps the selection of the entries found in both.  */
+void
+nkctx_refresh_file(void)
+{
+	if (!nk.path || file_refresh)
+		return;
+	if (!file_load || !file_load->sorted)
+	{
+		if (file_load && file_load->pattern)
+			nkctx_search_file(file_load->pattern, file_load->find_flags);
+		else
+			nkctx_enum_file(nk.path);
+		return;
+	}
+	/* A search walks the tree again instead of asking its index.  */
+	if (file_load->pattern)
+		file_refresh = file_load_start(nk.path, file_load->pattern, file_load->find_flags | GRUB_FIND_REBUILD);
 	else
-		path++;
+		file_refresh = file_load_start(nk.path, NULL, 0);
+	if (file_refresh)
+		grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Refreshing %s ...", nk.path);
+}
 
-	if (!path || !fs)
-		goto fail;
+static void
+merge_refresh(struct file_load* old, struct file_load* load)
+{
+	DWORD i = 0, j = 0;
+	DWORD added = 0, removed = 0, changed = 0;
 
-	nk.file_count = 0;
-	nk.dir_count = 0;
-	fs->fs_dir(disk, path, callback_count_file, NULL);
-	grub_errno = GRUB_ERR_NONE;
-	if (nk.file_count != 0)
-	{
-		nk.files = grub_calloc(nk.file_count, sizeof(struct nkctx_file));
-		if (!nk.files)
-			goto fail;
-		struct ctx_enum_file ctx = { 0 };
-		fs->fs_dir(disk, path, callback_enum_file, &ctx);
-		grub_errno = GRUB_ERR_NONE;
-		qsort(nk.files, nk.file_count, sizeof(struct nkctx_file), callback_sort_file);
-		remove_duplicated_dir();
-	}
-	grub_disk_close(disk);
-	grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Found %lu dir(s), %lu item(s)", nk.dir_count, nk.file_count);
-	return;
-
-fail:
-	if (disk)
-		grub_disk_close(disk);
-	nk.file_count = 0;
-	nk.dir_count = 0;
-	grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Can't open %s", nk.path);
+	while (i < old->file_count || j < load->file_count)
+	{
+		struct nkctx_file* a = &old->files[i];
+		struct nkctx_file* b = &load->files[j];
+		int cmp;
+
+		if (i == old->file_count)
+			cmp = 1;
+		else if (j == load->file_count)
+			cmp = -1;
+		else
+			cmp = compare_file(a->is_dir, a->name, b->is_dir, b->name);
+		if (cmp < 0)
+		{
+			removed++;
+			i++;
+		}
+		else if (cmp > 0)
+		{
+			added++;
+			j++;
+		}
+		else
+		{
+			b->selected = a->selected;
+			if (a->sizeset != b->sizeset || a->size != b->size
+				|| a->mtimeset != b->mtimeset || a->mtime != b->mtime)
+				changed++;
+			i++;
+			j++;
+		}
+	}
+
+	show_load(load);
+	file_load_unref(old);
+	grub_snprintf(nk.status, ARRAY_SIZE(nk.status),
+		"Found %lu dir(s), %lu item(s), %lu added, %lu removed, %lu changed",
+		nk.dir_count, nk.file_count, added, removed, changed);
 }
 
+void
+nkctx_enum_file_poll(void)
+{
+	struct file_load* load = file_load;
+
+	if (load && !load->loaded)
+	{
+		file_load_take(load);
+		show_load(load);
+		show_status(load);
+	}
+
+	load = file_refresh;
+	if (load && file_load_take(load))
+	{
+		file_refresh = NULL;
+		if (load->sorted && file_load)
+			merge_refresh(file_load, load);
+		else
+		{
+			file_load_unref(load);
+			grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Can't open %s", nk.path);
+		}
+	}
+}
+
+/* Wait for the loaders of thrown away directories to leave grub.  */
+void
+nkctx_enum_file_wait(void)
+{
+	if (load_inited)
+		WaitForSingleObject(load_idle, INFINITE);
+}
+
+/* Put the listing shown in the cache.  A listing still being read is
+   dropped, its names go once the loader is done with them.  */
 void
 nkctx_free_file(void)
 {
-	for (DWORD i = 0; i < nk.file_count; i++)
+	struct file_load* load = file_load;
+
+	if (file_refresh)
+	{
+		file_load_cancel(file_refresh);
+		file_refresh = NULL;
+	}
+	if (load)
 	{
-		free(nk.files[i].name);
-		free(nk.files[i].path);
+		file_load = NULL;
+		if (load->sorted && !load->pattern)
+			file_cache_put(load);
+		else
+			file_load_cancel(load);
 	}
-	free(nk.files);
 	nk.files = NULL;
 	nk.file_count = 0;
 	nk.dir_count = 0;
 }
+
+/* Grub path of INFO, valid until the next call.  */
+const char*
+nkctx_get_file_path(const struct nkctx_file* info)
+{
+	static char* buf;
+	static grub_size_t buf_size;
+	grub_size_t size;
+
+	if (!nk.path)
+		return "";
+	size = strlen(nk.path) + strlen(info->name) + 2;
+	if (size > buf_size)
+	{
+		char* p = realloc(buf, size);
+		if (!p)
+			return "";
+		buf = p;
+		buf_size = size;
+	}
+	grub_snprintf(buf, size, info->is_dir ? "%s%s/" : "%s%s", nk.path, info->name);
+	return buf;
+}
+
+/* The size and time columns, made only for the rows drawn.  */
+void
+nkctx_get_file_size(const struct nkctx_file* info, char* buf, size_t len)
+{
+	if (info->is_dir)
+		strcpy_s(buf, len, GET_STR(LANG_STR_DIR));
+	else if (info->sizeset)
+		strcpy_s(buf, len, grub_get_human_size(info->size, GRUB_HUMAN_SIZE_SHORT));
+	else
+		strcpy_s(buf, len, GET_STR(LANG_STR_UNKNOWN));
+}
+
+void
+nkctx_get_file_time(const struct nkctx_file* info, char* buf, size_t len)
+{
+	struct grub_datetime datetime;
+
+	buf[0] = '\0';
+	if (!info->mtimeset)
+		return;
+	grub_unixtime2datetime(info->mtime, &datetime);
+	if (datetime.year < 3000)
+		grub_snprintf(buf, len, "%04d-%02d-%02d %02d:%02d:%02d",
+			datetime.year, datetime.month, datetime.day,
+			datetime.hour, datetime.minute, datetime.second);
+}
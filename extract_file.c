@@ -26,156 +26,225 @@
 #include <grub/misc.h>
 #include <grub/file.h>
 #include <grub/charset.h>
+#include <grub/mm.h>
+#include <grub/extract.h>
 
 #define GRUB_MAX_PATH_LEN 32767
 
 static WCHAR m_u16_buf[GRUB_MAX_PATH_LEN + 1];
 
-static LPCWSTR
-get_u16_path(LPCWSTR dir, const char* file)
+/* An extraction running as a job.  */
+struct extract_job
 {
-	size_t len;
-	grub_memset(m_u16_buf, 0, sizeof(m_u16_buf));
-	if (_wcsnicmp(dir, L"\\\\?\\", 4) == 0)
-		wcscpy_s(m_u16_buf, GRUB_MAX_PATH_LEN - 1, dir);
-	else
-	{
-		wcscpy_s(m_u16_buf, GRUB_MAX_PATH_LEN - 1, L"\\\\?\\");
-		wcscat_s(m_u16_buf, GRUB_MAX_PATH_LEN - 1, dir);
-	}
-	len = wcslen(m_u16_buf);
-	if (len >= 1 && m_u16_buf[len - 1] != L'\\')
-		m_u16_buf[len++] = L'\\';
-	grub_utf8_to_utf16(m_u16_buf + len, GRUB_MAX_PATH_LEN - len, (const grub_uint8_t*)file, -1, NULL);
-	return m_u16_buf;
+	struct grub_extract_item* items;
+	grub_size_t count;
+	char* store;
+	struct grub_extract_stats stats;
+	/* First failure, shown in the summary.  */
+	char fail_path[256];
+};
+
+/* UTF-8 path of FILE in DIR, for the extraction engine.  */
+static char*
+get_u8_path(LPCWSTR dir, const char* file)
+{
+	size_t len = wcslen(dir);
+	char* path = grub_malloc(len * 3 + grub_strlen(file) + 2);
+	char* p;
+	if (!path)
+		return NULL;
+	p = (char*)grub_utf16_to_utf8((grub_uint8_t*)path, dir, len);
+	if (p > path && p[-1] != '\\')
+		*p++ = '\\';
+	grub_strcpy(p, file);
+	return path;
 }
 
-BOOL
-nkctx_extract_file(LPCWSTR target_dir, const char* source_file)
+/* Calls are serialized by grub_extract ().  */
+static void
+callback_extract_error(const char* path, const char* msg, void* data)
 {
-	BOOL ret = FALSE;
-	HANDLE hf = INVALID_HANDLE_VALUE;
-	grub_file_t file = NULL;
-	const char* target_file = grub_strrchr(source_file, '/');
-	if (!target_file)
-		goto fail;
-	target_file++;
-	file = grub_file_open(source_file, GRUB_FILE_TYPE_CAT | GRUB_FILE_TYPE_NO_DECOMPRESS);
-	if (!file)
-		goto fail;
+	struct extract_job* job = data;
+	if (!job->fail_path[0])
+		grub_snprintf(job->fail_path, sizeof(job->fail_path), "%s\n%s", path, msg);
+}
 
-	hf = CreateFileW(get_u16_path(target_dir, target_file),
-		GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (hf == NULL || hf == INVALID_HANDLE_VALUE)
-		goto fail;
+static void
+show_summary(const struct grub_extract_stats* stats, const char* fail_path)
+{
+	WCHAR text[512];
+	WCHAR size[32];
+	WCHAR speed[32];
+	grub_uint64_t ms = stats->elapsed_us / 1000;
+	UINT type = MB_OK;
+	LPCWSTR caption = GET_WCS(LANG_WCS_DONE);
+	size_t len;
+
+	memset(size, 0, sizeof(size));
+	memset(speed, 0, sizeof(speed));
+	grub_utf8_to_utf16(size, 31,
+		(grub_uint8_t*)grub_get_human_size(stats->bytes, GRUB_HUMAN_SIZE_SHORT), -1, NULL);
+	/* GRUB_HUMAN_SIZE_SPEED takes hundredths of bytes per second.  */
+	grub_utf8_to_utf16(speed, 31,
+		(grub_uint8_t*)grub_get_human_size(grub_divmod64(stats->bytes * 100000ULL,
+			ms ? ms : 1, 0), GRUB_HUMAN_SIZE_SPEED), -1, NULL);
+	swprintf(text, ARRAYSIZE(text), GET_WCS(LANG_WCS_EXTRACT_SUMMARY),
+		(unsigned long long)stats->files, (unsigned long long)stats->dirs,
+		size, (unsigned long long)(ms / 1000), (unsigned long long)(ms % 1000 / 100), speed);
 
-	while (1)
+	if (stats->cancelled)
+		caption = GET_WCS(LANG_WCS_CANCELLED);
+	else if (stats->errors)
 	{
-		DWORD w;
-		grub_ssize_t r = grub_file_read(file, nk.copy_buf, nk.copy_size);
-		if (r < 0)
-			goto fail;
-		if (r == 0)
-			break;
-		BOOL b = WriteFile(hf, nk.copy_buf, r, &w, NULL);
-		if (!b || w != (DWORD)r)
-			goto fail;
+		caption = GET_WCS(LANG_WCS_FAIL);
+		type |= MB_ICONERROR;
+		len = wcslen(text);
+		swprintf(text + len, ARRAYSIZE(text) - len, L"\n%ls: %llu\n\n",
+			GET_WCS(LANG_WCS_FAIL), (unsigned long long)stats->errors);
+		len = wcslen(text);
+		grub_utf8_to_utf16(text + len, ARRAYSIZE(text) - len - 1,
+			(grub_uint8_t*)fail_path, -1, NULL);
 	}
-
-	ret = TRUE;
-
-fail:
-	if (hf != NULL && hf != INVALID_HANDLE_VALUE)
-		CloseHandle(hf);
-	if (file)
-		grub_file_close(file);
-	grub_errno = GRUB_ERR_NONE;
-	return ret;
+	MessageBoxW(nk.wnd, text, caption, type);
 }
 
-struct ctx_extract_file
+/* Files extracted to a folder holding a ".nkstore" folder are kept once
+   there and linked, so that images sharing files take the space once.  */
+#define NKCTX_STORE_DIR L".nkstore"
+
+static char*
+get_store_path(LPCWSTR target_dir)
 {
-	grub_fs_t fs;
-	grub_disk_t disk;
-	WCHAR* target_dir;
-	char* path;
-};
+	WCHAR path[MAX_PATH];
+	DWORD attr;
 
-static void
-nkctx_extract_dir_real(struct ctx_extract_file* ctx);
+	if (swprintf(path, MAX_PATH, L"%ls\\%ls", target_dir, NKCTX_STORE_DIR) < 0)
+		return NULL;
+	attr = GetFileAttributesW(path);
+	if (attr == INVALID_FILE_ATTRIBUTES || !(attr & FILE_ATTRIBUTE_DIRECTORY))
+		return NULL;
+	return get_u8_path(target_dir, ".nkstore");
+}
 
-static int
-callback_extract_file(const char* filename,
-	const struct grub_dirhook_info* info, void* data)
+static void
+free_extract_job(struct extract_job* job)
 {
-	struct ctx_extract_file* ctx = data;
-	if (nkctx_is_hidden_file(filename))
-		return 0;
-	if (info->symlink)
-		return 0;
-	if (info->dir)
+	for (grub_size_t i = 0; i < job->count; i++)
 	{
-		struct ctx_extract_file* new_ctx = grub_malloc(sizeof(struct ctx_extract_file));
-		new_ctx->path = grub_xasprintf("%s/%s/", ctx->path, filename);
-		new_ctx->target_dir = _wcsdup(get_u16_path(ctx->target_dir, filename));
-		new_ctx->fs = ctx->fs;
-		new_ctx->disk = ctx->disk;
-		nkctx_extract_dir_real(new_ctx);
-		grub_free(new_ctx->path);
-		free(new_ctx->target_dir);
-		grub_free(new_ctx);
+		grub_free((char*)job->items[i].src);
+		grub_free((char*)job->items[i].dest);
 	}
-	else
+	grub_free(job->items);
+	grub_free(job->store);
+	grub_free(job);
+}
+
+static void
+extract_job_run(struct grub_progress* progress, void* data)
+{
+	struct extract_job* job = data;
+	struct grub_extract_options options =
 	{
-		char* path = grub_xasprintf("%s/%s", ctx->path, filename);
-		nkctx_extract_file(ctx->target_dir, path);
-		grub_free(path);
-	}
+		/* Disk images are mostly zeros, keep them sparse.  */
+		.flags = GRUB_EXTRACT_ZEROS,
+		.store = job->store,
+		.error = callback_extract_error,
+		.data = job,
+	};
+	grub_err_t err;
+
+	/* grub_extract () keeps PROGRESS itself.  */
+	NK_UNUSED(progress);
+	err = grub_extract(job->items, job->count, &options, &job->stats);
+	if (err != GRUB_ERR_NONE && !job->stats.errors && !job->stats.cancelled)
+		callback_extract_error("", grub_errmsg, job);
 	grub_errno = GRUB_ERR_NONE;
-	return 0;
 }
 
 static void
-nkctx_extract_dir_real(struct ctx_extract_file* ctx)
+extract_job_done(void* data, BOOL closing)
 {
-	CreateDirectoryW(ctx->target_dir, NULL);
-	grub_errno = GRUB_ERR_NONE;
-	char* dir = grub_strchr(ctx->path, ')');
-	ctx->fs->fs_dir(ctx->disk, ++dir, callback_extract_file, ctx); 
+	struct extract_job* job = data;
+	if (!closing)
+		show_summary(&job->stats, job->fail_path);
+	free_extract_job(job);
+}
+
+/* Copy the items of JOB in the background, the summary is shown
+   once it is done.  JOB is freed if it can't be started.  */
+static BOOL
+extract_items(LPCWSTR target_dir, struct extract_job* job, const char* title)
+{
+	job->store = get_store_path(target_dir);
+	if (nkctx_job_start(title, extract_job_run, extract_job_done, job))
+		return TRUE;
+	free_extract_job(job);
+	return FALSE;
+}
+
+BOOL
+nkctx_extract_file(LPCWSTR target_dir, const char* source_file)
+{
+	const char* name = grub_strrchr(source_file, '/');
+	struct extract_job* job;
+	char title[64];
+
+	if (!name)
+		return FALSE;
+	job = grub_zalloc(sizeof(struct extract_job));
+	if (!job)
+		goto fail;
+	job->items = grub_zalloc(sizeof(struct grub_extract_item));
+	if (!job->items)
+		goto fail;
+	job->count = 1;
+	job->items[0].src = grub_strdup(source_file);
+	job->items[0].dest = get_u8_path(target_dir, name + 1);
+	if (!job->items[0].src || !job->items[0].dest)
+		goto fail;
+	grub_snprintf(title, sizeof(title), "Extract  %s", name + 1);
+	return extract_items(target_dir, job, title);
+
+fail:
+	if (job)
+		free_extract_job(job);
 	grub_errno = GRUB_ERR_NONE;
+	return FALSE;
 }
 
-void
+BOOL
 nkctx_extract_dir(LPCWSTR target_dir)
 {
+	struct extract_job* job;
+	char title[64];
 	DWORD i;
-	char* disk_name = grub_file_get_disk_name(nk.path);
-	grub_disk_t disk = grub_disk_open(disk_name);
-	grub_free(disk_name);
-	grub_fs_t fs = grub_fs_probe(disk);
-	grub_errno = GRUB_ERR_NONE;
+
+	job = grub_zalloc(sizeof(struct extract_job));
+	if (!job)
+		goto fail;
+	job->items = grub_calloc(nk.file_count + 1, sizeof(struct grub_extract_item));
+	if (!job->items)
+		goto fail;
 	for (i = 0; i < nk.file_count; i++)
 	{
 		struct nkctx_file* p = &nk.files[i];
+		struct grub_extract_item* item = &job->items[job->count];
 		if (!p->name || !p->selected || p->icon == IDR_PNG_LINK)
 			continue;
-		if (p->is_dir)
-		{
-			struct ctx_extract_file ctx =
-			{
-				.fs = fs,
-				.disk = disk,
-				.target_dir = _wcsdup(get_u16_path(target_dir, p->name)),
-				.path = grub_strdup(p->path),
-			};
-			nkctx_extract_dir_real(&ctx);
-			grub_free(ctx.path);
-			free(ctx.target_dir);
-		}
-		else
-			nkctx_extract_file(target_dir, p->path);
+		item->src = grub_strdup(nkctx_get_file_path(p));
+		item->dest = get_u8_path(target_dir, p->name);
+		job->count++;
+		if (!item->src || !item->dest)
+			goto fail;
 	}
-	grub_disk_close(disk);
+	grub_snprintf(title, sizeof(title), "Extract  %s", nk.path);
+	return extract_items(target_dir, job, title);
+
+fail:
+	if (job)
+		free_extract_job(job);
+	grub_errno = GRUB_ERR_NONE;
+	return FALSE;
 }
 
 WCHAR*
@@ -0,0 +1,195 @@
+/*
+ *  NkArc
+ *  Copyright (C) 2023 A1ive
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <file_view.h>
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/file.h>
+
+/* Windows are read whole, so going back through a file behind a
+   decompressing disk costs one read per window instead of one per page.  */
+
+struct load_job
+{
+	struct file_view* view;
+	struct file_view_window* window;
+};
+
+static BOOL view_inited;
+static HANDLE view_idle;
+static volatile LONG view_pending;
+
+BOOL
+file_view_init(struct file_view* view, const char* path, enum grub_file_type type,
+	grub_size_t window_size, unsigned window_count, void (*release)(struct file_view* view))
+{
+	view->path = grub_strdup(path);
+	view->windows = calloc(window_count, sizeof(struct file_view_window));
+	if (!view->path || !view->windows)
+	{
+		grub_free(view->path);
+		free(view->windows);
+		view->path = NULL;
+		view->windows = NULL;
+		grub_errno = GRUB_ERR_NONE;
+		return FALSE;
+	}
+	view->refs = 1;
+	view->type = type;
+	view->window_size = window_size;
+	view->window_count = window_count;
+	view->release = release;
+	return TRUE;
+}
+
+void
+file_view_unref(struct file_view* view)
+{
+	if (InterlockedDecrement(&view->refs) != 0)
+		return;
+	for (unsigned i = 0; i < view->window_count; i++)
+		free(view->windows[i].data);
+	free(view->windows);
+	grub_free(view->path);
+	view->release(view);
+}
+
+void
+file_view_close(struct file_view* view)
+{
+	/* Workers still running let go of the view when they are done.  */
+	InterlockedExchange(&view->cancel, 1);
+	file_view_unref(view);
+}
+
+void
+file_view_job_done(struct file_view* view)
+{
+	file_view_unref(view);
+	PostMessageW(nk.wnd, WM_NULL, 0, 0);
+	if (InterlockedDecrement(&view_pending) == 0)
+		SetEvent(view_idle);
+}
+
+BOOL
+file_view_submit(struct file_view* view, PTP_SIMPLE_CALLBACK func, void* job)
+{
+	if (!view_inited)
+	{
+		view_idle = CreateEventW(NULL, TRUE, TRUE, NULL);
+		view_inited = TRUE;
+	}
+	InterlockedIncrement(&view->refs);
+	InterlockedIncrement(&view_pending);
+	ResetEvent(view_idle);
+	if (!TrySubmitThreadpoolCallback(func, job, NULL))
+	{
+		file_view_job_done(view);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Wait for the workers of every view to leave grub.  */
+void
+nkctx_file_view_wait(void)
+{
+	if (view_inited)
+		WaitForSingleObject(view_idle, INFINITE);
+}
+
+static void CALLBACK
+load_worker(PTP_CALLBACK_INSTANCE instance, PVOID data)
+{
+	struct load_job* job = data;
+	struct file_view* view = job->view;
+	struct file_view_window* w = job->window;
+	grub_ssize_t r = -1;
+	NK_UNUSED(instance);
+
+	free(job);
+	if (!view->cancel)
+	{
+		grub_file_t file = grub_file_open(view->path, view->type);
+		if (file)
+		{
+			grub_file_seek(file, w->offset);
+			r = grub_file_read(file, w->data, view->window_size);
+			grub_file_close(file);
+		}
+		grub_errno = GRUB_ERR_NONE;
+	}
+	w->size = r > 0 ? r : 0;
+	InterlockedExchange(&w->state, r >= 0 ? FILE_VIEW_READY : FILE_VIEW_FAILED);
+	file_view_job_done(view);
+}
+
+struct file_view_window*
+file_view_get_window(struct file_view* view, grub_off_t offset)
+{
+	struct file_view_window* w = NULL;
+	struct load_job* job;
+
+	offset &= ~(grub_off_t)(view->window_size - 1);
+	for (unsigned i = 0; i < view->window_count; i++)
+	{
+		struct file_view_window* p = &view->windows[i];
+		LONG state = InterlockedCompareExchange(&p->state, 0, 0);
+		if (state != FILE_VIEW_EMPTY && p->offset == offset)
+		{
+			p->used = ++view->clock;
+			return state == FILE_VIEW_LOADING ? NULL : p;
+		}
+		/* An empty one, or the least recently used one not being read.  */
+		if (state == FILE_VIEW_LOADING)
+			continue;
+		if (!w || state == FILE_VIEW_EMPTY || (w->state != FILE_VIEW_EMPTY && p->used < w->used))
+			w = p;
+	}
+	if (!w)
+		return NULL;
+	if (!w->data)
+	{
+		w->data = malloc(view->window_size);
+		if (!w->data)
+			return NULL;
+	}
+	job = calloc(1, sizeof(struct load_job));
+	if (!job)
+		return NULL;
+	job->view = view;
+	job->window = w;
+	w->offset = offset;
+	w->used = ++view->clock;
+	w->state = FILE_VIEW_LOADING;
+	if (!file_view_submit(view, load_worker, job))
+	{
+		w->state = FILE_VIEW_EMPTY;
+		free(job);
+	}
+	return NULL;
+}
+
+void
+file_view_prefetch(struct file_view* view, grub_off_t offset)
+{
+	if (offset < view->size)
+		file_view_get_window(view, offset);
+}
@@ -22,9 +22,14 @@
 
 #include <grub/misc.h>
 #include <grub/mm.h>
+#include <grub/find.h>
+#include <grub/partition.h>
 
 #define MAIN_WINDOW_NAME "NkArc"
 
+/* The file list is drawn as a grid of thumbnails.  */
+static BOOL show_thumbs;
+
 void
 nkctx_unset_path(void)
 {
@@ -35,8 +40,10 @@ nkctx_unset_path(void)
 void
 nkctx_set_path(const char* path)
 {
+	/* PATH may be nk.path itself, on refresh.  */
+	char* p = grub_strdup(path);
 	nkctx_unset_path();
-	nk.path = grub_strdup(path);
+	nk.path = p;
 }
 
 static void
@@ -65,6 +72,35 @@ fail:
 	nkctx_unset_path();
 }
 
+/* "re:" starts a regular expression, anything else is a glob, or a part of
+   the name if it has no wildcard.  Nothing goes back to the directory.  */
+static void
+search_file(const char* text)
+{
+	unsigned flags = GRUB_FIND_NOCASE;
+	char* pattern;
+
+	if (!nk.path)
+		return;
+	if (text[0] == '\0')
+	{
+		nkctx_enum_file(nk.path);
+		return;
+	}
+	if (strncmp(text, "re:", 3) == 0)
+	{
+		flags |= GRUB_FIND_REGEX;
+		pattern = grub_strdup(text + 3);
+	}
+	else if (strpbrk(text, "*?["))
+		pattern = grub_strdup(text);
+	else
+		pattern = grub_xasprintf("*%s*", text);
+	if (pattern)
+		nkctx_search_file(pattern, flags);
+	grub_free(pattern);
+}
+
 static void
 draw_disk_menu(struct nk_context* ctx, struct nkctx_disk* info, struct nk_rect bounds)
 {
@@ -81,6 +117,7 @@ draw_disk_menu(struct nk_context* ctx, struct nkctx_disk* info, struct nk_rect b
 		{
 			grub_loopback_delete(info->name);
 			nkctx_free_file();
+			nkctx_drop_file_cache(info->name);
 			nkctx_free_disk();
 			nkctx_enum_disk();
 			nk_contextual_close(ctx);
@@ -140,6 +177,7 @@ draw_pc_menu(struct nk_context* ctx, struct nk_rect bounds)
 		nkctx_free_file();
 		nk.disk_index = 0;
 		nkctx_free_disk();
+		grub_partition_cache_flush();
 		nkctx_enum_disk();
 		nk_contextual_close(ctx);
 	}
@@ -181,26 +219,35 @@ draw_file_menu(struct nk_context* ctx, struct nkctx_file* info, struct nk_rect b
 	{
 		if (nk_hb_image_label_styled(ctx, &nk.style_button, GET_PNG(IDR_PNG_IMAGE), GET_STR(LANG_STR_VIEW_IMAGE), NULL))
 		{
-			nkctx_image.init(info->path);
+			nkctx_image.init(nkctx_get_file_path(info));
+			nk_contextual_close(ctx);
+		}
+	}
+
+	if (info->type == NKCTX_FILE_TEXT)
+	{
+		if (nk_hb_image_label_styled(ctx, &nk.style_button, GET_PNG(IDR_PNG_TXT), GET_STR(LANG_STR_VIEW_TEXT), NULL))
+		{
+			nkctx_text.init(nkctx_get_file_path(info));
 			nk_contextual_close(ctx);
 		}
 	}
 
 	if (nk_hb_image_label_styled(ctx, &nk.style_button, GET_PNG(IDR_PNG_RM), GET_STR(LANG_STR_MOUNT_DISK), NULL))
 	{
-		nkctx_mount.init(info->path);
+		nkctx_mount.init(nkctx_get_file_path(info));
 		nk_contextual_close(ctx);
 	}
 
 	if (nk_hb_image_label_styled(ctx, &nk.style_button, GET_PNG(IDR_PNG_BIN), GET_STR(LANG_STR_VIEW_HEX), NULL))
 	{
-		nkctx_hex.init(info->path);
+		nkctx_hex.init(nkctx_get_file_path(info));
 		nk_contextual_close(ctx);
 	}
 
 	if (nk_hb_image_label_styled(ctx, &nk.style_button, GET_PNG(IDR_PNG_OK), GET_STR(LANG_STR_GET_CHECKSUM), NULL))
 	{
-		nkctx_hash.init(info->path);
+		nkctx_hash.init(nkctx_get_file_path(info));
 		nk_contextual_close(ctx);
 	}
 
@@ -209,12 +256,7 @@ draw_file_menu(struct nk_context* ctx, struct nkctx_file* info, struct nk_rect b
 		WCHAR* dir = nkctx_select_dir();
 		if (dir)
 		{
-			nkctx_show_progress();
-			if (nkctx_extract_file(dir, info->path))
-				MessageBoxW(nk.wnd, GET_WCS(LANG_WCS_DONE), GET_WCS(LANG_WCS_INFO), MB_OK);
-			else
-				MessageBoxW(nk.wnd, dir, GET_WCS(LANG_WCS_FAIL), MB_OK | MB_ICONERROR);
-			nkctx_hide_progress();
+			nkctx_extract_file(dir, nkctx_get_file_path(info));
 			free(dir);
 		}
 		nk_contextual_close(ctx);
@@ -225,14 +267,17 @@ draw_file_menu(struct nk_context* ctx, struct nkctx_file* info, struct nk_rect b
 	nk_contextual_end(ctx);
 }
 
-static void
-draw_file_info(struct nk_context* ctx, struct nkctx_file* info)
+/* Returns TRUE if the list was replaced by another directory.  */
+static BOOL
+draw_file_info(struct nk_context* ctx, struct nkctx_file* info, float row_height)
 {
 	struct nk_rect bounds;
 	struct nk_color color = nk.table[NK_COLOR_WINDOW];
+	char size[12];
+	char mtime[20];
 	if (!info->name)
-		return;
-	nk_layout_row(ctx, NK_DYNAMIC, 0, 4, (float[4]) { nk.gui_ratio, 0.5f, 0.3f, 0.2f - nk.gui_ratio });
+		return FALSE;
+	nk_layout_row(ctx, NK_DYNAMIC, row_height, 4, (float[4]) { nk.gui_ratio, 0.5f, 0.3f, 0.2f - nk.gui_ratio });
 	info->selected = !nk_check_text(ctx, "", 1, !info->selected);
 	if (info->selected)
 		color = nk_rgb(63, 98, 126);
@@ -242,22 +287,201 @@ draw_file_info(struct nk_context* ctx, struct nkctx_file* info)
 	if (nk_hb_image_label_styled(ctx, &nk.style_button, GET_PNG(info->icon), info->name, info->name))
 	{
 		if (info->is_dir)
-			nkctx_enum_file(info->path);
-		else
-			info->selected = !info->selected;
+		{
+			/* INFO is freed with the list.  */
+			nkctx_enum_file(nkctx_get_file_path(info));
+			return TRUE;
+		}
+		info->selected = !info->selected;
 	}
 
 	if (!info->is_dir)
 		draw_file_menu(ctx, info, bounds);
 
-	nk_label(ctx, info->time, NK_TEXT_LEFT);
-	nk_label(ctx, info->human_size, NK_TEXT_LEFT);
+	nkctx_get_file_time(info, mtime, sizeof(mtime));
+	nkctx_get_file_size(info, size, sizeof(size));
+	nk_label(ctx, mtime, NK_TEXT_LEFT);
+	nk_label(ctx, size, NK_TEXT_LEFT);
+	return FALSE;
+}
+
+/* Height of the rows nuklear lays out when asked for 0.  */
+static float
+get_row_height(struct nk_context* ctx)
+{
+	return ctx->style.font->height + ctx->style.text.padding.y * 2.0f
+		+ ctx->style.window.min_row_height_padding * 2.0f;
+}
+
+/* Rows above and below the view are not drawn, a spacer takes their
+   height instead so that the scrollbar still covers the whole list.  */
+static void
+draw_file_spacer(struct nk_context* ctx, DWORD rows, float pitch)
+{
+	if (rows == 0)
+		return;
+	nk_layout_row_dynamic(ctx, rows * pitch - ctx->style.window.spacing.y, 1);
+	nk_spacer(ctx);
+}
+
+static void
+draw_file_list(struct nk_context* ctx)
+{
+	float row_height = get_row_height(ctx);
+	float pitch = row_height + ctx->style.window.spacing.y;
+	struct nk_rect bounds = nk_layout_widget_bounds(ctx);
+	nk_uint scroll_y = 0;
+	DWORD first, last;
+
+	nk_group_get_scroll(ctx, "FILE", NULL, &scroll_y);
+	if (!nk_group_begin(ctx, "FILE", NK_WINDOW_BORDER))
+		return;
+
+	first = (DWORD)(scroll_y / pitch);
+	if (first > nk.file_count)
+		first = nk.file_count;
+	/* One more for the partly visible rows at both ends.  */
+	last = first + (DWORD)(bounds.h / pitch) + 2;
+	if (last > nk.file_count)
+		last = nk.file_count;
+
+	draw_file_spacer(ctx, first, pitch);
+	for (DWORD i = first; i < last; i++)
+	{
+		if (draw_file_info(ctx, &nk.files[i], row_height))
+			break;
+	}
+	if (nk.file_count > last)
+		draw_file_spacer(ctx, nk.file_count - last, pitch);
+	nk_group_end(ctx);
+}
+
+/* Bytes of TEXT that fit in WIDTH, cut at a character.  */
+static int
+fit_text(const struct nk_user_font* font, const char* text, float width)
+{
+	int len = (int)strlen(text);
+
+	while (len > 0 && font->width(font->userdata, font->height, text, len) > width)
+	{
+		len--;
+		while (len > 0 && (text[len] & 0xC0) == 0x80)
+			len--;
+	}
+	return len;
+}
+
+/* Returns TRUE if the list was replaced by another directory.  */
+static BOOL
+draw_thumb_cell(struct nk_context* ctx, struct nkctx_file* info, float row_height)
+{
+	struct nk_command_buffer* out = nk_window_get_canvas(ctx);
+	const struct nk_input* in = &ctx->input;
+	struct nk_rect bounds, area, name;
+	struct nk_image img = nk_image_id(0);
+	float w, h, scale;
+
+	if (!info->name)
+		return FALSE;
+	if (!nk_widget(&bounds, ctx))
+		return FALSE;
+	if (info->selected)
+		nk_fill_rect(out, bounds, 0.0f, nk_rgb(63, 98, 126));
+	else if (nk_input_is_mouse_hovering_rect(in, bounds))
+		nk_fill_rect(out, bounds, 0.0f, nk.table[NK_COLOR_BUTTON_HOVER]);
+
+	area = nk_rect(bounds.x, bounds.y, bounds.w, bounds.h - row_height);
+	name = nk_rect(bounds.x, bounds.y + area.h, bounds.w, row_height);
+	if (info->type == NKCTX_FILE_IMAGE)
+		img = nkctx_get_thumb(info);
+	if (img.handle.ptr)
+		scale = min(1.0f, min(area.w / img.w, area.h / img.h));
+	else
+	{
+		/* The icon of the file while there is no thumbnail.  */
+		img = GET_PNG(info->icon);
+		scale = min(area.w, area.h) / 2.0f / max(1.0f, max(img.w, img.h));
+	}
+	w = img.w * scale;
+	h = img.h * scale;
+	nk_draw_image(out, nk_rect(area.x + (area.w - w) / 2.0f, area.y + (area.h - h) / 2.0f, w, h),
+		&img, nk_rgb(255, 255, 255));
+	nk_draw_text(out, name, info->name, fit_text(ctx->style.font, info->name, name.w),
+		ctx->style.font, nk.table[NK_COLOR_WINDOW], nk.table[NK_COLOR_TEXT]);
+
+	if (nk_input_is_mouse_hovering_rect(in, bounds))
+		nk_tooltip(ctx, info->name);
+	if (nk_input_is_mouse_click_in_rect(in, NK_BUTTON_LEFT, bounds))
+	{
+		if (info->is_dir)
+		{
+			/* INFO is freed with the list.  */
+			nkctx_enum_file(nkctx_get_file_path(info));
+			return TRUE;
+		}
+		info->selected = !info->selected;
+	}
+	if (!info->is_dir)
+	{
+		if (info->type == NKCTX_FILE_IMAGE
+			&& nk_input_has_mouse_click_down_in_rect(in, NK_BUTTON_DOUBLE, bounds, nk_true))
+			nkctx_image.init(nkctx_get_file_path(info));
+		draw_file_menu(ctx, info, bounds);
+	}
+	return FALSE;
+}
+
+/* Only the thumbnails of the rows in view are asked for, the first of
+   them made first.  */
+static void
+draw_thumb_grid(struct nk_context* ctx)
+{
+	float row_height = get_row_height(ctx);
+	float cell = (float)NKCTX_THUMB_SIZE + row_height;
+	float pitch = cell + ctx->style.window.spacing.y;
+	struct nk_rect bounds = nk_layout_widget_bounds(ctx);
+	nk_uint scroll_y = 0;
+	DWORD cols, rows, first, last;
+
+	cols = (DWORD)((bounds.w - ctx->style.window.scrollbar_size.x)
+		/ ((float)NKCTX_THUMB_SIZE + ctx->style.window.spacing.x));
+	if (cols == 0)
+		cols = 1;
+	rows = (nk.file_count + cols - 1) / cols;
+
+	nk_group_get_scroll(ctx, "THUMB", NULL, &scroll_y);
+	if (!nk_group_begin(ctx, "THUMB", NK_WINDOW_BORDER))
+		return;
+	nkctx_thumb_frame();
+
+	first = (DWORD)(scroll_y / pitch);
+	if (first > rows)
+		first = rows;
+	last = first + (DWORD)(bounds.h / pitch) + 2;
+	if (last > rows)
+		last = rows;
+
+	draw_file_spacer(ctx, first, pitch);
+	for (DWORD r = first; r < last; r++)
+	{
+		nk_layout_row_dynamic(ctx, cell, (int)cols);
+		for (DWORD i = r * cols; i < (r + 1) * cols && i < nk.file_count; i++)
+		{
+			if (draw_thumb_cell(ctx, &nk.files[i], row_height))
+				goto out;
+		}
+	}
+	if (rows > last)
+		draw_file_spacer(ctx, rows - last, pitch);
+out:
+	nk_group_end(ctx);
 }
 
 void
 nkctx_main_window(struct nk_context* ctx, float width, float height)
 {
 	static BOOL show_about = 0;
+	static char search_text[256];
 	struct nk_rect total_space;
 
 	if (!nk_begin(ctx, MAIN_WINDOW_NAME, nk_rect(0.0f, 0.0f, width, height),
@@ -265,7 +489,7 @@ nkctx_main_window(struct nk_context* ctx, float width, float height)
 	{
 		nkctx_fini(0);
 	}
-	nk_layout_row_begin(ctx, NK_DYNAMIC, 0, 5);
+	nk_layout_row_begin(ctx, NK_DYNAMIC, 0, 7);
 
 	struct nk_rect rect = nk_layout_widget_bounds(ctx);
 	nk.gui_ratio = rect.h / rect.w;
@@ -273,21 +497,27 @@ nkctx_main_window(struct nk_context* ctx, float width, float height)
 	nk_layout_row_push(ctx, nk.gui_ratio);
 	if (nk_hb_image(ctx, GET_PNG(IDR_PNG_UP), GET_STR(LANG_STR_UP)))
 		go_up();
-	nk_layout_row_push(ctx, 1.0f - 4 * nk.gui_ratio);
+	nk_layout_row_push(ctx, 0.75f - 5 * nk.gui_ratio);
 	nk_image_label(ctx, GET_PNG(IDR_PNG_DIR), nk.path ? nk.path : GET_STR(LANG_STR_THIS_PC), NK_TEXT_LEFT, nk.table[NK_COLOR_TEXT]);
+	nk_layout_row_push(ctx, 0.25f);
+	if (nk_widget_is_hovered(ctx))
+		nk_tooltip(ctx, GET_STR(LANG_STR_SEARCH));
+	if (nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD | NK_EDIT_SIG_ENTER,
+		search_text, sizeof(search_text), nk_filter_default) & NK_EDIT_COMMITED)
+		search_file(search_text);
 	nk_layout_row_push(ctx, nk.gui_ratio);
 	if (nk_hb_image(ctx, GET_PNG(IDR_PNG_REFRESH), GET_STR(LANG_STR_REFRESH_FILES)) && nk.path)
-		nkctx_enum_file(nk.path);
+		nkctx_refresh_file();
+	nk_layout_row_push(ctx, nk.gui_ratio);
+	if (nk_hb_image(ctx, GET_PNG(IDR_PNG_IMAGE), GET_STR(LANG_STR_THUMBNAILS)))
+		show_thumbs = !show_thumbs;
 	nk_layout_row_push(ctx, nk.gui_ratio);
 	if (nk_hb_image(ctx, GET_PNG(IDR_PNG_COPY), GET_STR(LANG_STR_EXTRACT_DIR)) && nk.path)
 	{
 		WCHAR* dir = nkctx_select_dir();
 		if (dir)
 		{
-			nkctx_show_progress();
 			nkctx_extract_dir(dir);
-			MessageBoxW(nk.wnd, GET_WCS(LANG_WCS_DONE), GET_WCS(LANG_WCS_INFO), MB_OK);
-			nkctx_hide_progress();
 			free(dir);
 		}
 	}
@@ -307,13 +537,10 @@ nkctx_main_window(struct nk_context* ctx, float width, float height)
 	}
 	nk_group_end(ctx);
 
-	nk_group_begin(ctx, "FILE", NK_WINDOW_BORDER);
-	for (DWORD i = 0; i < nk.file_count; i++)
-	{
-		struct nkctx_file* info = &nk.files[i];
-		draw_file_info(ctx, info);
-	}
-	nk_group_end(ctx);
+	if (show_thumbs)
+		draw_thumb_grid(ctx);
+	else
+		draw_file_list(ctx);
 
 	nk_layout_row_dynamic(ctx, 0, 1);
 	nk_label(ctx, nk.status, NK_TEXT_LEFT);
@@ -23,6 +23,7 @@
 #include <grub/misc.h>
 #include <grub/diskfilter.h>
 #include <grub/partition.h>
+#include <grub/thread.h>
 
 GRUB_MOD_LICENSE("GPLv3+");
 
@@ -33,6 +34,9 @@ grub_raid6_recover_func_t grub_raid6_recover_func;
 grub_diskfilter_t grub_diskfilter_list;
 static int inscnt = 0;
 static int lv_num = 0;
+/* Guards array_list while scanning.  Arrays are only freed at module fini,
+   so open disks keep using their lv without it.  */
+static grub_mutex_t diskfilter_lock;
 
 static struct grub_diskfilter_lv*
 find_lv(const char* name);
@@ -250,6 +254,12 @@ grub_diskfilter_iterate(grub_disk_dev_iterate_hook_t hook, void* hook_data,
 {
 	struct grub_diskfilter_vg* array;
 	int islcnt = 0;
+	int ret = 0;
+
+	if (pull != GRUB_DISK_PULL_NONE && pull != GRUB_DISK_PULL_RESCAN)
+		return 0;
+
+	grub_mutex_lock(&diskfilter_lock);
 
 	if (pull == GRUB_DISK_PULL_RESCAN)
 	{
@@ -257,10 +267,7 @@ grub_diskfilter_iterate(grub_disk_dev_iterate_hook_t hook, void* hook_data,
 		scan_devices(NULL);
 	}
 
-	if (pull != GRUB_DISK_PULL_NONE && pull != GRUB_DISK_PULL_RESCAN)
-		return 0;
-
-	for (array = array_list; array; array = array->next)
+	for (array = array_list; array && !ret; array = array->next)
 	{
 		struct grub_diskfilter_lv* lv;
 		if (array->lvs)
@@ -268,11 +275,16 @@ grub_diskfilter_iterate(grub_disk_dev_iterate_hook_t hook, void* hook_data,
 				if (lv->visible && lv->fullname && lv->became_readable_at >= islcnt)
 				{
 					if (hook(lv->fullname, hook_data))
-						return 1;
+					{
+						ret = 1;
+						break;
+					}
 				}
 	}
 
-	return 0;
+	grub_mutex_unlock(&diskfilter_lock);
+
+	return ret;
 }
 
 #ifdef GRUB_UTIL
@@ -440,6 +452,8 @@ grub_diskfilter_open(const char* name, grub_disk_t disk)
 		return grub_error(GRUB_ERR_UNKNOWN_DEVICE, "unknown DISKFILTER device %s",
 			name);
 
+	grub_mutex_lock(&diskfilter_lock);
+
 	lv = find_lv(name);
 
 	if (!lv)
@@ -453,6 +467,8 @@ grub_diskfilter_open(const char* name, grub_disk_t disk)
 		lv = find_lv(name);
 	}
 
+	grub_mutex_unlock(&diskfilter_lock);
+
 	if (!lv)
 		return grub_error(GRUB_ERR_UNKNOWN_DEVICE, "unknown DISKFILTER device %s",
 			name);
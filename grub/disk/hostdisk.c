@@ -0,0 +1,218 @@
+/*
+ *  NkArc
+ *  Copyright (C) 2023 A1ive
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/disk.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/thread.h>
+
+#include <hostdisk.h>
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct hostdisk
+{
+	int fd;
+	grub_uint64_t size;
+};
+
+static struct hostdisk* hostdisks;
+static unsigned long hostdisk_count;
+/* Guards hostdisks and hostdisk_count.  */
+static grub_mutex_t hostdisk_lock;
+
+grub_err_t
+grub_hostdisk_add(const char* path, unsigned long* id)
+{
+	struct hostdisk* p;
+	off_t size;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return grub_error(GRUB_ERR_FILE_NOT_FOUND, "cannot open `%s': %s", path, strerror(errno));
+	/* Works for block devices too, unlike fstat.  */
+	size = lseek(fd, 0, SEEK_END);
+	if (size < 0)
+	{
+		close(fd);
+		return grub_error(GRUB_ERR_BAD_DEVICE, "cannot seek `%s': %s", path, strerror(errno));
+	}
+
+	grub_mutex_lock(&hostdisk_lock);
+	p = grub_realloc(hostdisks, (hostdisk_count + 1) * sizeof(hostdisks[0]));
+	if (!p)
+	{
+		grub_mutex_unlock(&hostdisk_lock);
+		close(fd);
+		return grub_errno;
+	}
+	hostdisks = p;
+	p = &hostdisks[hostdisk_count];
+	p->fd = fd;
+	p->size = (grub_uint64_t)size;
+	*id = hostdisk_count++;
+	grub_mutex_unlock(&hostdisk_lock);
+
+	return GRUB_ERR_NONE;
+}
+
+static int
+get_drive_id(const char* name, unsigned long* drive)
+{
+	unsigned long d;
+	const char* end;
+	if (!name || name[0] != 'h' || name[1] != 'd' || !grub_isdigit(name[2]))
+		goto fail;
+	d = grub_strtoul(name + 2, &end, 10);
+	if (*end || d >= hostdisk_count)
+		goto fail;
+	*drive = d;
+	return 1;
+fail:
+	grub_error(GRUB_ERR_UNKNOWN_DEVICE, "not a hostdisk");
+	return 0;
+}
+
+static int
+hostdisk_iterate(grub_disk_dev_iterate_hook_t hook, void* hook_data, grub_disk_pull_t pull)
+{
+	unsigned long drive;
+	unsigned long count;
+
+	if (pull != GRUB_DISK_PULL_NONE)
+		return 0;
+
+	grub_mutex_lock(&hostdisk_lock);
+	count = hostdisk_count;
+	grub_mutex_unlock(&hostdisk_lock);
+
+	for (drive = 0; drive < count; drive++)
+	{
+		char name[] = "hd4294967295";
+		grub_snprintf(name, sizeof(name), "hd%lu", drive);
+		if (hook(name, hook_data))
+			return 1;
+	}
+	return 0;
+}
+
+static grub_err_t
+hostdisk_open(const char* name, grub_disk_t disk)
+{
+	unsigned long drive;
+	int ok;
+
+	grub_mutex_lock(&hostdisk_lock);
+	ok = get_drive_id(name, &drive);
+	if (ok)
+	{
+		/* Round up to a complete sector like loopback, the tail reads as
+		   zeros.  */
+		disk->total_sectors = (hostdisks[drive].size + GRUB_DISK_SECTOR_SIZE - 1)
+			>> GRUB_DISK_SECTOR_BITS;
+		/* The fd is shared, reads are positional.  */
+		disk->data = (void*)(grub_addr_t)hostdisks[drive].fd;
+	}
+	grub_mutex_unlock(&hostdisk_lock);
+	if (!ok)
+		return grub_errno;
+
+	disk->id = drive;
+	disk->log_sector_size = GRUB_DISK_SECTOR_BITS;
+	disk->max_agglomerate = 1048576 >> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS);
+
+	return GRUB_ERR_NONE;
+}
+
+static void
+hostdisk_close(grub_disk_t disk)
+{
+	disk->data = NULL;
+}
+
+static grub_err_t
+hostdisk_read(struct grub_disk* disk, grub_disk_addr_t sector, grub_size_t size, char* buf)
+{
+	int fd = (int)(grub_addr_t)disk->data;
+	off_t ofs = (off_t)(sector << GRUB_DISK_SECTOR_BITS);
+	grub_size_t len = size << GRUB_DISK_SECTOR_BITS;
+
+	while (len)
+	{
+		ssize_t r = pread(fd, buf, len, ofs);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			return grub_error(GRUB_ERR_READ_ERROR, "failure reading sector 0x%llx from %s: %s",
+				(unsigned long long)sector, disk->name, strerror(errno));
+		/* Past the end of an image that is not a multiple of the sector
+		   size.  */
+		if (r == 0)
+		{
+			grub_memset(buf, 0, len);
+			break;
+		}
+		buf += r;
+		ofs += r;
+		len -= r;
+	}
+	return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+hostdisk_write(struct grub_disk* disk __attribute__((unused)),
+	grub_disk_addr_t sector __attribute__((unused)),
+	grub_size_t size __attribute__((unused)),
+	const char* buf __attribute__((unused)))
+{
+	return grub_error(GRUB_ERR_NOT_IMPLEMENTED_YET,
+		"hostdisk writes are not supported");
+}
+
+static struct grub_disk_dev grub_hostdisk_dev =
+{
+	.name = "hostdisk",
+	.id = GRUB_DISK_DEVICE_HOSTDISK_ID,
+	.disk_iterate = hostdisk_iterate,
+	.disk_open = hostdisk_open,
+	.disk_close = hostdisk_close,
+	.disk_read = hostdisk_read,
+	.disk_write = hostdisk_write,
+	.next = 0
+};
+
+GRUB_MOD_INIT(hostdisk)
+{
+	grub_disk_dev_register(&grub_hostdisk_dev);
+}
+
+GRUB_MOD_FINI(hostdisk)
+{
+	unsigned long i;
+
+	grub_disk_dev_unregister(&grub_hostdisk_dev);
+	for (i = 0; i < hostdisk_count; i++)
+		close(hostdisks[i].fd);
+	grub_free(hostdisks);
+	hostdisks = NULL;
+	hostdisk_count = 0;
+}
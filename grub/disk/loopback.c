@@ -22,6 +22,10 @@
 #include <grub/file.h>
 #include <grub/disk.h>
 #include <grub/mm.h>
+#include <grub/fs.h>
+#include <grub/partition.h>
+#include <grub/stats.h>
+#include <grub/thread.h>
 
 #include <loopback.h>
 
@@ -29,13 +33,27 @@ GRUB_MOD_LICENSE("GPLv3+");
 
 static struct grub_loopback* loopback_list;
 static unsigned long last_id = 0;
+/* Guards loopback_list, last_id and the reference counts.  */
+static grub_mutex_t loopback_lock;
 
-/* Delete the loopback device NAME.  */
+static void
+grub_loopback_free(struct grub_loopback* dev)
+{
+	grub_free(dev->devname);
+	grub_file_close(dev->file);
+	grub_free(dev);
+}
+
+/* Delete the loopback device NAME.  Disks still open on it keep working
+   until they are closed.  */
 grub_err_t
 grub_loopback_delete(const char* name)
 {
 	struct grub_loopback* dev;
 	struct grub_loopback** prev;
+	int unused;
+
+	grub_mutex_lock(&loopback_lock);
 
 	/* Search for the device.  */
 	for (dev = loopback_list, prev = &loopback_list;
@@ -45,14 +63,24 @@ grub_loopback_delete(const char* name)
 			break;
 
 	if (!dev)
+	{
+		grub_mutex_unlock(&loopback_lock);
 		return grub_error(GRUB_ERR_BAD_DEVICE, "device not found");
+	}
 
 	/* Remove the device from the list.  */
 	*prev = dev->next;
+	dev->deleted = 1;
+	unused = (dev->refcnt == 0);
 
-	grub_free(dev->devname);
-	grub_file_close(dev->file);
-	grub_free(dev);
+	grub_mutex_unlock(&loopback_lock);
+
+	grub_fs_probe_invalidate(GRUB_DISK_DEVICE_LOOPBACK_ID, dev->id);
+	grub_partition_cache_invalidate(GRUB_DISK_DEVICE_LOOPBACK_ID, dev->id);
+	grub_stats_disk_remove(GRUB_DISK_DEVICE_LOOPBACK_ID, dev->id);
+
+	if (unused)
+		grub_loopback_free(dev);
 	return GRUB_ERR_NONE;
 }
 
@@ -62,22 +90,18 @@ grub_loopback_add(const char* name, const char* path, int decompress)
 	grub_file_t file;
 	enum grub_file_type type = GRUB_FILE_TYPE_LOOPBACK | GRUB_FILE_TYPE_FILTER_VDISK;
 	struct grub_loopback* newdev;
+	struct grub_loopback* dev;
 	grub_err_t ret;
 
 	if (!decompress)
 		type |= GRUB_FILE_TYPE_NO_DECOMPRESS;
 
-	/* Check that a device with requested name does not already exist. */
-	for (newdev = loopback_list; newdev; newdev = newdev->next)
-		if (grub_strcmp(newdev->devname, name) == 0)
-			return grub_error(GRUB_ERR_BAD_ARGUMENT, "device name already exists");
-
 	file = grub_file_open(path, type);
 	if (!file)
 		return grub_errno;
 
 	/* Unable to replace it, make a new entry.  */
-	newdev = grub_malloc(sizeof(struct grub_loopback));
+	newdev = grub_zalloc(sizeof(struct grub_loopback));
 	if (!newdev)
 		goto fail;
 
@@ -89,12 +113,29 @@ grub_loopback_add(const char* name, const char* path, int decompress)
 	}
 
 	newdev->file = file;
+	newdev->passthrough = (file->fs->fs_map != NULL);
+
+	grub_mutex_lock(&loopback_lock);
+
+	/* Check that a device with requested name does not already exist. */
+	for (dev = loopback_list; dev; dev = dev->next)
+		if (grub_strcmp(dev->devname, name) == 0)
+			break;
+	if (dev)
+	{
+		grub_mutex_unlock(&loopback_lock);
+		grub_loopback_free(newdev);
+		return grub_error(GRUB_ERR_BAD_ARGUMENT, "device name already exists");
+	}
+
 	newdev->id = last_id++;
 
 	/* Add the new entry to the list.  */
 	newdev->next = loopback_list;
 	loopback_list = newdev;
 
+	grub_mutex_unlock(&loopback_lock);
+
 	return 0;
 
 fail:
@@ -109,14 +150,20 @@ grub_loopback_iterate(grub_disk_dev_iterate_hook_t hook, void* hook_data,
 	grub_disk_pull_t pull)
 {
 	struct grub_loopback* d;
+	int ret = 0;
 	if (pull != GRUB_DISK_PULL_NONE)
 		return 0;
+	grub_mutex_lock(&loopback_lock);
 	for (d = loopback_list; d; d = d->next)
 	{
 		if (hook(d->devname, hook_data))
-			return 1;
+		{
+			ret = 1;
+			break;
+		}
 	}
-	return 0;
+	grub_mutex_unlock(&loopback_lock);
+	return ret;
 }
 
 static grub_err_t
@@ -124,9 +171,13 @@ grub_loopback_open(const char* name, grub_disk_t disk)
 {
 	struct grub_loopback* dev;
 
+	grub_mutex_lock(&loopback_lock);
 	for (dev = loopback_list; dev; dev = dev->next)
 		if (grub_strcmp(dev->devname, name) == 0)
 			break;
+	if (dev)
+		dev->refcnt++;
+	grub_mutex_unlock(&loopback_lock);
 
 	if (!dev)
 		return grub_error(GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
@@ -148,27 +199,82 @@ grub_loopback_open(const char* name, grub_disk_t disk)
 	return 0;
 }
 
+static void
+grub_loopback_close(grub_disk_t disk)
+{
+	struct grub_loopback* dev = disk->data;
+	int unused;
+
+	grub_mutex_lock(&loopback_lock);
+	unused = (--dev->refcnt == 0 && dev->deleted);
+	grub_mutex_unlock(&loopback_lock);
+
+	if (unused)
+		grub_loopback_free(dev);
+}
+
 static grub_err_t
 grub_loopback_read(grub_disk_t disk, grub_disk_addr_t sector,
 	grub_size_t size, char* buf)
 {
-	grub_file_t file = ((struct grub_loopback*)disk->data)->file;
-	grub_off_t pos;
-
-	grub_file_seek(file, sector << GRUB_DISK_SECTOR_BITS);
-
-	grub_file_read(file, buf, size << GRUB_DISK_SECTOR_BITS);
-	if (grub_errno)
-		return grub_errno;
+	struct grub_loopback* dev = disk->data;
+	grub_file_t file = dev->file;
+	grub_off_t ofs = sector << GRUB_DISK_SECTOR_BITS;
+	grub_size_t total = size << GRUB_DISK_SECTOR_BITS;
 
-	/* In case there is more data read than there is available, in case
-	   of files that are not a multiple of GRUB_DISK_SECTOR_SIZE, fill
-	   the rest with zeros.  */
-	pos = (sector + size) << GRUB_DISK_SECTOR_BITS;
-	if (pos > file->size)
+	while (total)
 	{
-		grub_size_t amount = pos - file->size;
-		grub_memset(buf + (size << GRUB_DISK_SECTOR_BITS) - amount, 0, amount);
+		grub_off_t disk_pos;
+		grub_ssize_t ret;
+		grub_size_t len = total;
+
+		/* Extents stored verbatim on the underlying disk are read from there
+		   directly, so the data is cached only once, under this device.  */
+		if (dev->passthrough)
+		{
+			grub_err_t err;
+
+			/* FILE->disk is shared with the reads through the file, which set
+			   its read hook while the filesystem reads.  */
+			grub_mutex_lock(&dev->lock);
+			err = grub_file_map(file, ofs, &disk_pos, &len);
+			if (err == GRUB_ERR_NONE && grub_disk_read_nocache(file->disk, 0, disk_pos, len, buf))
+			{
+				grub_mutex_unlock(&dev->lock);
+				return grub_errno;
+			}
+			grub_mutex_unlock(&dev->lock);
+			if (err == GRUB_ERR_NONE)
+			{
+				ofs += len;
+				buf += len;
+				total -= len;
+				continue;
+			}
+			/* Compressed, sparse or unallocated, read one cache unit through
+			   the file and try mapping again after it.  */
+			grub_errno = GRUB_ERR_NONE;
+			len = GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS;
+			if (len > total)
+				len = total;
+		}
+
+		grub_mutex_lock(&dev->lock);
+		grub_file_seek(file, ofs);
+		ret = grub_file_read(file, buf, len);
+		grub_mutex_unlock(&dev->lock);
+		if (grub_errno)
+			return grub_errno;
+
+		/* In case there is more data read than there is available, in case
+		   of files that are not a multiple of GRUB_DISK_SECTOR_SIZE, fill
+		   the rest with zeros.  */
+		if (ret < (grub_ssize_t)len)
+			grub_memset(buf + ret, 0, len - ret);
+
+		ofs += len;
+		buf += len;
+		total -= len;
 	}
 
 	return 0;
@@ -190,6 +296,7 @@ static struct grub_disk_dev grub_loopback_dev =
 	.id = GRUB_DISK_DEVICE_LOOPBACK_ID,
 	.disk_iterate = grub_loopback_iterate,
 	.disk_open = grub_loopback_open,
+	.disk_close = grub_loopback_close,
 	.disk_read = grub_loopback_read,
 	.disk_write = grub_loopback_write,
 	.next = 0
@@ -167,18 +167,17 @@ windisk_read(struct grub_disk* disk, grub_disk_addr_t sector, grub_size_t size,
 {
 	HANDLE dh = disk->data;
 	__int64 distance = sector << GRUB_DISK_SECTOR_BITS;
-	LARGE_INTEGER li = { 0 };
+	OVERLAPPED ov = { 0 };
 	DWORD dwsize;
 	grub_dprintf("windisk", "windisk read %s sector 0x%llx size 0x%llx\n", disk->name, sector, size);
 	if (size > (DWORD_MAX >> GRUB_DISK_SECTOR_BITS))
 		return grub_error(GRUB_ERR_OUT_OF_RANGE, "attempt to read more than 4GB data");
 	dwsize = (DWORD)(size << GRUB_DISK_SECTOR_BITS);
-	li.QuadPart = distance;
-	li.LowPart = SetFilePointer(dh, li.LowPart, &li.HighPart, FILE_BEGIN);
-	if (li.LowPart == INVALID_SET_FILE_POINTER && GetLastError() != NO_ERROR)
-		return grub_error(GRUB_ERR_OUT_OF_RANGE, "attempt to read outside of disk %s", disk->name);
+	/* Positional read, the handle may be shared by several threads.  */
+	ov.Offset = (DWORD)distance;
+	ov.OffsetHigh = (DWORD)(distance >> 32);
 	grub_dprintf("windisk", "windisk readfile offset 0x%llx size 0x%lx\n", distance, dwsize);
-	if (ReadFile(dh, buf, dwsize, &dwsize, NULL))
+	if (ReadFile(dh, buf, dwsize, &dwsize, &ov))
 		return GRUB_ERR_NONE;
 	grub_dprintf("windisk", "windisk readfile failed %u\n", GetLastError());
 	return grub_error(GRUB_ERR_READ_ERROR, "failure reading sector 0x%llx from %s", sector, disk->name);
@@ -190,17 +189,15 @@ windisk_write(struct grub_disk* disk, grub_disk_addr_t sector, grub_size_t size,
 #ifdef GRUB_WINDISK_WRITE
 	HANDLE dh = disk->data;
 	__int64 distance = sector << GRUB_DISK_SECTOR_BITS;
-	LARGE_INTEGER li = { 0 };
+	OVERLAPPED ov = { 0 };
 	DWORD dwsize;
 	if (size > (DWORD_MAX >> GRUB_DISK_SECTOR_BITS))
 		return grub_error(GRUB_ERR_OUT_OF_RANGE, "attempt to write more than 4GB data");
 	dwsize = (DWORD)(size << GRUB_DISK_SECTOR_BITS);
-	li.QuadPart = distance;
-	li.LowPart = SetFilePointer(dh, li.LowPart, &li.HighPart, FILE_BEGIN);
-	if (li.LowPart == INVALID_SET_FILE_POINTER && GetLastError() != NO_ERROR)
-		return grub_error(GRUB_ERR_OUT_OF_RANGE, "attempt to write outside of disk %s", disk->name);
+	ov.Offset = (DWORD)distance;
+	ov.OffsetHigh = (DWORD)(distance >> 32);
 
-	if (WriteFile(dh, buf, dwsize, &dwsize, NULL))
+	if (WriteFile(dh, buf, dwsize, &dwsize, &ov))
 		return GRUB_ERR_NONE;
 	return grub_error(GRUB_ERR_READ_ERROR, "failure writing sector 0x%llx from %s", sector, disk->name);
 #else
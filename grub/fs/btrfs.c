@@ -2316,6 +2316,12 @@ grub_btrfs_label(grub_disk_t disk, char** label)
 	return grub_errno;
 }
 
+static const struct grub_fs_signature grub_btrfs_signatures[] =
+{
+	{ 0x10040, 8, GRUB_BTRFS_SIGNATURE },
+	{ 0, 0, NULL }
+};
+
 static struct grub_fs grub_btrfs_fs =
 {
 	.name = "btrfs",
@@ -2325,6 +2331,7 @@ static struct grub_fs grub_btrfs_fs =
 	.fs_close = grub_btrfs_close,
 	.fs_uuid = grub_btrfs_uuid,
 	.fs_label = grub_btrfs_label,
+	.fs_signatures = grub_btrfs_signatures,
 };
 
 GRUB_MOD_INIT(btrfs)
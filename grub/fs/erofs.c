@@ -1916,6 +1916,12 @@ grub_erofs_mtime(grub_disk_t disk, grub_int64_t* tm)
 	return grub_errno;
 }
 
+static const struct grub_fs_signature grub_erofs_signatures[] =
+{
+	{ EROFS_SUPER_OFFSET, 4, "\xe2\xe1\xf5\xe0" },
+	{ 0, 0, NULL }
+};
+
 static struct grub_fs grub_erofs_fs =
 {
 	.name = "erofs",
@@ -1926,6 +1932,7 @@ static struct grub_fs grub_erofs_fs =
 	.fs_uuid = grub_erofs_uuid,
 	.fs_label = grub_erofs_label,
 	.fs_mtime = grub_erofs_mtime,
+	.fs_signatures = grub_erofs_signatures,
 	.next = 0,
 };
 
@@ -156,6 +156,8 @@ GRUB_MOD_LICENSE("GPLv3+");
 
 #define EXT4_ENCRYPT_FLAG              0x800
 #define EXT4_EXTENTS_FLAG		0x80000
+/* Longer extents are uninitialized, their length is LEN - 32768.  */
+#define EXT4_EXT_INIT_MAX_LEN		32768
 
 	 /* The ext2 superblock.  */
 struct grub_ext2_sblock
@@ -510,8 +512,14 @@ grub_ext2_read_block(grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
 		if (--i >= 0)
 		{
+			grub_uint16_t len = grub_le_to_cpu16(ext[i].len);
+			/* Uninitialized extents are allocated but read as zeros.  */
+			int uninit = (len > EXT4_EXT_INIT_MAX_LEN);
+
+			if (uninit)
+				len -= EXT4_EXT_INIT_MAX_LEN;
 			fileblock -= grub_le_to_cpu32(ext[i].block);
-			if (fileblock >= grub_le_to_cpu16(ext[i].len))
+			if (fileblock >= len || uninit)
 				ret = 0;
 			else
 			{
@@ -524,10 +532,8 @@ grub_ext2_read_block(grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 			}
 		}
 		else
-		{
-			grub_error(GRUB_ERR_BAD_FS, "something wrong with extent");
-			ret = -1;
-		}
+			/* Before the first extent, or a leaf without any (i.e. sparse) */
+			ret = 0;
 
 		if (leaf != (struct grub_ext4_extent_header*)inode->blocks.dir_blocks)
 			grub_free(leaf);
@@ -944,6 +950,32 @@ grub_ext2_read(grub_file_t file, char* buf, grub_size_t len)
 		file->offset, len, buf);
 }
 
+static grub_err_t
+grub_ext2_map(grub_file_t file, grub_off_t offset,
+	grub_off_t* pos, grub_size_t* len)
+{
+	struct grub_ext2_data* data = (struct grub_ext2_data*)file->data;
+	grub_fshelp_node_t node = &data->diropen;
+
+	return grub_fshelp_map_file(node, offset, pos, len, grub_ext2_read_block,
+		grub_cpu_to_le32(node->inode.size)
+		| (((grub_off_t)grub_cpu_to_le32(node->inode.size_high)) << 32),
+		LOG2_EXT2_BLOCK_SIZE(data), 0);
+}
+
+static grub_err_t
+grub_ext2_hole(grub_file_t file, grub_off_t offset,
+	grub_size_t* len, int* hole)
+{
+	struct grub_ext2_data* data = (struct grub_ext2_data*)file->data;
+	grub_fshelp_node_t node = &data->diropen;
+
+	return grub_fshelp_hole(node, offset, len, hole, grub_ext2_read_block,
+		grub_cpu_to_le32(node->inode.size)
+		| (((grub_off_t)grub_cpu_to_le32(node->inode.size_high)) << 32),
+		LOG2_EXT2_BLOCK_SIZE(data));
+}
+
 
 /* Context for grub_ext2_dir.  */
 struct grub_ext2_dir_ctx
@@ -1074,6 +1106,12 @@ grub_ext2_mtime(grub_disk_t disk, grub_int64_t* tm)
 
 
 
+static const struct grub_fs_signature grub_ext2_signatures[] =
+{
+	{ 0x438, 2, "\x53\xef" },
+	{ 0, 0, NULL }
+};
+
 static struct grub_fs grub_ext2_fs =
 {
 	.name = "ext2",
@@ -1084,6 +1122,9 @@ static struct grub_fs grub_ext2_fs =
 	.fs_label = grub_ext2_label,
 	.fs_uuid = grub_ext2_uuid,
 	.fs_mtime = grub_ext2_mtime,
+	.fs_map = grub_ext2_map,
+	.fs_hole = grub_ext2_hole,
+	.fs_signatures = grub_ext2_signatures,
 	.next = 0
 };
 
@@ -27,6 +27,7 @@
 #include <grub/types.h>
 #include <grub/charset.h>
 #include <grub/fshelp.h>
+#include <grub/lib/crc.h>
 
 GRUB_MOD_LICENSE("GPLv3+");
 
@@ -35,7 +36,6 @@ GRUB_MOD_LICENSE("GPLv3+");
 
 #define CHECKSUM_OFFSET           4092  /* Must be aligned 4 bytes. */
 #define U32_CHECKSUM_OFFSET       (CHECKSUM_OFFSET >> 2)
-#define CRCPOLY_LE                0xedb88320
 
 /* Byte-size offset. */
 #define F2FS_SUPER_OFFSET         ((grub_disk_addr_t)1024)
@@ -444,23 +444,11 @@ grub_f2fs_block_read(struct grub_f2fs_data* data, grub_uint32_t blkaddr,
 		0, F2FS_BLKSIZE, buf);
 }
 
-/* CRC32 */
+/* CRC32 seeded with the magic and without the final inversion.  */
 static grub_uint32_t
 grub_f2fs_cal_crc32(const void* buf, const grub_uint32_t len)
 {
-	grub_uint32_t crc = F2FS_SUPER_MAGIC;
-	unsigned char* p = (unsigned char*)buf;
-	grub_uint32_t tmp = len;
-	int i;
-
-	while (tmp--)
-	{
-		crc ^= *p++;
-		for (i = 0; i < 8; i++)
-			crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_LE : 0);
-	}
-
-	return crc;
+	return ~grub_getcrc32(~F2FS_SUPER_MAGIC, buf, len);
 }
 
 static int
@@ -1339,6 +1327,13 @@ grub_f2fs_uuid(grub_disk_t disk, char** uuid)
 	return grub_errno;
 }
 
+static const struct grub_fs_signature grub_f2fs_signatures[] =
+{
+	{ F2FS_SUPER_OFFSET, 4, "\x10\x20\xf5\xf2" },
+	{ F2FS_SUPER_OFFSET + F2FS_BLKSIZE, 4, "\x10\x20\xf5\xf2" },
+	{ 0, 0, NULL }
+};
+
 static struct grub_fs grub_f2fs_fs =
 {
 	.name = "f2fs",
@@ -1348,6 +1343,7 @@ static struct grub_fs grub_f2fs_fs =
 	.fs_close = grub_f2fs_close,
 	.fs_label = grub_f2fs_label,
 	.fs_uuid = grub_f2fs_uuid,
+	.fs_signatures = grub_f2fs_signatures,
 	.next = 0
 };
 
@@ -466,6 +466,67 @@ fail:
 	return 0;
 }
 
+/* Advance NODE to the next cluster of its chain.  Return 0 on success,
+   1 at the end of the chain and -1 on error.  */
+static int
+grub_fat_next_cluster(grub_disk_t disk, grub_fshelp_node_t node)
+{
+	grub_uint32_t next_cluster;
+	grub_uint32_t fat_offset;
+
+	switch (node->data->fat_size)
+	{
+	case 32:
+		fat_offset = node->cur_cluster << 2;
+		break;
+	case 16:
+		fat_offset = node->cur_cluster << 1;
+		break;
+	default:
+		/* case 12: */
+		fat_offset = node->cur_cluster + (node->cur_cluster >> 1);
+		break;
+	}
+
+	/* Read the FAT.  */
+	if (grub_disk_read(disk, node->data->fat_sector, fat_offset,
+		(node->data->fat_size + 7) >> 3,
+		(char*)&next_cluster))
+		return -1;
+
+	next_cluster = grub_le_to_cpu32(next_cluster);
+	switch (node->data->fat_size)
+	{
+	case 16:
+		next_cluster &= 0xFFFF;
+		break;
+	case 12:
+		if (node->cur_cluster & 1)
+			next_cluster >>= 4;
+
+		next_cluster &= 0x0FFF;
+		break;
+	}
+
+	grub_dprintf("fat", "fat_size=%d, next_cluster=%u\n",
+		node->data->fat_size, next_cluster);
+
+	/* Check the end.  */
+	if (next_cluster >= node->data->cluster_eof_mark)
+		return 1;
+
+	if (next_cluster < 2 || next_cluster >= node->data->num_clusters)
+	{
+		grub_error(GRUB_ERR_BAD_FS, "invalid cluster %u",
+			next_cluster);
+		return -1;
+	}
+
+	node->cur_cluster = next_cluster;
+	node->cur_cluster_num++;
+	return 0;
+}
+
 static grub_ssize_t
 grub_fat_read_data(grub_disk_t disk, grub_fshelp_node_t node,
 	grub_disk_read_hook_t read_hook, void* read_hook_data,
@@ -529,60 +590,12 @@ grub_fat_read_data(grub_disk_t disk, grub_fshelp_node_t node,
 	{
 		while (logical_cluster > node->cur_cluster_num)
 		{
-			/* Find next cluster.  */
-			grub_uint32_t next_cluster;
-			grub_uint32_t fat_offset;
-
-			switch (node->data->fat_size)
-			{
-			case 32:
-				fat_offset = node->cur_cluster << 2;
-				break;
-			case 16:
-				fat_offset = node->cur_cluster << 1;
-				break;
-			default:
-				/* case 12: */
-				fat_offset = node->cur_cluster + (node->cur_cluster >> 1);
-				break;
-			}
-
-			/* Read the FAT.  */
-			if (grub_disk_read(disk, node->data->fat_sector, fat_offset,
-				(node->data->fat_size + 7) >> 3,
-				(char*)&next_cluster))
+			int r = grub_fat_next_cluster(disk, node);
+			if (r < 0)
 				return -1;
-
-			next_cluster = grub_le_to_cpu32(next_cluster);
-			switch (node->data->fat_size)
-			{
-			case 16:
-				next_cluster &= 0xFFFF;
-				break;
-			case 12:
-				if (node->cur_cluster & 1)
-					next_cluster >>= 4;
-
-				next_cluster &= 0x0FFF;
-				break;
-			}
-
-			grub_dprintf("fat", "fat_size=%d, next_cluster=%u\n",
-				node->data->fat_size, next_cluster);
-
 			/* Check the end.  */
-			if (next_cluster >= node->data->cluster_eof_mark)
+			if (r > 0)
 				return ret;
-
-			if (next_cluster < 2 || next_cluster >= node->data->num_clusters)
-			{
-				grub_error(GRUB_ERR_BAD_FS, "invalid cluster %u",
-					next_cluster);
-				return -1;
-			}
-
-			node->cur_cluster = next_cluster;
-			node->cur_cluster_num++;
 		}
 
 		/* Read the data here.  */
@@ -1113,6 +1126,72 @@ grub_fat_read(grub_file_t file, char* buf, grub_size_t len)
 		file->offset, len, buf);
 }
 
+static grub_err_t
+grub_fat_map(grub_file_t file, grub_off_t offset,
+	grub_off_t* pos, grub_size_t* len)
+{
+	grub_fshelp_node_t node = file->data;
+	grub_uint32_t logical_cluster;
+	unsigned logical_cluster_bits;
+	grub_uint32_t first;
+	grub_off_t size;
+
+	logical_cluster_bits = (node->data->cluster_bits
+		+ GRUB_DISK_SECTOR_BITS);
+
+#ifdef MODE_EXFAT
+	if (node->is_contiguous)
+	{
+		*pos = ((grub_off_t)(node->data->cluster_sector
+			+ ((grub_disk_addr_t)(node->file_cluster - 2)
+				<< node->data->cluster_bits)) << GRUB_DISK_SECTOR_BITS) + offset;
+		return GRUB_ERR_NONE;
+	}
+#endif
+
+	logical_cluster = (grub_uint32_t)(offset >> logical_cluster_bits);
+	offset &= (1ULL << logical_cluster_bits) - 1;
+
+	if (logical_cluster < node->cur_cluster_num)
+	{
+		node->cur_cluster_num = 0;
+		node->cur_cluster = node->file_cluster;
+	}
+
+	while (logical_cluster > node->cur_cluster_num)
+	{
+		int r = grub_fat_next_cluster(file->disk, node);
+		if (r < 0)
+			return grub_errno;
+		if (r > 0)
+			return grub_error(GRUB_ERR_BAD_FS, "cluster chain too short");
+	}
+
+	*pos = ((grub_off_t)(node->data->cluster_sector
+		+ ((grub_disk_addr_t)(node->cur_cluster - 2)
+			<< node->data->cluster_bits)) << GRUB_DISK_SECTOR_BITS) + offset;
+
+	/* Extend the extent over physically adjacent clusters.  */
+	first = node->cur_cluster - node->cur_cluster_num;
+	size = (1ULL << logical_cluster_bits) - offset;
+	while (size < *len)
+	{
+		if (grub_fat_next_cluster(file->disk, node) != 0)
+		{
+			grub_errno = GRUB_ERR_NONE;
+			break;
+		}
+		if (node->cur_cluster != first + node->cur_cluster_num)
+			break;
+		size += (1ULL << logical_cluster_bits);
+	}
+
+	if (*len > size)
+		*len = (grub_size_t)size;
+
+	return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_fat_close(grub_file_t file)
 {
@@ -1280,6 +1359,35 @@ grub_exfat_get_cluster_sector(grub_disk_t disk, grub_uint64_t* sec_per_lcn)
 }
 #endif
 
+#ifdef MODE_EXFAT
+static const struct grub_fs_signature grub_exfat_signatures[] =
+{
+	{ 3, 8, "EXFAT   " },
+	{ 0, 0, NULL }
+};
+#else
+/* Same sanity checks as the start of grub_fat_mount.  */
+static int
+grub_fat_detect(grub_disk_t disk __attribute__((unused)),
+	const grub_uint8_t* sb, grub_size_t size)
+{
+	const struct grub_fat_bpb* bpb = (const struct grub_fat_bpb*)sb;
+	int bits;
+
+	if (size < sizeof(*bpb))
+		return 1;
+
+	bits = fat_log2(grub_le_to_cpu16(bpb->bytes_per_sector));
+	if (bits < GRUB_DISK_SECTOR_BITS || bits >= 16)
+		return 0;
+
+	if (fat_log2(bpb->sectors_per_cluster) < 0)
+		return 0;
+
+	return bpb->num_reserved_sectors != 0;
+}
+#endif
+
 static struct grub_fs grub_fat_fs =
 {
 #ifdef MODE_EXFAT
@@ -1293,6 +1401,12 @@ static struct grub_fs grub_fat_fs =
 	.fs_close = grub_fat_close,
 	.fs_label = grub_fat_label,
 	.fs_uuid = grub_fat_uuid,
+	.fs_map = grub_fat_map,
+#ifdef MODE_EXFAT
+	.fs_signatures = grub_exfat_signatures,
+#else
+	.fs_detect = grub_fat_detect,
+#endif
 #ifdef GRUB_UTIL
 #ifdef MODE_EXFAT
 	/* ExFAT BPB is 30 larger than FAT32 one.  */
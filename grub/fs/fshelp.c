@@ -438,3 +438,106 @@ grub_fshelp_read_file(grub_disk_t disk, grub_fshelp_node_t node,
 
 	return len;
 }
+
+grub_err_t
+grub_fshelp_map_file(grub_fshelp_node_t node,
+	grub_off_t pos, grub_off_t* disk_pos, grub_size_t* len,
+	grub_disk_addr_t(*get_block) (grub_fshelp_node_t node,
+		grub_disk_addr_t block),
+	grub_off_t filesize, int log2blocksize,
+	grub_disk_addr_t blocks_start)
+{
+	grub_disk_addr_t i, blockcnt, blknr, first;
+	int log2bytes = log2blocksize + GRUB_DISK_SECTOR_BITS;
+	grub_off_t size;
+
+	if (log2bytes >= 31)
+		return grub_error(GRUB_ERR_OUT_OF_RANGE,
+			N_("blocksize too large"));
+
+	if (pos >= filesize)
+		return grub_error(GRUB_ERR_OUT_OF_RANGE,
+			N_("attempt to read past the end of file"));
+
+	if (pos + *len > filesize)
+		*len = filesize - pos;
+
+	i = pos >> log2bytes;
+	blockcnt = (pos + *len + (1ULL << log2bytes) - 1) >> log2bytes;
+
+	first = get_block(node, i);
+	if (grub_errno)
+		return grub_errno;
+	/* Holes have no location on disk.  */
+	if (!first)
+		return grub_error(GRUB_ERR_BAD_FS, "sparse block");
+
+	for (i++; i < blockcnt; i++)
+	{
+		blknr = get_block(node, i);
+		if (grub_errno)
+			return grub_errno;
+		if (blknr != first + i - (pos >> log2bytes))
+			break;
+	}
+
+	size = (i << log2bytes) - pos;
+	if (*len > size)
+		*len = (grub_size_t)size;
+	*disk_pos = (((first << log2blocksize) + blocks_start) << GRUB_DISK_SECTOR_BITS)
+		+ (pos & ((1ULL << log2bytes) - 1));
+
+	return GRUB_ERR_NONE;
+}
+
+/* Blocks looked at by one grub_fshelp_hole call, GET_BLOCK walks the block
+   map for each of them.  */
+#define FSHELP_HOLE_MAX_BLOCKS	65536
+
+grub_err_t
+grub_fshelp_hole(grub_fshelp_node_t node,
+	grub_off_t pos, grub_size_t* len, int* hole,
+	grub_disk_addr_t(*get_block) (grub_fshelp_node_t node,
+		grub_disk_addr_t block),
+	grub_off_t filesize, int log2blocksize)
+{
+	grub_disk_addr_t i, blockcnt, blknr;
+	int log2bytes = log2blocksize + GRUB_DISK_SECTOR_BITS;
+	grub_off_t size;
+
+	if (log2bytes >= 31)
+		return grub_error(GRUB_ERR_OUT_OF_RANGE,
+			N_("blocksize too large"));
+
+	if (pos >= filesize)
+		return grub_error(GRUB_ERR_OUT_OF_RANGE,
+			N_("attempt to read past the end of file"));
+
+	if (pos + *len > filesize)
+		*len = filesize - pos;
+
+	i = pos >> log2bytes;
+	blockcnt = (pos + *len + (1ULL << log2bytes) - 1) >> log2bytes;
+	if (blockcnt - i > FSHELP_HOLE_MAX_BLOCKS)
+		blockcnt = i + FSHELP_HOLE_MAX_BLOCKS;
+
+	blknr = get_block(node, i);
+	if (grub_errno)
+		return grub_errno;
+	*hole = (blknr == 0);
+
+	for (i++; i < blockcnt; i++)
+	{
+		blknr = get_block(node, i);
+		if (grub_errno)
+			return grub_errno;
+		if ((blknr == 0) != *hole)
+			break;
+	}
+
+	size = (i << log2bytes) - pos;
+	if (*len > size)
+		*len = (grub_size_t)size;
+
+	return GRUB_ERR_NONE;
+}
@@ -1409,6 +1409,12 @@ grub_hfs_uuid(grub_disk_t disk, char** uuid)
 
 
 
+static const struct grub_fs_signature grub_hfs_signatures[] =
+{
+	{ GRUB_HFS_SBLOCK << GRUB_DISK_SECTOR_BITS, 2, "BD" },
+	{ 0, 0, NULL }
+};
+
 static struct grub_fs grub_hfs_fs =
 {
 	.name = "hfs",
@@ -1419,6 +1425,7 @@ static struct grub_fs grub_hfs_fs =
 	.fs_label = grub_hfs_label,
 	.fs_uuid = grub_hfs_uuid,
 	.fs_mtime = grub_hfs_mtime,
+	.fs_signatures = grub_hfs_signatures,
 	.next = 0
 };
 
@@ -1135,6 +1135,14 @@ grub_hfsplus_uuid(grub_disk_t disk, char** uuid)
 	return grub_errno;
 }
 
+static const struct grub_fs_signature grub_hfsplus_signatures[] =
+{
+	{ GRUB_HFSPLUS_SBLOCK << GRUB_DISK_SECTOR_BITS, 2, "H+" },
+	{ GRUB_HFSPLUS_SBLOCK << GRUB_DISK_SECTOR_BITS, 2, "HX" },
+	{ GRUB_HFSPLUS_SBLOCK << GRUB_DISK_SECTOR_BITS, 2, "BD" },
+	{ 0, 0, NULL }
+};
+
 static struct grub_fs grub_hfsplus_fs =
 {
 	.name = "hfsplus",
@@ -1145,6 +1153,7 @@ static struct grub_fs grub_hfsplus_fs =
 	.fs_label = grub_hfsplus_label,
 	.fs_mtime = grub_hfsplus_mtime,
 	.fs_uuid = grub_hfsplus_uuid,
+	.fs_signatures = grub_hfsplus_signatures,
 	.next = 0
 };
 
@@ -180,8 +180,12 @@ hfsplus_read_compressed_real(struct grub_hfsplus_file* node,
 		}
 		grub_memcpy(buf, node->cbuf + (pos % HFSPLUS_COMPRESS_BLOCK_SIZE),
 			curlen);
-		if (grub_file_progress_hook && node->file)
-			grub_file_progress_hook(0, 0, curlen, NULL, node->file);
+		if (grub_file_progress_hook && node->file
+			&& grub_file_progress_hook(0, 0, curlen, NULL, node->file))
+		{
+			grub_free(tmp_buf);
+			return -1;
+		}
 		buf += curlen;
 		pos += curlen;
 		len -= curlen;
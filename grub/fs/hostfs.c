@@ -0,0 +1,249 @@
+/* hostfs.c - files of the host system as (host)/path */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2007,2008,2009,2010  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* SEEK_DATA and SEEK_HOLE.  */
+#define _GNU_SOURCE
+
+#include <grub/disk.h>
+#include <grub/fs.h>
+#include <grub/file.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+
+#include <errno.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+GRUB_MOD_LICENSE("GPLv3+");
+
+/* Unlike a blocklist over a hostdisk, host files keep their exact size, so
+   images can be loop mounted through the compression and vdisk filters.  */
+
+static int
+grub_hostdev_iterate(grub_disk_dev_iterate_hook_t hook, void* hook_data,
+	grub_disk_pull_t pull)
+{
+	if (pull != GRUB_DISK_PULL_NONE)
+		return 0;
+
+	return hook("host", hook_data);
+}
+
+static grub_err_t
+grub_hostdev_open(const char* name, grub_disk_t disk)
+{
+	if (grub_strcmp(name, "host"))
+		return grub_error(GRUB_ERR_UNKNOWN_DEVICE, "not a hostfs disk");
+
+	disk->total_sectors = 0;
+	disk->id = 0;
+
+	disk->data = 0;
+
+	return GRUB_ERR_NONE;
+}
+
+static void
+grub_hostdev_close(grub_disk_t disk __attribute((unused)))
+{
+}
+
+static grub_err_t
+grub_hostdev_read(grub_disk_t disk __attribute((unused)),
+	grub_disk_addr_t sector __attribute((unused)),
+	grub_size_t size __attribute((unused)),
+	char* buf __attribute((unused)))
+{
+	return GRUB_ERR_OUT_OF_RANGE;
+}
+
+static grub_err_t
+grub_hostdev_write(grub_disk_t disk __attribute((unused)),
+	grub_disk_addr_t sector __attribute((unused)),
+	grub_size_t size __attribute((unused)),
+	const char* buf __attribute((unused)))
+{
+	return GRUB_ERR_OUT_OF_RANGE;
+}
+
+static grub_err_t
+grub_hostfs_dir(grub_disk_t disk, const char* path,
+	grub_fs_dir_hook_t hook, void* hook_data)
+{
+	DIR* dir;
+	struct dirent* de;
+	char* name;
+
+	/* Check if the disk is our dummy disk.  */
+	if (grub_strcmp(disk->name, "host"))
+		return grub_error(GRUB_ERR_BAD_FS, "not a hostfs");
+
+	dir = opendir(path);
+	if (!dir)
+		return grub_error(GRUB_ERR_BAD_FILENAME, "can't open `%s': %s", path, strerror(errno));
+
+	while ((de = readdir(dir)))
+	{
+		struct grub_dirhook_info info;
+		struct stat st;
+
+		grub_memset(&info, 0, sizeof(info));
+		name = grub_xasprintf("%s/%s", path, de->d_name);
+		if (!name)
+			break;
+		if (lstat(name, &st) == 0)
+		{
+			info.dir = !!S_ISDIR(st.st_mode);
+			info.symlink = !!S_ISLNK(st.st_mode);
+			info.mtimeset = 1;
+			info.mtime = st.st_mtime;
+			info.inodeset = 1;
+			info.inode = st.st_ino;
+		}
+		grub_free(name);
+		if (hook(de->d_name, &info, hook_data))
+			break;
+	}
+
+	closedir(dir);
+	return grub_errno;
+}
+
+static grub_err_t
+grub_hostfs_open(struct grub_file* file, const char* path)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return grub_error(GRUB_ERR_FILE_NOT_FOUND, "can't open `%s': %s", path, strerror(errno));
+	if (fstat(fd, &st) != 0 || S_ISDIR(st.st_mode))
+	{
+		close(fd);
+		return grub_error(GRUB_ERR_BAD_FILE_TYPE, "`%s' is not a regular file", path);
+	}
+	if (S_ISREG(st.st_mode))
+		file->size = st.st_size;
+	else
+		file->size = lseek(fd, 0, SEEK_END);
+
+	file->data = (void*)(grub_addr_t)fd;
+	return GRUB_ERR_NONE;
+}
+
+static grub_ssize_t
+grub_hostfs_read(grub_file_t file, char* buf, grub_size_t len)
+{
+	int fd = (int)(grub_addr_t)file->data;
+	grub_off_t ofs = file->offset;
+	grub_size_t total = 0;
+
+	while (total < len)
+	{
+		ssize_t r = pread(fd, buf + total, len - total, ofs + total);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+		{
+			grub_error(GRUB_ERR_READ_ERROR, "can't read `%s': %s", file->name, strerror(errno));
+			return -1;
+		}
+		if (r == 0)
+			break;
+		total += r;
+	}
+
+	return total;
+}
+
+static grub_err_t
+grub_hostfs_hole(grub_file_t file, grub_off_t offset,
+	grub_size_t* len, int* hole)
+{
+#ifdef SEEK_HOLE
+	int fd = (int)(grub_addr_t)file->data;
+	off_t next;
+
+	/* Data runs up to the next hole, holes up to the next data.  ENXIO
+	   means no data follows.  */
+	next = lseek(fd, offset, SEEK_DATA);
+	if (next < 0 && errno == ENXIO)
+		next = file->size;
+	if (next < 0)
+		return GRUB_ERR_NONE;
+	if ((grub_off_t)next == offset)
+	{
+		next = lseek(fd, offset, SEEK_HOLE);
+		if (next < 0)
+			return GRUB_ERR_NONE;
+	}
+	else
+		*hole = 1;
+	if ((grub_off_t)next > offset && (grub_off_t)next - offset < *len)
+		*len = (grub_size_t)(next - offset);
+#endif
+	return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_hostfs_close(grub_file_t file)
+{
+	close((int)(grub_addr_t)file->data);
+
+	return GRUB_ERR_NONE;
+}
+
+static struct grub_disk_dev grub_hostfs_dev =
+{
+	.name = "host",
+	.id = GRUB_DISK_DEVICE_HOST_ID,
+	.disk_iterate = grub_hostdev_iterate,
+	.disk_open = grub_hostdev_open,
+	.disk_close = grub_hostdev_close,
+	.disk_read = grub_hostdev_read,
+	.disk_write = grub_hostdev_write,
+	.next = 0
+};
+
+static struct grub_fs grub_hostfs_fs =
+{
+	.name = "hostfs",
+	.fs_dir = grub_hostfs_dir,
+	.fs_open = grub_hostfs_open,
+	.fs_read = grub_hostfs_read,
+	.fs_close = grub_hostfs_close,
+	.fs_hole = grub_hostfs_hole,
+	.next = 0
+};
+
+GRUB_MOD_INIT(hostfs)
+{
+	grub_disk_dev_register(&grub_hostfs_dev);
+	grub_fs_register(&grub_hostfs_fs);
+}
+
+GRUB_MOD_FINI(hostfs)
+{
+	grub_disk_dev_unregister(&grub_hostfs_dev);
+	grub_fs_unregister(&grub_hostfs_fs);
+}
@@ -1231,6 +1231,12 @@ grub_iso9660_mtime(grub_disk_t disk, grub_int64_t* timebuf)
 
 
 
+static const struct grub_fs_signature grub_iso9660_signatures[] =
+{
+	{ (16 << (GRUB_ISO9660_LOG2_BLKSZ + GRUB_DISK_SECTOR_BITS)) + 1, 5, "CD001" },
+	{ 0, 0, NULL }
+};
+
 static struct grub_fs grub_iso9660_fs =
 {
 	.name = "iso9660",
@@ -1241,6 +1247,7 @@ static struct grub_fs grub_iso9660_fs =
 	.fs_label = grub_iso9660_label,
 	.fs_uuid = grub_iso9660_uuid,
 	.fs_mtime = grub_iso9660_mtime,
+	.fs_signatures = grub_iso9660_signatures,
 	.next = 0
 };
 
@@ -936,6 +936,12 @@ grub_jfs_label(grub_disk_t disk, char** label)
 	return grub_errno;
 }
 
+static const struct grub_fs_signature grub_jfs_signatures[] =
+{
+	{ GRUB_JFS_SBLOCK << GRUB_DISK_SECTOR_BITS, 4, "JFS1" },
+	{ 0, 0, NULL }
+};
+
 static struct grub_fs grub_jfs_fs =
 {
 	.name = "jfs",
@@ -945,6 +951,7 @@ static struct grub_fs grub_jfs_fs =
 	.fs_close = grub_jfs_close,
 	.fs_label = grub_jfs_label,
 	.fs_uuid = grub_jfs_uuid,
+	.fs_signatures = grub_jfs_signatures,
 	.next = 0
 };
 
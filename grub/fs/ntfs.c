@@ -484,17 +484,12 @@ read_data(struct grub_ntfs_attr* at, grub_uint8_t* pa, grub_uint8_t* dest,
 	return grub_errno;
 }
 
-static grub_err_t
-read_attr(struct grub_ntfs_attr* at, grub_uint8_t* dest, grub_disk_addr_t ofs,
-	grub_size_t len, int cached,
-	grub_disk_read_hook_t read_hook, void* read_hook_data)
+/* Find the piece of the current attribute that holds byte OFS.  */
+static grub_uint8_t*
+seek_attr(struct grub_ntfs_attr* at, grub_disk_addr_t ofs)
 {
-	grub_uint8_t* save_cur;
 	grub_uint8_t attr;
-	grub_uint8_t* pp;
-	grub_err_t ret;
 
-	save_cur = at->attr_cur;
 	at->attr_nxt = at->attr_cur;
 	attr = *at->attr_nxt;
 	if (at->flags & GRUB_NTFS_AF_ALST)
@@ -520,7 +515,20 @@ read_attr(struct grub_ntfs_attr* at, grub_uint8_t* dest, grub_disk_addr_t ofs,
 			pa += u16at(pa, 4);
 		}
 	}
-	pp = find_attr(at, attr);
+	return find_attr(at, attr);
+}
+
+static grub_err_t
+read_attr(struct grub_ntfs_attr* at, grub_uint8_t* dest, grub_disk_addr_t ofs,
+	grub_size_t len, int cached,
+	grub_disk_read_hook_t read_hook, void* read_hook_data)
+{
+	grub_uint8_t* save_cur;
+	grub_uint8_t* pp;
+	grub_err_t ret;
+
+	save_cur = at->attr_cur;
+	pp = seek_attr(at, ofs);
 	if (pp)
 		ret = read_data(at, pp, dest, ofs, len, cached,
 			read_hook, read_hook_data);
@@ -532,6 +540,128 @@ read_attr(struct grub_ntfs_attr* at, grub_uint8_t* dest, grub_disk_addr_t ofs,
 	return ret;
 }
 
+static grub_err_t
+map_data(struct grub_ntfs_attr* at, grub_uint8_t* pa, grub_disk_addr_t ofs,
+	grub_off_t* pos, grub_size_t* len)
+{
+	struct grub_ntfs_rlst cc, * ctx;
+	grub_uint64_t size;
+	grub_uint64_t mask;
+
+	if (pa[8] == 0)
+		return grub_error(GRUB_ERR_BAD_FS, "attribute is resident");
+
+	if (pa[0xC] & GRUB_NTFS_FLAG_COMPRESSED)
+		return grub_error(GRUB_ERR_BAD_FS, "attribute is compressed");
+
+	grub_memset(&cc, 0, sizeof(cc));
+	ctx = &cc;
+	ctx->attr = at;
+	ctx->comp.log_spc = at->mft->data->log_spc;
+	ctx->comp.disk = at->mft->data->disk;
+	ctx->cur_run = pa + u16at(pa, 0x20);
+	ctx->next_vcn = u32at(pa, 0x10);
+	ctx->curr_lcn = 0;
+
+	ctx->target_vcn = ofs >> (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc);
+	while (ctx->next_vcn <= ctx->target_vcn)
+	{
+		if (grub_ntfs_read_run_list(ctx))
+			return grub_errno;
+	}
+
+	if (ctx->flags & GRUB_NTFS_RF_BLNK)
+		return grub_error(GRUB_ERR_BAD_FS, "sparse run");
+
+	mask = (1ULL << (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc)) - 1;
+	*pos = ((ctx->target_vcn - ctx->curr_vcn + ctx->curr_lcn)
+		<< (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc)) + (ofs & mask);
+	size = ((ctx->next_vcn - ctx->target_vcn)
+		<< (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc)) - (ofs & mask);
+	if (*len > size)
+		*len = (grub_size_t)size;
+
+	return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+map_attr(struct grub_ntfs_attr* at, grub_disk_addr_t ofs,
+	grub_off_t* pos, grub_size_t* len)
+{
+	grub_uint8_t* save_cur;
+	grub_uint8_t* pp;
+	grub_err_t ret;
+
+	save_cur = at->attr_cur;
+	pp = seek_attr(at, ofs);
+	if (pp)
+		ret = map_data(at, pp, ofs, pos, len);
+	else
+		ret =
+		(grub_errno) ? grub_errno : grub_error(GRUB_ERR_BAD_FS,
+			"attribute not found");
+	at->attr_cur = save_cur;
+	return ret;
+}
+
+static grub_err_t
+hole_data(struct grub_ntfs_attr* at, grub_uint8_t* pa, grub_disk_addr_t ofs,
+	grub_size_t* len, int* hole)
+{
+	struct grub_ntfs_rlst cc, * ctx;
+	grub_uint64_t size;
+	grub_uint64_t mask;
+
+	/* Resident and compressed data is read whole, report it as data.  */
+	if (pa[8] == 0 || (pa[0xC] & GRUB_NTFS_FLAG_COMPRESSED))
+		return GRUB_ERR_NONE;
+
+	grub_memset(&cc, 0, sizeof(cc));
+	ctx = &cc;
+	ctx->attr = at;
+	ctx->comp.log_spc = at->mft->data->log_spc;
+	ctx->comp.disk = at->mft->data->disk;
+	ctx->cur_run = pa + u16at(pa, 0x20);
+	ctx->next_vcn = u32at(pa, 0x10);
+	ctx->curr_lcn = 0;
+
+	ctx->target_vcn = ofs >> (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc);
+	while (ctx->next_vcn <= ctx->target_vcn)
+	{
+		if (grub_ntfs_read_run_list(ctx))
+			return grub_errno;
+	}
+
+	*hole = !!(ctx->flags & GRUB_NTFS_RF_BLNK);
+	mask = (1ULL << (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc)) - 1;
+	size = ((ctx->next_vcn - ctx->target_vcn)
+		<< (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc)) - (ofs & mask);
+	if (*len > size)
+		*len = (grub_size_t)size;
+
+	return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+hole_attr(struct grub_ntfs_attr* at, grub_disk_addr_t ofs,
+	grub_size_t* len, int* hole)
+{
+	grub_uint8_t* save_cur;
+	grub_uint8_t* pp;
+	grub_err_t ret;
+
+	save_cur = at->attr_cur;
+	pp = seek_attr(at, ofs);
+	if (pp)
+		ret = hole_data(at, pp, ofs, len, hole);
+	else
+		ret =
+		(grub_errno) ? grub_errno : grub_error(GRUB_ERR_BAD_FS,
+			"attribute not found");
+	at->attr_cur = save_cur;
+	return ret;
+}
+
 static grub_err_t
 read_mft(struct grub_ntfs_data* data, grub_uint8_t* buf, grub_uint64_t mftno)
 {
@@ -1171,6 +1301,28 @@ grub_ntfs_read(grub_file_t file, char* buf, grub_size_t len)
 	return (grub_errno) ? -1 : (grub_ssize_t)len;
 }
 
+static grub_err_t
+grub_ntfs_map(grub_file_t file, grub_off_t offset,
+	grub_off_t* pos, grub_size_t* len)
+{
+	struct grub_ntfs_file* mft;
+
+	mft = &((struct grub_ntfs_data*)file->data)->cmft;
+
+	return map_attr(&mft->attr, offset, pos, len);
+}
+
+static grub_err_t
+grub_ntfs_hole(grub_file_t file, grub_off_t offset,
+	grub_size_t* len, int* hole)
+{
+	struct grub_ntfs_file* mft;
+
+	mft = &((struct grub_ntfs_data*)file->data)->cmft;
+
+	return hole_attr(&mft->attr, offset, len, hole);
+}
+
 static grub_err_t
 grub_ntfs_close(grub_file_t file)
 {
@@ -1283,6 +1435,12 @@ grub_ntfs_uuid(grub_disk_t disk, char** uuid)
 	return grub_errno;
 }
 
+static const struct grub_fs_signature grub_ntfs_signatures[] =
+{
+	{ 3, 4, "NTFS" },
+	{ 0, 0, NULL }
+};
+
 static struct grub_fs grub_ntfs_fs =
 {
 	.name = "ntfs",
@@ -1292,6 +1450,9 @@ static struct grub_fs grub_ntfs_fs =
 	.fs_close = grub_ntfs_close,
 	.fs_label = grub_ntfs_label,
 	.fs_uuid = grub_ntfs_uuid,
+	.fs_map = grub_ntfs_map,
+	.fs_hole = grub_ntfs_hole,
+	.fs_signatures = grub_ntfs_signatures,
 	.next = 0
 };
 
@@ -238,9 +238,10 @@ read_block(struct grub_ntfs_rlst* ctx, grub_uint8_t* buf, grub_size_t num)
 						return grub_errno;
 					if (buf)
 						buf += GRUB_NTFS_COM_LEN;
-					if (grub_file_progress_hook && ctx->file)
-						grub_file_progress_hook(0, 0, GRUB_NTFS_COM_LEN, NULL,
-							ctx->file);
+					if (grub_file_progress_hook && ctx->file
+						&& grub_file_progress_hook(0, 0, GRUB_NTFS_COM_LEN, NULL,
+							ctx->file))
+						return grub_errno;
 					nn--;
 				}
 			}
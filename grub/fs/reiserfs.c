@@ -1405,6 +1405,12 @@ grub_reiserfs_uuid(grub_disk_t disk, char** uuid)
 	return grub_errno;
 }
 
+static const struct grub_fs_signature grub_reiserfs_signatures[] =
+{
+	{ REISERFS_SUPER_BLOCK_OFFSET + 52, sizeof(REISERFS_MAGIC_STRING) - 1, REISERFS_MAGIC_STRING },
+	{ 0, 0, NULL }
+};
+
 static struct grub_fs grub_reiserfs_fs =
 {
 	.name = "reiserfs",
@@ -1414,6 +1420,7 @@ static struct grub_fs grub_reiserfs_fs =
 	.fs_close = grub_reiserfs_close,
 	.fs_label = grub_reiserfs_label,
 	.fs_uuid = grub_reiserfs_uuid,
+	.fs_signatures = grub_reiserfs_signatures,
 	.next = 0
 };
 
@@ -1110,6 +1110,12 @@ grub_squash_mtime(grub_disk_t disk, grub_int64_t* tm)
 	return GRUB_ERR_NONE;
 }
 
+static const struct grub_fs_signature grub_squash_signatures[] =
+{
+	{ 0, 4, "hsqs" },
+	{ 0, 0, NULL }
+};
+
 static struct grub_fs grub_squash_fs =
 {
 	.name = "squash4",
@@ -1118,6 +1124,7 @@ static struct grub_fs grub_squash_fs =
 	.fs_read = grub_squash_read,
 	.fs_close = grub_squash_close,
 	.fs_mtime = grub_squash_mtime,
+	.fs_signatures = grub_squash_signatures,
 	.next = 0
 };
 
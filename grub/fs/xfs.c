@@ -1206,6 +1206,25 @@ grub_xfs_read(grub_file_t file, char* buf, grub_size_t len)
 }
 
 
+static grub_err_t
+grub_xfs_hole(grub_file_t file, grub_off_t offset,
+	grub_size_t* len, int* hole)
+{
+	struct grub_xfs_data* data =
+		(struct grub_xfs_data*)file->data;
+	grub_fshelp_node_t node = &data->diropen;
+
+	/* Data kept in the inode has no block map.  */
+	if (node->inode.format != XFS_INODE_FORMAT_EXT
+		&& node->inode.format != XFS_INODE_FORMAT_BTREE)
+		return GRUB_ERR_NONE;
+
+	return grub_fshelp_hole(node, offset, len, hole, grub_xfs_read_block,
+		grub_be_to_cpu64(node->inode.size),
+		node->data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS);
+}
+
+
 static grub_err_t
 grub_xfs_close(grub_file_t file)
 {
@@ -1257,6 +1276,12 @@ grub_xfs_uuid(grub_disk_t disk, char** uuid)
 	return grub_errno;
 }
 
+static const struct grub_fs_signature grub_xfs_signatures[] =
+{
+	{ 0, 4, "XFSB" },
+	{ 0, 0, NULL }
+};
+
 static struct grub_fs grub_xfs_fs =
 {
 	.name = "xfs",
@@ -1266,6 +1291,8 @@ static struct grub_fs grub_xfs_fs =
 	.fs_close = grub_xfs_close,
 	.fs_label = grub_xfs_label,
 	.fs_uuid = grub_xfs_uuid,
+	.fs_hole = grub_xfs_hole,
+	.fs_signatures = grub_xfs_signatures,
 	.next = 0
 };
 
@@ -1284,6 +1284,26 @@ static grub_uint8_t powx[255 * 2];
 static int powx_inv[256];
 static const grub_uint8_t poly = 0x1d;
 
+/* Compute mul. x**s has a period of 255.  Filled once at module init so
+   concurrent readers never see a partial table.  */
+static void
+init_powx(void)
+{
+	grub_uint8_t cur = 1;
+	unsigned i;
+
+	for (i = 0; i < 255; i++)
+	{
+		powx[i] = cur;
+		powx[i + 255] = cur;
+		powx_inv[cur] = i;
+		if (cur & 0x80)
+			cur = (cur << 1) ^ poly;
+		else
+			cur <<= 1;
+	}
+}
+
 /* perform the operation a ^= b * (x ** (known_idx * recovery_pow) ) */
 static inline void
 xor_out(grub_uint8_t* a, const grub_uint8_t* b, grub_size_t s,
@@ -1583,22 +1603,6 @@ read_device(grub_uint64_t offset, struct grub_zfs_device_desc* desc,
 			unsigned i, j;
 			grub_err_t err;
 
-			/* Compute mul. x**s has a period of 255.  */
-			if (powx[0] == 0)
-			{
-				grub_uint8_t cur = 1;
-				for (i = 0; i < 255; i++)
-				{
-					powx[i] = cur;
-					powx[i + 255] = cur;
-					powx_inv[cur] = i;
-					if (cur & 0x80)
-						cur = (cur << 1) ^ poly;
-					else
-						cur <<= 1;
-				}
-			}
-
 			/* Read redundancy data.  */
 			for (n_redundancy = 0, cur_redundancy_pow = 0;
 				n_redundancy < failed_devices;
@@ -4367,6 +4371,7 @@ static struct grub_fs grub_zfs_fs =
 GRUB_MOD_INIT(zfs)
 {
 	COMPILE_TIME_ASSERT(sizeof(zap_leaf_chunk_t) == ZAP_LEAF_CHUNKSIZE);
+	init_powx();
 	grub_fs_register(&grub_zfs_fs);
 }
 
@@ -1525,6 +1525,38 @@ dmgRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbTo
 	return rc;
 }
 
+/**
+ * Tells whether the guest offset lies in a run of zero extents.
+ */
+static int
+dmgHole(void* pBackendData, grub_uint64_t uOffset, grub_size_t cbToCheck,
+	grub_size_t* pcbRun, int* pfZero)
+{
+	PDMGIMAGE pThis = (PDMGIMAGE)pBackendData;
+	PDMGEXTENT pExtent;
+	grub_uint64_t cbRun;
+
+	if (uOffset + cbToCheck > pThis->cbSize)
+		return GRUB_ERR_BAD_ARGUMENT;
+
+	pExtent = dmgExtentGetFromOffset(pThis, DMG_BYTE2BLOCK(uOffset));
+	if (!pExtent)
+		return GRUB_ERR_BAD_ARGUMENT;
+
+	*pfZero = (pExtent->enmType == DMGEXTENTTYPE_ZERO);
+	cbRun = DMG_BLOCK2BYTE(pExtent->uSectorExtent + pExtent->cSectorsExtent) - uOffset;
+
+	/* The extents are sorted, merge the zero ones that follow. */
+	while (*pfZero && cbRun < cbToCheck
+		&& ++pExtent < pThis->paExtents + pThis->cExtents
+		&& pExtent->enmType == DMGEXTENTTYPE_ZERO
+		&& DMG_BLOCK2BYTE(pExtent->uSectorExtent) == uOffset + cbRun)
+		cbRun += DMG_BLOCK2BYTE(pExtent->cSectorsExtent);
+
+	*pcbRun = (grub_size_t)RT_MIN(cbRun, cbToCheck);
+	return GRUB_ERR_NONE;
+}
+
 static grub_uint64_t
 dmgGetSize(void* pBackendData)
 {
@@ -1629,6 +1661,18 @@ grub_dmg_read(grub_file_t file, char* buf, grub_size_t len)
 	return size;
 }
 
+static grub_err_t
+grub_dmg_hole(grub_file_t file, grub_off_t offset,
+	grub_size_t* len, int* hole)
+{
+	grub_dmg_t dmgio = file->data;
+
+	if (dmgHole(dmgio->dmg, offset, *len, len, hole) != GRUB_ERR_NONE)
+		return grub_error(GRUB_ERR_BAD_ARGUMENT, "dmg offset out of range");
+
+	return GRUB_ERR_NONE;
+}
+
 static struct grub_fs grub_dmg_fs =
 {
 	.name = "dmg",
@@ -1637,6 +1681,7 @@ static struct grub_fs grub_dmg_fs =
 	.fs_read = grub_dmg_read,
 	.fs_close = grub_dmg_close,
 	.fs_label = 0,
+	.fs_hole = grub_dmg_hole,
 	.next = 0
 };
 
@@ -719,11 +719,10 @@ static grub_uint64_t qcowCluster2Byte(PQCOWIMAGE pImage, grub_uint64_t cClusters
 }
 
 /**
- * Returns the real image offset for a given cluster or an error if the cluster is not
- * yet allocated.
+ * Returns the real image offset for a given cluster, 0 if the cluster is not
+ * yet allocated.  The header is at offset 0, so no data can be.
  *
  * @returns VBox status code.
- *          VERR_VD_BLOCK_FREE if the cluster is not yet allocated.
  * @param   pImage        The image instance data.
  * @param   pIoCtx        The I/O context.
  * @param   idxL1         The L1 index.
@@ -741,6 +740,8 @@ static int qcowConvertToImageOffset(PQCOWIMAGE pImage,
 {
 	int rc = GRUB_ERR_NONE;
 
+	*pfCompressed = false;
+	*poffImage = 0;
 	if (pImage->paL1Table[idxL1])
 	{
 		PQCOWL2CACHEENTRY pL2Entry;
@@ -773,7 +774,7 @@ static int qcowConvertToImageOffset(PQCOWIMAGE pImage,
 						off &= QCOW_V2_TBL_OFFSET_MASK;
 
 						*pfCompressed = false;
-						*poffImage = off + offCluster;
+						*poffImage = off ? off + offCluster : 0;
 					}
 				}
 				else
@@ -793,7 +794,7 @@ static int qcowConvertToImageOffset(PQCOWIMAGE pImage,
 						off &= ~QCOW_V1_COMPRESSED_FLAG;
 
 						*pfCompressed = false;
-						*poffImage = off + offCluster;
+						*poffImage = off ? off + offCluster : 0;
 					}
 				}
 			}
@@ -1143,7 +1144,10 @@ qcowRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbT
 		&offFile, &fCompressedCluster, &cbCompressedCluster);
 	if (RT_SUCCESS(rc))
 	{
-		if (!fCompressedCluster)
+		/* There is no backing file, free clusters read as zeros. */
+		if (!fCompressedCluster && !offFile)
+			grub_memset(pvBuf, 0, cbToRead);
+		else if (!fCompressedCluster)
 			rc = qcowFileReadSync(pImage, offFile,
 				pvBuf, cbToRead, NULL);
 		else
@@ -1156,6 +1160,48 @@ qcowRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbT
 	return rc;
 }
 
+/**
+ * Tells whether the guest offset lies in a run of free clusters, which read
+ * as zeros.
+ */
+static int
+qcowHole(void* pBackendData, grub_uint64_t uOffset, grub_size_t cbToCheck,
+	grub_size_t* pcbRun, int* pfZero)
+{
+	PQCOWIMAGE pImage = (PQCOWIMAGE)pBackendData;
+	grub_size_t cbRun = 0;
+	int rc = GRUB_ERR_NONE;
+
+	if (uOffset + cbToCheck > pImage->cbSize)
+		return GRUB_ERR_BAD_ARGUMENT;
+
+	while (cbRun < cbToCheck)
+	{
+		grub_uint32_t offCluster = 0;
+		grub_uint32_t idxL1 = 0;
+		grub_uint32_t idxL2 = 0;
+		grub_uint64_t offFile = 0;
+		int fCompressedCluster = false;
+		grub_size_t cbCompressedCluster = 0;
+		int fFree;
+
+		qcowConvertLogicalOffset(pImage, uOffset + cbRun, &idxL1, &idxL2, &offCluster);
+		rc = qcowConvertToImageOffset(pImage, idxL1, idxL2, offCluster,
+			&offFile, &fCompressedCluster, &cbCompressedCluster);
+		if (RT_FAILURE(rc))
+			break;
+		fFree = !fCompressedCluster && !offFile;
+		if (cbRun == 0)
+			*pfZero = fFree;
+		else if (fFree != *pfZero)
+			break;
+		cbRun += pImage->cbCluster - offCluster;
+	}
+
+	*pcbRun = RT_MIN(cbRun, cbToCheck);
+	return rc;
+}
+
 static grub_uint64_t
 qcowGetSize(void* pBackendData)
 {
@@ -1260,6 +1306,18 @@ grub_qcow_read(grub_file_t file, char* buf, grub_size_t len)
 	return size;
 }
 
+static grub_err_t
+grub_qcow_hole(grub_file_t file, grub_off_t offset,
+	grub_size_t* len, int* hole)
+{
+	grub_qcow_t qcowio = file->data;
+
+	if (qcowHole(qcowio->qcow, offset, *len, len, hole) != GRUB_ERR_NONE)
+		return grub_error(GRUB_ERR_BAD_FS, "can't read qcow cluster table");
+
+	return GRUB_ERR_NONE;
+}
+
 static struct grub_fs grub_qcow_fs =
 {
 	.name = "qcow",
@@ -1268,6 +1326,7 @@ static struct grub_fs grub_qcow_fs =
 	.fs_read = grub_qcow_read,
 	.fs_close = grub_qcow_close,
 	.fs_label = 0,
+	.fs_hole = grub_qcow_hole,
 	.next = 0
 };
 
@@ -1024,6 +1024,46 @@ vdiClose(void* pBackendData)
 	return rc;
 }
 
+#define IS_VDI_BLOCK_ZERO(bp) ((bp) == VDI_IMAGE_BLOCK_FREE || (bp) == VDI_IMAGE_BLOCK_ZERO)
+
+/**
+ * Internal: Computes how many bytes starting at offRead in block uBlock can be
+ * served by a single operation. Consecutive free/zero blocks are merged into
+ * one memset, allocated blocks are merged as long as they are stored back to
+ * back in the image file.
+ */
+static grub_size_t
+vdiGetRunLength(PVDIIMAGEDESC pImage, unsigned uBlock, unsigned offRead, grub_size_t cbToRead)
+{
+	VDIIMAGEBLOCKPOINTER bp = pImage->paBlocks[uBlock];
+	grub_size_t cbBlock = getImageBlockSize(&pImage->Header);
+	grub_size_t cbRun = cbBlock - offRead;
+	int fZero = IS_VDI_BLOCK_ZERO(bp);
+
+	/* Blocks with extra data in front can't be read in one go. */
+	if (!fZero && pImage->offStartBlockData)
+		return RT_MIN(cbRun, cbToRead);
+
+	while (cbRun < cbToRead)
+	{
+		VDIIMAGEBLOCKPOINTER bpNext = pImage->paBlocks[++uBlock];
+		if (fZero)
+		{
+			if (!IS_VDI_BLOCK_ZERO(bpNext))
+				break;
+		}
+		else
+		{
+			if (IS_VDI_BLOCK_ZERO(bpNext) || bpNext != bp + 1)
+				break;
+			bp = bpNext;
+		}
+		cbRun += cbBlock;
+	}
+
+	return RT_MIN(cbRun, cbToRead);
+}
+
 static int
 vdiRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbToRead, grub_size_t* pcbActuallyRead)
 {
@@ -1039,12 +1079,10 @@ vdiRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbTo
 	uBlock = (unsigned)(uOffset >> pImage->uShiftOffset2Index);
 	offRead = (unsigned)uOffset & pImage->uBlockMask;
 
-	/* Clip read range to at most the rest of the block. */
-	cbToRead = RT_MIN(cbToRead, getImageBlockSize(&pImage->Header) - offRead);
+	/* Clip read range to the run of blocks that can be served at once. */
+	cbToRead = vdiGetRunLength(pImage, uBlock, offRead, cbToRead);
 
-	if (pImage->paBlocks[uBlock] == VDI_IMAGE_BLOCK_FREE)
-		rc = GRUB_ERR_NONE;
-	else if (pImage->paBlocks[uBlock] == VDI_IMAGE_BLOCK_ZERO)
+	if (IS_VDI_BLOCK_ZERO(pImage->paBlocks[uBlock]))
 	{
 		grub_memset(pvBuf, 0, cbToRead);
 	}
@@ -1070,6 +1108,60 @@ vdiRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbTo
 	return rc;
 }
 
+/**
+ * Internal: Maps the guest offset to the image file offset of an allocated
+ * block, free and zero blocks have no backing in the image file.
+ */
+static int
+vdiMap(void* pBackendData, grub_uint64_t uOffset, grub_size_t cbToMap,
+	grub_uint64_t* puFileOffset, grub_size_t* pcbMapped)
+{
+	PVDIIMAGEDESC pImage = (PVDIIMAGEDESC)pBackendData;
+	unsigned uBlock;
+	unsigned offRead;
+
+	if (uOffset + cbToMap > getImageDiskSize(&pImage->Header))
+		return GRUB_ERR_OUT_OF_RANGE;
+
+	uBlock = (unsigned)(uOffset >> pImage->uShiftOffset2Index);
+	offRead = (unsigned)uOffset & pImage->uBlockMask;
+
+	if (IS_VDI_BLOCK_ZERO(pImage->paBlocks[uBlock]))
+		return GRUB_ERR_BAD_ARGUMENT;
+
+	cbToMap = vdiGetRunLength(pImage, uBlock, offRead, cbToMap);
+	*puFileOffset = (grub_uint64_t)pImage->paBlocks[uBlock] * pImage->cbTotalBlockData
+		+ (pImage->offStartData + pImage->offStartBlockData + offRead);
+	if (*puFileOffset + cbToMap > pImage->cbImage)
+		return GRUB_ERR_OUT_OF_RANGE;
+
+	*pcbMapped = cbToMap;
+	return GRUB_ERR_NONE;
+}
+
+/**
+ * Internal: Tells whether the guest offset lies in a run of free or zero
+ * blocks, which read as zeros.
+ */
+static int
+vdiHole(void* pBackendData, grub_uint64_t uOffset, grub_size_t cbToCheck,
+	grub_size_t* pcbRun, int* pfZero)
+{
+	PVDIIMAGEDESC pImage = (PVDIIMAGEDESC)pBackendData;
+	unsigned uBlock;
+	unsigned offRead;
+
+	if (uOffset + cbToCheck > getImageDiskSize(&pImage->Header))
+		return GRUB_ERR_OUT_OF_RANGE;
+
+	uBlock = (unsigned)(uOffset >> pImage->uShiftOffset2Index);
+	offRead = (unsigned)uOffset & pImage->uBlockMask;
+
+	*pfZero = IS_VDI_BLOCK_ZERO(pImage->paBlocks[uBlock]);
+	*pcbRun = vdiGetRunLength(pImage, uBlock, offRead, cbToCheck);
+	return GRUB_ERR_NONE;
+}
+
 static grub_uint64_t
 vdiGetSize(void* pBackendData)
 {
@@ -1156,12 +1248,13 @@ grub_vdi_read(grub_file_t file, char* buf, grub_size_t len)
 	int rc = GRUB_ERR_NONE;
 	grub_size_t real_size;
 	grub_ssize_t size = 0;
+	grub_off_t offset = file->offset;
 	grub_vdi_t vdiio = file->data;
 
 	while (rc == GRUB_ERR_NONE)
 	{
-		rc = vdiRead(vdiio->vdi, file->offset, buf, len, &real_size);
-		file->offset += real_size;
+		rc = vdiRead(vdiio->vdi, offset, buf, len, &real_size);
+		offset += real_size;
 		buf += real_size;
 		size += real_size;
 		if (real_size >= len)
@@ -1174,6 +1267,33 @@ grub_vdi_read(grub_file_t file, char* buf, grub_size_t len)
 	return size;
 }
 
+static grub_err_t
+grub_vdi_map(grub_file_t file, grub_off_t offset,
+	grub_off_t* pos, grub_size_t* len)
+{
+	grub_vdi_t vdiio = file->data;
+	grub_uint64_t file_offset;
+	grub_size_t size;
+
+	if (vdiMap(vdiio->vdi, offset, *len, &file_offset, &size) != GRUB_ERR_NONE)
+		return grub_error(GRUB_ERR_BAD_ARGUMENT, "vdi block not mapped");
+
+	*len = size;
+	return grub_file_map(vdiio->file, file_offset, pos, len);
+}
+
+static grub_err_t
+grub_vdi_hole(grub_file_t file, grub_off_t offset,
+	grub_size_t* len, int* hole)
+{
+	grub_vdi_t vdiio = file->data;
+
+	if (vdiHole(vdiio->vdi, offset, *len, len, hole) != GRUB_ERR_NONE)
+		return grub_error(GRUB_ERR_BAD_ARGUMENT, "vdi offset out of range");
+
+	return GRUB_ERR_NONE;
+}
+
 static struct grub_fs grub_vdi_fs =
 {
 	.name = "vdi",
@@ -1182,6 +1302,8 @@ static struct grub_fs grub_vdi_fs =
 	.fs_read = grub_vdi_read,
 	.fs_close = grub_vdi_close,
 	.fs_label = 0,
+	.fs_map = grub_vdi_map,
+	.fs_hole = grub_vdi_hole,
 	.next = 0
 };
 
@@ -170,6 +170,8 @@ typedef struct VHDIMAGE
 	grub_uint64_t        uBlockAllocationTableOffset;
 	/** Buffer to hold block's bitmap for bit search operations. */
 	grub_uint8_t* pu8Bitmap;
+	/** BAT index of the block whose bitmap is in pu8Bitmap, ~0 if none. */
+	grub_uint32_t        uBitmapBlock;
 	/** Offset to the next data structure (dynamic disk header). */
 	grub_uint64_t        u64DataOffset;
 } VHDIMAGE, * PVHDIMAGE;
@@ -270,6 +272,7 @@ vhdLoadDynamicDisk(PVHDIMAGE pImage, grub_uint64_t uDynamicDiskHeaderOffset)
 	pImage->pu8Bitmap = vhdBlockBitmapAllocate(pImage);
 	if (!pImage->pu8Bitmap)
 		return GRUB_ERR_OUT_OF_MEMORY;
+	pImage->uBitmapBlock = ~0U;
 
 	pBlockAllocationTable = (grub_uint32_t*)grub_zalloc(pImage->cBlockAllocationTableEntries * sizeof(grub_uint32_t));
 	if (!pBlockAllocationTable)
@@ -460,6 +463,7 @@ vhdRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbTo
 		grub_uint32_t cBlockAllocationTableEntry = (uOffset / VHD_SECTOR_SIZE) / pImage->cSectorsPerDataBlock;
 		grub_uint32_t cBATEntryIndex = (uOffset / VHD_SECTOR_SIZE) % pImage->cSectorsPerDataBlock;
 		grub_uint64_t uVhdOffset;
+		grub_size_t cbLeft = cbToRead;
 
 		/*
 		 * Clip read range to remain in this data block.
@@ -467,21 +471,34 @@ vhdRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbTo
 		cbToRead = RT_MIN(cbToRead, (pImage->cbDataBlock - (cBATEntryIndex * VHD_SECTOR_SIZE)));
 
 		/*
-		 * If the block is not allocated the content of the entry is ~0
+		 * If the block is not allocated the content of the entry is ~0.
+		 * Merge all following unallocated blocks and return zeros for them.
 		 */
 		if (pImage->pBlockAllocationTable[cBlockAllocationTableEntry] == ~0U)
+		{
+			grub_size_t cbRun = cbToRead;
+			while (cbRun < cbLeft
+				&& ++cBlockAllocationTableEntry < pImage->cBlockAllocationTableEntries
+				&& pImage->pBlockAllocationTable[cBlockAllocationTableEntry] == ~0U)
+				cbRun += pImage->cbDataBlock;
+			cbToRead = RT_MIN(cbRun, cbLeft);
+			grub_memset(pvBuf, 0, cbToRead);
 			rc = GRUB_ERR_NONE;
+		}
 		else
 		{
 			uVhdOffset = ((grub_uint64_t)pImage->pBlockAllocationTable[cBlockAllocationTableEntry] + pImage->cDataBlockBitmapSectors + cBATEntryIndex) * VHD_SECTOR_SIZE;
 
-			/* Clip read range to remain in this data block. */
-			cbToRead = RT_MIN(cbToRead, (pImage->cbDataBlock - (cBATEntryIndex * VHD_SECTOR_SIZE)));
-
-			/* Read in the block's bitmap. */
-			rc = vhdFileReadSync(pImage,
-				((grub_uint64_t)pImage->pBlockAllocationTable[cBlockAllocationTableEntry]) * VHD_SECTOR_SIZE,
-				pImage->pu8Bitmap, pImage->cbDataBlockBitmap, NULL);
+			/* Read in the block's bitmap, unless it is already there. */
+			if (pImage->uBitmapBlock != cBlockAllocationTableEntry)
+			{
+				pImage->uBitmapBlock = ~0U;
+				rc = vhdFileReadSync(pImage,
+					((grub_uint64_t)pImage->pBlockAllocationTable[cBlockAllocationTableEntry]) * VHD_SECTOR_SIZE,
+					pImage->pu8Bitmap, pImage->cbDataBlockBitmap, NULL);
+				if (RT_SUCCESS(rc))
+					pImage->uBitmapBlock = cBlockAllocationTableEntry;
+			}
 
 			if (RT_SUCCESS(rc))
 			{
@@ -504,7 +521,7 @@ vhdRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbTo
 						cSectors++;
 					}
 
-					cbToRead = (grub_size_t) cSectors * VHD_SECTOR_SIZE;
+					cbToRead = RT_MIN((grub_size_t) cSectors * VHD_SECTOR_SIZE, cbToRead);
 
 					rc = vhdFileReadSync(pImage, uVhdOffset, pvBuf, cbToRead, NULL);
 				}
@@ -528,8 +545,10 @@ vhdRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbTo
 						cSectors++;
 					}
 
-					cbToRead = (grub_size_t) cSectors * VHD_SECTOR_SIZE;
-					
+					cbToRead = RT_MIN((grub_size_t) cSectors * VHD_SECTOR_SIZE, cbToRead);
+
+					/* There is no parent to read from, clean sectors read as zeros. */
+					grub_memset(pvBuf, 0, cbToRead);
 					rc = GRUB_ERR_NONE;
 				}
 			}
@@ -544,6 +563,101 @@ vhdRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbTo
 	return rc;
 }
 
+/**
+ * Map the guest offset to the image file offset the data is stored at.
+ *
+ * Only fixed images and dirty sectors of allocated blocks are mapped,
+ * unallocated blocks and clean sectors have no backing in the image file.
+ */
+static int
+vhdMap(void* pBackendData, grub_uint64_t uOffset, grub_size_t cbToMap,
+	grub_uint64_t* puFileOffset, grub_size_t* pcbMapped)
+{
+	PVHDIMAGE pImage = (PVHDIMAGE)pBackendData;
+	int rc = GRUB_ERR_NONE;
+
+	if (uOffset + cbToMap > pImage->cbSize)
+		return GRUB_ERR_BAD_ARGUMENT;
+
+	if (pImage->pBlockAllocationTable)
+	{
+		grub_uint32_t cBlockAllocationTableEntry = (uOffset / VHD_SECTOR_SIZE) / pImage->cSectorsPerDataBlock;
+		grub_uint32_t cBATEntryIndex = (uOffset / VHD_SECTOR_SIZE) % pImage->cSectorsPerDataBlock;
+		grub_uint32_t offSector = uOffset % VHD_SECTOR_SIZE;
+		grub_uint32_t cSectorsMax;
+		grub_uint32_t cSectors;
+
+		cbToMap = RT_MIN(cbToMap, (pImage->cbDataBlock - (cBATEntryIndex * VHD_SECTOR_SIZE) - offSector));
+		if (pImage->pBlockAllocationTable[cBlockAllocationTableEntry] == ~0U)
+			return GRUB_ERR_BAD_ARGUMENT;
+
+		if (pImage->uBitmapBlock != cBlockAllocationTableEntry)
+		{
+			pImage->uBitmapBlock = ~0U;
+			rc = vhdFileReadSync(pImage,
+				((grub_uint64_t)pImage->pBlockAllocationTable[cBlockAllocationTableEntry]) * VHD_SECTOR_SIZE,
+				pImage->pu8Bitmap, pImage->cbDataBlockBitmap, NULL);
+			if (RT_FAILURE(rc))
+				return rc;
+			pImage->uBitmapBlock = cBlockAllocationTableEntry;
+		}
+
+		*puFileOffset = ((grub_uint64_t)pImage->pBlockAllocationTable[cBlockAllocationTableEntry] + pImage->cDataBlockBitmapSectors + cBATEntryIndex) * VHD_SECTOR_SIZE + offSector;
+
+		cSectorsMax = (grub_uint32_t)((offSector + cbToMap + VHD_SECTOR_SIZE - 1) / VHD_SECTOR_SIZE);
+		for (cSectors = 0; cSectors < cSectorsMax; cSectors++)
+		{
+			if (!vhdBlockBitmapSectorContainsData(pImage, cBATEntryIndex + cSectors))
+				break;
+		}
+		if (cSectors == 0)
+			return GRUB_ERR_BAD_ARGUMENT;
+
+		*pcbMapped = RT_MIN((grub_size_t)cSectors * VHD_SECTOR_SIZE - offSector, cbToMap);
+	}
+	else
+	{
+		*puFileOffset = uOffset;
+		*pcbMapped = cbToMap;
+	}
+
+	return rc;
+}
+
+/**
+ * Tell whether the guest offset lies in a run of unallocated blocks, which
+ * read as zeros.  Allocated blocks count as data, clean sectors included.
+ */
+static int
+vhdHole(void* pBackendData, grub_uint64_t uOffset, grub_size_t cbToCheck,
+	grub_size_t* pcbRun, int* pfZero)
+{
+	PVHDIMAGE pImage = (PVHDIMAGE)pBackendData;
+	grub_uint32_t cBlockAllocationTableEntry;
+	grub_size_t cbRun;
+	int fZero;
+
+	if (uOffset + cbToCheck > pImage->cbSize)
+		return GRUB_ERR_BAD_ARGUMENT;
+
+	*pfZero = 0;
+	*pcbRun = cbToCheck;
+	if (!pImage->pBlockAllocationTable)
+		return GRUB_ERR_NONE;
+
+	cBlockAllocationTableEntry = (grub_uint32_t)(uOffset / pImage->cbDataBlock);
+	cbRun = pImage->cbDataBlock - (grub_size_t)(uOffset % pImage->cbDataBlock);
+	fZero = (pImage->pBlockAllocationTable[cBlockAllocationTableEntry] == ~0U);
+	while (cbRun < cbToCheck
+		&& ++cBlockAllocationTableEntry < pImage->cBlockAllocationTableEntries
+		&& (pImage->pBlockAllocationTable[cBlockAllocationTableEntry] == ~0U) == fZero)
+		cbRun += pImage->cbDataBlock;
+
+	*pfZero = fZero;
+	*pcbRun = RT_MIN(cbRun, cbToCheck);
+	return GRUB_ERR_NONE;
+}
+
 static grub_uint64_t
 vhdGetSize(void* pBackendData)
 {
@@ -629,12 +743,13 @@ grub_vhd_read(grub_file_t file, char* buf, grub_size_t len)
 	int rc = GRUB_ERR_NONE;
 	grub_size_t real_size;
 	grub_ssize_t size = 0;
+	grub_off_t offset = file->offset;
 	grub_vhd_t vhdio = file->data;
 
 	while (rc == GRUB_ERR_NONE)
 	{
-		rc = vhdRead(vhdio->vhd, file->offset, buf, len, &real_size);
-		file->offset += real_size;
+		rc = vhdRead(vhdio->vhd, offset, buf, len, &real_size);
+		offset += real_size;
 		buf += real_size;
 		size += real_size;
 		if (real_size >= len)
@@ -647,6 +762,33 @@ grub_vhd_read(grub_file_t file, char* buf, grub_size_t len)
 	return size;
 }
 
+static grub_err_t
+grub_vhd_map(grub_file_t file, grub_off_t offset,
+	grub_off_t* pos, grub_size_t* len)
+{
+	grub_vhd_t vhdio = file->data;
+	grub_uint64_t file_offset;
+	grub_size_t size;
+
+	if (vhdMap(vhdio->vhd, offset, *len, &file_offset, &size) != GRUB_ERR_NONE)
+		return grub_error(GRUB_ERR_BAD_ARGUMENT, "vhd block not mapped");
+
+	*len = size;
+	return grub_file_map(vhdio->file, file_offset, pos, len);
+}
+
+static grub_err_t
+grub_vhd_hole(grub_file_t file, grub_off_t offset,
+	grub_size_t* len, int* hole)
+{
+	grub_vhd_t vhdio = file->data;
+
+	if (vhdHole(vhdio->vhd, offset, *len, len, hole) != GRUB_ERR_NONE)
+		return grub_error(GRUB_ERR_BAD_ARGUMENT, "vhd offset out of range");
+
+	return GRUB_ERR_NONE;
+}
+
 static struct grub_fs grub_vhd_fs =
 {
 	.name = "vhd",
@@ -655,6 +797,8 @@ static struct grub_fs grub_vhd_fs =
 	.fs_read = grub_vhd_read,
 	.fs_close = grub_vhd_close,
 	.fs_label = 0,
+	.fs_map = grub_vhd_map,
+	.fs_hole = grub_vhd_hole,
 	.next = 0
 };
 
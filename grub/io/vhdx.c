@@ -1476,6 +1476,66 @@ vhdxClose(void* pBackendData)
 	return rc;
 }
 
+/**
+ * Returns TRUE if the payload block state reads back as zeros.
+ */
+static int
+vhdxBatIsZero(grub_uint64_t uBatEntry)
+{
+	switch (VHDX_BAT_ENTRY_GET_STATE(uBatEntry))
+	{
+	case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_NOT_PRESENT:
+	case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_UNDEFINED:
+	case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_ZERO:
+	case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_UNMAPPED:
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Computes how many bytes starting at offRead in payload block idxBlock can be
+ * served by a single operation. Consecutive zero blocks are merged into one
+ * memset, consecutive fully present blocks are merged as long as they are
+ * physically contiguous in the image file.
+ *
+ * @returns Number of bytes, at most cbToRead.
+ * @param   pImage    Image instance data.
+ * @param   idxBlock  Index of the first payload block (without the
+ *                    interleaved sector bitmap entries).
+ * @param   offRead   Offset inside the first payload block.
+ * @param   cbToRead  Number of bytes requested, must not cross the end of the disk.
+ */
+static grub_size_t
+vhdxGetRunLength(PVHDXIMAGE pImage, grub_uint32_t idxBlock, grub_uint32_t offRead, grub_size_t cbToRead)
+{
+	grub_uint64_t uBatEntry = pImage->paBat[idxBlock + idxBlock / pImage->uChunkRatio].u64BatEntry;
+	int fZero = vhdxBatIsZero(uBatEntry);
+	grub_uint64_t offNext = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) + pImage->cbBlock;
+	grub_size_t cbRun = pImage->cbBlock - offRead;
+
+	while (cbRun < cbToRead)
+	{
+		idxBlock++;
+		uBatEntry = pImage->paBat[idxBlock + idxBlock / pImage->uChunkRatio].u64BatEntry;
+		if (fZero)
+		{
+			if (!vhdxBatIsZero(uBatEntry))
+				break;
+		}
+		else
+		{
+			if (VHDX_BAT_ENTRY_GET_STATE(uBatEntry) != VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT
+				|| VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) != offNext)
+				break;
+			offNext += pImage->cbBlock;
+		}
+		cbRun += pImage->cbBlock;
+	}
+
+	return RT_MIN(cbRun, cbToRead);
+}
+
 static int
 vhdxRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbToRead,
 	grub_size_t* pcbActuallyRead)
@@ -1488,15 +1548,14 @@ vhdxRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbT
 		rc = GRUB_ERR_BAD_ARGUMENT;
 	else
 	{
-		grub_uint32_t idxBat = (grub_uint32_t)(uOffset / pImage->cbBlock);
+		grub_uint32_t idxBlock = (grub_uint32_t)(uOffset / pImage->cbBlock);
 		grub_uint32_t offRead = uOffset % pImage->cbBlock;
+		grub_uint32_t idxBat;
 		grub_uint64_t uBatEntry;
 
-		idxBat += idxBat / pImage->uChunkRatio; /* Add interleaving sector bitmap entries. */
+		idxBat = idxBlock + idxBlock / pImage->uChunkRatio; /* Add interleaving sector bitmap entries. */
 		uBatEntry = pImage->paBat[idxBat].u64BatEntry;
 
-		cbToRead = RT_MIN(cbToRead, pImage->cbBlock - offRead);
-
 		switch (VHDX_BAT_ENTRY_GET_STATE(uBatEntry))
 		{
 		case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_NOT_PRESENT:
@@ -1504,12 +1563,14 @@ vhdxRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbT
 		case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_ZERO:
 		case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_UNMAPPED:
 		{
+			cbToRead = vhdxGetRunLength(pImage, idxBlock, offRead, cbToRead);
 			grub_memset(pvBuf, 0, cbToRead);
 			break;
 		}
 		case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT:
 		{
 			grub_uint64_t offFile = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) + offRead;
+			cbToRead = vhdxGetRunLength(pImage, idxBlock, offRead, cbToRead);
 			rc = vhdxFileReadSync(pImage, offFile,
 				pvBuf, cbToRead, NULL);
 			break;
@@ -1527,6 +1588,73 @@ vhdxRead(void* pBackendData, grub_uint64_t uOffset, void* pvBuf, grub_size_t cbT
 	return rc;
 }
 
+/**
+ * Maps the guest offset to the image file offset of a fully present block.
+ *
+ * @returns GRUB_ERR_NONE if the data is stored verbatim in the image file.
+ * @param   pBackendData  Image instance data.
+ * @param   uOffset       Guest offset to map.
+ * @param   cbToMap       Number of bytes requested.
+ * @param   puFileOffset  Where to store the image file offset.
+ * @param   pcbMapped     Where to store the length of the contiguous extent.
+ */
+static int
+vhdxMap(void* pBackendData, grub_uint64_t uOffset, grub_size_t cbToMap,
+	grub_uint64_t* puFileOffset, grub_size_t* pcbMapped)
+{
+	PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+	grub_uint32_t idxBlock;
+	grub_uint32_t offRead;
+	grub_uint64_t uBatEntry;
+
+	if (uOffset + cbToMap > pImage->cbSize
+		|| cbToMap == 0)
+		return GRUB_ERR_BAD_ARGUMENT;
+
+	idxBlock = (grub_uint32_t)(uOffset / pImage->cbBlock);
+	offRead = uOffset % pImage->cbBlock;
+	uBatEntry = pImage->paBat[idxBlock + idxBlock / pImage->uChunkRatio].u64BatEntry;
+
+	if (VHDX_BAT_ENTRY_GET_STATE(uBatEntry) != VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT)
+		return GRUB_ERR_BAD_ARGUMENT;
+
+	*puFileOffset = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) + offRead;
+	*pcbMapped = vhdxGetRunLength(pImage, idxBlock, offRead, cbToMap);
+	return GRUB_ERR_NONE;
+}
+
+/**
+ * Tells whether the guest offset lies in a run of blocks that read as zeros.
+ *
+ * @returns GRUB_ERR_NONE on success.
+ * @param   pBackendData  Image instance data.
+ * @param   uOffset       Guest offset to check.
+ * @param   cbToCheck     Number of bytes requested.
+ * @param   pcbRun        Where to store the length of the zero or data run.
+ * @param   pfZero        Where to store whether the run reads as zeros.
+ */
+static int
+vhdxHole(void* pBackendData, grub_uint64_t uOffset, grub_size_t cbToCheck,
+	grub_size_t* pcbRun, int* pfZero)
+{
+	PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+	grub_uint32_t idxBlock;
+	grub_uint32_t offRead;
+	grub_uint64_t uBatEntry;
+
+	if (uOffset + cbToCheck > pImage->cbSize
+		|| cbToCheck == 0)
+		return GRUB_ERR_BAD_ARGUMENT;
+
+	idxBlock = (grub_uint32_t)(uOffset / pImage->cbBlock);
+	offRead = uOffset % pImage->cbBlock;
+	uBatEntry = pImage->paBat[idxBlock + idxBlock / pImage->uChunkRatio].u64BatEntry;
+
+	*pfZero = vhdxBatIsZero(uBatEntry);
+	*pcbRun = vhdxGetRunLength(pImage, idxBlock, offRead, cbToCheck);
+	return GRUB_ERR_NONE;
+}
+
 static grub_uint64_t
 vhdxGetSize(void* pBackendData)
 {
@@ -1612,12 +1740,13 @@ grub_vhdx_read(grub_file_t file, char* buf, grub_size_t len)
 	int rc = GRUB_ERR_NONE;
 	grub_size_t real_size;
 	grub_ssize_t size = 0;
+	grub_off_t offset = file->offset;
 	grub_vhdx_t vhdxio = file->data;
 
 	while (rc == GRUB_ERR_NONE)
 	{
-		rc = vhdxRead(vhdxio->vhdx, file->offset, buf, len, &real_size);
-		file->offset += real_size;
+		rc = vhdxRead(vhdxio->vhdx, offset, buf, len, &real_size);
+		offset += real_size;
 		buf += real_size;
 		size += real_size;
 		if (real_size >= len)
@@ -1630,6 +1759,33 @@ grub_vhdx_read(grub_file_t file, char* buf, grub_size_t len)
 	return size;
 }
 
+static grub_err_t
+grub_vhdx_map(grub_file_t file, grub_off_t offset,
+	grub_off_t* pos, grub_size_t* len)
+{
+	grub_vhdx_t vhdxio = file->data;
+	grub_uint64_t file_offset;
+	grub_size_t size;
+
+	if (vhdxMap(vhdxio->vhdx, offset, *len, &file_offset, &size) != GRUB_ERR_NONE)
+		return grub_error(GRUB_ERR_BAD_ARGUMENT, "vhdx block not mapped");
+
+	*len = size;
+	return grub_file_map(vhdxio->file, file_offset, pos, len);
+}
+
+static grub_err_t
+grub_vhdx_hole(grub_file_t file, grub_off_t offset,
+	grub_size_t* len, int* hole)
+{
+	grub_vhdx_t vhdxio = file->data;
+
+	if (vhdxHole(vhdxio->vhdx, offset, *len, len, hole) != GRUB_ERR_NONE)
+		return grub_error(GRUB_ERR_BAD_ARGUMENT, "vhdx offset out of range");
+
+	return GRUB_ERR_NONE;
+}
+
 static struct grub_fs grub_vhdx_fs =
 {
 	.name = "vhdx",
@@ -1638,6 +1794,8 @@ static struct grub_fs grub_vhdx_fs =
 	.fs_read = grub_vhdx_read,
 	.fs_close = grub_vhdx_close,
 	.fs_label = 0,
+	.fs_map = grub_vhdx_map,
+	.fs_hole = grub_vhdx_hole,
 	.next = 0
 };
 
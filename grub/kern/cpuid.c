@@ -0,0 +1,111 @@
+/* cpuid.c - instruction set extensions of the running processor */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/cpuid.h>
+
+#if defined(GRUB_CPU_X86) && !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
+
+/* Marks FEATURES as filled in, every thread computes the same value so
+   racing on it is harmless.  */
+#define GRUB_CPU_VALID	(1U << 31)
+
+static volatile grub_uint32_t features;
+
+#ifdef GRUB_CPU_X86
+static void
+cpuid(unsigned leaf, unsigned reg[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int*)reg, leaf, 0);
+#else
+	__cpuid_count(leaf, 0, reg[0], reg[1], reg[2], reg[3]);
+#endif
+}
+
+static grub_uint64_t
+xgetbv(void)
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned lo, hi;
+	__asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((grub_uint64_t)hi << 32) | lo;
+#endif
+}
+
+static grub_uint32_t
+detect(void)
+{
+	grub_uint32_t ret = 0;
+	unsigned reg[4];
+	unsigned max;
+
+	cpuid(0, reg);
+	max = reg[0];
+	if (max < 1)
+		return 0;
+
+	cpuid(1, reg);
+	if (reg[2] & (1 << 9))
+		ret |= GRUB_CPU_SSSE3;
+	if (reg[2] & (1 << 19))
+		ret |= GRUB_CPU_SSE41;
+	if (reg[2] & (1 << 20))
+		ret |= GRUB_CPU_SSE42;
+	if (reg[2] & (1 << 1))
+		ret |= GRUB_CPU_PCLMUL;
+	/* AVX needs OSXSAVE and the OS enabling the XMM and YMM state.  */
+	if ((reg[2] & (1 << 27)) && (reg[2] & (1 << 28)) && max >= 7
+		&& (xgetbv() & 6) == 6)
+	{
+		cpuid(7, reg);
+		if (reg[1] & (1 << 5))
+			ret |= GRUB_CPU_AVX2;
+	}
+	if (max >= 7)
+	{
+		cpuid(7, reg);
+		if (reg[1] & (1 << 29))
+			ret |= GRUB_CPU_SHA;
+	}
+	return ret;
+}
+#else
+static grub_uint32_t
+detect(void)
+{
+	return 0;
+}
+#endif
+
+grub_uint32_t
+grub_cpu_features(void)
+{
+	grub_uint32_t ret = features;
+
+	if (!(ret & GRUB_CPU_VALID))
+	{
+		ret = detect() | GRUB_CPU_VALID;
+		features = ret;
+	}
+	return ret & ~GRUB_CPU_VALID;
+}
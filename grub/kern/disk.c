@@ -23,6 +23,8 @@
 #include <grub/partition.h>
 #include <grub/misc.h>
 #include <grub/time.h>
+#include <grub/thread.h>
+#include <grub/stats.h>
 
 #define	GRUB_CACHE_TIMEOUT	2
 
@@ -92,25 +94,38 @@ grub_disk_cache_get_index(unsigned long dev_id, unsigned long disk_id,
 		% GRUB_DISK_CACHE_NUM);
 }
 
+/* Cache lines are guarded by a lock per shard, so readers of different
+   lines don't contend.  */
+static grub_mutex_t grub_disk_cache_lock[GRUB_DISK_CACHE_SHARDS];
+
+static grub_mutex_t*
+grub_disk_cache_shard(unsigned cache_index)
+{
+	return grub_disk_cache_lock + (cache_index % GRUB_DISK_CACHE_SHARDS);
+}
+
 static void
 grub_disk_cache_invalidate(unsigned long dev_id, unsigned long disk_id,
 	grub_disk_addr_t sector)
 {
 	unsigned cache_index;
 	struct grub_disk_cache* cache;
+	char* data = 0;
 
 	sector &= ~((grub_disk_addr_t)GRUB_DISK_CACHE_SIZE - 1);
 	cache_index = grub_disk_cache_get_index(dev_id, disk_id, sector);
 	cache = grub_disk_cache_table + cache_index;
 
+	grub_mutex_lock(grub_disk_cache_shard(cache_index));
 	if (cache->dev_id == dev_id && cache->disk_id == disk_id
 		&& cache->sector == sector && cache->data)
 	{
-		cache->lock = 1;
-		grub_free(cache->data);
+		data = cache->data;
 		cache->data = 0;
-		cache->lock = 0;
 	}
+	grub_mutex_unlock(grub_disk_cache_shard(cache_index));
+
+	grub_free(data);
 }
 
 void
@@ -122,14 +137,14 @@ grub_disk_cache_invalidate_all(void)
 	{
 		struct grub_disk_cache* cache = grub_disk_cache_table + i;
 
-		if (cache->data && !cache->lock)
-		{
-			grub_free(cache->data);
-			cache->data = 0;
-		}
+		grub_mutex_lock(grub_disk_cache_shard(i));
+		grub_free(cache->data);
+		cache->data = 0;
+		grub_mutex_unlock(grub_disk_cache_shard(i));
 	}
 }
 
+/* On a hit the shard stays locked until grub_disk_cache_unlock().  */
 static char*
 grub_disk_cache_fetch(unsigned long dev_id, unsigned long disk_id,
 	grub_disk_addr_t sector)
@@ -140,13 +155,16 @@ grub_disk_cache_fetch(unsigned long dev_id, unsigned long disk_id,
 	cache_index = grub_disk_cache_get_index(dev_id, disk_id, sector);
 	cache = grub_disk_cache_table + cache_index;
 
+	grub_mutex_lock(grub_disk_cache_shard(cache_index));
 	if (cache->dev_id == dev_id && cache->disk_id == disk_id
-		&& cache->sector == sector)
+		&& cache->sector == sector && cache->data)
 	{
-		cache->lock = 1;
+		grub_stats_cache(GRUB_STATS_CACHE_HIT);
 		return cache->data;
 	}
+	grub_mutex_unlock(grub_disk_cache_shard(cache_index));
 
+	grub_stats_cache(GRUB_STATS_CACHE_MISS);
 	return 0;
 }
 
@@ -154,15 +172,10 @@ static void
 grub_disk_cache_unlock(unsigned long dev_id, unsigned long disk_id,
 	grub_disk_addr_t sector)
 {
-	struct grub_disk_cache* cache;
 	unsigned cache_index;
 
 	cache_index = grub_disk_cache_get_index(dev_id, disk_id, sector);
-	cache = grub_disk_cache_table + cache_index;
-
-	if (cache->dev_id == dev_id && cache->disk_id == disk_id
-		&& cache->sector == sector)
-		cache->lock = 0;
+	grub_mutex_unlock(grub_disk_cache_shard(cache_index));
 }
 
 static grub_err_t
@@ -171,28 +184,48 @@ grub_disk_cache_store(unsigned long dev_id, unsigned long disk_id,
 {
 	unsigned cache_index;
 	struct grub_disk_cache* cache;
+	char* copy;
+	char* old;
 
 	cache_index = grub_disk_cache_get_index(dev_id, disk_id, sector);
 	cache = grub_disk_cache_table + cache_index;
 
-	cache->lock = 1;
-	grub_free(cache->data);
-	cache->data = 0;
-	cache->lock = 0;
-
-	cache->data = grub_malloc(GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
-	if (!cache->data)
+	copy = grub_malloc(GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+	if (!copy)
 		return grub_errno;
-
-	grub_memcpy(cache->data, data,
+	grub_memcpy(copy, data,
 		GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+
+	grub_mutex_lock(grub_disk_cache_shard(cache_index));
+	old = cache->data;
+	if (old && (cache->dev_id != dev_id || cache->disk_id != disk_id
+		|| cache->sector != sector))
+		grub_stats_cache(GRUB_STATS_CACHE_EVICT);
+	cache->data = copy;
 	cache->dev_id = dev_id;
 	cache->disk_id = disk_id;
 	cache->sector = sector;
+	grub_mutex_unlock(grub_disk_cache_shard(cache_index));
+
+	grub_free(old);
 
 	return GRUB_ERR_NONE;
 }
 
+/* Read NUM native sectors straight from the device driver.  */
+static grub_err_t
+grub_disk_dev_read(grub_disk_t disk, grub_disk_addr_t sector,
+	grub_size_t num, void* buf)
+{
+	grub_uint64_t start = grub_stats_start();
+	grub_err_t err;
+
+	err = (disk->dev->disk_read) (disk, sector, num, buf);
+	grub_stats_disk_read(disk, sector, num << disk->log_sector_size, start, err);
+
+	return err;
+}
+
 grub_disk_dev_t grub_disk_dev_list;
 
 void
@@ -394,7 +427,7 @@ grub_disk_read_small_real(grub_disk_t disk, grub_disk_addr_t sector,
 		< (disk->total_sectors << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS)))
 	{
 		grub_err_t err;
-		err = (disk->dev->disk_read) (disk, grub_disk_to_native_sector(disk, sector),
+		err = grub_disk_dev_read(disk, grub_disk_to_native_sector(disk, sector),
 			1U << (GRUB_DISK_CACHE_BITS
 				+ GRUB_DISK_SECTOR_BITS
 				- disk->log_sector_size), tmp_buf);
@@ -430,7 +463,7 @@ grub_disk_read_small_real(grub_disk_t disk, grub_disk_addr_t sector,
 		if (!tmp_buf)
 			return grub_errno;
 
-		if ((disk->dev->disk_read) (disk, grub_disk_to_native_sector(disk, aligned_sector),
+		if (grub_disk_dev_read(disk, grub_disk_to_native_sector(disk, aligned_sector),
 			num, tmp_buf))
 		{
 			grub_error_push();
@@ -466,6 +499,8 @@ grub_err_t
 grub_disk_read(grub_disk_t disk, grub_disk_addr_t sector,
 	grub_off_t offset, grub_size_t size, void* buf)
 {
+	grub_stats_disk_request(disk, size);
+
 	/* First of all, check if the region is within the disk.  */
 	if (grub_disk_adjust_range(disk, &sector, &offset, size) != GRUB_ERR_NONE)
 	{
@@ -536,7 +571,7 @@ grub_disk_read(grub_disk_t disk, grub_disk_addr_t sector,
 		{
 			grub_disk_addr_t i;
 
-			err = (disk->dev->disk_read) (disk, grub_disk_to_native_sector(disk, sector),
+			err = grub_disk_dev_read(disk, grub_disk_to_native_sector(disk, sector),
 				agglomerate << (GRUB_DISK_CACHE_BITS
 					+ GRUB_DISK_SECTOR_BITS
 					- disk->log_sector_size),
@@ -553,8 +588,12 @@ grub_disk_read(grub_disk_t disk, grub_disk_addr_t sector,
 
 
 			if (disk->read_hook)
-				(disk->read_hook) (sector, 0, agglomerate << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS),
+			{
+				err = (disk->read_hook) (sector, 0, agglomerate << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS),
 					buf, disk->read_hook_data);
+				if (err)
+					return err;
+			}
 
 			sector += agglomerate << GRUB_DISK_CACHE_BITS;
 			size -= agglomerate << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS);
@@ -565,8 +604,12 @@ grub_disk_read(grub_disk_t disk, grub_disk_addr_t sector,
 		if (data)
 		{
 			if (disk->read_hook)
-				(disk->read_hook) (sector, 0, (GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS),
+			{
+				err = (disk->read_hook) (sector, 0, (GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS),
 					buf, disk->read_hook_data);
+				if (err)
+					return err;
+			}
 			sector += GRUB_DISK_CACHE_SIZE;
 			buf = (char*)buf + (GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS);
 			size -= (GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS);
@@ -585,6 +628,67 @@ grub_disk_read(grub_disk_t disk, grub_disk_addr_t sector,
 	return grub_errno;
 }
 
+/* Read data from the disk without going through the disk cache.  Used for
+   data that is already cached under another device.  */
+grub_err_t
+grub_disk_read_nocache(grub_disk_t disk, grub_disk_addr_t sector,
+	grub_off_t offset, grub_size_t size, void* buf)
+{
+	grub_disk_addr_t real_sector = sector;
+	grub_off_t real_offset = offset;
+	grub_uint64_t pos, real_pos;
+	grub_size_t mask = (1U << disk->log_sector_size) - 1;
+	grub_size_t max_size;
+	grub_size_t len;
+
+	if (grub_disk_adjust_range(disk, &real_sector, &real_offset, size) != GRUB_ERR_NONE)
+		return grub_errno;
+
+	pos = (sector << GRUB_DISK_SECTOR_BITS) + offset;
+	real_pos = (real_sector << GRUB_DISK_SECTOR_BITS) + real_offset;
+
+	/* Partial native sectors at both ends go through the cache.  */
+	if (real_pos & mask)
+	{
+		len = (mask + 1) - (real_pos & mask);
+		if (len > size)
+			len = size;
+		if (grub_disk_read(disk, 0, pos, len, buf))
+			return grub_errno;
+		buf = (char*)buf + len;
+		size -= len;
+		pos += len;
+		real_pos += len;
+	}
+
+	max_size = (grub_size_t)disk->max_agglomerate
+		<< (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS);
+	if (max_size < mask + 1)
+		max_size = mask + 1;
+
+	while (size > mask)
+	{
+		len = size & ~mask;
+		if (len > max_size)
+			len = max_size;
+		if (grub_disk_dev_read(disk, real_pos >> disk->log_sector_size,
+			len >> disk->log_sector_size, buf))
+			return grub_errno;
+		if (disk->read_hook && (disk->read_hook) (real_pos >> GRUB_DISK_SECTOR_BITS, 0, len,
+			buf, disk->read_hook_data))
+			return grub_errno;
+		buf = (char*)buf + len;
+		size -= len;
+		pos += len;
+		real_pos += len;
+	}
+
+	if (size)
+		return grub_disk_read(disk, 0, pos, size, buf);
+
+	return GRUB_ERR_NONE;
+}
+
 grub_uint64_t
 grub_disk_native_sectors(grub_disk_t disk)
 {
@@ -20,6 +20,7 @@
 #include <grub/types.h>
 #include <grub/procfs.h>
 #include <grub/misc.h>
+#include <grub/partition.h>
 
 #include "version.h"
 
@@ -41,11 +42,19 @@ struct grub_procfs_entry version_info =
 };
 
 void grub_module_init_progress(void);
+#ifndef GRUB_HEADLESS
 void grub_module_init_efivars(void);
+#endif
 
 void grub_module_init_procfs(void);
+void grub_module_init_stats(void);
 void grub_module_init_diskfilter(void);
+#ifdef GRUB_HEADLESS
+void grub_module_init_hostdisk(void);
+void grub_module_init_hostfs(void);
+#else
 void grub_module_init_windisk(void);
+#endif
 void grub_module_init_ldm(void);
 void grub_module_init_lvm(void);
 void grub_module_init_dm_nv(void);
@@ -130,11 +139,19 @@ void
 grub_module_init(void)
 {
 	grub_module_init_progress();
+#ifndef GRUB_HEADLESS
 	grub_module_init_efivars();
+#endif
 
 	grub_module_init_procfs();
+	grub_module_init_stats();
 	grub_module_init_diskfilter();
+#ifdef GRUB_HEADLESS
+	grub_module_init_hostdisk();
+	grub_module_init_hostfs();
+#else
 	grub_module_init_windisk();
+#endif
 	grub_module_init_ldm();
 	grub_module_init_lvm();
 	grub_module_init_dm_nv();
@@ -219,11 +236,19 @@ grub_module_init(void)
 }
 
 void grub_module_fini_progress(void);
+#ifndef GRUB_HEADLESS
 void grub_module_fini_efivars(void);
+#endif
 
 void grub_module_fini_procfs(void);
+void grub_module_fini_stats(void);
 void grub_module_fini_diskfilter(void);
+#ifdef GRUB_HEADLESS
+void grub_module_fini_hostdisk(void);
+void grub_module_fini_hostfs(void);
+#else
 void grub_module_fini_windisk(void);
+#endif
 void grub_module_fini_ldm(void);
 void grub_module_fini_lvm(void);
 void grub_module_fini_dm_nv(void);
@@ -308,11 +333,19 @@ void
 grub_module_fini(void)
 {
 	grub_module_fini_progress();
+#ifndef GRUB_HEADLESS
 	grub_module_fini_efivars();
+#endif
 
 	grub_module_fini_procfs();
+	grub_module_fini_stats();
 	grub_module_fini_diskfilter();
+#ifdef GRUB_HEADLESS
+	grub_module_fini_hostdisk();
+	grub_module_fini_hostfs();
+#else
 	grub_module_fini_windisk();
+#endif
 	grub_module_fini_ldm();
 	grub_module_fini_lvm();
 	grub_module_fini_dm_nv();
@@ -334,6 +367,7 @@ grub_module_fini(void)
 	grub_module_fini_part_plan();
 	grub_module_fini_part_sun();
 	grub_module_fini_part_sunpc();
+	grub_partition_cache_flush();
 
 	grub_module_fini_affs();
 	grub_module_fini_afs();
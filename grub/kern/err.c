@@ -25,14 +25,14 @@
 
 #define GRUB_ERROR_STACK_SIZE	10
 
-grub_err_t grub_errno;
-char grub_errmsg[GRUB_MAX_ERRMSG];
+GRUB_THREAD_LOCAL grub_err_t grub_errno;
+GRUB_THREAD_LOCAL char grub_errmsg[GRUB_MAX_ERRMSG];
 int grub_err_printed_errors;
 
-static struct grub_error_saved grub_error_stack_items[GRUB_ERROR_STACK_SIZE];
+static GRUB_THREAD_LOCAL struct grub_error_saved grub_error_stack_items[GRUB_ERROR_STACK_SIZE];
 
-static int grub_error_stack_pos;
-static int grub_error_stack_assert;
+static GRUB_THREAD_LOCAL int grub_error_stack_pos;
+static GRUB_THREAD_LOCAL int grub_error_stack_assert;
 
 grub_err_t
 grub_error(grub_err_t n, const char* fmt, ...)
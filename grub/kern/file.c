@@ -23,6 +23,7 @@
 #include <grub/mm.h>
 #include <grub/fs.h>
 #include <grub/disk.h>
+#include <grub/stats.h>
 
 grub_file_filter_t grub_file_filters[GRUB_FILE_FILTER_MAX];
 
@@ -61,6 +62,7 @@ grub_file_open(const char* name, enum grub_file_type type)
 	char* disk_name;
 	const char* file_name;
 	grub_file_filter_id_t filter;
+	grub_uint64_t start;
 
 	/* Reset grub_errno before we start. */
 	grub_errno = GRUB_ERR_NONE;
@@ -103,8 +105,10 @@ grub_file_open(const char* name, enum grub_file_type type)
 			goto fail;
 	}
 
+	start = grub_stats_start();
 	if ((file->fs->fs_open) (file, file_name) != GRUB_ERR_NONE)
 		goto fail;
+	grub_stats_fs(file->fs, GRUB_STATS_FS_OPEN, 0, start);
 
 	file->name = grub_strdup(name);
 	grub_errno = GRUB_ERR_NONE;
@@ -116,9 +120,11 @@ grub_file_open(const char* name, enum grub_file_type type)
 		if (grub_file_filters[filter])
 		{
 			last_file = file;
+			start = grub_stats_start();
 			file = grub_file_filters[filter](file, type);
 			if (file && file != last_file)
 			{
+				grub_stats_fs(file->fs, GRUB_STATS_FS_OPEN, 0, start);
 				file->name = grub_strdup(name);
 				grub_errno = GRUB_ERR_NONE;
 				break;
@@ -131,9 +137,11 @@ grub_file_open(const char* name, enum grub_file_type type)
 		if (grub_file_filters[filter])
 		{
 			last_file = file;
+			start = grub_stats_start();
 			file = grub_file_filters[filter](file, type);
 			if (file && file != last_file)
 			{
+				grub_stats_fs(file->fs, GRUB_STATS_FS_OPEN, 0, start);
 				file->name = grub_strdup(name);
 				grub_errno = GRUB_ERR_NONE;
 				break;
@@ -158,6 +166,7 @@ fail:
 }
 
 grub_disk_read_hook_t grub_file_progress_hook;
+GRUB_THREAD_LOCAL struct grub_progress* grub_file_progress;
 
 grub_ssize_t
 grub_file_read(grub_file_t file, void* buf, grub_size_t len)
@@ -165,6 +174,7 @@ grub_file_read(grub_file_t file, void* buf, grub_size_t len)
 	grub_ssize_t res;
 	grub_disk_read_hook_t read_hook;
 	void* read_hook_data;
+	grub_uint64_t start;
 
 	if (file->offset > file->size)
 	{
@@ -176,6 +186,12 @@ grub_file_read(grub_file_t file, void* buf, grub_size_t len)
 	if (len == 0)
 		return 0;
 
+	if (grub_file_progress && grub_file_progress->cancel)
+	{
+		grub_error(GRUB_ERR_CANCELLED, N_("operation cancelled"));
+		return -1;
+	}
+
 	if (len > file->size - file->offset)
 		len = file->size - file->offset;
 
@@ -193,7 +209,10 @@ grub_file_read(grub_file_t file, void* buf, grub_size_t len)
 		file->read_hook_data = file;
 		file->progress_offset = file->offset;
 	}
+	start = grub_stats_start();
 	res = (file->fs->fs_read) (file, buf, len);
+	if (res > 0)
+		grub_stats_fs(file->fs, GRUB_STATS_FS_READ, res, start);
 	file->read_hook = read_hook;
 	file->read_hook_data = read_hook_data;
 	if (res > 0)
@@ -232,3 +251,43 @@ grub_file_seek(grub_file_t file, grub_off_t offset)
 
 	return old;
 }
+
+grub_err_t
+grub_file_map(grub_file_t file, grub_off_t offset,
+	grub_off_t* pos, grub_size_t* len)
+{
+	if (!file->fs->fs_map)
+		return grub_error(GRUB_ERR_NOT_IMPLEMENTED_YET,
+			"%s doesn't support extent mapping", file->fs->name);
+
+	if (offset >= file->size)
+		return grub_error(GRUB_ERR_OUT_OF_RANGE,
+			N_("attempt to read past the end of file"));
+
+	if (*len > file->size - offset)
+		*len = file->size - offset;
+
+	if (*len == 0)
+		return grub_error(GRUB_ERR_OUT_OF_RANGE,
+			N_("attempt to read past the end of file"));
+
+	return (file->fs->fs_map) (file, offset, pos, len);
+}
+
+grub_err_t
+grub_file_hole(grub_file_t file, grub_off_t offset,
+	grub_size_t* len, int* hole)
+{
+	if (offset >= file->size)
+		return grub_error(GRUB_ERR_OUT_OF_RANGE,
+			N_("attempt to read past the end of file"));
+
+	if (*len > file->size - offset)
+		*len = file->size - offset;
+
+	*hole = 0;
+	if (*len == 0 || !file->fs->fs_hole)
+		return GRUB_ERR_NONE;
+
+	return (file->fs->fs_hole) (file, offset, len, hole);
+}
@@ -24,9 +24,72 @@
 #include <grub/misc.h>
 #include <grub/types.h>
 #include <grub/mm.h>
+#include <grub/partition.h>
+#include <grub/thread.h>
+#include <grub/stats.h>
 
 grub_fs_t grub_fs_list = 0;
 
+/* Probe results, keyed by device and partition.  A null FS records an
+   unknown filesystem.  */
+#define GRUB_FS_PROBE_CACHE_NUM	67
+
+struct grub_fs_probe_cache
+{
+	unsigned long dev_id;
+	unsigned long disk_id;
+	grub_disk_addr_t start;
+	grub_uint64_t len;
+	grub_fs_t fs;
+	int valid;
+};
+
+static struct grub_fs_probe_cache grub_fs_probe_cache_table[GRUB_FS_PROBE_CACHE_NUM];
+static grub_mutex_t grub_fs_probe_cache_lock;
+
+static struct grub_fs_probe_cache*
+grub_fs_probe_cache_get(grub_disk_t disk)
+{
+	grub_disk_addr_t start = 0;
+	unsigned cache_index;
+
+	if (disk->partition)
+		start = grub_partition_get_start(disk->partition);
+
+	cache_index = (disk->dev->id * 524287UL + disk->id * 2606459UL
+		+ (unsigned)start) % GRUB_FS_PROBE_CACHE_NUM;
+
+	return grub_fs_probe_cache_table + cache_index;
+}
+
+static int
+grub_fs_probe_cache_match(const struct grub_fs_probe_cache* cache, grub_disk_t disk)
+{
+	return cache->valid
+		&& cache->dev_id == disk->dev->id
+		&& cache->disk_id == disk->id
+		&& cache->start == (disk->partition ? grub_partition_get_start(disk->partition) : 0)
+		&& cache->len == grub_disk_native_sectors(disk);
+}
+
+void
+grub_fs_probe_invalidate(unsigned long dev_id, unsigned long disk_id)
+{
+	unsigned i;
+
+	grub_mutex_lock(&grub_fs_probe_cache_lock);
+	for (i = 0; i < GRUB_FS_PROBE_CACHE_NUM; i++)
+	{
+		struct grub_fs_probe_cache* cache = grub_fs_probe_cache_table + i;
+
+		if (cache->valid
+			&& cache->dev_id == dev_id
+			&& cache->disk_id == disk_id)
+			cache->valid = 0;
+	}
+	grub_mutex_unlock(&grub_fs_probe_cache_lock);
+}
+
 /* Helper for grub_fs_probe.  */
 static int
 probe_dummy_iter(const char* filename __attribute__((unused)),
@@ -36,18 +99,88 @@ probe_dummy_iter(const char* filename __attribute__((unused)),
 	return 1;
 }
 
+/* Helper for grub_fs_probe.  Return zero if the superblock area SB rules
+   out the filesystem P.  */
+static int
+probe_candidate(grub_fs_t p, grub_disk_t disk,
+	const grub_uint8_t* sb, grub_size_t size)
+{
+	const struct grub_fs_signature* sig;
+	int checked = 0;
+
+	if (!sb)
+		return 1;
+
+	if (p->fs_detect && !(p->fs_detect) (disk, sb, size))
+		return 0;
+
+	if (!p->fs_signatures)
+		return 1;
+
+	for (sig = p->fs_signatures; sig->len; sig++)
+	{
+		if (sig->offset + sig->len > size)
+			continue;
+		if (grub_memcmp(sb + sig->offset, sig->magic, sig->len) == 0)
+			return 1;
+		checked = 1;
+	}
+
+	/* No signature inside the probe area, can't tell.  */
+	return !checked;
+}
+
 grub_fs_t
 grub_fs_probe(grub_disk_t disk)
 {
 	grub_fs_t p;
+	struct grub_fs_probe_cache* cache;
+	grub_uint8_t* sb = NULL;
+	grub_size_t size = GRUB_FS_PROBE_SIZE;
+	grub_uint64_t len;
+	grub_uint64_t start;
+
+	cache = grub_fs_probe_cache_get(disk);
+	grub_mutex_lock(&grub_fs_probe_cache_lock);
+	if (grub_fs_probe_cache_match(cache, disk))
+	{
+		p = cache->fs;
+		grub_mutex_unlock(&grub_fs_probe_cache_lock);
+		if (!p)
+			grub_error(GRUB_ERR_UNKNOWN_FS, N_("unknown filesystem"));
+		return p;
+	}
+	grub_mutex_unlock(&grub_fs_probe_cache_lock);
+
+	/* Read the well-known superblock locations once.  */
+	len = grub_disk_native_sectors(disk);
+	if (len != GRUB_DISK_SIZE_UNKNOWN && (len << GRUB_DISK_SECTOR_BITS) < size)
+		size = (grub_size_t)(len << GRUB_DISK_SECTOR_BITS);
+	sb = grub_malloc(size);
+	if (sb && grub_disk_read(disk, 0, 0, size, sb))
+	{
+		grub_free(sb);
+		sb = NULL;
+	}
+	grub_errno = GRUB_ERR_NONE;
 
 	for (p = grub_fs_list; p; p = p->next)
 	{
+		if (!probe_candidate(p, disk, sb, size))
+		{
+			grub_dprintf("fs", "Skipping %s, no signature.\n", p->name);
+			continue;
+		}
+
 		grub_dprintf("fs", "Detecting %s...\n", p->name);
+		start = grub_stats_start();
 		(p->fs_dir) (disk, "/", probe_dummy_iter, NULL);
 
 		if (grub_errno == GRUB_ERR_NONE)
-			return p;
+		{
+			grub_stats_fs(p, GRUB_STATS_FS_MOUNT, 0, start);
+			break;
+		}
 
 		grub_error_push();
 		/* The grub_error_push() does not touch grub_errmsg. */
@@ -57,13 +190,28 @@ grub_fs_probe(grub_disk_t disk)
 
 		if (grub_errno != GRUB_ERR_BAD_FS
 			&& grub_errno != GRUB_ERR_OUT_OF_RANGE)
+		{
+			grub_free(sb);
 			return 0;
+		}
 
 		grub_errno = GRUB_ERR_NONE;
 	}
 
-	grub_error(GRUB_ERR_UNKNOWN_FS, N_("unknown filesystem"));
-	return 0;
+	grub_free(sb);
+
+	grub_mutex_lock(&grub_fs_probe_cache_lock);
+	cache->dev_id = disk->dev->id;
+	cache->disk_id = disk->id;
+	cache->start = disk->partition ? grub_partition_get_start(disk->partition) : 0;
+	cache->len = len;
+	cache->fs = p;
+	cache->valid = 1;
+	grub_mutex_unlock(&grub_fs_probe_cache_lock);
+
+	if (!p)
+		grub_error(GRUB_ERR_UNKNOWN_FS, N_("unknown filesystem"));
+	return p;
 }
 
 /* Block list support routines.  */
@@ -194,6 +342,34 @@ grub_fs_blocklist_read(grub_file_t file, char* buf, grub_size_t len)
 	return ret;
 }
 
+static grub_err_t
+grub_fs_blocklist_map(grub_file_t file, grub_off_t offset,
+	grub_off_t* pos, grub_size_t* len)
+{
+	struct grub_fs_block* p;
+	grub_disk_addr_t sector;
+	grub_off_t size;
+
+	sector = (offset >> GRUB_DISK_SECTOR_BITS);
+	for (p = file->data; p->length; p++)
+	{
+		if (sector < p->length)
+		{
+			*pos = ((p->offset + sector) << GRUB_DISK_SECTOR_BITS)
+				+ (offset & (GRUB_DISK_SECTOR_SIZE - 1));
+			size = ((p->length - sector) << GRUB_DISK_SECTOR_BITS)
+				- (offset & (GRUB_DISK_SECTOR_SIZE - 1));
+			if (*len > size)
+				*len = (grub_size_t)size;
+			return GRUB_ERR_NONE;
+		}
+		sector -= p->length;
+	}
+
+	return grub_error(GRUB_ERR_OUT_OF_RANGE,
+		N_("attempt to read past the end of file"));
+}
+
 struct grub_fs grub_fs_blocklist =
 {
   .name = "blocklist",
@@ -201,5 +377,6 @@ struct grub_fs grub_fs_blocklist =
   .fs_open = grub_fs_blocklist_open,
   .fs_read = grub_fs_blocklist_read,
   .fs_close = 0,
+  .fs_map = grub_fs_blocklist_map,
   .next = 0
 };
@@ -22,10 +22,13 @@
 #include <grub/mm.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <grub/types.h>
 #include <grub/charset.h>
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 
 union printf_arg
 {
@@ -164,8 +167,8 @@ grub_debug_enabled(const char* condition)
 	return ret;
 }
 
-static char debug_title[256];
-static char debug_info[512];
+static GRUB_THREAD_LOCAL char debug_title[256];
+static GRUB_THREAD_LOCAL char debug_info[512];
 
 void
 grub_real_dprintf(const char* file, const int line, const char* condition,
@@ -179,7 +182,11 @@ grub_real_dprintf(const char* file, const int line, const char* condition,
 		va_start(args, fmt);
 		grub_vsnprintf(debug_info, 512, fmt, args);
 		va_end(args);
+#ifdef _WIN32
 		MessageBoxA(NULL, debug_info, debug_title, MB_OK);
+#else
+		fprintf(stderr, "%s: %s\n", debug_title, debug_info);
+#endif
 	}
 }
 
@@ -1096,7 +1103,11 @@ grub_fatal(const char* fmt, ...)
 	grub_vsnprintf(buf, 256, fmt, ap);
 	va_end(ap);
 
+#ifdef _WIN32
 	MessageBoxA(NULL, buf, "GRUB Fatal Error", MB_OK | MB_ICONERROR);
+#else
+	fprintf(stderr, "GRUB Fatal Error: %s\n", buf);
+#endif
 	exit(-1);
 }
 
@@ -1149,7 +1160,8 @@ grub_get_human_size(grub_uint64_t size, enum grub_human_size_type type)
 {
 	grub_uint64_t fsize;
 	unsigned units = 0;
-	static char buf[30];
+	/* Disks are enumerated on worker threads.  */
+	static GRUB_THREAD_LOCAL char buf[30];
 	const char* umsg;
 
 	if (type != GRUB_HUMAN_SIZE_SPEED)
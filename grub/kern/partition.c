@@ -20,9 +20,47 @@
 #include <grub/mm.h>
 #include <grub/partition.h>
 #include <grub/disk.h>
+#include <grub/thread.h>
 
 grub_partition_map_t grub_partition_map_list;
 
+/* Parsed partition tables of whole disks, so opening a partition or
+   listing them doesn't read and parse the tables again.  Nodes are kept
+   in the order grub_partition_iterate reports them, each subtree follows
+   its root.  */
+#define GRUB_PARTITION_CACHE_NUM	31
+
+struct grub_partition_cache_node
+{
+	struct grub_partition part;
+	/* Index of the containing partition, -1 for the disk itself.  */
+	int parent;
+	int depth;
+};
+
+/* A partition map that parsed under PARENT, whether or not it reported
+   anything.  Probing stops at the first of them, like the uncached path.  */
+struct grub_partition_cache_answer
+{
+	int parent;
+	const struct grub_partition_map* partmap;
+};
+
+struct grub_partition_cache
+{
+	struct grub_partition_cache* next;
+	unsigned long dev_id;
+	unsigned long disk_id;
+	grub_disk_addr_t total_sectors;
+	struct grub_partition_cache_node* nodes;
+	int count;
+	struct grub_partition_cache_answer* answers;
+	int answer_count;
+};
+
+static struct grub_partition_cache* grub_partition_cache_table[GRUB_PARTITION_CACHE_NUM];
+static grub_mutex_t grub_partition_cache_lock;
+
 /*
  * Checks that disk->partition contains part.  This function assumes that the
  * start of part is relative to the start of disk->partition.  Returns 1 if
@@ -97,6 +135,353 @@ fail:
 	return 0;
 }
 
+static unsigned
+grub_partition_cache_get_index(unsigned long dev_id, unsigned long disk_id)
+{
+	return (dev_id * 524287UL + disk_id * 2606459UL) % GRUB_PARTITION_CACHE_NUM;
+}
+
+static void
+grub_partition_cache_free(struct grub_partition_cache* cache)
+{
+	grub_free(cache->nodes);
+	grub_free(cache->answers);
+	grub_free(cache);
+}
+
+void
+grub_partition_cache_invalidate(unsigned long dev_id, unsigned long disk_id)
+{
+	struct grub_partition_cache** prev;
+	struct grub_partition_cache* cache;
+
+	grub_mutex_lock(&grub_partition_cache_lock);
+	prev = grub_partition_cache_table + grub_partition_cache_get_index(dev_id, disk_id);
+	for (cache = *prev; cache; cache = *prev)
+	{
+		if (cache->dev_id == dev_id && cache->disk_id == disk_id)
+		{
+			*prev = cache->next;
+			grub_partition_cache_free(cache);
+			continue;
+		}
+		prev = &cache->next;
+	}
+	grub_mutex_unlock(&grub_partition_cache_lock);
+}
+
+void
+grub_partition_cache_flush(void)
+{
+	struct grub_partition_cache* cache;
+	unsigned i;
+
+	grub_mutex_lock(&grub_partition_cache_lock);
+	for (i = 0; i < GRUB_PARTITION_CACHE_NUM; i++)
+	{
+		while ((cache = grub_partition_cache_table[i]) != 0)
+		{
+			grub_partition_cache_table[i] = cache->next;
+			grub_partition_cache_free(cache);
+		}
+	}
+	grub_mutex_unlock(&grub_partition_cache_lock);
+}
+
+/* Context for grub_partition_cache_build.  */
+struct grub_partition_cache_build_ctx
+{
+	struct grub_partition_cache* cache;
+	grub_size_t alloc;
+	/* The table is incomplete and must not be cached.  */
+	int failed;
+};
+
+/* Per level context for cache_build_iter.  */
+struct grub_partition_cache_level_ctx
+{
+	struct grub_partition_cache_build_ctx* build;
+	int parent;
+	int depth;
+};
+
+static void
+cache_build_level(grub_disk_t disk, struct grub_partition_cache_level_ctx* ctx);
+
+static void
+cache_add_answer(struct grub_partition_cache_build_ctx* build, int parent,
+	const struct grub_partition_map* partmap)
+{
+	struct grub_partition_cache* cache = build->cache;
+	struct grub_partition_cache_answer* answers;
+
+	answers = grub_realloc(cache->answers,
+		(cache->answer_count + 1) * sizeof(*answers));
+	if (!answers)
+	{
+		build->failed = 1;
+		return;
+	}
+	answers[cache->answer_count].parent = parent;
+	answers[cache->answer_count].partmap = partmap;
+	cache->answers = answers;
+	cache->answer_count++;
+}
+
+/* Helper for grub_partition_cache_build.  Mirrors part_iterate.  */
+static int
+cache_build_iter(grub_disk_t dsk, const grub_partition_t partition, void* data)
+{
+	struct grub_partition_cache_level_ctx* ctx = data;
+	struct grub_partition_cache_build_ctx* build = ctx->build;
+	struct grub_partition_cache* cache = build->cache;
+	struct grub_partition_cache_node* node;
+	int index;
+
+	if (!(grub_partition_check_containment(dsk, partition)))
+		return 0;
+
+	if ((grub_size_t)cache->count == build->alloc)
+	{
+		struct grub_partition_cache_node* nodes;
+
+		nodes = grub_realloc(cache->nodes,
+			(build->alloc ? build->alloc * 2 : 16) * sizeof(*nodes));
+		if (!nodes)
+		{
+			build->failed = 1;
+			return 1;
+		}
+		build->alloc = build->alloc ? build->alloc * 2 : 16;
+		cache->nodes = nodes;
+	}
+
+	index = cache->count++;
+	node = cache->nodes + index;
+	node->part = *partition;
+	node->part.parent = 0;
+	node->parent = ctx->parent;
+	node->depth = ctx->depth;
+
+	if (partition->start != 0)
+	{
+		struct grub_partition_cache_level_ctx sub =
+		{
+			.build = build,
+			.parent = index,
+			.depth = ctx->depth + 1
+		};
+		struct grub_partition p = *partition;
+
+		p.parent = dsk->partition;
+		dsk->partition = &p;
+		cache_build_level(dsk, &sub);
+		dsk->partition = p.parent;
+	}
+
+	return build->failed;
+}
+
+static void
+cache_build_level(grub_disk_t disk, struct grub_partition_cache_level_ctx* ctx)
+{
+	const struct grub_partition_map* partmap;
+
+	FOR_PARTITION_MAPS(partmap)
+	{
+		grub_err_t err;
+		err = partmap->iterate(disk, cache_build_iter, ctx);
+		/* A missing table is an answer, a failed read is not.  */
+		if (err == GRUB_ERR_READ_ERROR)
+			ctx->build->failed = 1;
+		else if (err != GRUB_ERR_BAD_PART_TABLE && !ctx->build->failed)
+			cache_add_answer(ctx->build, ctx->parent, partmap);
+		grub_errno = GRUB_ERR_NONE;
+		if (ctx->build->failed)
+			break;
+	}
+}
+
+static struct grub_partition_cache*
+grub_partition_cache_build(grub_disk_t disk)
+{
+	struct grub_partition_cache_build_ctx build = { 0 };
+	struct grub_partition_cache_level_ctx ctx =
+	{
+		.build = &build,
+		.parent = -1,
+		.depth = 0
+	};
+
+	build.cache = grub_zalloc(sizeof(*build.cache));
+	if (!build.cache)
+		return 0;
+	build.cache->dev_id = disk->dev->id;
+	build.cache->disk_id = disk->id;
+	build.cache->total_sectors = disk->total_sectors;
+
+	cache_build_level(disk, &ctx);
+
+	if (build.failed)
+	{
+		grub_partition_cache_free(build.cache);
+		return 0;
+	}
+
+	return build.cache;
+}
+
+/* Look up the table of DISK, parsing it on a miss.  Returns with the cache
+   lock held unless it fails.  */
+static struct grub_partition_cache*
+grub_partition_cache_get(grub_disk_t disk)
+{
+	struct grub_partition_cache** head;
+	struct grub_partition_cache* cache;
+	struct grub_partition_cache* built;
+
+	head = grub_partition_cache_table
+		+ grub_partition_cache_get_index(disk->dev->id, disk->id);
+
+	grub_mutex_lock(&grub_partition_cache_lock);
+	for (cache = *head; cache; cache = cache->next)
+		if (cache->dev_id == disk->dev->id && cache->disk_id == disk->id
+			&& cache->total_sectors == disk->total_sectors)
+			return cache;
+	grub_mutex_unlock(&grub_partition_cache_lock);
+
+	built = grub_partition_cache_build(disk);
+	if (!built)
+		return 0;
+
+	grub_mutex_lock(&grub_partition_cache_lock);
+	for (cache = *head; cache; cache = cache->next)
+		if (cache->dev_id == disk->dev->id && cache->disk_id == disk->id
+			&& cache->total_sectors == disk->total_sectors)
+			break;
+	if (cache)
+	{
+		/* Another thread was faster.  */
+		grub_partition_cache_free(built);
+		return cache;
+	}
+	built->next = *head;
+	*head = built;
+	return built;
+}
+
+/* Return the index of the node describing PART, -1 for the whole disk or
+   -2 if it isn't in CACHE.  */
+static int
+grub_partition_cache_find(const struct grub_partition_cache* cache,
+	const grub_partition_t part)
+{
+	int parent;
+	int i;
+
+	if (!part)
+		return -1;
+
+	parent = grub_partition_cache_find(cache, part->parent);
+	if (parent == -2)
+		return -2;
+
+	for (i = parent + 1; i < cache->count; i++)
+	{
+		const struct grub_partition* p = &cache->nodes[i].part;
+
+		if (cache->nodes[i].parent == parent && p->partmap == part->partmap
+			&& p->number == part->number && p->start == part->start)
+			return i;
+	}
+
+	return -2;
+}
+
+/* Resolve STR from the cached table.  Returns non-zero if the table
+   couldn't be cached.  */
+static int
+grub_partition_cache_probe(grub_disk_t disk, const char* str,
+	grub_partition_t* out)
+{
+	struct grub_partition_cache* cache;
+	grub_partition_t part = 0;
+	const char* ptr;
+	int parent = -1;
+
+	cache = grub_partition_cache_get(disk);
+	if (!cache)
+	{
+		grub_errno = GRUB_ERR_NONE;
+		return 1;
+	}
+
+	for (ptr = str; *ptr;)
+	{
+		grub_partition_t curpart;
+		const struct grub_partition_map* partmap;
+		const char* partname, * partname_end;
+		int num;
+		int i;
+
+		partname = ptr;
+		while (*ptr && grub_isalpha(*ptr))
+			ptr++;
+		partname_end = ptr;
+		num = grub_strtoul(ptr, &ptr, 0) - 1;
+
+		/* Take the number from the first map in list order that parsed
+		   under PARENT, even if it doesn't have it.  */
+		i = cache->count;
+		FOR_PARTITION_MAPS(partmap)
+		{
+			int j;
+
+			if (partname_end != partname &&
+				(grub_strncmp(partmap->name, partname, partname_end - partname)
+					!= 0 || partmap->name[partname_end - partname] != 0))
+				continue;
+
+			for (j = 0; j < cache->answer_count; j++)
+				if (cache->answers[j].parent == parent
+					&& cache->answers[j].partmap == partmap)
+					break;
+			if (j == cache->answer_count)
+				continue;
+
+			for (i = parent + 1; i < cache->count; i++)
+				if (cache->nodes[i].parent == parent
+					&& cache->nodes[i].part.partmap == partmap
+					&& cache->nodes[i].part.number == num)
+					break;
+			break;
+		}
+
+		curpart = (i < cache->count) ? grub_malloc(sizeof(*curpart)) : 0;
+		if (!curpart)
+		{
+			while (part)
+			{
+				curpart = part->parent;
+				grub_free(part);
+				part = curpart;
+			}
+			break;
+		}
+		*curpart = cache->nodes[i].part;
+		curpart->parent = part;
+		part = curpart;
+		parent = i;
+		if (!ptr || *ptr != ',')
+			break;
+		ptr++;
+	}
+
+	grub_mutex_unlock(&grub_partition_cache_lock);
+	*out = part;
+	return 0;
+}
+
 grub_partition_t
 grub_partition_probe(struct grub_disk* disk, const char* str)
 {
@@ -108,6 +493,9 @@ grub_partition_probe(struct grub_disk* disk, const char* str)
 	if (str == NULL)
 		return 0;
 
+	if (!disk->partition && grub_partition_cache_probe(disk, str, &part) == 0)
+		return part;
+
 	part = tail = disk->partition;
 
 	for (ptr = str; *ptr;)
@@ -210,6 +598,65 @@ part_iterate(grub_disk_t dsk, const grub_partition_t partition, void* data)
 	return ctx->ret;
 }
 
+/* Replay the cached partitions below DISK->partition to HOOK.  Returns -1
+   if the table couldn't be cached.  */
+static int
+grub_partition_cache_iterate(struct grub_disk* disk,
+	grub_partition_iterate_hook_t hook, void* hook_data)
+{
+	struct grub_partition_cache* cache;
+	struct grub_partition* parts;
+	grub_partition_t saved = disk->partition;
+	int root;
+	int count;
+	int ret = 0;
+	int i;
+
+	cache = grub_partition_cache_get(disk);
+	if (!cache)
+		return -1;
+
+	root = grub_partition_cache_find(cache, disk->partition);
+	if (root == -2)
+	{
+		grub_mutex_unlock(&grub_partition_cache_lock);
+		return -1;
+	}
+
+	/* The subtree of ROOT directly follows it.  */
+	for (count = 0; root + 1 + count < cache->count; count++)
+		if (root >= 0 && cache->nodes[root + 1 + count].depth <= cache->nodes[root].depth)
+			break;
+
+	/* Copy it out so the hook runs without the lock.  */
+	parts = grub_calloc(count ? count : 1, sizeof(*parts));
+	if (!parts)
+	{
+		grub_mutex_unlock(&grub_partition_cache_lock);
+		return -1;
+	}
+	for (i = 0; i < count; i++)
+	{
+		const struct grub_partition_cache_node* node = cache->nodes + root + 1 + i;
+
+		parts[i] = node->part;
+		parts[i].parent = (node->parent == root) ? saved : parts + (node->parent - root - 1);
+	}
+	grub_mutex_unlock(&grub_partition_cache_lock);
+
+	for (i = 0; i < count; i++)
+	{
+		disk->partition = 0;
+		ret = hook(disk, parts + i, hook_data);
+		disk->partition = saved;
+		if (ret)
+			break;
+	}
+
+	grub_free(parts);
+	return ret;
+}
+
 int
 grub_partition_iterate(struct grub_disk* disk,
 	grub_partition_iterate_hook_t hook, void* hook_data)
@@ -221,6 +668,12 @@ grub_partition_iterate(struct grub_disk* disk,
 	  .hook_data = hook_data
 	};
 	const struct grub_partition_map* partmap;
+	int ret;
+
+	ret = grub_partition_cache_iterate(disk, hook, hook_data);
+	if (ret >= 0)
+		return ret;
+	grub_errno = GRUB_ERR_NONE;
 
 	FOR_PARTITION_MAPS(partmap)
 	{
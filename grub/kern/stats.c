@@ -0,0 +1,457 @@
+/* stats.c - I/O counters exported through procfs */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/stats.h>
+#include <grub/disk.h>
+#include <grub/fs.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/procfs.h>
+#include <grub/thread.h>
+
+#include <stdlib.h>
+
+GRUB_MOD_LICENSE("GPLv3+");
+
+#define GRUB_STATS_DISK_NUM	64
+#define GRUB_STATS_FS_NUM	96
+/* Latency buckets, bucket N counts reads taking [2^N, 2^(N+1)) us.  */
+#define GRUB_STATS_HIST_NUM	24
+
+struct grub_stats_disk
+{
+	/* stats_disk_key of the disk, or one of the STATS_DISK_* states.  */
+	volatile grub_uint64_t key;
+	char name[32];
+	volatile grub_uint64_t requests;
+	volatile grub_uint64_t request_bytes;
+	volatile grub_uint64_t reads;
+	volatile grub_uint64_t read_bytes;
+	volatile grub_uint64_t read_us;
+	volatile grub_uint64_t errors;
+	volatile grub_uint64_t hist[GRUB_STATS_HIST_NUM];
+};
+
+struct grub_stats_fs
+{
+	const struct grub_fs* fs;
+	volatile grub_uint64_t count[GRUB_STATS_FS_OPS];
+	volatile grub_uint64_t us[GRUB_STATS_FS_OPS];
+	volatile grub_uint64_t read_bytes;
+};
+
+struct grub_stats_trace_entry
+{
+	grub_uint64_t time;
+	grub_disk_addr_t sector;
+	grub_uint32_t size;
+	grub_uint32_t us;
+	grub_err_t err;
+	char name[20];
+};
+
+/* Open addressed by stats_disk_key.  Slots are filled and freed under
+   stats_lock and published by setting the key, so lookups need no lock.  */
+static struct grub_stats_disk stats_disk[GRUB_STATS_DISK_NUM];
+static struct grub_stats_fs stats_fs[GRUB_STATS_FS_NUM];
+static volatile grub_uint64_t stats_fs_count;
+static volatile grub_uint64_t stats_cache_events[GRUB_STATS_CACHE_EVENTS];
+static grub_mutex_t stats_lock;
+
+/* Ring of recent device reads, guarded by stats_lock.  */
+static struct grub_stats_trace_entry* trace_ring;
+static unsigned trace_size;
+static grub_uint64_t trace_total;
+static grub_uint64_t trace_base;
+
+/* A slot never used, which ends a probe sequence.  */
+#define STATS_DISK_FREE	0
+/* A slot whose disk was removed, free for reuse.  */
+#define STATS_DISK_GONE	1
+
+static grub_uint64_t
+stats_disk_key(unsigned long dev_id, unsigned long disk_id)
+{
+	return (((grub_uint64_t)dev_id << 48)
+		| ((grub_uint64_t)disk_id & 0xffffffffffffULL)) + 2;
+}
+
+static unsigned
+stats_disk_index(unsigned long dev_id, unsigned long disk_id)
+{
+	return (dev_id * 524287UL + disk_id * 2606459UL) % GRUB_STATS_DISK_NUM;
+}
+
+/* Find the slot of KEY starting at INDEX.  With GONE, also return the
+   first reusable slot on the way, or the free slot ending the sequence.  */
+static struct grub_stats_disk*
+stats_find_disk(grub_uint64_t key, unsigned index, struct grub_stats_disk** gone)
+{
+	unsigned i;
+
+	for (i = 0; i < GRUB_STATS_DISK_NUM; i++)
+	{
+		struct grub_stats_disk* p = stats_disk + (index + i) % GRUB_STATS_DISK_NUM;
+		grub_uint64_t k = p->key;
+
+		if (k == key)
+			return p;
+		if (gone && !*gone && k <= STATS_DISK_GONE)
+			*gone = p;
+		if (k == STATS_DISK_FREE)
+			break;
+	}
+	return NULL;
+}
+
+static struct grub_stats_disk*
+stats_get_disk(struct grub_disk* disk)
+{
+	grub_uint64_t key = stats_disk_key(disk->dev->id, disk->id);
+	unsigned index = stats_disk_index(disk->dev->id, disk->id);
+	struct grub_stats_disk* gone = NULL;
+	struct grub_stats_disk* p;
+
+	p = stats_find_disk(key, index, NULL);
+	if (p)
+		return p;
+
+	grub_mutex_lock(&stats_lock);
+	p = stats_find_disk(key, index, &gone);
+	if (!p && gone)
+	{
+		p = gone;
+		grub_memset((char*)p + sizeof(p->key), 0, sizeof(*p) - sizeof(p->key));
+		grub_strncpy(p->name, disk->name, sizeof(p->name) - 1);
+		grub_atomic_add(&p->key, key - p->key);
+	}
+	grub_mutex_unlock(&stats_lock);
+
+	return p;
+}
+
+void
+grub_stats_disk_remove(unsigned long dev_id, unsigned long disk_id)
+{
+	struct grub_stats_disk* p;
+
+	grub_mutex_lock(&stats_lock);
+	p = stats_find_disk(stats_disk_key(dev_id, disk_id),
+		stats_disk_index(dev_id, disk_id), NULL);
+	if (p)
+		grub_atomic_add(&p->key, STATS_DISK_GONE - p->key);
+	grub_mutex_unlock(&stats_lock);
+}
+
+static struct grub_stats_fs*
+stats_get_fs(const struct grub_fs* fs)
+{
+	grub_uint64_t i, n = stats_fs_count;
+
+	for (i = 0; i < n; i++)
+		if (stats_fs[i].fs == fs)
+			return stats_fs + i;
+
+	grub_mutex_lock(&stats_lock);
+	for (i = 0; i < stats_fs_count; i++)
+		if (stats_fs[i].fs == fs)
+			break;
+	if (i == stats_fs_count && i < GRUB_STATS_FS_NUM)
+	{
+		stats_fs[i].fs = fs;
+		grub_atomic_add(&stats_fs_count, 1);
+	}
+	grub_mutex_unlock(&stats_lock);
+
+	return (i < GRUB_STATS_FS_NUM) ? stats_fs + i : NULL;
+}
+
+void
+grub_stats_disk_request(struct grub_disk* disk, grub_size_t size)
+{
+	struct grub_stats_disk* p = stats_get_disk(disk);
+
+	if (!p)
+		return;
+	grub_atomic_add(&p->requests, 1);
+	grub_atomic_add(&p->request_bytes, size);
+}
+
+void
+grub_stats_disk_read(struct grub_disk* disk, grub_disk_addr_t sector,
+	grub_size_t size, grub_uint64_t start, grub_err_t err)
+{
+	struct grub_stats_disk* p = stats_get_disk(disk);
+	grub_uint64_t now = grub_get_time_us();
+	grub_uint64_t us = now - start;
+	unsigned bucket;
+
+	if (p)
+	{
+		for (bucket = 0; bucket < GRUB_STATS_HIST_NUM - 1 && (us >> (bucket + 1)); bucket++)
+			;
+		grub_atomic_add(&p->reads, 1);
+		grub_atomic_add(&p->read_bytes, size);
+		grub_atomic_add(&p->read_us, us);
+		grub_atomic_add(&p->hist[bucket], 1);
+		if (err)
+			grub_atomic_add(&p->errors, 1);
+	}
+
+	if (!trace_size)
+		return;
+
+	grub_mutex_lock(&stats_lock);
+	if (trace_size)
+	{
+		struct grub_stats_trace_entry* e = trace_ring + (trace_total++ % trace_size);
+
+		e->time = start - trace_base;
+		e->sector = sector;
+		e->size = (grub_uint32_t)size;
+		e->us = (grub_uint32_t)us;
+		e->err = err;
+		grub_strncpy(e->name, disk->name, sizeof(e->name) - 1);
+		e->name[sizeof(e->name) - 1] = 0;
+	}
+	grub_mutex_unlock(&stats_lock);
+}
+
+void
+grub_stats_cache(enum grub_stats_cache_event event)
+{
+	grub_atomic_add(&stats_cache_events[event], 1);
+}
+
+void
+grub_stats_fs(const struct grub_fs* fs, enum grub_stats_fs_op op,
+	grub_uint64_t bytes, grub_uint64_t start)
+{
+	struct grub_stats_fs* p;
+
+	if (!fs)
+		return;
+	p = stats_get_fs(fs);
+	if (!p)
+		return;
+	grub_atomic_add(&p->count[op], 1);
+	grub_atomic_add(&p->us[op], grub_get_time_us() - start);
+	if (op == GRUB_STATS_FS_READ)
+		grub_atomic_add(&p->read_bytes, bytes);
+}
+
+grub_err_t
+grub_stats_trace(unsigned entries)
+{
+	struct grub_stats_trace_entry* ring = NULL;
+
+	if (entries)
+	{
+		ring = grub_calloc(entries, sizeof(*ring));
+		if (!ring)
+			return grub_errno;
+	}
+
+	grub_mutex_lock(&stats_lock);
+	grub_free(trace_ring);
+	trace_ring = ring;
+	trace_size = entries;
+	trace_total = 0;
+	trace_base = grub_get_time_us();
+	grub_mutex_unlock(&stats_lock);
+
+	return GRUB_ERR_NONE;
+}
+
+struct stats_buf
+{
+	char* data;
+	grub_size_t len;
+	grub_size_t alloc;
+};
+
+static void
+stats_printf(struct stats_buf* buf, const char* fmt, ...)
+{
+	va_list ap;
+	char* line;
+	grub_size_t len;
+
+	va_start(ap, fmt);
+	line = grub_xvasprintf(fmt, ap);
+	va_end(ap);
+	if (!line)
+		return;
+
+	len = grub_strlen(line);
+	if (buf->len + len + 1 > buf->alloc)
+	{
+		grub_size_t alloc = buf->alloc ? buf->alloc : 4096;
+		char* data;
+
+		while (buf->len + len + 1 > alloc)
+			alloc *= 2;
+		data = grub_realloc(buf->data, alloc);
+		if (!data)
+		{
+			grub_free(line);
+			return;
+		}
+		buf->data = data;
+		buf->alloc = alloc;
+	}
+	grub_memcpy(buf->data + buf->len, line, len + 1);
+	buf->len += len;
+	grub_free(line);
+}
+
+static char*
+stats_finish(struct stats_buf* buf, grub_size_t* sz)
+{
+	if (!buf->data)
+		buf->data = grub_zalloc(1);
+	*sz = buf->data ? buf->len : 0;
+	return buf->data;
+}
+
+static grub_uint64_t
+stats_div(grub_uint64_t a, grub_uint64_t b)
+{
+	return b ? a / b : 0;
+}
+
+static char*
+stats_get(struct grub_procfs_entry* this __attribute__((unused)), grub_size_t* sz)
+{
+	struct stats_buf buf = { 0 };
+	grub_uint64_t hits = stats_cache_events[GRUB_STATS_CACHE_HIT];
+	grub_uint64_t misses = stats_cache_events[GRUB_STATS_CACHE_MISS];
+	grub_uint64_t i, n;
+	unsigned j;
+
+	stats_printf(&buf, "%-12s %10s %14s %10s %14s %8s %10s\n",
+		"disk", "requests", "bytes", "reads", "read_bytes", "errors", "avg_us");
+	for (i = 0; i < GRUB_STATS_DISK_NUM; i++)
+	{
+		struct grub_stats_disk* p = stats_disk + i;
+
+		if (p->key <= STATS_DISK_GONE)
+			continue;
+		stats_printf(&buf, "%-12s %10llu %14llu %10llu %14llu %8llu %10llu\n",
+			p->name,
+			(unsigned long long)p->requests, (unsigned long long)p->request_bytes,
+			(unsigned long long)p->reads, (unsigned long long)p->read_bytes,
+			(unsigned long long)p->errors,
+			(unsigned long long)stats_div(p->read_us, p->reads));
+		stats_printf(&buf, "  latency_us");
+		for (j = 0; j < GRUB_STATS_HIST_NUM; j++)
+			if (p->hist[j])
+				stats_printf(&buf, " %llu+:%llu",
+					j ? 1ULL << j : 0ULL, (unsigned long long)p->hist[j]);
+		stats_printf(&buf, "\n");
+	}
+
+	stats_printf(&buf, "\ncache hits %llu misses %llu evictions %llu hit_permille %llu\n",
+		(unsigned long long)hits, (unsigned long long)misses,
+		(unsigned long long)stats_cache_events[GRUB_STATS_CACHE_EVICT],
+		(unsigned long long)stats_div(hits * 1000, hits + misses));
+
+	stats_printf(&buf, "\n%-12s %8s %10s %8s %10s %10s %14s %10s %8s\n",
+		"fs", "mounts", "mount_us", "opens", "open_us",
+		"reads", "read_bytes", "read_us", "KiB/s");
+	n = stats_fs_count;
+	for (i = 0; i < n; i++)
+	{
+		struct grub_stats_fs* p = stats_fs + i;
+		grub_uint64_t read_us = p->us[GRUB_STATS_FS_READ];
+
+		stats_printf(&buf, "%-12s %8llu %10llu %8llu %10llu %10llu %14llu %10llu %8llu\n",
+			p->fs->name,
+			(unsigned long long)p->count[GRUB_STATS_FS_MOUNT],
+			(unsigned long long)p->us[GRUB_STATS_FS_MOUNT],
+			(unsigned long long)p->count[GRUB_STATS_FS_OPEN],
+			(unsigned long long)p->us[GRUB_STATS_FS_OPEN],
+			(unsigned long long)p->count[GRUB_STATS_FS_READ],
+			(unsigned long long)p->read_bytes,
+			(unsigned long long)read_us,
+			(unsigned long long)stats_div(p->read_bytes * 1000000 / 1024, read_us));
+	}
+
+	return stats_finish(&buf, sz);
+}
+
+static char*
+trace_get(struct grub_procfs_entry* this __attribute__((unused)), grub_size_t* sz)
+{
+	struct stats_buf buf = { 0 };
+	grub_uint64_t i, first;
+
+	grub_mutex_lock(&stats_lock);
+	if (!trace_size)
+		stats_printf(&buf, "tracing is off\n");
+	else
+	{
+		stats_printf(&buf, "%-12s %-20s %18s %10s %8s %s\n",
+			"start_us", "disk", "sector", "bytes", "us", "err");
+		first = (trace_total > trace_size) ? trace_total - trace_size : 0;
+		for (i = first; i < trace_total; i++)
+		{
+			struct grub_stats_trace_entry* e = trace_ring + (i % trace_size);
+
+			stats_printf(&buf, "%-12llu %-20s %18llu %10u %8u %d\n",
+				(unsigned long long)e->time, e->name,
+				(unsigned long long)e->sector, e->size, e->us, e->err);
+		}
+	}
+	grub_mutex_unlock(&stats_lock);
+
+	return stats_finish(&buf, sz);
+}
+
+static struct grub_procfs_entry stats_entry =
+{
+	.name = "stats",
+	.get_contents = stats_get
+};
+
+static struct grub_procfs_entry trace_entry =
+{
+	.name = "trace",
+	.get_contents = trace_get
+};
+
+GRUB_MOD_INIT(stats)
+{
+	const char* trace = getenv("NKARC_TRACE");
+
+	/* NKARC_TRACE=<entries> turns the I/O trace on from the start.  */
+	if (trace)
+		grub_stats_trace(grub_strtoul(trace, NULL, 0));
+	grub_errno = GRUB_ERR_NONE;
+
+	grub_procfs_register("stats", &stats_entry);
+	grub_procfs_register("trace", &trace_entry);
+}
+
+GRUB_MOD_FINI(stats)
+{
+	grub_procfs_unregister(&trace_entry);
+	grub_procfs_unregister(&stats_entry);
+	grub_stats_trace(0);
+}
@@ -0,0 +1,187 @@
+/* thread.c - locking primitives for the shared grub core */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/thread.h>
+#include <grub/err.h>
+#include <grub/mm.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/* The address of a thread-local variable identifies the calling thread and
+   is never zero.  */
+static GRUB_THREAD_LOCAL char grub_thread_tag;
+
+#define grub_thread_self() ((grub_addr_t)&grub_thread_tag)
+
+void
+grub_mutex_lock(grub_mutex_t* mutex)
+{
+	grub_addr_t self = grub_thread_self();
+
+	/* Only this thread can have stored its own id.  */
+	if (mutex->owner == self)
+	{
+		mutex->depth++;
+		return;
+	}
+#ifdef _WIN32
+	AcquireSRWLockExclusive((PSRWLOCK)&mutex->lock);
+#else
+	pthread_mutex_lock(&mutex->lock);
+#endif
+	mutex->owner = self;
+	mutex->depth = 1;
+}
+
+void
+grub_mutex_unlock(grub_mutex_t* mutex)
+{
+	if (--mutex->depth)
+		return;
+	mutex->owner = 0;
+#ifdef _WIN32
+	ReleaseSRWLockExclusive((PSRWLOCK)&mutex->lock);
+#else
+	pthread_mutex_unlock(&mutex->lock);
+#endif
+}
+
+grub_uint64_t
+grub_atomic_add(volatile grub_uint64_t* p, grub_uint64_t v)
+{
+#ifdef _WIN32
+	return (grub_uint64_t)InterlockedExchangeAdd64((volatile LONG64*)p, (LONG64)v) + v;
+#else
+	return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+void
+grub_cond_wait(grub_cond_t* cond, grub_mutex_t* mutex)
+{
+	/* The lock is released while waiting, so its owner must be too.  */
+	mutex->owner = 0;
+	mutex->depth = 0;
+#ifdef _WIN32
+	SleepConditionVariableSRW((PCONDITION_VARIABLE)&cond->cond, (PSRWLOCK)&mutex->lock, INFINITE, 0);
+#else
+	pthread_cond_wait(&cond->cond, &mutex->lock);
+#endif
+	mutex->owner = grub_thread_self();
+	mutex->depth = 1;
+}
+
+void
+grub_cond_signal(grub_cond_t* cond)
+{
+#ifdef _WIN32
+	WakeConditionVariable((PCONDITION_VARIABLE)&cond->cond);
+#else
+	pthread_cond_signal(&cond->cond);
+#endif
+}
+
+void
+grub_cond_broadcast(grub_cond_t* cond)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable((PCONDITION_VARIABLE)&cond->cond);
+#else
+	pthread_cond_broadcast(&cond->cond);
+#endif
+}
+
+struct grub_thread
+{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	void (*func) (void* data);
+	void* data;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI
+grub_thread_start(LPVOID param)
+#else
+static void*
+grub_thread_start(void* param)
+#endif
+{
+	grub_thread_t thread = param;
+
+	thread->func(thread->data);
+	return 0;
+}
+
+grub_thread_t
+grub_thread_create(void (*func) (void* data), void* data)
+{
+	grub_thread_t thread = grub_malloc(sizeof(*thread));
+
+	if (!thread)
+		return NULL;
+	thread->func = func;
+	thread->data = data;
+#ifdef _WIN32
+	thread->handle = CreateThread(NULL, 0, grub_thread_start, thread, 0, NULL);
+	if (!thread->handle)
+#else
+	if (pthread_create(&thread->handle, NULL, grub_thread_start, thread) != 0)
+#endif
+	{
+		grub_free(thread);
+		grub_error(GRUB_ERR_OUT_OF_MEMORY, "can't create thread");
+		return NULL;
+	}
+	return thread;
+}
+
+void
+grub_thread_join(grub_thread_t thread)
+{
+#ifdef _WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+	grub_free(thread);
+}
+
+unsigned
+grub_cpu_count(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (unsigned)n : 1;
+#endif
+}
@@ -19,28 +19,35 @@
 
 #include <grub/datetime.h>
 #include <grub/time.h>
+#include <grub/misc.h>
 #include <time.h>
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
 grub_err_t
 grub_get_datetime(struct grub_datetime* datetime)
 {
-	struct tm* mytm;
+	struct tm mytm;
 	time_t mytime;
 
 	mytime = time(&mytime);
-	if (gmtime_s(mytm, &mytime) == 0)
+#ifdef _WIN32
+	if (gmtime_s(&mytm, &mytime) == 0)
+#else
+	if (gmtime_r(&mytime, &mytm))
+#endif
 	{
-		datetime->year = mytm->tm_year + 1900;
-		datetime->month = mytm->tm_mon + 1;
-		datetime->day = mytm->tm_mday;
-		datetime->hour = mytm->tm_hour;
-		datetime->minute = mytm->tm_min;
-		datetime->second = mytm->tm_sec;
+		datetime->year = mytm.tm_year + 1900;
+		datetime->month = mytm.tm_mon + 1;
+		datetime->day = mytm.tm_mday;
+		datetime->hour = mytm.tm_hour;
+		datetime->minute = mytm.tm_min;
+		datetime->second = mytm.tm_sec;
 	}
 	else
-		memset(datetime, 0, sizeof(*datetime));
+		grub_memset(datetime, 0, sizeof(*datetime));
 
 	return GRUB_ERR_NONE;
 }
@@ -52,6 +59,8 @@ grub_set_datetime(struct grub_datetime* datetime __attribute__((unused)))
 		"no clock setting routine available");
 }
 
+#ifdef _WIN32
+
 grub_uint64_t
 grub_get_time_ms(void)
 {
@@ -65,8 +74,52 @@ grub_get_time_ms(void)
 	return us_ul.QuadPart / 10000;
 }
 
+grub_uint64_t
+grub_get_time_us(void)
+{
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+
+	return (grub_uint64_t)(now.QuadPart / freq.QuadPart) * 1000000
+		+ (grub_uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+}
+
 void
 grub_millisleep(grub_uint32_t ms)
 {
 	Sleep(ms);
 }
+
+#else
+
+grub_uint64_t
+grub_get_time_ms(void)
+{
+	return grub_get_time_us() / 1000;
+}
+
+grub_uint64_t
+grub_get_time_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (grub_uint64_t)now.tv_sec * 1000000 + (grub_uint64_t)now.tv_nsec / 1000;
+}
+
+void
+grub_millisleep(grub_uint32_t ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+}
+
+#endif
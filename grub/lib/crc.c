@@ -18,59 +18,291 @@
  */
 
 #include <grub/types.h>
+#include <grub/thread.h>
+#include <grub/cpuid.h>
 #include <grub/lib/crc.h>
 
-static grub_uint32_t crc32c_table[256];
+/* All three CRCs are reflected.  The portable path is slicing-by-8, on x86
+   CRC32C uses the SSE4.2 crc32 instruction and CRC32 and CRC64 fold 64
+   bytes per step with PCLMULQDQ.  */
 
-/* Helper for init_crc32c_table.  */
-static grub_uint32_t
-reflect(grub_uint32_t ref, int len)
+#ifdef GRUB_CPU_X86
+#define CRC_X86	1
+#define CRC_TARGET	GRUB_CPU_TARGET("sse4.2,pclmul")
+#endif
+
+#define CRC32_POLY	0xedb88320U
+#define CRC32C_POLY	0x82f63b78U
+#define CRC64_POLY	0xc96c5795d7870f42ULL
+
+static grub_uint32_t crc32_table[8][256];
+static grub_uint32_t crc32c_table[8][256];
+static grub_uint64_t crc64_table[8][256];
+
+static volatile int crc_ready;
+static grub_mutex_t crc_lock;
+
+#ifdef CRC_X86
+static int crc_has_sse42;
+static int crc_has_pclmul;
+
+/* Folding constants, x^(D+63) and x^(D-1) mod P reflected, for a distance
+   D of 512 (four lanes) and 128 bits (one lane).  */
+struct crc_fold_keys
+{
+	grub_uint64_t k512[2];
+	grub_uint64_t k128[2];
+};
+
+static const struct crc_fold_keys crc32_keys =
+{
+	{ 0x653d982200000000ULL, 0xcad38e8f00000000ULL },
+	{ 0x65673b4600000000ULL, 0x9ba54c6f00000000ULL },
+};
+
+static const struct crc_fold_keys crc64_keys =
 {
-	grub_uint32_t result = 0;
-	int i;
+	{ 0x6ae3efbb9dd441f3ULL, 0x081f6054a7842df4ULL },
+	{ 0xe05dd497ca393ae4ULL, 0xdabe95afc7875f40ULL },
+};
+#endif
 
-	for (i = 1; i <= len; i++)
+static void
+init_crc32_table(grub_uint32_t table[8][256], grub_uint32_t poly)
+{
+	int i, j;
+
+	for (i = 0; i < 256; i++)
 	{
-		if (ref & 1)
-			result |= 1 << (len - i);
-		ref >>= 1;
+		grub_uint32_t c = i;
+		for (j = 0; j < 8; j++)
+			c = (c >> 1) ^ (c & 1 ? poly : 0);
+		table[0][i] = c;
 	}
-
-	return result;
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
 }
 
 static void
-init_crc32c_table(void)
+init_crc64_table(grub_uint64_t table[8][256], grub_uint64_t poly)
 {
-	grub_uint32_t polynomial = 0x1edc6f41;
 	int i, j;
 
 	for (i = 0; i < 256; i++)
 	{
-		crc32c_table[i] = reflect(i, 8) << 24;
+		grub_uint64_t c = i;
 		for (j = 0; j < 8; j++)
-			crc32c_table[i] = (crc32c_table[i] << 1) ^
-			(crc32c_table[i] & (1 << 31) ? polynomial : 0);
-		crc32c_table[i] = reflect(crc32c_table[i], 32);
+			c = (c >> 1) ^ (c & 1 ? poly : 0);
+		table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+}
+
+static void
+crc_init(void)
+{
+	grub_mutex_lock(&crc_lock);
+	if (!crc_ready)
+	{
+		init_crc32_table(crc32_table, CRC32_POLY);
+		init_crc32_table(crc32c_table, CRC32C_POLY);
+		init_crc64_table(crc64_table, CRC64_POLY);
+#ifdef CRC_X86
+		crc_has_sse42 = grub_cpu_has(GRUB_CPU_SSE42);
+		crc_has_pclmul = grub_cpu_has(GRUB_CPU_SSE42 | GRUB_CPU_PCLMUL);
+#endif
+		crc_ready = 1;
+	}
+	grub_mutex_unlock(&crc_lock);
+}
+
+/* Advance the raw register CRC over SIZE bytes at P.  */
+static grub_uint32_t
+crc32_slice8(const grub_uint32_t table[8][256], grub_uint32_t crc,
+	const grub_uint8_t* p, grub_size_t size)
+{
+	while (size && ((grub_addr_t)p & 7))
+	{
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+		size--;
+	}
+	while (size >= 8)
+	{
+		grub_uint32_t lo = crc ^ grub_le_to_cpu32(grub_get_unaligned32(p));
+		grub_uint32_t hi = grub_le_to_cpu32(grub_get_unaligned32(p + 4));
+		crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+			table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+			table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+			table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+		p += 8;
+		size -= 8;
+	}
+	while (size--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+static grub_uint64_t
+crc64_slice8(const grub_uint64_t table[8][256], grub_uint64_t crc,
+	const grub_uint8_t* p, grub_size_t size)
+{
+	while (size && ((grub_addr_t)p & 7))
+	{
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+		size--;
+	}
+	while (size >= 8)
+	{
+		grub_uint64_t v = crc ^ grub_le_to_cpu64(grub_get_unaligned64(p));
+		crc = table[7][v & 0xff] ^ table[6][(v >> 8) & 0xff] ^
+			table[5][(v >> 16) & 0xff] ^ table[4][(v >> 24) & 0xff] ^
+			table[3][(v >> 32) & 0xff] ^ table[2][(v >> 40) & 0xff] ^
+			table[1][(v >> 48) & 0xff] ^ table[0][v >> 56];
+		p += 8;
+		size -= 8;
+	}
+	while (size--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+#ifdef CRC_X86
+static CRC_TARGET grub_uint32_t
+crc32c_sse42(grub_uint32_t crc, const grub_uint8_t* p, grub_size_t size)
+{
+	while (size && ((grub_addr_t)p & 7))
+	{
+		crc = _mm_crc32_u8(crc, *p++);
+		size--;
+	}
+#if defined(_M_X64) || defined(__x86_64__)
+	{
+		grub_uint64_t c = crc;
+		for (; size >= 32; p += 32, size -= 32)
+		{
+			c = _mm_crc32_u64(c, grub_get_unaligned64(p));
+			c = _mm_crc32_u64(c, grub_get_unaligned64(p + 8));
+			c = _mm_crc32_u64(c, grub_get_unaligned64(p + 16));
+			c = _mm_crc32_u64(c, grub_get_unaligned64(p + 24));
+		}
+		for (; size >= 8; p += 8, size -= 8)
+			c = _mm_crc32_u64(c, grub_get_unaligned64(p));
+		crc = (grub_uint32_t)c;
+	}
+#endif
+	for (; size >= 4; p += 4, size -= 4)
+		crc = _mm_crc32_u32(crc, grub_get_unaligned32(p));
+	while (size--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+
+static CRC_TARGET __m128i
+crc_fold(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00),
+		_mm_clmulepi64_si128(x, k, 0x11));
+}
+
+/* Fold SIZE >= 64 bytes at P, with the raw register CRC xored into the
+   first bytes, down to 16 bytes in OUT that leave the same remainder.
+   Returns the number of bytes consumed.  */
+static CRC_TARGET grub_size_t
+crc_fold_pclmul(const struct crc_fold_keys* keys, grub_uint64_t crc,
+	const grub_uint8_t* p, grub_size_t size, grub_uint8_t* out)
+{
+	const __m128i* q = (const __m128i*)p;
+	__m128i k512 = _mm_loadu_si128((const __m128i*)keys->k512);
+	__m128i k128 = _mm_loadu_si128((const __m128i*)keys->k128);
+	__m128i x0, x1, x2, x3;
+	grub_size_t done = 64;
+
+	x0 = _mm_xor_si128(_mm_loadu_si128(q),
+		_mm_set_epi64x(0, (long long)crc));
+	x1 = _mm_loadu_si128(q + 1);
+	x2 = _mm_loadu_si128(q + 2);
+	x3 = _mm_loadu_si128(q + 3);
+	for (q += 4; size - done >= 64; q += 4, done += 64)
+	{
+		x0 = _mm_xor_si128(crc_fold(x0, k512), _mm_loadu_si128(q));
+		x1 = _mm_xor_si128(crc_fold(x1, k512), _mm_loadu_si128(q + 1));
+		x2 = _mm_xor_si128(crc_fold(x2, k512), _mm_loadu_si128(q + 2));
+		x3 = _mm_xor_si128(crc_fold(x3, k512), _mm_loadu_si128(q + 3));
 	}
+	x0 = _mm_xor_si128(crc_fold(x0, k128), x1);
+	x0 = _mm_xor_si128(crc_fold(x0, k128), x2);
+	x0 = _mm_xor_si128(crc_fold(x0, k128), x3);
+	for (; size - done >= 16; q++, done += 16)
+		x0 = _mm_xor_si128(crc_fold(x0, k128), _mm_loadu_si128(q));
+	_mm_storeu_si128((__m128i*)out, x0);
+	return done;
 }
+#endif
 
 grub_uint32_t
-grub_getcrc32c(grub_uint32_t crc, const void* buf, int size)
+grub_getcrc32(grub_uint32_t crc, const void* buf, grub_size_t size)
 {
-	int i;
 	const grub_uint8_t* data = buf;
 
-	if (!crc32c_table[1])
-		init_crc32c_table();
+	if (!crc_ready)
+		crc_init();
 
 	crc ^= 0xffffffff;
-
-	for (i = 0; i < size; i++)
+#ifdef CRC_X86
+	if (crc_has_pclmul && size >= 64)
 	{
-		crc = (crc >> 8) ^ crc32c_table[(crc & 0xFF) ^ *data];
-		data++;
+		grub_uint8_t tmp[16];
+		grub_size_t done = crc_fold_pclmul(&crc32_keys, crc, data, size, tmp);
+		crc = crc32_slice8(crc32_table, 0, tmp, sizeof(tmp));
+		data += done;
+		size -= done;
 	}
+#endif
+	crc = crc32_slice8(crc32_table, crc, data, size);
+
+	return crc ^ 0xffffffff;
+}
+
+grub_uint32_t
+grub_getcrc32c(grub_uint32_t crc, const void* buf, grub_size_t size)
+{
+	if (!crc_ready)
+		crc_init();
+
+	crc ^= 0xffffffff;
+#ifdef CRC_X86
+	if (crc_has_sse42)
+		crc = crc32c_sse42(crc, buf, size);
+	else
+#endif
+		crc = crc32_slice8(crc32c_table, crc, buf, size);
 
 	return crc ^ 0xffffffff;
 }
+
+grub_uint64_t
+grub_getcrc64(grub_uint64_t crc, const void* buf, grub_size_t size)
+{
+	const grub_uint8_t* data = buf;
+
+	if (!crc_ready)
+		crc_init();
+
+	crc = ~crc;
+#ifdef CRC_X86
+	if (crc_has_pclmul && size >= 64)
+	{
+		grub_uint8_t tmp[16];
+		grub_size_t done = crc_fold_pclmul(&crc64_keys, crc, data, size, tmp);
+		crc = crc64_slice8(crc64_table, 0, tmp, sizeof(tmp));
+		data += done;
+		size -= done;
+	}
+#endif
+	crc = crc64_slice8(crc64_table, crc, data, size);
+
+	return ~crc;
+}
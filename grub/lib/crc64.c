@@ -19,68 +19,22 @@
 
 #include <grub/types.h>
 #include <grub/crypto.h>
+#include <grub/lib/crc.h>
 
 GRUB_MOD_LICENSE("GPLv3+");
 
-static grub_uint64_t crc64_table[256];
-
-/* Helper for init_crc64_table.  */
-static grub_uint64_t
-reflect(grub_uint64_t ref, int len)
-{
-	grub_uint64_t result = 0;
-	int i;
-
-	for (i = 1; i <= len; i++)
-	{
-		if (ref & 1)
-			result |= 1ULL << (len - i);
-		ref >>= 1;
-	}
-
-	return result;
-}
-
-static void
-init_crc64_table(void)
-{
-	grub_uint64_t polynomial = 0x42f0e1eba9ea3693ULL;
-	int i, j;
-
-	for (i = 0; i < 256; i++)
-	{
-		crc64_table[i] = reflect(i, 8) << 56;
-		for (j = 0; j < 8; j++)
-		{
-			crc64_table[i] = (crc64_table[i] << 1) ^
-				(crc64_table[i] & (1ULL << 63) ? polynomial : 0);
-		}
-		crc64_table[i] = reflect(crc64_table[i], 64);
-	}
-}
-
 static void
 crc64_init(void* context)
 {
-	if (!crc64_table[1])
-		init_crc64_table();
 	*(grub_uint64_t*)context = 0;
 }
 
 static void
 crc64_write(void* context, const void* buf, grub_size_t size)
 {
-	unsigned i;
-	const grub_uint8_t* data = buf;
-	grub_uint64_t crc = ~grub_le_to_cpu64(*(grub_uint64_t*)context);
-
-	for (i = 0; i < size; i++)
-	{
-		crc = (crc >> 8) ^ crc64_table[(crc & 0xFF) ^ *data];
-		data++;
-	}
+	grub_uint64_t crc = grub_le_to_cpu64(*(grub_uint64_t*)context);
 
-	*(grub_uint64_t*)context = grub_cpu_to_le64(~crc);
+	*(grub_uint64_t*)context = grub_cpu_to_le64(grub_getcrc64(crc, buf, size));
 }
 
 static grub_uint8_t*
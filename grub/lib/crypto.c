@@ -47,6 +47,27 @@ grub_crypto_hash(const gcry_md_spec_t* hash, void* out, const void* in, grub_siz
 	grub_memcpy(out, hash->read(&ctx), hash->mdlen);
 }
 
+void
+grub_crypto_hash_multi(const gcry_md_spec_t* hash, void* const out[],
+	const void* const in[], const grub_size_t inlen[], grub_size_t count)
+{
+	grub_size_t i;
+
+	if (!hash->hash_multi)
+	{
+		for (i = 0; i < count; i++)
+			grub_crypto_hash(hash, out[i], in[i], inlen[i]);
+		return;
+	}
+	for (i = 0; i < count; i += GRUB_CRYPTO_MULTI_MAX)
+	{
+		grub_size_t n = count - i;
+		if (n > GRUB_CRYPTO_MULTI_MAX)
+			n = GRUB_CRYPTO_MULTI_MAX;
+		hash->hash_multi(out + i, in + i, inlen + i, (unsigned)n);
+	}
+}
+
 const gcry_md_spec_t*
 grub_crypto_lookup_md_by_name(const char* name)
 {
@@ -0,0 +1,1788 @@
+/* extract.c - copy files and directory trees to the host */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/disk.h>
+#include <grub/fs.h>
+#include <grub/file.h>
+#include <grub/time.h>
+#include <grub/thread.h>
+#include <grub/crypto.h>
+#include <grub/hostfile.h>
+#include <grub/extract.h>
+#include <grub/lib/crc.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <grub/charset.h>
+#else
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#endif
+
+#define EXTRACT_READERS		1
+#define EXTRACT_WRITERS		4
+#define EXTRACT_BUFFER_SIZE	(1024 * 1024)
+#define EXTRACT_INTERVAL	250
+/* Granularity of GRUB_EXTRACT_ZEROS.  */
+#define EXTRACT_ZERO_BLOCK	4096
+/* Files of the store are first told apart by their size and the CRC64 of
+   this many bytes at the start.  */
+#define STORE_KEY_BLOCK		4096
+#define STORE_DIGEST		32
+#define STORE_MAGIC		"NKCS"
+#define STORE_VERSION		1
+
+/* A directory seen by the walk.  Its paths are built once and shared by
+   every file in it.  */
+struct extract_dir
+{
+	/* All directories, newest first, so children come before parents.  */
+	struct extract_dir* next;
+	/* Directories still to be listed.  */
+	struct extract_dir* walk_next;
+	/* "(dev)/path/", the path on the device starts at SRC + OFS.  */
+	char* src;
+	grub_size_t ofs;
+	/* Host directory with a trailing '/'.  */
+	char* dest;
+	int created;
+	int mtimeset;
+	grub_int64_t mtime;
+};
+
+/* A file waiting to be read.  */
+struct extract_file
+{
+	struct extract_file* next;
+	struct extract_dir* dir;
+	/* Host name, NAME unless the item renames the file.  */
+	const char* dest_name;
+	int mtimeset;
+	grub_int64_t mtime;
+	char name[1];
+};
+
+#ifdef _WIN32
+typedef HANDLE host_file_t;
+#define HOST_FILE_NONE INVALID_HANDLE_VALUE
+#else
+typedef int host_file_t;
+#define HOST_FILE_NONE (-1)
+#endif
+
+/* A file being written, alive until its reader and every queued buffer
+   let go of it.  */
+struct extract_out
+{
+	char* src;
+	char* dest;
+	/* Serializes the writers of this file.  */
+	grub_mutex_t lock;
+	host_file_t handle;
+	/* The reader reached the end without error.  */
+	int complete;
+	/* Failed, or a write was dropped after a cancel.  */
+	int failed;
+	int dropped;
+	int mtimeset;
+	grub_int64_t mtime;
+	/* Holes were left out, SIZE is set when the file is closed.  Under
+	   LOCK, SPARSE_SET once the host file is marked sparse.  */
+	int sparse;
+	int sparse_set;
+	grub_off_t size;
+	/* Under the job lock.  */
+	unsigned refs;
+	/* With a store: DIGEST is the SHA-256 of the data once HASHED is set,
+	   KEY the CRC64 of the first block.  LINKED if DEST is a link to the
+	   store.  */
+	int hashed;
+	int linked;
+	grub_uint64_t key;
+	grub_uint8_t digest[STORE_DIGEST];
+};
+
+struct extract_buf
+{
+	struct extract_buf* next;
+	struct extract_out* out;
+	grub_off_t offset;
+	grub_size_t len;
+	char* data;
+};
+
+struct extract_job
+{
+	const struct grub_extract_item* items;
+	grub_size_t count;
+	struct grub_extract_options opts;
+
+	/* Guards everything below.  */
+	grub_mutex_t lock;
+	/* The file queue grew or the walk ended.  */
+	grub_cond_t file_cond;
+	/* A buffer was returned to the pool.  */
+	grub_cond_t free_cond;
+	/* A buffer was queued for writing or the last reader left.  */
+	grub_cond_t write_cond;
+
+	struct extract_file* files;
+	struct extract_file** files_tail;
+	struct extract_dir* dirs;
+	struct extract_buf* free_bufs;
+	struct extract_buf* writes;
+	struct extract_buf** writes_tail;
+	unsigned readers_running;
+	unsigned writers_running;
+	struct grub_extract_stats stats;
+
+	volatile int cancel;
+
+	grub_mutex_t error_lock;
+
+	/* Store directory with a trailing '/', and the files known to be in
+	   it by size and key, under STORE_LOCK.  */
+	char* store;
+	grub_mutex_t store_lock;
+	struct store_entry** store_table;
+	grub_size_t store_mask;
+	grub_size_t store_count;
+	int store_dirty;
+};
+
+struct store_entry
+{
+	struct store_entry* next;
+	grub_uint64_t size;
+	grub_uint64_t key;
+	grub_uint8_t digest[STORE_DIGEST];
+};
+
+/* Index file of the store, little endian.  */
+GRUB_PACKED_START
+struct store_header
+{
+	char magic[4];
+	grub_uint32_t version;
+	grub_uint64_t count;
+};
+GRUB_PACKED_END
+
+GRUB_PACKED_START
+struct store_record
+{
+	grub_uint64_t size;
+	grub_uint64_t key;
+	grub_uint8_t digest[STORE_DIGEST];
+};
+GRUB_PACKED_END
+
+static void
+extract_cancel(struct extract_job* job)
+{
+	grub_mutex_lock(&job->lock);
+	job->cancel = 1;
+	job->stats.cancelled = 1;
+	grub_cond_broadcast(&job->file_cond);
+	grub_cond_broadcast(&job->free_cond);
+	grub_cond_broadcast(&job->write_cond);
+	grub_mutex_unlock(&job->lock);
+}
+
+static void
+extract_error(struct extract_job* job, const char* path, const char* msg)
+{
+	grub_mutex_lock(&job->lock);
+	job->stats.errors++;
+	grub_mutex_unlock(&job->lock);
+	if (job->opts.error)
+	{
+		grub_mutex_lock(&job->error_lock);
+		job->opts.error(path, msg, job->opts.data);
+		grub_mutex_unlock(&job->error_lock);
+	}
+}
+
+/* Report and clear the grub error of this thread.  */
+static void
+extract_grub_error(struct extract_job* job, const char* path)
+{
+	extract_error(job, path, grub_errno != GRUB_ERR_NONE ? grub_errmsg : "unknown error");
+	grub_errno = GRUB_ERR_NONE;
+}
+
+#ifdef _WIN32
+
+/* UTF-16 with the \\?\ prefix for absolute paths, so long paths work.  */
+static WCHAR*
+host_path(const char* path)
+{
+	grub_size_t len = grub_strlen(path);
+	WCHAR* wpath = grub_calloc(len + 5, sizeof(WCHAR));
+	WCHAR* p = wpath;
+
+	if (!wpath)
+		return NULL;
+	if (grub_isalpha(path[0]) && path[1] == ':')
+	{
+		grub_memcpy(wpath, L"\\\\?\\", 4 * sizeof(WCHAR));
+		p += 4;
+	}
+	grub_utf8_to_utf16(p, len, (const grub_uint8_t*)path, len, NULL);
+	for (; *p; p++)
+	{
+		if (*p == L'/')
+			*p = L'\\';
+	}
+	return wpath;
+}
+
+static const char*
+host_errmsg(char* buf, grub_size_t size)
+{
+	grub_snprintf(buf, size, "Windows error %lu", (unsigned long)GetLastError());
+	return buf;
+}
+
+static FILETIME
+host_filetime(grub_int64_t mtime)
+{
+	ULARGE_INTEGER t;
+	FILETIME ft;
+
+	t.QuadPart = (ULONGLONG)(mtime + 11644473600LL) * 10000000ULL;
+	ft.dwLowDateTime = t.LowPart;
+	ft.dwHighDateTime = t.HighPart;
+	return ft;
+}
+
+static host_file_t
+host_create(const char* path)
+{
+	WCHAR* wpath = host_path(path);
+	HANDLE handle;
+
+	if (!wpath)
+		return HOST_FILE_NONE;
+	handle = CreateFileW(wpath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	grub_free(wpath);
+	return handle;
+}
+
+static int
+host_write(host_file_t handle, const char* buf, grub_size_t len, grub_off_t offset)
+{
+	OVERLAPPED ov = { 0 };
+	DWORD w;
+
+	ov.Offset = (DWORD)offset;
+	ov.OffsetHigh = (DWORD)(offset >> 32);
+	return WriteFile(handle, buf, (DWORD)len, &w, &ov) && w == len;
+}
+
+static void
+host_set_mtime(host_file_t handle, grub_int64_t mtime)
+{
+	FILETIME ft = host_filetime(mtime);
+
+	SetFileTime(handle, NULL, &ft, &ft);
+}
+
+/* NTFS only leaves the ranges that are never written unallocated in
+   sparse files.  */
+static void
+host_set_sparse(host_file_t handle)
+{
+	DWORD ret;
+
+	DeviceIoControl(handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &ret, NULL);
+}
+
+static int
+host_set_size(host_file_t handle, grub_off_t size)
+{
+	FILE_END_OF_FILE_INFO info;
+
+	info.EndOfFile.QuadPart = (LONGLONG)size;
+	return SetFileInformationByHandle(handle, FileEndOfFileInfo, &info, sizeof(info));
+}
+
+static void
+host_close(host_file_t handle)
+{
+	CloseHandle(handle);
+}
+
+static void
+host_remove(const char* path)
+{
+	WCHAR* wpath = host_path(path);
+
+	if (wpath)
+		DeleteFileW(wpath);
+	grub_free(wpath);
+}
+
+static int
+host_mkdir(const char* path)
+{
+	WCHAR* wpath = host_path(path);
+	int ret;
+
+	if (!wpath)
+		return 0;
+	ret = CreateDirectoryW(wpath, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+	grub_free(wpath);
+	return ret;
+}
+
+static void
+host_set_dir_mtime(const char* path, grub_int64_t mtime)
+{
+	WCHAR* wpath = host_path(path);
+	HANDLE handle;
+
+	if (!wpath)
+		return;
+	handle = CreateFileW(wpath, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	grub_free(wpath);
+	if (handle == INVALID_HANDLE_VALUE)
+		return;
+	host_set_mtime(handle, mtime);
+	CloseHandle(handle);
+}
+
+enum
+{
+	HOST_LINK_NONE,
+	HOST_LINK_HARD,
+	HOST_LINK_CLONE,
+};
+
+/* Make TO a hardlink to the file FROM.  */
+static int
+host_link(const char* from, const char* to, const grub_int64_t* mtime __attribute__((unused)))
+{
+	WCHAR* wfrom = host_path(from);
+	WCHAR* wto = host_path(to);
+	int ret = HOST_LINK_NONE;
+
+	if (wfrom && wto && CreateHardLinkW(wto, wfrom, NULL))
+		ret = HOST_LINK_HARD;
+	grub_free(wfrom);
+	grub_free(wto);
+	return ret;
+}
+
+static int
+host_exists(const char* path)
+{
+	WCHAR* wpath = host_path(path);
+	int ret;
+
+	if (!wpath)
+		return 0;
+	ret = GetFileAttributesW(wpath) != INVALID_FILE_ATTRIBUTES;
+	grub_free(wpath);
+	return ret;
+}
+
+/* Names that would leave their directory or can't be created.  */
+static int
+host_bad_name(const char* name)
+{
+	return grub_strchr(name, '/') || grub_strchr(name, '\\') || grub_strchr(name, ':');
+}
+
+#else
+
+static const char*
+host_errmsg(char* buf, grub_size_t size)
+{
+	grub_snprintf(buf, size, "%s", strerror(errno));
+	return buf;
+}
+
+static host_file_t
+host_create(const char* path)
+{
+	int fd;
+
+	do
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	while (fd < 0 && errno == EINTR);
+	return fd;
+}
+
+static int
+host_write(host_file_t fd, const char* buf, grub_size_t len, grub_off_t offset)
+{
+	while (len)
+	{
+		ssize_t w = pwrite(fd, buf, len, offset);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return 0;
+		buf += w;
+		len -= w;
+		offset += w;
+	}
+	return 1;
+}
+
+static void
+host_set_mtime(host_file_t fd, grub_int64_t mtime)
+{
+	struct timespec ts[2];
+
+	ts[0].tv_sec = ts[1].tv_sec = (time_t)mtime;
+	ts[0].tv_nsec = ts[1].tv_nsec = 0;
+	futimens(fd, ts);
+}
+
+/* Ranges that are never written become holes.  */
+static void
+host_set_sparse(host_file_t fd __attribute__((unused)))
+{
+}
+
+static int
+host_set_size(host_file_t fd, grub_off_t size)
+{
+	return ftruncate(fd, (off_t)size) == 0;
+}
+
+static void
+host_close(host_file_t fd)
+{
+	close(fd);
+}
+
+static void
+host_remove(const char* path)
+{
+	unlink(path);
+}
+
+static int
+host_mkdir(const char* path)
+{
+	return mkdir(path, 0777) == 0 || errno == EEXIST;
+}
+
+static void
+host_set_dir_mtime(const char* path, grub_int64_t mtime)
+{
+	struct timespec ts[2];
+
+	ts[0].tv_sec = ts[1].tv_sec = (time_t)mtime;
+	ts[0].tv_nsec = ts[1].tv_nsec = 0;
+	utimensat(AT_FDCWD, path, ts, 0);
+}
+
+enum
+{
+	HOST_LINK_NONE,
+	HOST_LINK_HARD,
+	HOST_LINK_CLONE,
+};
+
+/* Make TO a copy of FROM that shares its extents, so it keeps its own
+   metadata, or else a hardlink.  A clone gets MTIME if it is not NULL.  */
+static int
+host_link(const char* from, const char* to, const grub_int64_t* mtime __attribute__((unused)))
+{
+#ifdef FICLONE
+	int src = open(from, O_RDONLY);
+
+	if (src >= 0)
+	{
+		int dst = open(to, O_WRONLY | O_CREAT | O_EXCL, 0666);
+		if (dst >= 0)
+		{
+			if (ioctl(dst, FICLONE, src) == 0)
+			{
+				if (mtime)
+					host_set_mtime(dst, *mtime);
+				close(dst);
+				close(src);
+				return HOST_LINK_CLONE;
+			}
+			close(dst);
+			unlink(to);
+		}
+		close(src);
+	}
+#endif
+	return link(from, to) == 0 ? HOST_LINK_HARD : HOST_LINK_NONE;
+}
+
+static int
+host_exists(const char* path)
+{
+	return access(path, F_OK) == 0;
+}
+
+static int
+host_bad_name(const char* name)
+{
+	return grub_strchr(name, '/') != NULL;
+}
+
+#endif
+
+static grub_size_t
+store_bucket(struct extract_job* job, grub_uint64_t size, grub_uint64_t key)
+{
+	return (grub_size_t)((key ^ (size * 0x9e3779b97f4a7c15ULL)) & job->store_mask);
+}
+
+/* Whether the store holds a file of SIZE bytes with the first block KEY.
+   Under STORE_LOCK.  */
+static int
+store_has_key(struct extract_job* job, grub_uint64_t size, grub_uint64_t key)
+{
+	struct store_entry* e;
+
+	for (e = job->store_table[store_bucket(job, size, key)]; e; e = e->next)
+	{
+		if (e->size == size && e->key == key)
+			return 1;
+	}
+	return 0;
+}
+
+/* Under STORE_LOCK.  */
+static void
+store_add(struct extract_job* job, grub_uint64_t size, grub_uint64_t key,
+	const grub_uint8_t* digest)
+{
+	struct store_entry* e;
+	grub_size_t b;
+
+	if (job->store_count >= job->store_mask + 1)
+	{
+		/* Grow to twice the buckets.  */
+		grub_size_t mask = job->store_mask * 2 + 1;
+		struct store_entry** table = grub_calloc(mask + 1, sizeof(*table));
+		grub_size_t i;
+
+		if (table)
+		{
+			struct store_entry** old = job->store_table;
+			grub_size_t old_mask = job->store_mask;
+			job->store_table = table;
+			job->store_mask = mask;
+			for (i = 0; i <= old_mask; i++)
+			{
+				while (old[i])
+				{
+					e = old[i];
+					old[i] = e->next;
+					b = store_bucket(job, e->size, e->key);
+					e->next = table[b];
+					table[b] = e;
+				}
+			}
+			grub_free(old);
+		}
+		grub_errno = GRUB_ERR_NONE;
+	}
+
+	b = store_bucket(job, size, key);
+	for (e = job->store_table[b]; e; e = e->next)
+	{
+		if (e->size == size && e->key == key
+			&& grub_memcmp(e->digest, digest, STORE_DIGEST) == 0)
+			return;
+	}
+	e = grub_malloc(sizeof(*e));
+	if (!e)
+	{
+		grub_errno = GRUB_ERR_NONE;
+		return;
+	}
+	e->size = size;
+	e->key = key;
+	grub_memcpy(e->digest, digest, STORE_DIGEST);
+	e->next = job->store_table[b];
+	job->store_table[b] = e;
+	job->store_count++;
+	job->store_dirty = 1;
+}
+
+/* STORE/xx/yyyy... of DIGEST, the xx directory is created if MKDIR.  */
+static char*
+store_object(struct extract_job* job, const grub_uint8_t* digest, int mkdir)
+{
+	char hex[STORE_DIGEST * 2 + 1];
+	char* path;
+	unsigned i;
+
+	for (i = 0; i < STORE_DIGEST; i++)
+		grub_snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+	path = grub_xasprintf("%s%c%c/%s", job->store, hex[0], hex[1], hex + 2);
+	if (path && mkdir)
+	{
+		/* Cut at the slash for the directory.  */
+		grub_size_t len = grub_strlen(job->store) + 2;
+		path[len] = '\0';
+		host_mkdir(path);
+		path[len] = '/';
+	}
+	return path;
+}
+
+/* Open the store and read its index.  A damaged index is dropped, the
+   files it listed are added again as they come by.  */
+static grub_err_t
+store_open(struct extract_job* job)
+{
+	const struct store_header* hdr;
+	grub_uint8_t* buf;
+	grub_size_t size = 0, len, i;
+	char* path;
+
+	len = grub_strlen(job->opts.store);
+	while (len > 1 && (job->opts.store[len - 1] == '/'
+#ifdef _WIN32
+		|| job->opts.store[len - 1] == '\\'
+#endif
+		))
+		len--;
+	job->store = grub_malloc(len + 2);
+	job->store_mask = 1023;
+	job->store_table = grub_calloc(job->store_mask + 1, sizeof(*job->store_table));
+	if (!job->store || !job->store_table)
+		return grub_errno;
+	grub_memcpy(job->store, job->opts.store, len);
+	job->store[len] = '/';
+	job->store[len + 1] = '\0';
+	if (!host_mkdir(job->store))
+	{
+		char msg[64];
+		return grub_error(GRUB_ERR_WRITE_ERROR, "cannot create `%s': %s",
+			job->store, host_errmsg(msg, sizeof(msg)));
+	}
+
+	path = grub_xasprintf("%sindex", job->store);
+	if (!path)
+		return grub_errno;
+	buf = grub_host_read_file(path, &size);
+	grub_free(path);
+	grub_errno = GRUB_ERR_NONE;
+	if (!buf)
+		return GRUB_ERR_NONE;
+	hdr = (const struct store_header*)buf;
+	if (size >= sizeof(*hdr) && grub_memcmp(hdr->magic, STORE_MAGIC, 4) == 0
+		&& grub_le_to_cpu32(hdr->version) == STORE_VERSION
+		&& grub_le_to_cpu64(hdr->count) == (size - sizeof(*hdr)) / sizeof(struct store_record)
+		&& (size - sizeof(*hdr)) % sizeof(struct store_record) == 0)
+	{
+		const struct store_record* rec = (const struct store_record*)(hdr + 1);
+		for (i = 0; i < (size - sizeof(*hdr)) / sizeof(*rec); i++)
+			store_add(job, grub_le_to_cpu64(rec[i].size), grub_le_to_cpu64(rec[i].key), rec[i].digest);
+	}
+	grub_free(buf);
+	job->store_dirty = 0;
+	return GRUB_ERR_NONE;
+}
+
+/* Write the index if it changed and free it.  */
+static void
+store_close(struct extract_job* job)
+{
+	struct store_header hdr;
+	struct store_record* recs = NULL;
+	grub_size_t i, n = 0;
+
+	if (job->store_table && job->store_dirty)
+		recs = grub_calloc(job->store_count + 1, sizeof(*recs));
+	for (i = 0; job->store_table && i <= job->store_mask; i++)
+	{
+		while (job->store_table[i])
+		{
+			struct store_entry* e = job->store_table[i];
+			job->store_table[i] = e->next;
+			if (recs)
+			{
+				recs[n].size = grub_cpu_to_le64(e->size);
+				recs[n].key = grub_cpu_to_le64(e->key);
+				grub_memcpy(recs[n].digest, e->digest, STORE_DIGEST);
+				n++;
+			}
+			grub_free(e);
+		}
+	}
+	if (recs)
+	{
+		char* path = grub_xasprintf("%sindex", job->store);
+		const void* part[2] = { &hdr, recs };
+		grub_size_t len[2] = { sizeof(hdr), n * sizeof(*recs) };
+
+		grub_memcpy(hdr.magic, STORE_MAGIC, 4);
+		hdr.version = grub_cpu_to_le32(STORE_VERSION);
+		hdr.count = grub_cpu_to_le64(n);
+		if (!path || grub_host_replace_file(path, part, len, 2) != GRUB_ERR_NONE)
+			extract_grub_error(job, job->store);
+		grub_free(path);
+		grub_free(recs);
+	}
+	grub_errno = GRUB_ERR_NONE;
+	grub_free(job->store_table);
+	grub_free(job->store);
+}
+
+/* Link the written file OUT into the store.  */
+static void
+store_insert(struct extract_job* job, struct extract_out* out)
+{
+	char* object = store_object(job, out->digest, 1);
+
+	if (!object)
+	{
+		grub_errno = GRUB_ERR_NONE;
+		return;
+	}
+	if (host_link(out->dest, object, NULL) != HOST_LINK_NONE || host_exists(object))
+	{
+		grub_mutex_lock(&job->store_lock);
+		store_add(job, out->size, out->key, out->digest);
+		grub_mutex_unlock(&job->store_lock);
+	}
+	grub_free(object);
+}
+
+/* Readers install this so the reads of a worker don't end up in the
+   progress hook of the UI.  */
+static grub_err_t
+extract_read_hook(grub_disk_addr_t sector __attribute__((unused)),
+	unsigned offset __attribute__((unused)),
+	unsigned length __attribute__((unused)),
+	char* buf __attribute__((unused)), void* data __attribute__((unused)))
+{
+	return GRUB_ERR_NONE;
+}
+
+static void
+free_dir(struct extract_dir* dir)
+{
+	grub_free(dir->src);
+	grub_free(dir->dest);
+	grub_free(dir);
+}
+
+/* New directory node, SRC and DEST get NAME and a slash appended.  The
+   node is not linked anywhere yet.  */
+static struct extract_dir*
+new_dir(const char* src, grub_size_t ofs, const char* dest, const char* name,
+	const struct grub_dirhook_info* info)
+{
+	struct extract_dir* dir = grub_zalloc(sizeof(*dir));
+
+	if (!dir)
+		return NULL;
+	dir->ofs = ofs;
+	dir->src = grub_xasprintf("%s%s/", src, name);
+	dir->dest = grub_xasprintf("%s%s/", dest, name);
+	if (!dir->src || !dir->dest)
+	{
+		free_dir(dir);
+		return NULL;
+	}
+	if (info && info->mtimeset)
+	{
+		dir->mtimeset = 1;
+		dir->mtime = info->mtime;
+	}
+	return dir;
+}
+
+static void
+queue_file(struct extract_job* job, struct extract_dir* dir,
+	const char* name, const char* dest_name, const struct grub_dirhook_info* info)
+{
+	grub_size_t name_len = grub_strlen(name);
+	struct extract_file* file;
+
+	file = grub_malloc(sizeof(*file) + name_len + (dest_name ? grub_strlen(dest_name) + 1 : 0));
+	if (!file)
+	{
+		extract_grub_error(job, name);
+		return;
+	}
+	file->next = NULL;
+	file->dir = dir;
+	grub_strcpy(file->name, name);
+	file->dest_name = file->name;
+	if (dest_name)
+	{
+		char* p = file->name + name_len + 1;
+		grub_strcpy(p, dest_name);
+		file->dest_name = p;
+	}
+	file->mtimeset = info->mtimeset;
+	file->mtime = info->mtime;
+
+	grub_mutex_lock(&job->lock);
+	*job->files_tail = file;
+	job->files_tail = &file->next;
+	job->stats.total_files++;
+	grub_cond_signal(&job->file_cond);
+	grub_mutex_unlock(&job->lock);
+}
+
+struct walk_ctx
+{
+	struct extract_job* job;
+	struct extract_dir* dir;
+	/* Tail of the directories still to be listed.  */
+	struct extract_dir** walk_tail;
+};
+
+static void
+add_dir(struct walk_ctx* ctx, struct extract_dir* dir)
+{
+	struct extract_job* job = ctx->job;
+
+	if (!host_mkdir(dir->dest))
+	{
+		char msg[64];
+		extract_error(job, dir->dest, host_errmsg(msg, sizeof(msg)));
+		free_dir(dir);
+		return;
+	}
+	dir->created = 1;
+	*ctx->walk_tail = dir;
+	ctx->walk_tail = &dir->walk_next;
+
+	grub_mutex_lock(&job->lock);
+	dir->next = job->dirs;
+	job->dirs = dir;
+	job->stats.dirs++;
+	grub_mutex_unlock(&job->lock);
+}
+
+static int
+callback_walk(const char* filename,
+	const struct grub_dirhook_info* info, void* data)
+{
+	struct walk_ctx* ctx = data;
+	struct extract_job* job = ctx->job;
+	struct extract_dir* dir = ctx->dir;
+
+	if (job->cancel)
+		return 1;
+	if (grub_strcmp(filename, ".") == 0 || grub_strcmp(filename, "..") == 0)
+		return 0;
+	if (info->symlink || host_bad_name(filename))
+	{
+		grub_mutex_lock(&job->lock);
+		job->stats.skipped++;
+		grub_mutex_unlock(&job->lock);
+		return 0;
+	}
+	if (info->dir)
+	{
+		struct extract_dir* sub = new_dir(dir->src, dir->ofs, dir->dest, filename, info);
+		if (sub)
+			add_dir(ctx, sub);
+		else
+			extract_grub_error(job, filename);
+	}
+	else
+		queue_file(job, dir, filename, NULL, info);
+	return 0;
+}
+
+struct find_ctx
+{
+	const char* name;
+	int found;
+	struct grub_dirhook_info info;
+};
+
+static int
+callback_find(const char* filename,
+	const struct grub_dirhook_info* info, void* data)
+{
+	struct find_ctx* ctx = data;
+
+	if ((info->case_insensitive ? grub_strcasecmp(filename, ctx->name)
+		: grub_strcmp(filename, ctx->name)) != 0)
+		return 0;
+	ctx->found = 1;
+	ctx->info = *info;
+	return 1;
+}
+
+/* Queue everything under ITEM.  */
+static void
+walk_item(struct extract_job* job, const struct grub_extract_item* item)
+{
+	struct walk_ctx ctx = { .job = job };
+	struct extract_dir* top = NULL;
+	struct find_ctx find = { 0 };
+	grub_disk_t disk = NULL;
+	grub_fs_t fs;
+	const char* p;
+	char* disk_name = NULL;
+	char* path = NULL;
+	char* name;
+	grub_size_t ofs;
+	grub_size_t len;
+
+	p = (item->src[0] == '(') ? grub_strchr(item->src, ')') : NULL;
+	if (!p)
+	{
+		grub_error(GRUB_ERR_BAD_FILENAME, "`%s' is not a (device)/path", item->src);
+		goto fail;
+	}
+	ofs = p + 1 - item->src;
+	disk_name = grub_strndup(item->src + 1, ofs - 2);
+	/* The path without trailing slashes, "" for the root.  */
+	len = grub_strlen(p + 1);
+	while (len && p[len] == '/')
+		len--;
+	path = grub_strndup(p + 1, len);
+	if (!disk_name || !path)
+		goto fail;
+	disk = grub_disk_open(disk_name);
+	if (!disk)
+		goto fail;
+	fs = grub_fs_probe(disk);
+	if (!fs)
+		goto fail;
+
+	if (path[0])
+	{
+		/* Look the item up in its parent for its type and mtime.  */
+		name = grub_strrchr(path, '/');
+		if (!name)
+		{
+			grub_error(GRUB_ERR_BAD_FILENAME, "`%s' is not a (device)/path", item->src);
+			goto fail;
+		}
+		*name++ = '\0';
+		find.name = name;
+		fs->fs_dir(disk, path[0] ? path : "/", callback_find, &find);
+		if (grub_errno != GRUB_ERR_NONE)
+			goto fail;
+		if (!find.found)
+		{
+			grub_error(GRUB_ERR_FILE_NOT_FOUND, "file `%s' not found", item->src);
+			goto fail;
+		}
+		if (find.info.symlink)
+		{
+			grub_mutex_lock(&job->lock);
+			job->stats.skipped++;
+			grub_mutex_unlock(&job->lock);
+			goto out;
+		}
+	}
+	else
+	{
+		name = path;
+		find.info.dir = 1;
+	}
+
+	if (find.info.dir)
+	{
+		top = grub_zalloc(sizeof(*top));
+		if (!top)
+			goto fail;
+		top->ofs = ofs;
+		if (name == path)
+			top->src = grub_xasprintf("(%s)/", disk_name);
+		else
+			top->src = grub_xasprintf("(%s)%s/%s/", disk_name, path, name);
+		top->dest = grub_xasprintf("%s/", item->dest);
+		top->mtimeset = find.info.mtimeset;
+		top->mtime = find.info.mtime;
+		if (!top->src || !top->dest)
+			goto fail;
+		ctx.walk_tail = &ctx.dir;
+		add_dir(&ctx, top);
+		top = NULL;
+		/* Breadth first, the hook appends the subdirectories.  */
+		while (ctx.dir && !job->cancel)
+		{
+			struct extract_dir* dir = ctx.dir;
+			fs->fs_dir(disk, dir->src + dir->ofs, callback_walk, &ctx);
+			if (grub_errno != GRUB_ERR_NONE)
+				extract_grub_error(job, dir->src);
+			ctx.dir = dir->walk_next;
+			if (!ctx.dir)
+				ctx.walk_tail = &ctx.dir;
+		}
+	}
+	else
+	{
+		/* A single file, in a node of its own that is never created.  */
+		const char* dest_name = item->dest;
+		const char* q;
+		for (q = item->dest; *q; q++)
+		{
+#ifdef _WIN32
+			if (*q == '\\')
+				dest_name = q + 1;
+#endif
+			if (*q == '/')
+				dest_name = q + 1;
+		}
+		top = grub_zalloc(sizeof(*top));
+		if (!top)
+			goto fail;
+		top->ofs = ofs;
+		top->src = grub_xasprintf("(%s)%s/", disk_name, path);
+		top->dest = grub_strndup(item->dest, dest_name - item->dest);
+		if (!top->src || !top->dest)
+			goto fail;
+		grub_mutex_lock(&job->lock);
+		top->next = job->dirs;
+		job->dirs = top;
+		grub_mutex_unlock(&job->lock);
+		queue_file(job, top, name, dest_name, &find.info);
+		top = NULL;
+	}
+	goto out;
+
+fail:
+	extract_grub_error(job, item->src);
+out:
+	if (top)
+		free_dir(top);
+	if (disk)
+		grub_disk_close(disk);
+	grub_free(path);
+	grub_free(disk_name);
+}
+
+static void
+extract_walker(void* data)
+{
+	struct extract_job* job = data;
+	grub_size_t i;
+
+	for (i = 0; i < job->count && !job->cancel; i++)
+		walk_item(job, &job->items[i]);
+
+	grub_mutex_lock(&job->lock);
+	job->stats.walk_done = 1;
+	grub_cond_broadcast(&job->file_cond);
+	grub_mutex_unlock(&job->lock);
+}
+
+/* Drop a reference to OUT, the last one closes the file.  */
+static void
+release_out(struct extract_job* job, struct extract_out* out)
+{
+	unsigned refs;
+	int ok;
+
+	grub_mutex_lock(&job->lock);
+	refs = --out->refs;
+	grub_mutex_unlock(&job->lock);
+	if (refs)
+		return;
+
+	ok = out->complete && !out->failed && !out->dropped;
+	if (out->handle != HOST_FILE_NONE)
+	{
+		/* A trailing hole was never written.  */
+		if (ok && out->sparse)
+		{
+			if (!out->sparse_set)
+				host_set_sparse(out->handle);
+			if (!host_set_size(out->handle, out->size))
+			{
+				char msg[64];
+
+				extract_error(job, out->dest, host_errmsg(msg, sizeof(msg)));
+				ok = 0;
+			}
+		}
+		if (ok && out->mtimeset)
+			host_set_mtime(out->handle, out->mtime);
+		host_close(out->handle);
+		if (!ok)
+			host_remove(out->dest);
+		else if (job->store && out->hashed)
+			store_insert(job, out);
+	}
+	if (ok)
+	{
+		grub_mutex_lock(&job->lock);
+		job->stats.files++;
+		grub_mutex_unlock(&job->lock);
+	}
+	grub_free(out->src);
+	grub_free(out->dest);
+	grub_free(out);
+}
+
+/* Take a buffer from the pool, NULL after a cancel.  */
+static struct extract_buf*
+get_buf(struct extract_job* job)
+{
+	struct extract_buf* buf;
+
+	grub_mutex_lock(&job->lock);
+	while (!job->free_bufs && !job->cancel)
+		grub_cond_wait(&job->free_cond, &job->lock);
+	buf = job->cancel ? NULL : job->free_bufs;
+	if (buf)
+		job->free_bufs = buf->next;
+	grub_mutex_unlock(&job->lock);
+	return buf;
+}
+
+static void
+put_buf(struct extract_job* job, struct extract_buf* buf)
+{
+	grub_mutex_lock(&job->lock);
+	buf->next = job->free_bufs;
+	job->free_bufs = buf;
+	grub_cond_signal(&job->free_cond);
+	grub_mutex_unlock(&job->lock);
+}
+
+/* Note a hole of LEN bytes that was left out of OUT.  */
+static void
+add_hole(struct extract_job* job, struct extract_out* out, grub_off_t len)
+{
+	grub_mutex_lock(&out->lock);
+	out->sparse = 1;
+	grub_mutex_unlock(&out->lock);
+	grub_mutex_lock(&job->lock);
+	job->stats.holes += len;
+	grub_mutex_unlock(&job->lock);
+}
+
+/* Feed LEN zero bytes of a hole to HASH.  */
+static void
+hash_zeros(const gcry_md_spec_t* hash, void* context, grub_off_t len)
+{
+	static const grub_uint8_t zeros[EXTRACT_ZERO_BLOCK];
+
+	while (len)
+	{
+		grub_size_t n = (len > sizeof(zeros)) ? sizeof(zeros) : (grub_size_t)len;
+		hash->write(context, zeros, n);
+		len -= n;
+	}
+}
+
+/* Try to link OUT to an identical file of the store.  Files whose size and
+   first block the store has never seen are left to be written, the others
+   are hashed first.  Returns nonzero if OUT was linked.  */
+static int
+dedup_file(struct extract_job* job, grub_file_t file, struct extract_out* out,
+	void* context)
+{
+	const gcry_md_spec_t* hash = GRUB_MD_SHA256;
+	struct extract_buf* buf;
+	grub_size_t len = 0;
+	char* object;
+	int found, kind;
+
+	buf = get_buf(job);
+	if (!buf)
+		return 0;
+	/* The key, from the start of the first read.  */
+	while (len < STORE_KEY_BLOCK && grub_errno == GRUB_ERR_NONE)
+	{
+		grub_ssize_t r = grub_file_read(file, buf->data + len, STORE_KEY_BLOCK - len);
+		if (r <= 0)
+			break;
+		len += r;
+	}
+	if (grub_errno != GRUB_ERR_NONE)
+		goto fail;
+	out->key = grub_getcrc64(0, buf->data, len);
+	grub_mutex_lock(&job->store_lock);
+	found = store_has_key(job, file->size, out->key);
+	grub_mutex_unlock(&job->store_lock);
+	if (!found)
+	{
+		put_buf(job, buf);
+		grub_file_seek(file, 0);
+		return 0;
+	}
+
+	hash->init(context);
+	hash->write(context, buf->data, len);
+	while (!job->cancel)
+	{
+		grub_ssize_t r = grub_file_read(file, buf->data, job->opts.buffer_size);
+		if (r <= 0)
+			break;
+		hash->write(context, buf->data, r);
+	}
+	if (grub_errno != GRUB_ERR_NONE || file->offset != file->size)
+		goto fail;
+	put_buf(job, buf);
+	hash->final(context);
+	grub_memcpy(out->digest, hash->read(context), STORE_DIGEST);
+	out->hashed = 1;
+	grub_file_seek(file, 0);
+
+	object = store_object(job, out->digest, 0);
+	if (!object)
+	{
+		grub_errno = GRUB_ERR_NONE;
+		return 0;
+	}
+	host_remove(out->dest);
+	kind = host_link(object, out->dest, out->mtimeset ? &out->mtime : NULL);
+	grub_free(object);
+	if (kind == HOST_LINK_NONE)
+		return 0;
+	out->linked = 1;
+	out->complete = 1;
+	out->size = file->size;
+	grub_mutex_lock(&job->lock);
+	job->stats.linked++;
+	job->stats.linked_bytes += file->size;
+	grub_mutex_unlock(&job->lock);
+	return 1;
+
+fail:
+	/* The copy runs into the same error and reports it.  */
+	put_buf(job, buf);
+	grub_errno = GRUB_ERR_NONE;
+	grub_file_seek(file, 0);
+	return 0;
+}
+
+static void
+read_file(struct extract_job* job, struct extract_file* entry)
+{
+	struct extract_out* out;
+	grub_file_t file;
+	grub_off_t offset = 0;
+	/* Bytes left in the data run that starts at OFFSET, 0 if unknown.  */
+	grub_size_t run = 0;
+	int check_holes;
+	int sent = 0;
+	const gcry_md_spec_t* hash = GRUB_MD_SHA256;
+	void* context = NULL;
+
+	out = grub_zalloc(sizeof(*out));
+	if (!out)
+	{
+		extract_grub_error(job, entry->name);
+		return;
+	}
+	out->handle = HOST_FILE_NONE;
+	out->refs = 1;
+	out->mtimeset = entry->mtimeset;
+	out->mtime = entry->mtime;
+	out->src = grub_xasprintf("%s%s", entry->dir->src, entry->name);
+	out->dest = grub_xasprintf("%s%s", entry->dir->dest, entry->dest_name);
+	if (!out->src || !out->dest)
+	{
+		extract_grub_error(job, entry->name);
+		release_out(job, out);
+		return;
+	}
+
+	if (job->opts.flags & GRUB_EXTRACT_EXPAND)
+		file = grub_file_open(out->src, GRUB_FILE_TYPE_CAT | GRUB_FILE_TYPE_FILTER_VDISK);
+	else
+		file = grub_file_open(out->src, GRUB_FILE_TYPE_CAT | GRUB_FILE_TYPE_NO_DECOMPRESS);
+	if (!file)
+	{
+		extract_grub_error(job, out->src);
+		release_out(job, out);
+		return;
+	}
+	file->read_hook = extract_read_hook;
+	check_holes = (file->size != GRUB_FILE_SIZE_UNKNOWN);
+
+	/* Files of unknown size are copied as they are.  */
+	if (job->store && check_holes && file->size)
+	{
+		context = grub_malloc(hash->contextsize);
+		if (!context)
+			grub_errno = GRUB_ERR_NONE;
+		else if (dedup_file(job, file, out, context))
+			goto done;
+		else if (!out->hashed)
+			hash->init(context);
+	}
+
+	while (1)
+	{
+		struct extract_buf* buf;
+		grub_size_t want = job->opts.buffer_size;
+		grub_size_t len = 0;
+
+		/* Step over the holes in front of the next data.  */
+		while (check_holes && !run && offset < file->size && !job->cancel)
+		{
+			int hole;
+
+			run = (file->size - offset > GRUB_SIZE_MAX) ? GRUB_SIZE_MAX
+				: (grub_size_t)(file->size - offset);
+			if (grub_file_hole(file, offset, &run, &hole) != GRUB_ERR_NONE)
+			{
+				/* Read what the lower layers can't tell about.  */
+				grub_errno = GRUB_ERR_NONE;
+				check_holes = 0;
+				run = 0;
+				break;
+			}
+			if (!hole)
+				break;
+			if (context && !out->hashed)
+				hash_zeros(hash, context, run);
+			add_hole(job, out, run);
+			offset += run;
+			run = 0;
+		}
+		if (run && run < want)
+			want = run;
+
+		buf = get_buf(job);
+		if (!buf)
+			break;
+		if (offset != file->offset)
+			grub_file_seek(file, offset);
+		while (len < want && grub_errno == GRUB_ERR_NONE)
+		{
+			grub_ssize_t r = grub_file_read(file, buf->data + len, want - len);
+			if (r <= 0)
+				break;
+			len += r;
+		}
+		if (grub_errno != GRUB_ERR_NONE)
+		{
+			put_buf(job, buf);
+			grub_mutex_lock(&out->lock);
+			out->failed = 1;
+			grub_mutex_unlock(&out->lock);
+			extract_grub_error(job, out->src);
+			break;
+		}
+		/* An empty buffer still goes out for a file without data, the
+		   writer creates it.  */
+		if (len == 0 && sent)
+		{
+			put_buf(job, buf);
+			out->size = offset;
+			out->complete = 1;
+			break;
+		}
+		if (context && !out->hashed)
+			hash->write(context, buf->data, len);
+		buf->out = out;
+		buf->offset = offset;
+		buf->len = len;
+		buf->next = NULL;
+		offset += len;
+		run = (run > len) ? run - len : 0;
+		sent = 1;
+		if (len < want || offset >= file->size)
+		{
+			out->size = offset;
+			out->complete = 1;
+		}
+
+		grub_mutex_lock(&job->lock);
+		out->refs++;
+		*job->writes_tail = buf;
+		job->writes_tail = &buf->next;
+		grub_cond_signal(&job->write_cond);
+		grub_mutex_unlock(&job->lock);
+		if (out->complete)
+			break;
+	}
+	/* Before the last reference goes, that adds the file to the store.  */
+	if (context && !out->hashed && out->complete && out->size == file->size)
+	{
+		hash->final(context);
+		grub_memcpy(out->digest, hash->read(context), STORE_DIGEST);
+		out->hashed = 1;
+	}
+
+done:
+	grub_free(context);
+	grub_file_close(file);
+	grub_errno = GRUB_ERR_NONE;
+	release_out(job, out);
+}
+
+static void
+extract_reader(void* data)
+{
+	struct extract_job* job = data;
+
+	while (1)
+	{
+		struct extract_file* entry;
+
+		grub_mutex_lock(&job->lock);
+		while (!job->files && !job->stats.walk_done && !job->cancel)
+			grub_cond_wait(&job->file_cond, &job->lock);
+		entry = job->cancel ? NULL : job->files;
+		if (entry)
+		{
+			job->files = entry->next;
+			if (!job->files)
+				job->files_tail = &job->files;
+		}
+		grub_mutex_unlock(&job->lock);
+		if (!entry)
+			break;
+		read_file(job, entry);
+		grub_free(entry);
+	}
+
+	grub_mutex_lock(&job->lock);
+	if (--job->readers_running == 0)
+		grub_cond_broadcast(&job->write_cond);
+	grub_mutex_unlock(&job->lock);
+}
+
+static int
+all_zeros(const char* data, grub_size_t len)
+{
+	const grub_uint64_t* p = (const grub_uint64_t*)data;
+	grub_uint64_t acc = 0;
+	grub_size_t i;
+
+	for (i = 0; i < len / 8; i++)
+		acc |= p[i];
+	for (i *= 8; i < len; i++)
+		acc |= (grub_uint8_t)data[i];
+	return acc == 0;
+}
+
+/* Write BUF to OUT, under OUT->lock.  With GRUB_EXTRACT_ZEROS the blocks
+   that are all zeros are left out, *HOLES gets their size.  */
+static int
+write_data(struct extract_job* job, struct extract_out* out,
+	struct extract_buf* buf, grub_size_t* holes)
+{
+	grub_size_t pos, n, start = 0;
+
+	*holes = 0;
+	if (!(job->opts.flags & GRUB_EXTRACT_ZEROS))
+		return host_write(out->handle, buf->data, buf->len, buf->offset);
+
+	for (pos = 0; pos < buf->len; pos += n)
+	{
+		n = buf->len - pos;
+		if (n > EXTRACT_ZERO_BLOCK)
+			n = EXTRACT_ZERO_BLOCK;
+		if (!all_zeros(buf->data + pos, n))
+			continue;
+		if (!out->sparse_set)
+		{
+			host_set_sparse(out->handle);
+			out->sparse_set = 1;
+		}
+		out->sparse = 1;
+		if (pos > start && !host_write(out->handle, buf->data + start, pos - start, buf->offset + start))
+			return 0;
+		*holes += n;
+		start = pos + n;
+	}
+	if (start < buf->len)
+		return host_write(out->handle, buf->data + start, buf->len - start, buf->offset + start);
+	return 1;
+}
+
+static void
+write_buf(struct extract_job* job, struct extract_buf* buf)
+{
+	struct extract_out* out = buf->out;
+	grub_size_t holes = 0;
+	char msg[64];
+	int ok = 0;
+
+	grub_mutex_lock(&out->lock);
+	if (job->cancel)
+		out->dropped = 1;
+	else if (!out->failed)
+	{
+		if (out->handle == HOST_FILE_NONE)
+		{
+			/* An old copy may be a link to the store, replace it
+			   instead of writing through it.  */
+			if (job->store)
+				host_remove(out->dest);
+			out->handle = host_create(out->dest);
+			if (out->handle == HOST_FILE_NONE)
+			{
+				out->failed = 1;
+				extract_error(job, out->dest, host_errmsg(msg, sizeof(msg)));
+			}
+		}
+		if (out->handle != HOST_FILE_NONE)
+		{
+			/* Before anything is written past a hole.  */
+			if (out->sparse && !out->sparse_set)
+			{
+				host_set_sparse(out->handle);
+				out->sparse_set = 1;
+			}
+			ok = write_data(job, out, buf, &holes);
+			if (!ok)
+			{
+				out->failed = 1;
+				extract_error(job, out->dest, host_errmsg(msg, sizeof(msg)));
+			}
+		}
+	}
+	grub_mutex_unlock(&out->lock);
+
+	grub_mutex_lock(&job->lock);
+	if (ok)
+	{
+		job->stats.bytes += buf->len - holes;
+		job->stats.holes += holes;
+	}
+	grub_mutex_unlock(&job->lock);
+	put_buf(job, buf);
+	release_out(job, out);
+}
+
+static void
+extract_writer(void* data)
+{
+	struct extract_job* job = data;
+
+	while (1)
+	{
+		struct extract_buf* buf;
+
+		grub_mutex_lock(&job->lock);
+		while (!job->writes && job->readers_running)
+			grub_cond_wait(&job->write_cond, &job->lock);
+		buf = job->writes;
+		if (buf)
+		{
+			job->writes = buf->next;
+			if (!job->writes)
+				job->writes_tail = &job->writes;
+		}
+		grub_mutex_unlock(&job->lock);
+		if (!buf)
+			break;
+		write_buf(job, buf);
+	}
+
+	grub_mutex_lock(&job->lock);
+	job->writers_running--;
+	grub_mutex_unlock(&job->lock);
+}
+
+grub_err_t
+grub_extract(const struct grub_extract_item* items, grub_size_t count,
+	const struct grub_extract_options* options, struct grub_extract_stats* stats)
+{
+	/* The progress of the caller, its workers do not share it.  */
+	struct grub_progress* progress = grub_file_progress;
+	struct extract_job* job;
+	struct extract_buf* bufs = NULL;
+	grub_thread_t walker = NULL;
+	grub_thread_t* threads = NULL;
+	unsigned nthreads = 0;
+	grub_uint64_t start, next;
+	unsigned i;
+	grub_err_t err;
+
+	job = grub_zalloc(sizeof(*job));
+	if (!job)
+		return grub_errno;
+	job->items = items;
+	job->count = count;
+	if (options)
+		job->opts = *options;
+	if (!job->opts.readers)
+		job->opts.readers = EXTRACT_READERS;
+	if (!job->opts.writers)
+		job->opts.writers = EXTRACT_WRITERS;
+	if (job->opts.buffers < job->opts.readers + job->opts.writers)
+		job->opts.buffers = 4 * job->opts.writers;
+	if (job->opts.buffers < job->opts.readers + job->opts.writers)
+		job->opts.buffers = job->opts.readers + job->opts.writers;
+	if (!job->opts.buffer_size)
+		job->opts.buffer_size = EXTRACT_BUFFER_SIZE;
+	if (!job->opts.interval_ms)
+		job->opts.interval_ms = EXTRACT_INTERVAL;
+	job->files_tail = &job->files;
+	job->writes_tail = &job->writes;
+	start = grub_get_time_us();
+	if (job->opts.store && store_open(job) != GRUB_ERR_NONE)
+		goto fail;
+
+	bufs = grub_calloc(job->opts.buffers, sizeof(*bufs));
+	threads = grub_calloc(job->opts.readers + job->opts.writers, sizeof(*threads));
+	if (!bufs || !threads)
+		goto fail;
+	for (i = 0; i < job->opts.buffers; i++)
+	{
+		bufs[i].data = grub_malloc(job->opts.buffer_size);
+		if (!bufs[i].data)
+			goto fail;
+		bufs[i].next = job->free_bufs;
+		job->free_bufs = &bufs[i];
+	}
+
+	/* Writers wait while any reader runs, so count the readers first.  */
+	job->readers_running = job->opts.readers;
+	job->writers_running = job->opts.writers;
+	for (i = 0; i < job->opts.writers; i++)
+	{
+		threads[nthreads] = grub_thread_create(extract_writer, job);
+		if (!threads[nthreads])
+			break;
+		nthreads++;
+	}
+	job->writers_running = nthreads;
+	if (nthreads)
+		walker = grub_thread_create(extract_walker, job);
+	if (!walker)
+	{
+		/* Let the writers go.  */
+		grub_mutex_lock(&job->lock);
+		job->readers_running = 0;
+		grub_cond_broadcast(&job->write_cond);
+		grub_mutex_unlock(&job->lock);
+		goto fail;
+	}
+	for (i = 0; i < job->opts.readers; i++)
+	{
+		threads[nthreads] = grub_thread_create(extract_reader, job);
+		if (!threads[nthreads])
+			break;
+		nthreads++;
+	}
+	if (i < job->opts.readers)
+	{
+		grub_mutex_lock(&job->lock);
+		job->readers_running -= job->opts.readers - i;
+		if (i == 0)
+		{
+			/* Nothing would read the queue, stop the walk and the writers
+			   and keep the error.  */
+			job->cancel = 1;
+			grub_cond_broadcast(&job->file_cond);
+			grub_cond_broadcast(&job->write_cond);
+		}
+		grub_mutex_unlock(&job->lock);
+	}
+	if (i)
+		grub_errno = GRUB_ERR_NONE;
+
+	/* Report progress until the writers are done.  */
+	next = start + job->opts.interval_ms * 1000ULL;
+	while (1)
+	{
+		struct grub_extract_stats snap;
+		unsigned running;
+		grub_uint64_t now;
+
+		grub_mutex_lock(&job->lock);
+		snap = job->stats;
+		running = job->writers_running;
+		grub_mutex_unlock(&job->lock);
+		if (progress)
+		{
+			progress->bytes = snap.bytes;
+			progress->items = snap.files;
+			progress->total_items = snap.walk_done ? snap.total_files : 0;
+			if (progress->cancel && !snap.cancelled)
+				extract_cancel(job);
+		}
+		if (!running)
+			break;
+		grub_millisleep(10);
+		now = grub_get_time_us();
+		if (now < next || !job->opts.progress)
+			continue;
+		next = now + job->opts.interval_ms * 1000ULL;
+		snap.elapsed_us = now - start;
+		if (job->opts.progress(&snap, job->opts.data))
+			extract_cancel(job);
+	}
+
+fail:
+	if (walker)
+		grub_thread_join(walker);
+	for (i = 0; i < nthreads; i++)
+		grub_thread_join(threads[i]);
+
+	/* Directories last, the files in them changed their mtimes.  */
+	while (job->dirs)
+	{
+		struct extract_dir* dir = job->dirs;
+		job->dirs = dir->next;
+		if (dir->created && dir->mtimeset && !job->cancel)
+			host_set_dir_mtime(dir->dest, dir->mtime);
+		free_dir(dir);
+	}
+	while (job->files)
+	{
+		struct extract_file* entry = job->files;
+		job->files = entry->next;
+		grub_free(entry);
+	}
+	if (bufs)
+	{
+		for (i = 0; i < job->opts.buffers; i++)
+			grub_free(bufs[i].data);
+	}
+	grub_free(bufs);
+	grub_free(threads);
+	if (job->store_table)
+		store_close(job);
+
+	job->stats.elapsed_us = grub_get_time_us() - start;
+	if (stats)
+		*stats = job->stats;
+	if (grub_errno != GRUB_ERR_NONE)
+		err = grub_errno;
+	else if (job->stats.cancelled)
+		err = grub_error(GRUB_ERR_CANCELLED, "extraction cancelled");
+	else if (job->stats.errors)
+		err = grub_error(GRUB_ERR_WRITE_ERROR, "%llu files or directories failed",
+			(unsigned long long)job->stats.errors);
+	else
+		err = GRUB_ERR_NONE;
+	grub_free(job);
+	return err;
+}
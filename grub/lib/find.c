@@ -0,0 +1,1607 @@
+/* find.c - search a directory tree by name, size and time */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/disk.h>
+#include <grub/partition.h>
+#include <grub/fs.h>
+#include <grub/file.h>
+#include <grub/thread.h>
+#include <grub/find.h>
+
+/* Names are copied to chunks that never move.  */
+#define FIND_POOL_SIZE		65536
+/* Matches handed to the hook at a time.  */
+#define FIND_BATCH		256
+#define FIND_NONE		((grub_uint32_t)-1)
+
+#define NODE_DIR		(1 << 0)
+#define NODE_MTIME		(1 << 1)
+#define NODE_SIZE		(1 << 2)
+/* The file could not be opened for its size.  */
+#define NODE_NOSIZE		(1 << 3)
+#define NODE_SYMLINK		(1 << 4)
+
+/* An entry of the tree, its parent comes before it.  */
+struct find_node
+{
+	const char* name;
+	grub_uint32_t parent;
+	grub_uint32_t flags;
+	grub_int64_t mtime;
+	grub_uint64_t size;
+};
+
+struct find_pool
+{
+	struct find_pool* next;
+	grub_size_t used;
+	grub_size_t size;
+	char data[0];
+};
+
+/* Everything under the directory TOP of a device, node 0 is TOP.  */
+struct find_index
+{
+	struct find_index* next;
+	char* disk_name;
+	unsigned long dev_id;
+	unsigned long disk_id;
+	grub_disk_addr_t start;
+	/* "/dir/" on the device.  */
+	char* top;
+	struct find_node* nodes;
+	grub_uint32_t count;
+	grub_uint32_t alloc;
+	struct find_pool* pool;
+	/* Held while the index is searched or its sizes are filled in.  */
+	grub_mutex_t lock;
+	/* Searches using the index, and whether it is in the kept list.  */
+	unsigned refs;
+	int kept;
+};
+
+/* Regular expressions run on a Pike VM, so a match takes linear time in
+   the length of the name whatever the expression.  A byte class is the
+   only consuming instruction, '.' and negated classes take a whole UTF-8
+   sequence.  */
+enum
+{
+	RE_SET,
+	RE_SPLIT,
+	RE_JMP,
+	RE_BOL,
+	RE_EOL,
+	RE_MATCH,
+};
+
+struct re_inst
+{
+	grub_uint8_t op;
+	grub_uint32_t x;
+	grub_uint32_t y;
+};
+
+enum
+{
+	AST_SET,
+	AST_EMPTY,
+	AST_CAT,
+	AST_ALT,
+	AST_STAR,
+	AST_PLUS,
+	AST_QUEST,
+	AST_BOL,
+	AST_EOL,
+};
+
+struct re_ast
+{
+	int type;
+	grub_uint32_t set;
+	struct re_ast* l;
+	struct re_ast* r;
+};
+
+struct re_parser
+{
+	const char* p;
+	int nocase;
+	struct re_ast* ast;
+	grub_size_t ast_count;
+	grub_size_t ast_alloc;
+	grub_uint8_t (*sets)[32];
+	grub_uint32_t set_count;
+	grub_uint32_t set_alloc;
+	int error;
+};
+
+struct find_pattern
+{
+	unsigned flags;
+	const char* glob;
+	struct re_inst* prog;
+	grub_uint32_t len;
+	grub_uint8_t (*sets)[32];
+};
+
+/* Thread lists of the Pike VM, one per thread.  */
+struct re_state
+{
+	grub_uint32_t* buf;
+	grub_uint32_t* clist;
+	grub_uint32_t* nlist;
+	grub_uint32_t* mark;
+	grub_uint32_t gen;
+};
+
+struct find_dir
+{
+	struct find_dir* next;
+	grub_uint32_t node;
+	char path[0];
+};
+
+/* A match with its path.  */
+struct find_found
+{
+	grub_size_t path;
+	const char* name;
+	grub_uint32_t flags;
+	grub_int64_t mtime;
+	grub_uint64_t size;
+};
+
+struct find_batch
+{
+	struct find_found* found;
+	grub_size_t count;
+	grub_size_t alloc;
+	char* text;
+	grub_size_t used;
+	grub_size_t size;
+};
+
+struct find_job
+{
+	struct find_index* index;
+	const struct grub_find_options* options;
+	struct find_pattern* pattern;
+	const char* disk_name;
+	/* Offset of the path on the device in the paths of FIND_DIR.  */
+	grub_size_t ofs;
+
+	grub_mutex_t lock;
+	/* Directories were queued, or the walk is over.  */
+	grub_cond_t dir_cond;
+	/* Matches were found, or the walk is over.  */
+	grub_cond_t match_cond;
+	struct find_dir* dirs;
+	struct find_dir** dirs_tail;
+	/* Walkers listing a directory, and walkers still running.  */
+	unsigned busy;
+	unsigned walkers;
+	/* Every directory was listed.  */
+	int complete;
+	volatile int stop;
+	grub_err_t top_error;
+	char top_errmsg[GRUB_MAX_ERRMSG];
+	grub_uint32_t* matches;
+	grub_size_t match_count;
+	grub_size_t match_alloc;
+	struct grub_find_stats stats;
+};
+
+/* An entry seen by a walker, before it goes to the index.  */
+struct walk_entry
+{
+	grub_size_t name;
+	grub_uint32_t flags;
+	grub_int64_t mtime;
+	grub_uint64_t size;
+	int match;
+};
+
+struct walk_ctx
+{
+	struct find_job* job;
+	struct walk_entry* entries;
+	grub_size_t count;
+	grub_size_t alloc;
+	char* names;
+	grub_size_t names_used;
+	grub_size_t names_size;
+	int failed;
+};
+
+static grub_mutex_t find_lock;
+static struct find_index* find_indexes;
+
+static int
+fold(int c)
+{
+	return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static const char*
+next_char(const char* s)
+{
+	s++;
+	while ((*s & 0xc0) == 0x80)
+		s++;
+	return s;
+}
+
+/* Parse the class at P, just after '[', into SET.  Returns the position
+   after ']' or NULL.  */
+static const char*
+parse_class(const char* p, grub_uint8_t set[32], int nocase, int* negate)
+{
+	int first = 1;
+
+	grub_memset(set, 0, 32);
+	*negate = 0;
+	if (*p == '!' || *p == '^')
+	{
+		*negate = 1;
+		p++;
+	}
+	while (*p && (*p != ']' || first))
+	{
+		int lo = (grub_uint8_t)*p++;
+		int hi = lo;
+		int c;
+
+		first = 0;
+		if (lo == '\\' && *p)
+			lo = hi = (grub_uint8_t)*p++;
+		if (p[0] == '-' && p[1] && p[1] != ']')
+		{
+			hi = (grub_uint8_t)p[1];
+			if (hi == '\\' && p[2])
+			{
+				hi = (grub_uint8_t)p[2];
+				p++;
+			}
+			p += 2;
+		}
+		for (c = lo; c <= hi; c++)
+		{
+			set[c >> 3] |= 1 << (c & 7);
+			if (nocase && fold(c) != c)
+				set[fold(c) >> 3] |= 1 << (fold(c) & 7);
+			if (nocase && c >= 'a' && c <= 'z')
+				set[(c - 'a' + 'A') >> 3] |= 1 << ((c - 'a' + 'A') & 7);
+		}
+	}
+	if (*p != ']')
+		return NULL;
+	return p + 1;
+}
+
+static int
+in_set(const grub_uint8_t set[32], int c)
+{
+	return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+/* Match the whole NAME.  A star restarts from the last star only, which is
+   enough since a star matches any run.  */
+static int
+glob_match(const char* p, const char* s, int nocase)
+{
+	const char* star_p = NULL;
+	const char* star_s = NULL;
+
+	while (*s)
+	{
+		if (*p == '*')
+		{
+			while (*p == '*')
+				p++;
+			if (!*p)
+				return 1;
+			star_p = p;
+			star_s = s;
+			continue;
+		}
+		if (*p == '?')
+		{
+			p++;
+			s = next_char(s);
+			continue;
+		}
+		if (*p == '[')
+		{
+			grub_uint8_t set[32];
+			int negate;
+			const char* q = parse_class(p + 1, set, nocase, &negate);
+			if (q && in_set(set, (grub_uint8_t)*s) != negate)
+			{
+				p = q;
+				s = negate ? next_char(s) : s + 1;
+				continue;
+			}
+			if (!q && *s == '[')
+			{
+				p++;
+				s++;
+				continue;
+			}
+		}
+		else
+		{
+			const char* q = p;
+			if (*q == '\\' && q[1])
+				q++;
+			if (*q && (nocase ? fold((grub_uint8_t)*q) == fold((grub_uint8_t)*s) : *q == *s))
+			{
+				p = q + 1;
+				s++;
+				continue;
+			}
+		}
+		if (!star_p)
+			return 0;
+		p = star_p;
+		s = star_s = next_char(star_s);
+	}
+	while (*p == '*')
+		p++;
+	return *p == '\0';
+}
+
+static struct re_ast*
+re_node(struct re_parser* re, int type, struct re_ast* l, struct re_ast* r)
+{
+	struct re_ast* n;
+
+	if (re->ast_count == re->ast_alloc)
+	{
+		re->error = 1;
+		return NULL;
+	}
+	n = &re->ast[re->ast_count++];
+	n->type = type;
+	n->l = l;
+	n->r = r;
+	n->set = 0;
+	return n;
+}
+
+static struct re_ast*
+re_set(struct re_parser* re, grub_uint8_t** set)
+{
+	struct re_ast* n;
+
+	if (re->set_count == re->set_alloc)
+	{
+		re->error = 1;
+		return NULL;
+	}
+	n = re_node(re, AST_SET, NULL, NULL);
+	if (!n)
+		return NULL;
+	n->set = re->set_count++;
+	*set = re->sets[n->set];
+	grub_memset(*set, 0, 32);
+	return n;
+}
+
+/* One UTF-8 character from the bytes in SET that start one.  */
+static struct re_ast*
+re_char(struct re_parser* re, const grub_uint8_t* lead)
+{
+	grub_uint8_t* set;
+	struct re_ast* first;
+	struct re_ast* cont;
+	int c;
+
+	first = re_set(re, &set);
+	if (!first)
+		return NULL;
+	for (c = 0; c < 256; c++)
+	{
+		if ((c & 0xc0) != 0x80 && in_set(lead, c))
+			set[c >> 3] |= 1 << (c & 7);
+	}
+	cont = re_set(re, &set);
+	if (!cont)
+		return NULL;
+	for (c = 0x80; c < 0xc0; c++)
+		set[c >> 3] |= 1 << (c & 7);
+	return re_node(re, AST_CAT, first, re_node(re, AST_STAR, cont, NULL));
+}
+
+static struct re_ast* re_alt(struct re_parser* re);
+
+static struct re_ast*
+re_atom(struct re_parser* re)
+{
+	grub_uint8_t* set;
+	grub_uint8_t tmp[32];
+	struct re_ast* n;
+	int negate;
+	int c;
+
+	switch (*re->p)
+	{
+	case '(':
+		re->p++;
+		n = re_alt(re);
+		if (*re->p != ')')
+		{
+			re->error = 1;
+			return NULL;
+		}
+		re->p++;
+		return n;
+	case '^':
+		re->p++;
+		return re_node(re, AST_BOL, NULL, NULL);
+	case '$':
+		re->p++;
+		return re_node(re, AST_EOL, NULL, NULL);
+	case '.':
+		re->p++;
+		grub_memset(tmp, 0xff, sizeof(tmp));
+		return re_char(re, tmp);
+	case '[':
+		re->p = parse_class(re->p + 1, tmp, re->nocase, &negate);
+		if (!re->p)
+		{
+			re->error = 1;
+			return NULL;
+		}
+		if (negate)
+		{
+			for (c = 0; c < 32; c++)
+				tmp[c] = ~tmp[c];
+			return re_char(re, tmp);
+		}
+		n = re_set(re, &set);
+		if (n)
+			grub_memcpy(set, tmp, 32);
+		return n;
+	case '*':
+	case '+':
+	case '?':
+	case ')':
+	case '|':
+	case '\0':
+		re->error = 1;
+		return NULL;
+	}
+
+	c = (grub_uint8_t)*re->p++;
+	n = re_set(re, &set);
+	if (!n)
+		return NULL;
+	if (c == '\\' && *re->p)
+	{
+		c = (grub_uint8_t)*re->p++;
+		if (c == 'd' || c == 'w' || c == 's')
+		{
+			int i;
+			for (i = 0; i < 128; i++)
+			{
+				if ((c == 'd' && grub_isdigit(i)) || (c == 's' && grub_isspace(i))
+					|| (c == 'w' && (grub_isalnum(i) || i == '_')))
+					set[i >> 3] |= 1 << (i & 7);
+			}
+			return n;
+		}
+	}
+	set[c >> 3] |= 1 << (c & 7);
+	if (re->nocase && c >= 'A' && c <= 'Z')
+		set[fold(c) >> 3] |= 1 << (fold(c) & 7);
+	if (re->nocase && c >= 'a' && c <= 'z')
+		set[(c - 'a' + 'A') >> 3] |= 1 << ((c - 'a' + 'A') & 7);
+	return n;
+}
+
+static struct re_ast*
+re_repeat(struct re_parser* re)
+{
+	struct re_ast* n = re_atom(re);
+
+	while (n && (*re->p == '*' || *re->p == '+' || *re->p == '?'))
+	{
+		int type = (*re->p == '*') ? AST_STAR : (*re->p == '+') ? AST_PLUS : AST_QUEST;
+		re->p++;
+		n = re_node(re, type, n, NULL);
+	}
+	return n;
+}
+
+static struct re_ast*
+re_cat(struct re_parser* re)
+{
+	struct re_ast* n = re_node(re, AST_EMPTY, NULL, NULL);
+
+	while (n && *re->p && *re->p != '|' && *re->p != ')')
+	{
+		struct re_ast* r = re_repeat(re);
+		if (!r)
+			return NULL;
+		n = re_node(re, AST_CAT, n, r);
+	}
+	return n;
+}
+
+static struct re_ast*
+re_alt(struct re_parser* re)
+{
+	struct re_ast* n = re_cat(re);
+
+	while (n && *re->p == '|')
+	{
+		struct re_ast* r;
+		re->p++;
+		r = re_cat(re);
+		if (!r)
+			return NULL;
+		n = re_node(re, AST_ALT, n, r);
+	}
+	return n;
+}
+
+static grub_uint32_t
+re_size(const struct re_ast* n)
+{
+	switch (n->type)
+	{
+	case AST_EMPTY:
+		return 0;
+	case AST_CAT:
+		return re_size(n->l) + re_size(n->r);
+	case AST_ALT:
+		return 2 + re_size(n->l) + re_size(n->r);
+	case AST_STAR:
+		return 2 + re_size(n->l);
+	case AST_PLUS:
+	case AST_QUEST:
+		return 1 + re_size(n->l);
+	default:
+		return 1;
+	}
+}
+
+static grub_uint32_t
+re_emit(const struct re_ast* n, struct re_inst* prog, grub_uint32_t pc)
+{
+	grub_uint32_t start = pc;
+	grub_uint32_t split;
+
+	switch (n->type)
+	{
+	case AST_EMPTY:
+		break;
+	case AST_SET:
+		prog[pc].op = RE_SET;
+		prog[pc++].x = n->set;
+		break;
+	case AST_BOL:
+		prog[pc++].op = RE_BOL;
+		break;
+	case AST_EOL:
+		prog[pc++].op = RE_EOL;
+		break;
+	case AST_CAT:
+		pc = re_emit(n->l, prog, pc);
+		pc = re_emit(n->r, prog, pc);
+		break;
+	case AST_ALT:
+		split = pc++;
+		prog[split].op = RE_SPLIT;
+		prog[split].x = pc;
+		pc = re_emit(n->l, prog, pc);
+		prog[pc].op = RE_JMP;
+		prog[split].y = pc + 1;
+		split = pc++;
+		pc = re_emit(n->r, prog, pc);
+		prog[split].x = pc;
+		break;
+	case AST_STAR:
+		split = pc++;
+		prog[split].op = RE_SPLIT;
+		prog[split].x = pc;
+		pc = re_emit(n->l, prog, pc);
+		prog[pc].op = RE_JMP;
+		prog[pc++].x = start;
+		prog[split].y = pc;
+		break;
+	case AST_PLUS:
+		pc = re_emit(n->l, prog, pc);
+		prog[pc].op = RE_SPLIT;
+		prog[pc].x = start;
+		prog[pc].y = pc + 1;
+		pc++;
+		break;
+	case AST_QUEST:
+		split = pc++;
+		prog[split].op = RE_SPLIT;
+		prog[split].x = pc;
+		pc = re_emit(n->l, prog, pc);
+		prog[split].y = pc;
+		break;
+	}
+	return pc;
+}
+
+static grub_err_t
+compile_regex(struct find_pattern* pattern, const char* expr)
+{
+	grub_size_t len = grub_strlen(expr);
+	struct re_parser re =
+	{
+		.p = expr,
+		.nocase = !!(pattern->flags & GRUB_FIND_NOCASE),
+		/* A character takes at most 5 nodes and 2 sets, '.' included.  */
+		.ast_alloc = 5 * len + 2,
+		.set_alloc = 2 * len + 1,
+	};
+	struct re_ast* ast;
+
+	re.ast = grub_calloc(re.ast_alloc, sizeof(*re.ast));
+	re.sets = grub_calloc(re.set_alloc, 32);
+	if (!re.ast || !re.sets)
+		goto fail;
+	ast = re_alt(&re);
+	if (!ast || re.error || *re.p)
+	{
+		grub_error(GRUB_ERR_BAD_ARGUMENT, "bad regular expression `%s'", expr);
+		goto fail;
+	}
+	pattern->len = re_size(ast) + 1;
+	pattern->prog = grub_calloc(pattern->len, sizeof(struct re_inst));
+	if (!pattern->prog)
+		goto fail;
+	re_emit(ast, pattern->prog, 0);
+	pattern->prog[pattern->len - 1].op = RE_MATCH;
+	pattern->sets = re.sets;
+	grub_free(re.ast);
+	return GRUB_ERR_NONE;
+
+fail:
+	grub_free(re.ast);
+	grub_free(re.sets);
+	return grub_errno;
+}
+
+static void
+re_add(const struct find_pattern* pattern, struct re_state* st,
+	grub_uint32_t* list, grub_uint32_t* n, grub_uint32_t pc, int bol, int eol)
+{
+	while (st->mark[pc] != st->gen)
+	{
+		const struct re_inst* in = &pattern->prog[pc];
+		st->mark[pc] = st->gen;
+		switch (in->op)
+		{
+		case RE_JMP:
+			pc = in->x;
+			continue;
+		case RE_SPLIT:
+			re_add(pattern, st, list, n, in->x, bol, eol);
+			pc = in->y;
+			continue;
+		case RE_BOL:
+			if (!bol)
+				return;
+			pc++;
+			continue;
+		case RE_EOL:
+			if (!eol)
+				return;
+			pc++;
+			continue;
+		default:
+			list[(*n)++] = pc;
+			return;
+		}
+	}
+}
+
+static int
+re_match(const struct find_pattern* pattern, struct re_state* st, const char* name)
+{
+	const grub_uint8_t* s = (const grub_uint8_t*)name;
+	grub_uint32_t nc = 0;
+	grub_uint32_t nn;
+	grub_uint32_t i;
+
+	for (;; s++)
+	{
+		grub_uint32_t* t;
+
+		/* The search is not anchored, a thread starts at every byte.  */
+		st->gen++;
+		for (i = 0; i < nc; i++)
+			st->mark[st->clist[i]] = st->gen;
+		re_add(pattern, st, st->clist, &nc, 0, s == (const grub_uint8_t*)name, *s == '\0');
+		for (i = 0; i < nc; i++)
+		{
+			if (pattern->prog[st->clist[i]].op == RE_MATCH)
+				return 1;
+		}
+		if (*s == '\0')
+			return 0;
+
+		st->gen++;
+		nn = 0;
+		for (i = 0; i < nc; i++)
+		{
+			const struct re_inst* in = &pattern->prog[st->clist[i]];
+			if (in->op == RE_SET && in_set(pattern->sets[in->x], *s))
+				re_add(pattern, st, st->nlist, &nn, st->clist[i] + 1, 0, s[1] == '\0');
+		}
+		t = st->clist;
+		st->clist = st->nlist;
+		st->nlist = t;
+		nc = nn;
+	}
+}
+
+static int
+re_state_init(const struct find_pattern* pattern, struct re_state* st)
+{
+	grub_memset(st, 0, sizeof(*st));
+	if (!pattern->prog)
+		return 1;
+	st->buf = grub_calloc(pattern->len * 3, sizeof(grub_uint32_t));
+	if (!st->buf)
+		return 0;
+	st->clist = st->buf;
+	st->nlist = st->clist + pattern->len;
+	st->mark = st->nlist + pattern->len;
+	return 1;
+}
+
+static void
+re_state_fini(struct re_state* st)
+{
+	grub_free(st->buf);
+}
+
+static int
+match_name(const struct find_pattern* pattern, struct re_state* st, const char* name)
+{
+	if (pattern->prog)
+		return re_match(pattern, st, name);
+	if (pattern->glob)
+		return glob_match(pattern->glob, name, pattern->flags & GRUB_FIND_NOCASE);
+	return 1;
+}
+
+/* The tests that need no open file.  */
+static int
+match_entry(const struct grub_find_options* options, const struct find_pattern* pattern,
+	struct re_state* st, const char* name, grub_uint32_t flags, grub_int64_t mtime)
+{
+	if ((options->flags & GRUB_FIND_FILES) && (flags & NODE_DIR))
+		return 0;
+	if ((options->flags & GRUB_FIND_DIRS) && !(flags & NODE_DIR))
+		return 0;
+	if ((options->flags & GRUB_FIND_SIZE) && (flags & NODE_DIR))
+		return 0;
+	if (options->flags & GRUB_FIND_MTIME)
+	{
+		if (!(flags & NODE_MTIME) || mtime < options->min_mtime || mtime > options->max_mtime)
+			return 0;
+	}
+	return match_name(pattern, st, name);
+}
+
+static int
+match_size(const struct grub_find_options* options, grub_uint32_t flags, grub_uint64_t size)
+{
+	if (!(options->flags & GRUB_FIND_SIZE))
+		return 1;
+	return (flags & NODE_SIZE) && size >= options->min_size
+		&& (!options->max_size || size <= options->max_size);
+}
+
+static int
+need_size(const struct grub_find_options* options, grub_uint32_t flags)
+{
+	return (options->flags & (GRUB_FIND_SIZE | GRUB_FIND_STAT)) && !(flags & NODE_DIR)
+		&& !(flags & (NODE_SIZE | NODE_NOSIZE));
+}
+
+static void
+get_size(const char* path, grub_uint32_t* flags, grub_uint64_t* size)
+{
+	grub_file_t file = grub_file_open(path, GRUB_FILE_TYPE_GET_SIZE | GRUB_FILE_TYPE_NO_DECOMPRESS);
+
+	if (file)
+	{
+		*size = grub_file_size(file);
+		*flags |= NODE_SIZE;
+		grub_file_close(file);
+	}
+	else
+		*flags |= NODE_NOSIZE;
+	grub_errno = GRUB_ERR_NONE;
+}
+
+static const char*
+pool_add(struct find_pool** pool, struct find_pool** chain, const char* name, grub_size_t len)
+{
+	struct find_pool* p = *pool;
+	char* s;
+
+	if (!p || p->size - p->used < len + 1)
+	{
+		grub_size_t size = (len + 1 > FIND_POOL_SIZE) ? len + 1 : FIND_POOL_SIZE;
+		p = grub_malloc(sizeof(*p) + size);
+		if (!p)
+			return NULL;
+		p->used = 0;
+		p->size = size;
+		p->next = *chain;
+		*chain = p;
+		*pool = p;
+	}
+	s = p->data + p->used;
+	grub_memcpy(s, name, len);
+	s[len] = '\0';
+	p->used += len + 1;
+	return s;
+}
+
+static void
+index_free(struct find_index* index)
+{
+	while (index->pool)
+	{
+		struct find_pool* next = index->pool->next;
+		grub_free(index->pool);
+		index->pool = next;
+	}
+	grub_free(index->nodes);
+	grub_free(index->disk_name);
+	grub_free(index->top);
+	grub_free(index);
+}
+
+static void
+index_unref(struct find_index* index)
+{
+	int gone;
+
+	grub_mutex_lock(&find_lock);
+	index->refs--;
+	gone = !index->refs && !index->kept;
+	grub_mutex_unlock(&find_lock);
+	if (gone)
+		index_free(index);
+}
+
+/* Append node N with its path, "(disk)/top/dir/name", to BATCH.  */
+static int
+batch_add(struct find_batch* batch, const struct find_index* index,
+	grub_uint32_t n, const char* disk_name)
+{
+	const struct find_node* node = &index->nodes[n];
+	struct find_found* found;
+	grub_size_t head = grub_strlen(disk_name) + 2 + grub_strlen(index->top);
+	grub_size_t len = (node->flags & NODE_DIR) ? 1 : 0;
+	grub_uint32_t i;
+	char* p;
+	char c;
+
+	for (i = n; i; i = index->nodes[i].parent)
+		len += grub_strlen(index->nodes[i].name) + 1;
+	len = len + head;
+	if (batch->count == batch->alloc)
+	{
+		grub_size_t alloc = batch->alloc ? batch->alloc * 2 : FIND_BATCH;
+		found = grub_realloc(batch->found, alloc * sizeof(*found));
+		if (!found)
+			return 0;
+		batch->found = found;
+		batch->alloc = alloc;
+	}
+	if (batch->used + len > batch->size)
+	{
+		grub_size_t size = batch->size ? batch->size * 2 : 4 * FIND_POOL_SIZE;
+		while (size < batch->used + len)
+			size *= 2;
+		p = grub_realloc(batch->text, size);
+		if (!p)
+			return 0;
+		batch->text = p;
+		batch->size = size;
+	}
+	found = &batch->found[batch->count++];
+	found->path = batch->used;
+	found->name = node->name;
+	found->flags = node->flags;
+	found->mtime = node->mtime;
+	found->size = node->size;
+	/* The names are written from the end, one '/' before each.  */
+	p = batch->text + batch->used + len - 1;
+	*p = '\0';
+	if (node->flags & NODE_DIR)
+		*--p = '/';
+	for (i = n; i; i = index->nodes[i].parent)
+	{
+		const char* name = index->nodes[i].name;
+		grub_size_t l = grub_strlen(name);
+		p -= l;
+		grub_memcpy(p, name, l);
+		if (index->nodes[i].parent)
+			*--p = '/';
+	}
+	c = batch->text[batch->used + head];
+	grub_snprintf(batch->text + batch->used, head + 1, "(%s)%s", disk_name, index->top);
+	batch->text[batch->used + head] = c;
+	batch->used += len;
+	return 1;
+}
+
+static void
+batch_drop(struct find_batch* batch)
+{
+	batch->used = batch->found[--batch->count].path;
+}
+
+/* Hand BATCH to HOOK and empty it.  Returns nonzero if HOOK stopped.  */
+static int
+batch_report(struct find_batch* batch, grub_find_hook_t hook, void* data)
+{
+	grub_size_t i;
+	int ret = 0;
+
+	for (i = 0; i < batch->count && !ret; i++)
+	{
+		const struct find_found* found = &batch->found[i];
+		struct grub_find_entry entry =
+		{
+			.path = batch->text + found->path,
+			.name = found->name,
+			.dir = !!(found->flags & NODE_DIR),
+			.sizeset = !!(found->flags & NODE_SIZE),
+			.size = found->size,
+			.mtimeset = !!(found->flags & NODE_MTIME),
+			.mtime = found->mtime,
+		};
+		ret = hook(&entry, data);
+	}
+	batch->count = 0;
+	batch->used = 0;
+	return ret;
+}
+
+static int
+callback_walk(const char* filename,
+	const struct grub_dirhook_info* info, void* data)
+{
+	struct walk_ctx* ctx = data;
+	struct walk_entry* e;
+	grub_size_t len;
+
+	if (ctx->job->stop || (ctx->job->options->cancel && *ctx->job->options->cancel))
+	{
+		ctx->job->stop = 1;
+		return 1;
+	}
+	if (grub_strcmp(filename, ".") == 0 || grub_strcmp(filename, "..") == 0)
+		return 0;
+	if (ctx->count == ctx->alloc)
+	{
+		grub_size_t alloc = ctx->alloc ? ctx->alloc * 2 : 64;
+		e = grub_realloc(ctx->entries, alloc * sizeof(*e));
+		if (!e)
+			goto fail;
+		ctx->entries = e;
+		ctx->alloc = alloc;
+	}
+	len = grub_strlen(filename) + 1;
+	if (ctx->names_used + len > ctx->names_size)
+	{
+		grub_size_t size = ctx->names_size ? ctx->names_size * 2 : 4096;
+		char* names;
+		while (size < ctx->names_used + len)
+			size *= 2;
+		names = grub_realloc(ctx->names, size);
+		if (!names)
+			goto fail;
+		ctx->names = names;
+		ctx->names_size = size;
+	}
+	e = &ctx->entries[ctx->count++];
+	e->name = ctx->names_used;
+	grub_memcpy(ctx->names + ctx->names_used, filename, len);
+	ctx->names_used += len;
+	e->flags = 0;
+	if (info->dir && !info->symlink)
+		e->flags |= NODE_DIR;
+	if (info->symlink)
+		e->flags |= NODE_SYMLINK;
+	if (info->mtimeset)
+	{
+		e->flags |= NODE_MTIME;
+		e->mtime = info->mtime;
+	}
+	e->size = 0;
+	e->match = 0;
+	return 0;
+
+fail:
+	ctx->failed = 1;
+	return 1;
+}
+
+static void
+find_walker(void* data)
+{
+	struct find_job* job = data;
+	const struct grub_find_options* options = job->options;
+	struct find_index* index = job->index;
+	struct walk_ctx ctx = { .job = job };
+	struct find_pool* pool = NULL;
+	struct re_state st;
+	grub_disk_t disk;
+	grub_fs_t fs = NULL;
+	char* path = NULL;
+	grub_size_t path_size = 0;
+
+	disk = grub_disk_open(job->disk_name);
+	if (disk)
+		fs = grub_fs_probe(disk);
+	grub_errno = GRUB_ERR_NONE;
+	if (!re_state_init(job->pattern, &st))
+		fs = NULL;
+
+	grub_mutex_lock(&job->lock);
+	while (fs)
+	{
+		struct find_dir* dir;
+		grub_size_t dir_len;
+		grub_size_t i;
+		int matched = 0;
+		int queued = 0;
+
+		while (!job->dirs && job->busy && !job->stop)
+			grub_cond_wait(&job->dir_cond, &job->lock);
+		if (!job->dirs || job->stop)
+		{
+			if (!job->stop)
+				job->complete = 1;
+			break;
+		}
+		dir = job->dirs;
+		job->dirs = dir->next;
+		if (!job->dirs)
+			job->dirs_tail = &job->dirs;
+		job->busy++;
+		grub_mutex_unlock(&job->lock);
+
+		ctx.count = 0;
+		ctx.names_used = 0;
+		fs->fs_dir(disk, dir->path + job->ofs, callback_walk, &ctx);
+		if (grub_errno != GRUB_ERR_NONE && dir->node == 0 && !job->top_error)
+		{
+			job->top_error = grub_errno;
+			grub_strncpy(job->top_errmsg, grub_errmsg, sizeof(job->top_errmsg) - 1);
+		}
+		grub_errno = GRUB_ERR_NONE;
+
+		/* Files are opened after the listing, not all filesystems can
+		   read while they iterate.  */
+		dir_len = grub_strlen(dir->path);
+		for (i = 0; i < ctx.count && !job->stop; i++)
+		{
+			struct walk_entry* e = &ctx.entries[i];
+			const char* name = ctx.names + e->name;
+			e->match = match_entry(options, job->pattern, &st, name, e->flags, e->mtime);
+			if (e->match && need_size(options, e->flags))
+			{
+				grub_size_t size = dir_len + grub_strlen(name) + 1;
+				if (size > path_size)
+				{
+					char* p = grub_realloc(path, size);
+					if (!p)
+					{
+						e->match = 0;
+						continue;
+					}
+					path = p;
+					path_size = size;
+				}
+				grub_memcpy(path, dir->path, dir_len);
+				grub_strcpy(path + dir_len, name);
+				get_size(path, &e->flags, &e->size);
+			}
+			if (e->match)
+				e->match = match_size(options, e->flags, e->size);
+		}
+
+		grub_mutex_lock(&job->lock);
+		job->busy--;
+		job->stats.dirs++;
+		if (ctx.failed)
+			job->stop = 1;
+		for (i = 0; i < ctx.count && !job->stop; i++)
+		{
+			struct walk_entry* e = &ctx.entries[i];
+			const char* name = ctx.names + e->name;
+			struct find_node* node;
+			grub_uint32_t n = index->count;
+
+			if (index->count == index->alloc)
+			{
+				grub_uint32_t alloc = index->alloc * 2;
+				node = grub_realloc(index->nodes, alloc * sizeof(*node));
+				if (!node || alloc <= index->alloc)
+				{
+					job->stop = 1;
+					break;
+				}
+				index->nodes = node;
+				index->alloc = alloc;
+			}
+			node = &index->nodes[n];
+			node->name = pool_add(&pool, &index->pool, name, grub_strlen(name));
+			if (!node->name)
+			{
+				job->stop = 1;
+				break;
+			}
+			node->parent = dir->node;
+			node->flags = e->flags;
+			node->mtime = e->mtime;
+			node->size = e->size;
+			index->count++;
+			job->stats.entries++;
+
+			if (e->match)
+			{
+				if (job->match_count == job->match_alloc)
+				{
+					grub_size_t alloc = job->match_alloc ? job->match_alloc * 2 : FIND_BATCH;
+					grub_uint32_t* m = grub_realloc(job->matches, alloc * sizeof(*m));
+					if (!m)
+					{
+						job->stop = 1;
+						break;
+					}
+					job->matches = m;
+					job->match_alloc = alloc;
+				}
+				job->matches[job->match_count++] = n;
+				matched = 1;
+			}
+			if (e->flags & NODE_DIR)
+			{
+				grub_size_t len = grub_strlen(name);
+				struct find_dir* sub = grub_malloc(sizeof(*sub) + dir_len + len + 2);
+				if (!sub)
+				{
+					job->stop = 1;
+					break;
+				}
+				sub->next = NULL;
+				sub->node = n;
+				grub_memcpy(sub->path, dir->path, dir_len);
+				grub_memcpy(sub->path + dir_len, name, len);
+				sub->path[dir_len + len] = '/';
+				sub->path[dir_len + len + 1] = '\0';
+				*job->dirs_tail = sub;
+				job->dirs_tail = &sub->next;
+				queued = 1;
+			}
+		}
+		grub_free(dir);
+		if (queued || !job->busy || job->stop)
+			grub_cond_broadcast(&job->dir_cond);
+		if (matched)
+			grub_cond_signal(&job->match_cond);
+	}
+	job->walkers--;
+	grub_cond_broadcast(&job->dir_cond);
+	grub_cond_broadcast(&job->match_cond);
+	grub_mutex_unlock(&job->lock);
+
+	re_state_fini(&st);
+	grub_free(path);
+	grub_free(ctx.entries);
+	grub_free(ctx.names);
+	if (disk)
+		grub_disk_close(disk);
+	grub_errno = GRUB_ERR_NONE;
+}
+
+static void
+keep_index(struct find_index* index)
+{
+	struct find_index** pp;
+	unsigned count = 0;
+
+	grub_mutex_lock(&find_lock);
+	index->kept = 1;
+	index->next = find_indexes;
+	find_indexes = index;
+	for (pp = &find_indexes->next; *pp;)
+	{
+		struct find_index* p = *pp;
+		grub_size_t len = grub_strlen(p->top);
+		int stale = grub_strcmp(p->disk_name, index->disk_name) == 0
+			&& (grub_strncmp(p->top, index->top, len) == 0
+				|| grub_strncmp(p->top, index->top, grub_strlen(index->top)) == 0);
+		/* The new index replaces those of the same tree.  */
+		if (stale || ++count >= GRUB_FIND_MAX_INDEX)
+		{
+			*pp = p->next;
+			p->next = NULL;
+			p->kept = 0;
+			/* The last search using it frees it.  */
+			if (!p->refs)
+				index_free(p);
+			continue;
+		}
+		pp = &p->next;
+	}
+	grub_mutex_unlock(&find_lock);
+}
+
+/* A kept index of the disk that covers TOP, with its node for TOP.  */
+static struct find_index*
+find_index(const char* disk_name, grub_disk_t disk, const char* top, grub_uint32_t* node)
+{
+	struct find_index* index;
+	struct find_index** pp;
+	grub_disk_addr_t start = disk->partition ? grub_partition_get_start(disk->partition) : 0;
+
+	grub_mutex_lock(&find_lock);
+	for (index = find_indexes; index; index = index->next)
+	{
+		grub_size_t len = grub_strlen(index->top);
+		const char* p;
+		grub_uint32_t n = 0;
+		grub_uint32_t i;
+
+		if (grub_strcmp(index->disk_name, disk_name) != 0 || index->dev_id != disk->dev->id
+			|| index->disk_id != disk->id || index->start != start
+			|| grub_strncmp(index->top, top, len) != 0)
+			continue;
+		/* Look the rest of TOP up one name at a time.  */
+		for (p = top + len; *p && n != FIND_NONE;)
+		{
+			const char* e = grub_strchr(p, '/');
+			grub_size_t l = e - p;
+			grub_uint32_t parent = n;
+			n = FIND_NONE;
+			for (i = parent + 1; i < index->count; i++)
+			{
+				const struct find_node* x = &index->nodes[i];
+				if (x->parent == parent && (x->flags & NODE_DIR)
+					&& grub_strncmp(x->name, p, l) == 0 && x->name[l] == '\0')
+				{
+					n = i;
+					break;
+				}
+			}
+			p = e + 1;
+		}
+		if (n == FIND_NONE)
+			continue;
+		index->refs++;
+		*node = n;
+		/* Move it to the front, the last one is dropped first.  */
+		for (pp = &find_indexes; *pp != index; pp = &(*pp)->next)
+			;
+		*pp = index->next;
+		index->next = find_indexes;
+		find_indexes = index;
+		break;
+	}
+	grub_mutex_unlock(&find_lock);
+	return index;
+}
+
+
+static grub_err_t
+search_index(struct find_index* index, grub_uint32_t top, const char* disk_name,
+	const struct grub_find_options* options, struct find_pattern* pattern,
+	grub_find_hook_t hook, void* data, struct grub_find_stats* stats)
+{
+	struct find_batch batch = { 0 };
+	grub_uint8_t* under;
+	struct re_state st;
+	grub_uint32_t i;
+
+	if (!re_state_init(pattern, &st))
+		return grub_errno;
+	grub_mutex_lock(&index->lock);
+	under = grub_zalloc(index->count);
+	if (!under)
+		goto out;
+	/* Parents come before their children, one pass marks the tree.  */
+	under[top] = 1;
+	stats->dirs = 1;
+	for (i = top + 1; i < index->count; i++)
+	{
+		struct find_node* node = &index->nodes[i];
+		struct find_found* found;
+
+		if (!under[node->parent])
+			continue;
+		under[i] = 1;
+		stats->entries++;
+		if (node->flags & NODE_DIR)
+			stats->dirs++;
+		if (options->cancel && *options->cancel)
+			break;
+		if (!match_entry(options, pattern, &st, node->name, node->flags, node->mtime))
+			continue;
+		if (!batch_add(&batch, index, i, disk_name))
+			break;
+		found = &batch.found[batch.count - 1];
+		if (need_size(options, node->flags))
+		{
+			/* The size is kept for the next search.  */
+			get_size(batch.text + found->path, &node->flags, &node->size);
+			found->flags = node->flags;
+			found->size = node->size;
+		}
+		if (!match_size(options, node->flags, node->size))
+		{
+			batch_drop(&batch);
+			continue;
+		}
+		stats->matches++;
+		if (batch.count == FIND_BATCH && batch_report(&batch, hook, data))
+			break;
+	}
+	if (batch.count)
+		batch_report(&batch, hook, data);
+
+out:
+	grub_mutex_unlock(&index->lock);
+	re_state_fini(&st);
+	grub_free(under);
+	grub_free(batch.found);
+	grub_free(batch.text);
+	return grub_errno;
+}
+
+static grub_err_t
+walk_tree(struct find_index* index, const char* disk_name,
+	const struct grub_find_options* options, struct find_pattern* pattern,
+	grub_find_hook_t hook, void* data, struct grub_find_stats* stats)
+{
+	struct find_job job =
+	{
+		.index = index,
+		.options = options,
+		.pattern = pattern,
+		.disk_name = disk_name,
+		.ofs = grub_strlen(disk_name) + 2,
+	};
+	struct find_batch batch = { 0 };
+	grub_thread_t threads[GRUB_FIND_MAX_THREADS];
+	unsigned nthreads = options->threads ? options->threads : grub_cpu_count();
+	grub_size_t size;
+	unsigned i;
+	int stopped = 0;
+
+	if (nthreads > GRUB_FIND_MAX_THREADS)
+		nthreads = GRUB_FIND_MAX_THREADS;
+	size = job.ofs + grub_strlen(index->top) + 1;
+	job.dirs = grub_malloc(sizeof(struct find_dir) + size);
+	if (!job.dirs)
+	{
+		index_free(index);
+		return grub_errno;
+	}
+	job.dirs->next = NULL;
+	job.dirs->node = 0;
+	grub_snprintf(job.dirs->path, size, "(%s)%s", disk_name, index->top);
+	job.dirs_tail = &job.dirs->next;
+
+	grub_mutex_lock(&job.lock);
+	for (i = 0; i < nthreads; i++)
+	{
+		threads[i] = grub_thread_create(find_walker, &job);
+		if (!threads[i])
+			break;
+		job.walkers++;
+	}
+	nthreads = i;
+	grub_errno = GRUB_ERR_NONE;
+
+	/* Hand the matches to HOOK while the walkers go on.  The nodes may move
+	   as they are added, so the paths are built with the lock held.  */
+	while (1)
+	{
+		grub_size_t count;
+
+		while (!job.match_count && job.walkers)
+			grub_cond_wait(&job.match_cond, &job.lock);
+		if (!job.match_count)
+			break;
+		count = job.match_count;
+		job.match_count = 0;
+		if (stopped)
+			continue;
+		for (i = 0; i < count; i++)
+		{
+			if (!batch_add(&batch, index, job.matches[i], disk_name))
+				break;
+		}
+		stats->matches += batch.count;
+		grub_mutex_unlock(&job.lock);
+		stopped = batch_report(&batch, hook, data);
+		grub_mutex_lock(&job.lock);
+		if (stopped || i < count)
+		{
+			stopped = 1;
+			job.stop = 1;
+			grub_cond_broadcast(&job.dir_cond);
+		}
+	}
+	grub_mutex_unlock(&job.lock);
+
+	for (i = 0; i < nthreads; i++)
+		grub_thread_join(threads[i]);
+	while (job.dirs)
+	{
+		struct find_dir* next = job.dirs->next;
+		grub_free(job.dirs);
+		job.dirs = next;
+	}
+	stats->dirs = job.stats.dirs;
+	stats->entries = job.stats.entries;
+	grub_free(job.matches);
+	grub_free(batch.found);
+	grub_free(batch.text);
+
+	if (job.complete && !job.stop && !job.top_error)
+		keep_index(index);
+	else
+		index_free(index);
+	if (job.top_error)
+		return grub_error(job.top_error, "%s", job.top_errmsg);
+	if (!nthreads)
+		return grub_error(GRUB_ERR_OUT_OF_MEMORY, "can't start the search");
+	return GRUB_ERR_NONE;
+}
+
+grub_err_t
+grub_find(const char* path, const struct grub_find_options* options,
+	grub_find_hook_t hook, void* data, struct grub_find_stats* stats)
+{
+	struct grub_find_stats dummy;
+	struct find_pattern pattern = { .flags = options->flags, .glob = options->pattern };
+	struct find_index* index;
+	grub_disk_t disk = NULL;
+	char* disk_name = NULL;
+	char* top = NULL;
+	const char* p;
+	grub_uint32_t node;
+	grub_size_t len;
+
+	if (!stats)
+		stats = &dummy;
+	grub_memset(stats, 0, sizeof(*stats));
+
+	p = (path[0] == '(') ? grub_strchr(path, ')') : NULL;
+	if (!p)
+		return grub_error(GRUB_ERR_BAD_FILENAME, "`%s' is not a (device)/path", path);
+	disk_name = grub_strndup(path + 1, p - path - 1);
+	/* "/dir/", or "/" for the root.  */
+	for (p++; *p == '/'; p++)
+		;
+	for (len = grub_strlen(p); len && p[len - 1] == '/'; len--)
+		;
+	top = grub_malloc(len + 3);
+	if (!disk_name || !top)
+		goto out;
+	top[0] = '/';
+	grub_memcpy(top + 1, p, len);
+	top[len + 1] = '/';
+	top[len ? len + 2 : 1] = '\0';
+
+	if (options->pattern && (options->flags & GRUB_FIND_REGEX))
+	{
+		pattern.glob = NULL;
+		if (compile_regex(&pattern, options->pattern) != GRUB_ERR_NONE)
+			goto out;
+	}
+
+	disk = grub_disk_open(disk_name);
+	if (!disk)
+		goto out;
+
+	if (!(options->flags & GRUB_FIND_REBUILD))
+	{
+		index = find_index(disk_name, disk, top, &node);
+		if (index)
+		{
+			stats->indexed = 1;
+			search_index(index, node, disk_name, options, &pattern, hook, data, stats);
+			index_unref(index);
+			goto out;
+		}
+	}
+
+	index = grub_zalloc(sizeof(*index));
+	if (!index)
+		goto out;
+	index->disk_name = grub_strdup(disk_name);
+	index->top = grub_strdup(top);
+	index->alloc = 1024;
+	index->nodes = grub_malloc(index->alloc * sizeof(struct find_node));
+	if (!index->disk_name || !index->top || !index->nodes)
+	{
+		index_free(index);
+		goto out;
+	}
+	index->dev_id = disk->dev->id;
+	index->disk_id = disk->id;
+	index->start = disk->partition ? grub_partition_get_start(disk->partition) : 0;
+	index->nodes[0].name = "";
+	index->nodes[0].parent = FIND_NONE;
+	index->nodes[0].flags = NODE_DIR;
+	index->count = 1;
+	/* The walkers open their own handles.  */
+	grub_disk_close(disk);
+	disk = NULL;
+	walk_tree(index, disk_name, options, &pattern, hook, data, stats);
+
+out:
+	if (disk)
+		grub_disk_close(disk);
+	grub_free(pattern.prog);
+	grub_free(pattern.sets);
+	grub_free(disk_name);
+	grub_free(top);
+	return grub_errno;
+}
+
+void
+grub_find_flush(const char* disk)
+{
+	grub_size_t len = disk ? grub_strlen(disk) : 0;
+	struct find_index** pp;
+
+	grub_mutex_lock(&find_lock);
+	for (pp = &find_indexes; *pp;)
+	{
+		struct find_index* p = *pp;
+		if (!disk || (grub_strncmp(p->disk_name, disk, len) == 0
+			&& (p->disk_name[len] == '\0' || p->disk_name[len] == ',')))
+		{
+			*pp = p->next;
+			p->next = NULL;
+			p->kept = 0;
+			if (!p->refs)
+				index_free(p);
+			continue;
+		}
+		pp = &p->next;
+	}
+	grub_mutex_unlock(&find_lock);
+}
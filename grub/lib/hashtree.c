@@ -0,0 +1,484 @@
+/* hashtree.c - hash every file of a directory tree */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/disk.h>
+#include <grub/fs.h>
+#include <grub/file.h>
+#include <grub/crypto.h>
+#include <grub/hashtree.h>
+
+/* Small files collected before they are hashed, and the memory they may
+   take.  */
+#define HASHTREE_BATCH		64
+#define HASHTREE_POOL		(2 * 1024 * 1024)
+/* Read size for the larger files.  */
+#define HASHTREE_BUFFER		(256 * 1024)
+
+struct hashtree_small
+{
+	/* PATH is owned.  */
+	struct grub_hashtree_entry entry;
+	grub_size_t ofs;
+};
+
+/* A directory still to be listed, "(dev)/path/".  */
+struct hashtree_dir
+{
+	struct hashtree_dir* next;
+	char path[];
+};
+
+/* A file of the directory being listed.  */
+struct hashtree_name
+{
+	struct hashtree_name* next;
+	struct grub_dirhook_info info;
+	char name[];
+};
+
+struct hashtree_job
+{
+	const gcry_md_spec_t* const* hash;
+	unsigned nhash;
+	/* Sum of the digest sizes.  */
+	grub_size_t mdlen;
+	grub_hashtree_filter_t filter;
+	grub_hashtree_hook_t hook;
+	void* data;
+	int stop;
+
+	struct hashtree_small small[HASHTREE_BATCH];
+	unsigned count;
+	grub_uint8_t* pool;
+	grub_size_t pool_used;
+
+	grub_uint8_t* buf;
+	void* context[GRUB_HASHTREE_MAX_HASH];
+	grub_uint8_t* digests;
+};
+
+/* Pass ENTRY to the hook with DIGEST, or with the grub error if DIGEST is
+   NULL.  */
+static void
+report(struct hashtree_job* job, struct grub_hashtree_entry* entry,
+	const grub_uint8_t* digest)
+{
+	entry->digest = digest;
+	entry->error = digest ? NULL : grub_errmsg;
+	if (!job->stop && job->hook(entry, job->data))
+		job->stop = 1;
+	grub_errno = GRUB_ERR_NONE;
+}
+
+static void
+report_path(struct hashtree_job* job, const char* path)
+{
+	struct grub_hashtree_entry entry = { .path = path };
+
+	report(job, &entry, NULL);
+}
+
+/* Hash the collected small files.  */
+static void
+flush_small(struct hashtree_job* job)
+{
+	void* out[HASHTREE_BATCH];
+	const void* in[HASHTREE_BATCH];
+	grub_size_t len[HASHTREE_BATCH];
+	unsigned order[HASHTREE_BATCH];
+	unsigned i, j;
+	grub_size_t ofs;
+
+	/* Insertion sort by size, messages of a lane group should end
+	   together.  */
+	for (i = 0; i < job->count; i++)
+	{
+		for (j = i; j > 0 && job->small[order[j - 1]].entry.size > job->small[i].entry.size; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+	for (i = 0; i < job->count; i++)
+	{
+		struct hashtree_small* s = &job->small[order[i]];
+		in[i] = job->pool + s->ofs;
+		len[i] = (grub_size_t)s->entry.size;
+	}
+	for (j = 0, ofs = 0; j < job->nhash; ofs += job->hash[j]->mdlen, j++)
+	{
+		for (i = 0; i < job->count; i++)
+			out[i] = job->digests + order[i] * job->mdlen + ofs;
+		grub_crypto_hash_multi(job->hash[j], out, in, len, job->count);
+	}
+
+	for (i = 0; i < job->count; i++)
+	{
+		struct hashtree_small* s = &job->small[i];
+		report(job, &s->entry, job->digests + i * job->mdlen);
+		grub_free((char*)s->entry.path);
+	}
+	job->count = 0;
+	job->pool_used = 0;
+}
+
+/* Read exactly SIZE bytes.  */
+static int
+read_all(grub_file_t file, grub_uint8_t* buf, grub_size_t size)
+{
+	while (size)
+	{
+		grub_ssize_t r = grub_file_read(file, buf, size);
+		if (r <= 0)
+		{
+			if (r == 0)
+				grub_error(GRUB_ERR_FILE_READ_ERROR, N_("premature end of file"));
+			return 0;
+		}
+		buf += r;
+		size -= r;
+	}
+	return 1;
+}
+
+/* Hash PATH, small files are only queued.  PATH is freed.  */
+static void
+hash_file(struct hashtree_job* job, char* path, const struct grub_dirhook_info* info)
+{
+	struct grub_hashtree_entry entry =
+	{
+		.path = path,
+		.mtimeset = info->mtimeset,
+		.mtime = info->mtime,
+		.inodeset = info->inodeset,
+		.inode = info->inode,
+	};
+	grub_file_t file;
+	unsigned i;
+
+	file = grub_file_open(path, GRUB_FILE_TYPE_TO_HASH | GRUB_FILE_TYPE_NO_DECOMPRESS);
+	if (!file)
+		goto fail;
+	entry.size = file->size;
+	if (job->filter && !job->filter(&entry, job->data))
+	{
+		grub_file_close(file);
+		grub_free(path);
+		return;
+	}
+
+	if (entry.size <= GRUB_HASHTREE_SMALL)
+	{
+		struct hashtree_small* s;
+
+		if (job->count == HASHTREE_BATCH || job->pool_used + entry.size > HASHTREE_POOL)
+			flush_small(job);
+		if (!read_all(file, job->pool + job->pool_used, (grub_size_t)entry.size))
+			goto fail;
+		grub_file_close(file);
+		s = &job->small[job->count++];
+		s->entry = entry;
+		s->ofs = job->pool_used;
+		job->pool_used += (grub_size_t)entry.size;
+		return;
+	}
+
+	for (i = 0; i < job->nhash; i++)
+		job->hash[i]->init(job->context[i]);
+	while (1)
+	{
+		grub_ssize_t r = grub_file_read(file, job->buf, HASHTREE_BUFFER);
+		if (r < 0)
+			goto fail;
+		if (r == 0)
+			break;
+		for (i = 0; i < job->nhash; i++)
+			job->hash[i]->write(job->context[i], job->buf, r);
+	}
+	grub_file_close(file);
+	{
+		grub_uint8_t* digest = job->digests;
+		for (i = 0; i < job->nhash; i++)
+		{
+			job->hash[i]->final(job->context[i]);
+			grub_memcpy(digest, job->hash[i]->read(job->context[i]), job->hash[i]->mdlen);
+			digest += job->hash[i]->mdlen;
+		}
+	}
+	report(job, &entry, job->digests);
+	grub_free(path);
+	return;
+
+fail:
+	if (file)
+	{
+		grub_error_push();
+		grub_file_close(file);
+		grub_error_pop();
+	}
+	report(job, &entry, NULL);
+	grub_free(path);
+}
+
+struct list_ctx
+{
+	struct hashtree_job* job;
+	const char* path;
+	struct hashtree_name* names;
+	struct hashtree_dir** dirs_tail;
+};
+
+static int
+callback_list(const char* filename,
+	const struct grub_dirhook_info* info, void* data)
+{
+	struct list_ctx* ctx = data;
+	grub_size_t len = grub_strlen(filename);
+
+	if (ctx->job->stop)
+		return 1;
+	if (grub_strcmp(filename, ".") == 0 || grub_strcmp(filename, "..") == 0
+		|| info->symlink)
+		return 0;
+	if (info->dir)
+	{
+		grub_size_t plen = grub_strlen(ctx->path);
+		struct hashtree_dir* dir = grub_malloc(sizeof(*dir) + plen + len + 2);
+		if (!dir)
+			return 1;
+		dir->next = NULL;
+		grub_memcpy(dir->path, ctx->path, plen);
+		grub_memcpy(dir->path + plen, filename, len);
+		dir->path[plen + len] = '/';
+		dir->path[plen + len + 1] = '\0';
+		*ctx->dirs_tail = dir;
+		ctx->dirs_tail = &dir->next;
+	}
+	else
+	{
+		/* Files are opened after the listing, not all filesystems can
+		   read while they iterate.  */
+		struct hashtree_name* name = grub_malloc(sizeof(*name) + len + 1);
+		if (!name)
+			return 1;
+		name->info = *info;
+		grub_memcpy(name->name, filename, len + 1);
+		name->next = ctx->names;
+		ctx->names = name;
+	}
+	return 0;
+}
+
+struct find_ctx
+{
+	const char* name;
+	int found;
+	struct grub_dirhook_info info;
+};
+
+static int
+callback_find(const char* filename,
+	const struct grub_dirhook_info* info, void* data)
+{
+	struct find_ctx* ctx = data;
+
+	if ((info->case_insensitive ? grub_strcasecmp(filename, ctx->name)
+		: grub_strcmp(filename, ctx->name)) != 0)
+		return 0;
+	ctx->found = 1;
+	ctx->info = *info;
+	return 1;
+}
+
+/* Hash every file under the directory TOP, "(dev)/path/" with the path on
+   the device at TOP + OFS.  */
+static void
+walk(struct hashtree_job* job, grub_disk_t disk, grub_fs_t fs,
+	char* top, grub_size_t ofs)
+{
+	struct hashtree_dir* dirs;
+	struct hashtree_dir** dirs_tail = &dirs;
+	grub_size_t len = grub_strlen(top);
+
+	dirs = grub_malloc(sizeof(*dirs) + len + 1);
+	if (!dirs)
+		return;
+	dirs->next = NULL;
+	grub_memcpy(dirs->path, top, len + 1);
+	dirs_tail = &dirs->next;
+
+	while (dirs)
+	{
+		struct hashtree_dir* dir = dirs;
+		struct list_ctx ctx =
+		{
+			.job = job,
+			.path = dir->path,
+			.dirs_tail = dirs_tail,
+		};
+
+		if (!job->stop)
+		{
+			fs->fs_dir(disk, dir->path + ofs, callback_list, &ctx);
+			if (grub_errno != GRUB_ERR_NONE)
+				report_path(job, dir->path);
+		}
+		dirs_tail = ctx.dirs_tail;
+		while (ctx.names)
+		{
+			struct hashtree_name* name = ctx.names;
+			ctx.names = name->next;
+			if (!job->stop)
+			{
+				char* path = grub_xasprintf("%s%s", dir->path, name->name);
+				if (path)
+					hash_file(job, path, &name->info);
+				else
+					report_path(job, name->name);
+			}
+			grub_free(name);
+		}
+		dirs = dir->next;
+		if (!dirs)
+			dirs_tail = &dirs;
+		grub_free(dir);
+	}
+}
+
+grub_err_t
+grub_hash_tree(const char* path,
+	const gcry_md_spec_t* const hash[], unsigned count,
+	grub_hashtree_filter_t filter, grub_hashtree_hook_t hook, void* data)
+{
+	struct hashtree_job job =
+	{
+		.hash = hash,
+		.nhash = count,
+		.filter = filter,
+		.hook = hook,
+		.data = data,
+	};
+	struct find_ctx find = { 0 };
+	grub_disk_t disk = NULL;
+	grub_fs_t fs;
+	const char* p;
+	char* disk_name = NULL;
+	char* sub = NULL;
+	char* top = NULL;
+	char* name;
+	grub_size_t ofs;
+	grub_size_t len;
+	unsigned i;
+
+	if (count == 0 || count > GRUB_HASHTREE_MAX_HASH)
+		return grub_error(GRUB_ERR_BAD_ARGUMENT, "bad hash count %u", count);
+	for (i = 0; i < count; i++)
+		job.mdlen += hash[i]->mdlen;
+
+	p = (path[0] == '(') ? grub_strchr(path, ')') : NULL;
+	if (!p)
+		return grub_error(GRUB_ERR_BAD_FILENAME, "`%s' is not a (device)/path", path);
+	ofs = p + 1 - path;
+	disk_name = grub_strndup(path + 1, ofs - 2);
+	/* The path without trailing slashes, "" for the root.  */
+	len = grub_strlen(p + 1);
+	while (len && p[len] == '/')
+		len--;
+	sub = grub_strndup(p + 1, len);
+	job.pool = grub_malloc(HASHTREE_POOL);
+	job.buf = grub_malloc(HASHTREE_BUFFER);
+	job.digests = grub_malloc(HASHTREE_BATCH * job.mdlen);
+	if (!disk_name || !sub || !job.pool || !job.buf || !job.digests)
+		goto fail;
+	for (i = 0; i < count; i++)
+	{
+		job.context[i] = grub_zalloc(hash[i]->contextsize);
+		if (!job.context[i])
+			goto fail;
+	}
+	disk = grub_disk_open(disk_name);
+	if (!disk)
+		goto fail;
+	fs = grub_fs_probe(disk);
+	if (!fs)
+		goto fail;
+
+	if (sub[0])
+	{
+		/* Look PATH up in its parent for its type and mtime.  */
+		name = grub_strrchr(sub, '/');
+		if (!name)
+		{
+			grub_error(GRUB_ERR_BAD_FILENAME, "`%s' is not a (device)/path", path);
+			goto fail;
+		}
+		*name++ = '\0';
+		find.name = name;
+		fs->fs_dir(disk, sub[0] ? sub : "/", callback_find, &find);
+		if (grub_errno != GRUB_ERR_NONE)
+			goto fail;
+		if (!find.found)
+		{
+			grub_error(GRUB_ERR_FILE_NOT_FOUND, N_("file `%s' not found"), path);
+			goto fail;
+		}
+		if (find.info.symlink)
+			goto out;
+		if (find.info.dir)
+			top = grub_xasprintf("(%s)%s/%s/", disk_name, sub, name);
+		else
+			top = grub_xasprintf("(%s)%s/%s", disk_name, sub, name);
+	}
+	else
+	{
+		find.info.dir = 1;
+		top = grub_xasprintf("(%s)/", disk_name);
+	}
+	if (!top)
+		goto fail;
+
+	if (find.info.dir)
+		walk(&job, disk, fs, top, ofs);
+	else
+	{
+		hash_file(&job, top, &find.info);
+		top = NULL;
+	}
+	if (job.count)
+		flush_small(&job);
+
+out:
+	grub_errno = GRUB_ERR_NONE;
+fail:
+	while (job.count)
+		grub_free((char*)job.small[--job.count].entry.path);
+	if (disk)
+		grub_disk_close(disk);
+	grub_free(top);
+	grub_free(sub);
+	grub_free(disk_name);
+	grub_free(job.pool);
+	grub_free(job.buf);
+	grub_free(job.digests);
+	for (i = 0; i < count; i++)
+		grub_free(job.context[i]);
+	return grub_errno;
+}
@@ -0,0 +1,248 @@
+/* hostfile.c - whole host files */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/hostfile.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <grub/charset.h>
+#else
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+
+/* UTF-16 with the \\?\ prefix for absolute paths, so long paths work.  */
+static WCHAR*
+host_path(const char* path)
+{
+	grub_size_t len = grub_strlen(path);
+	WCHAR* wpath = grub_calloc(len + 5, sizeof(WCHAR));
+	WCHAR* p = wpath;
+
+	if (!wpath)
+		return NULL;
+	if (grub_isalpha(path[0]) && path[1] == ':')
+	{
+		grub_memcpy(wpath, L"\\\\?\\", 4 * sizeof(WCHAR));
+		p += 4;
+	}
+	grub_utf8_to_utf16(p, len, (const grub_uint8_t*)path, len, NULL);
+	for (; *p; p++)
+	{
+		if (*p == L'/')
+			*p = L'\\';
+	}
+	return wpath;
+}
+
+grub_uint8_t*
+grub_host_read_file(const char* path, grub_size_t* size)
+{
+	WCHAR* wpath = host_path(path);
+	HANDLE handle;
+	LARGE_INTEGER len;
+	grub_uint8_t* buf = NULL;
+	DWORD r;
+
+	if (!wpath)
+		return NULL;
+	handle = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	grub_free(wpath);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		if (GetLastError() == ERROR_FILE_NOT_FOUND || GetLastError() == ERROR_PATH_NOT_FOUND)
+			grub_error(GRUB_ERR_FILE_NOT_FOUND, N_("file `%s' not found"), path);
+		else
+			grub_error(GRUB_ERR_FILE_READ_ERROR, "cannot open `%s': Windows error %lu",
+				path, (unsigned long)GetLastError());
+		return NULL;
+	}
+	if (!GetFileSizeEx(handle, &len) || len.QuadPart > 0x7fffffff)
+	{
+		grub_error(GRUB_ERR_FILE_READ_ERROR, "cannot read `%s'", path);
+		goto out;
+	}
+	buf = grub_malloc((grub_size_t)len.QuadPart + 1);
+	if (!buf)
+		goto out;
+	if (!ReadFile(handle, buf, (DWORD)len.QuadPart, &r, NULL) || r != (DWORD)len.QuadPart)
+	{
+		grub_error(GRUB_ERR_FILE_READ_ERROR, "cannot read `%s': Windows error %lu",
+			path, (unsigned long)GetLastError());
+		grub_free(buf);
+		buf = NULL;
+		goto out;
+	}
+	*size = (grub_size_t)len.QuadPart;
+out:
+	CloseHandle(handle);
+	return buf;
+}
+
+grub_err_t
+grub_host_replace_file(const char* path, const void* const part[],
+	const grub_size_t len[], unsigned count)
+{
+	char* tmp = grub_xasprintf("%s.tmp", path);
+	WCHAR* wtmp = tmp ? host_path(tmp) : NULL;
+	WCHAR* wpath = host_path(path);
+	HANDLE handle = INVALID_HANDLE_VALUE;
+	unsigned i;
+	DWORD w;
+
+	if (!tmp || !wtmp || !wpath)
+		goto out;
+	handle = CreateFileW(wtmp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		goto fail;
+	for (i = 0; i < count; i++)
+	{
+		if (!WriteFile(handle, part[i], (DWORD)len[i], &w, NULL) || w != len[i])
+			goto fail;
+	}
+	if (!CloseHandle(handle))
+	{
+		handle = INVALID_HANDLE_VALUE;
+		goto fail;
+	}
+	handle = INVALID_HANDLE_VALUE;
+	if (!MoveFileExW(wtmp, wpath, MOVEFILE_REPLACE_EXISTING))
+		goto fail;
+	goto out;
+
+fail:
+	grub_error(GRUB_ERR_WRITE_ERROR, "cannot write `%s': Windows error %lu",
+		path, (unsigned long)GetLastError());
+	if (handle != INVALID_HANDLE_VALUE)
+		CloseHandle(handle);
+	DeleteFileW(wtmp);
+out:
+	grub_free(tmp);
+	grub_free(wtmp);
+	grub_free(wpath);
+	return grub_errno;
+}
+
+#else
+
+grub_uint8_t*
+grub_host_read_file(const char* path, grub_size_t* size)
+{
+	grub_uint8_t* buf = NULL;
+	struct stat st;
+	grub_size_t done = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		if (errno == ENOENT)
+			grub_error(GRUB_ERR_FILE_NOT_FOUND, N_("file `%s' not found"), path);
+		else
+			grub_error(GRUB_ERR_FILE_READ_ERROR, "cannot open `%s': %s", path, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size > 0x7fffffff)
+	{
+		grub_error(GRUB_ERR_FILE_READ_ERROR, "cannot read `%s'", path);
+		goto out;
+	}
+	buf = grub_malloc((grub_size_t)st.st_size + 1);
+	if (!buf)
+		goto out;
+	while (done < (grub_size_t)st.st_size)
+	{
+		ssize_t r = read(fd, buf + done, (grub_size_t)st.st_size - done);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+		{
+			grub_error(GRUB_ERR_FILE_READ_ERROR, "cannot read `%s'", path);
+			grub_free(buf);
+			buf = NULL;
+			goto out;
+		}
+		done += r;
+	}
+	*size = done;
+out:
+	close(fd);
+	return buf;
+}
+
+grub_err_t
+grub_host_replace_file(const char* path, const void* const part[],
+	const grub_size_t len[], unsigned count)
+{
+	char* tmp = grub_xasprintf("%s.tmp", path);
+	unsigned i;
+	int fd;
+
+	if (!tmp)
+		return grub_errno;
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		goto fail;
+	for (i = 0; i < count; i++)
+	{
+		const char* p = part[i];
+		grub_size_t left = len[i];
+		while (left)
+		{
+			ssize_t w = write(fd, p, left);
+			if (w < 0 && errno == EINTR)
+				continue;
+			if (w <= 0)
+				goto fail;
+			p += w;
+			left -= w;
+		}
+	}
+	if (close(fd) != 0)
+	{
+		fd = -1;
+		goto fail;
+	}
+	fd = -1;
+	if (rename(tmp, path) != 0)
+		goto fail;
+	grub_free(tmp);
+	return GRUB_ERR_NONE;
+
+fail:
+	grub_error(GRUB_ERR_WRITE_ERROR, "cannot write `%s': %s", path, strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	unlink(tmp);
+	grub_free(tmp);
+	return grub_errno;
+}
+
+#endif
@@ -187,6 +187,118 @@ transform(MD5_CONTEXT* ctx, const unsigned char* data)
 	ctx->D += D;
 }
 
+#ifdef GRUB_CPU_X86
+/* One block of each of eight messages, lanes clear in MASK keep their
+   state.  */
+static GRUB_CPU_TARGET("avx2") void
+transform_avx2(__m256i st[4], const byte* const p[8], __m256i mask)
+{
+	static const u32 k[64] =
+	{
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+		0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+		0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+		0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+		0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+		0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+		0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+		0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+		0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+	};
+	static const byte r[16] =
+	{
+		7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21
+	};
+	const __m256i ones = _mm256_set1_epi32(-1);
+	__m256i x[16], a, b, c, d, f, t;
+	int i;
+
+	md_load8(x, p, 0);
+	md_load8(x + 8, p, 32);
+	a = st[0];
+	b = st[1];
+	c = st[2];
+	d = st[3];
+
+	for (i = 0; i < 64; i++)
+	{
+		int g, s;
+
+		if (i < 16)
+		{
+			f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+			g = i;
+		}
+		else if (i < 32)
+		{
+			f = _mm256_xor_si256(c, _mm256_and_si256(d, _mm256_xor_si256(b, c)));
+			g = (5 * i + 1) & 15;
+		}
+		else if (i < 48)
+		{
+			f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			g = (3 * i + 5) & 15;
+		}
+		else
+		{
+			f = _mm256_xor_si256(c, _mm256_or_si256(b, _mm256_xor_si256(d, ones)));
+			g = (7 * i) & 15;
+		}
+		s = r[(i >> 4) * 4 + (i & 3)];
+		t = _mm256_add_epi32(_mm256_add_epi32(a, f),
+			_mm256_add_epi32(_mm256_set1_epi32(k[i]), x[g]));
+		t = _mm256_or_si256(_mm256_sll_epi32(t, _mm_cvtsi32_si128(s)),
+			_mm256_srl_epi32(t, _mm_cvtsi32_si128(32 - s)));
+		a = d;
+		d = c;
+		c = b;
+		b = _mm256_add_epi32(b, t);
+	}
+
+	st[0] = _mm256_blendv_epi8(st[0], _mm256_add_epi32(st[0], a), mask);
+	st[1] = _mm256_blendv_epi8(st[1], _mm256_add_epi32(st[1], b), mask);
+	st[2] = _mm256_blendv_epi8(st[2], _mm256_add_epi32(st[2], c), mask);
+	st[3] = _mm256_blendv_epi8(st[3], _mm256_add_epi32(st[3], d), mask);
+}
+
+static GRUB_CPU_TARGET("avx2") void
+md5_multi_avx2(void* const out[], const void* const in[],
+	const grub_size_t inlen[], unsigned count)
+{
+	static const u32 iv[4] =
+	{
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+	};
+	struct md_lanes l;
+	__m256i st[4];
+	u32 h[4][8];
+	grub_size_t b;
+	unsigned i, j;
+
+	md_lanes_init(&l, in, inlen, count, 0);
+	for (j = 0; j < 4; j++)
+		st[j] = _mm256_set1_epi32(iv[j]);
+	for (b = 0; b < l.max; b++)
+	{
+		const byte* p[8];
+		__m256i mask = md_lanes_next(&l, b, p);
+		transform_avx2(st, p, mask);
+	}
+	for (j = 0; j < 4; j++)
+		_mm256_storeu_si256((__m256i*)h[j], st[j]);
+	for (i = 0; i < count; i++)
+		for (j = 0; j < 4; j++)
+			buf_put_le32((byte*)out[i] + 4 * j, h[j][i]);
+}
+#endif
+
 /* The routine updates the message-digest context to
  * account for the presence of each of the characters inBuf[0..inLen-1]
  * in the message whose digest is being computed.
@@ -322,9 +434,34 @@ static gcry_md_oid_spec_t oid_spec_md5[] =
 	{ NULL },
 };
 
+/* Whole messages side by side in the AVX2 lanes.  */
+static void
+md5_multi(void* const out[], const void* const in[],
+	const grub_size_t inlen[], unsigned count)
+{
+	MD5_CONTEXT ctx;
+	unsigned i;
+
+#ifdef GRUB_CPU_X86
+	if (count > 1 && grub_cpu_has(GRUB_CPU_AVX2))
+	{
+		md5_multi_avx2(out, in, inlen, count);
+		return;
+	}
+#endif
+	for (i = 0; i < count; i++)
+	{
+		md5_init(&ctx);
+		md5_write(&ctx, in[i], inlen[i]);
+		md5_final(&ctx);
+		grub_memcpy(out[i], md5_read(&ctx), 16);
+	}
+}
+
 gcry_md_spec_t _gcry_digest_spec_md5 =
 {
 	"MD5", asn, DIM(asn), oid_spec_md5, 16,
 	md5_init, md5_write, md5_final, md5_read,
-	sizeof(MD5_CONTEXT)
+	sizeof(MD5_CONTEXT),
+	.hash_multi = md5_multi
 };
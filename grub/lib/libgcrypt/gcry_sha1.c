@@ -30,7 +30,7 @@
    /* # define U32_ALIGNED_P(p) (!(((uintptr_t)p) % sizeof (u32))) */
    /* #endif */
 
-#define TRANSFORM(x,d,n) transform ((x), (d), (n))
+#define TRANSFORM(x,d,n) transform_blocks ((x), (d), (n))
 
 typedef struct
 {
@@ -206,6 +206,195 @@ transform(SHA1_CONTEXT* hd, const unsigned char* data, grub_size_t nblocks)
 }
 
 
+#ifdef GRUB_CPU_X86
+#define SHANI_TARGET GRUB_CPU_TARGET("sha,sse4.1,ssse3")
+#define SHANI_CPU (GRUB_CPU_SHA | GRUB_CPU_SSE41 | GRUB_CPU_SSSE3)
+
+/* Rounds 4 * I to 4 * I + 3.  E alternates between e[0] and e[1], the
+   message words of rounds 16 later are built up in the slot of those 16
+   before.  */
+#define SHANI_ROUNDS(i) do							\
+		{									\
+			if ((i) < 4)							\
+				m[i] = _mm_shuffle_epi8(_mm_loadu_si128(		\
+					(const __m128i*)(data + 16 * (i))), mask);	\
+			if ((i) == 0)							\
+				e[0] = _mm_add_epi32(e[0], m[0]);			\
+			else								\
+				e[(i) & 1] = _mm_sha1nexte_epu32(e[(i) & 1], m[(i) & 3]);	\
+			e[((i) + 1) & 1] = abcd;					\
+			if ((i) >= 3 && (i) <= 18)					\
+				m[((i) + 1) & 3] = _mm_sha1msg2_epu32(m[((i) + 1) & 3], m[(i) & 3]);	\
+			abcd = _mm_sha1rnds4_epu32(abcd, e[(i) & 1], (i) / 5);	\
+			if ((i) >= 1 && (i) <= 16)					\
+				m[((i) + 3) & 3] = _mm_sha1msg1_epu32(m[((i) + 3) & 3], m[(i) & 3]);	\
+			if ((i) >= 2 && (i) <= 17)					\
+				m[((i) + 2) & 3] = _mm_xor_si128(m[((i) + 2) & 3], m[(i) & 3]);	\
+		} while (0)
+
+/* transform () with the SHA extensions.  */
+static SHANI_TARGET void
+transform_shani(SHA1_CONTEXT* hd, const unsigned char* data, grub_size_t nblocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e_save;
+	__m128i e[2], m[4];
+	u32 h[4];
+
+	abcd = _mm_set_epi32(hd->h0, hd->h1, hd->h2, hd->h3);
+	e[0] = _mm_set_epi32(hd->h4, 0, 0, 0);
+	e[1] = _mm_setzero_si128();
+
+	for (; nblocks; nblocks--, data += 64)
+	{
+		abcd_save = abcd;
+		e_save = e[0];
+		SHANI_ROUNDS(0);
+		SHANI_ROUNDS(1);
+		SHANI_ROUNDS(2);
+		SHANI_ROUNDS(3);
+		SHANI_ROUNDS(4);
+		SHANI_ROUNDS(5);
+		SHANI_ROUNDS(6);
+		SHANI_ROUNDS(7);
+		SHANI_ROUNDS(8);
+		SHANI_ROUNDS(9);
+		SHANI_ROUNDS(10);
+		SHANI_ROUNDS(11);
+		SHANI_ROUNDS(12);
+		SHANI_ROUNDS(13);
+		SHANI_ROUNDS(14);
+		SHANI_ROUNDS(15);
+		SHANI_ROUNDS(16);
+		SHANI_ROUNDS(17);
+		SHANI_ROUNDS(18);
+		SHANI_ROUNDS(19);
+		e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	_mm_storeu_si128((__m128i*)h, abcd);
+	hd->h0 = h[0];
+	hd->h1 = h[1];
+	hd->h2 = h[2];
+	hd->h3 = h[3];
+	hd->h4 = _mm_extract_epi32(e[0], 3);
+}
+#undef SHANI_ROUNDS
+
+/* One block of each of eight messages, lanes clear in MASK keep their
+   state.  */
+static GRUB_CPU_TARGET("avx2") void
+transform_avx2(__m256i st[5], const byte* const p[8], __m256i mask)
+{
+	const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+		11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4,
+		11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i w[16], a, b, c, d, e, f, k, t;
+	int i;
+
+	md_load8(w, p, 0);
+	md_load8(w + 8, p, 32);
+	for (i = 0; i < 16; i++)
+		w[i] = _mm256_shuffle_epi8(w[i], bswap);
+	a = st[0];
+	b = st[1];
+	c = st[2];
+	d = st[3];
+	e = st[4];
+
+	for (i = 0; i < 80; i++)
+	{
+		if (i >= 16)
+		{
+			t = _mm256_xor_si256(_mm256_xor_si256(w[(i - 3) & 15], w[(i - 8) & 15]),
+				_mm256_xor_si256(w[(i - 14) & 15], w[i & 15]));
+			w[i & 15] = MD_ROL8(t, 1);
+		}
+		if (i < 20)
+		{
+			f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+			k = _mm256_set1_epi32(K1);
+		}
+		else if (i < 40)
+		{
+			f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			k = _mm256_set1_epi32(K2);
+		}
+		else if (i < 60)
+		{
+			f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+			k = _mm256_set1_epi32(K3);
+		}
+		else
+		{
+			f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			k = _mm256_set1_epi32(K4);
+		}
+		t = _mm256_add_epi32(_mm256_add_epi32(MD_ROL8(a, 5), f),
+			_mm256_add_epi32(_mm256_add_epi32(e, k), w[i & 15]));
+		e = d;
+		d = c;
+		c = MD_ROL8(b, 30);
+		b = a;
+		a = t;
+	}
+
+	st[0] = _mm256_blendv_epi8(st[0], _mm256_add_epi32(st[0], a), mask);
+	st[1] = _mm256_blendv_epi8(st[1], _mm256_add_epi32(st[1], b), mask);
+	st[2] = _mm256_blendv_epi8(st[2], _mm256_add_epi32(st[2], c), mask);
+	st[3] = _mm256_blendv_epi8(st[3], _mm256_add_epi32(st[3], d), mask);
+	st[4] = _mm256_blendv_epi8(st[4], _mm256_add_epi32(st[4], e), mask);
+}
+
+static GRUB_CPU_TARGET("avx2") void
+sha1_multi_avx2(void* const out[], const void* const in[],
+	const grub_size_t inlen[], unsigned count)
+{
+	static const u32 iv[5] =
+	{
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+	};
+	struct md_lanes l;
+	__m256i st[5];
+	u32 h[5][8];
+	grub_size_t b;
+	unsigned i, j;
+
+	md_lanes_init(&l, in, inlen, count, 1);
+	for (j = 0; j < 5; j++)
+		st[j] = _mm256_set1_epi32(iv[j]);
+	for (b = 0; b < l.max; b++)
+	{
+		const byte* p[8];
+		__m256i mask = md_lanes_next(&l, b, p);
+		transform_avx2(st, p, mask);
+	}
+	for (j = 0; j < 5; j++)
+		_mm256_storeu_si256((__m256i*)h[j], st[j]);
+	for (i = 0; i < count; i++)
+		for (j = 0; j < 5; j++)
+			buf_put_be32((byte*)out[i] + 4 * j, h[j][i]);
+}
+
+#endif
+
+/* Run NBLOCKS at DATA through the fastest transform.  */
+static void
+transform_blocks(SHA1_CONTEXT* hd, const unsigned char* data, grub_size_t nblocks)
+{
+#ifdef GRUB_CPU_X86
+	if (grub_cpu_has(SHANI_CPU))
+	{
+		transform_shani(hd, data, nblocks);
+		return;
+	}
+#endif
+	transform(hd, data, nblocks);
+}
+
+
 /* Update the message digest with the contents
  * of INBUF with length INLEN.
  */
@@ -371,9 +560,35 @@ static gcry_md_oid_spec_t oid_spec_sha1[] =
 	{ NULL },
 };
 
+/* Whole messages side by side in the AVX2 lanes.  The SHA extensions are
+   faster one message at a time.  */
+static void
+sha1_multi(void* const out[], const void* const in[],
+	const grub_size_t inlen[], unsigned count)
+{
+	SHA1_CONTEXT ctx;
+	unsigned i;
+
+#ifdef GRUB_CPU_X86
+	if (count > 1 && !grub_cpu_has(SHANI_CPU) && grub_cpu_has(GRUB_CPU_AVX2))
+	{
+		sha1_multi_avx2(out, in, inlen, count);
+		return;
+	}
+#endif
+	for (i = 0; i < count; i++)
+	{
+		sha1_init(&ctx);
+		sha1_write(&ctx, in[i], inlen[i]);
+		sha1_final(&ctx);
+		grub_memcpy(out[i], sha1_read(&ctx), 20);
+	}
+}
+
 gcry_md_spec_t _gcry_digest_spec_sha1 =
 {
 	"SHA1", asn, DIM(asn), oid_spec_sha1, 20,
 	sha1_init, sha1_write, sha1_final, sha1_read,
-	sizeof(SHA1_CONTEXT)
+	sizeof(SHA1_CONTEXT),
+	.hash_multi = sha1_multi
 };
@@ -96,29 +96,29 @@ Sum1(u32 x)
 	return (ror(x, 6) ^ ror(x, 11) ^ ror(x, 25));
 }
 
+static const u32 K[64] =
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
 static void
 transform(SHA256_CONTEXT* hd, const unsigned char* data)
 {
-	static const u32 K[64] =
-	{
-	  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-	  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-	  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-	  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-	  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-	  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-	  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-	  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-	  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-	  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-	  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-	  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-	  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-	  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-	  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-	  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-	};
-
 	u32 a, b, c, d, e, f, g, h, t1, t2;
 	u32 x[16];
 	u32 w[64];
@@ -217,6 +217,192 @@ transform(SHA256_CONTEXT* hd, const unsigned char* data)
 #undef S1
 #undef R
 
+#ifdef GRUB_CPU_X86
+#define SHANI_TARGET GRUB_CPU_TARGET("sha,sse4.1,ssse3")
+#define SHANI_CPU (GRUB_CPU_SHA | GRUB_CPU_SSE41 | GRUB_CPU_SSSE3)
+
+/* Rounds 4 * I to 4 * I + 3, the message words for them replace those
+   of the rounds 16 before.  */
+#define SHANI_ROUNDS(i) do							\
+		{									\
+			if ((i) < 4)							\
+				m[i] = _mm_shuffle_epi8(_mm_loadu_si128(		\
+					(const __m128i*)(data + 16 * (i))), mask);	\
+			else								\
+				m[(i) & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(	\
+					_mm_sha256msg1_epu32(m[(i) & 3], m[((i) + 1) & 3]),	\
+					_mm_alignr_epi8(m[((i) + 3) & 3], m[((i) + 2) & 3], 4)),	\
+					m[((i) + 3) & 3]);				\
+			msg = _mm_add_epi32(m[(i) & 3],					\
+				_mm_loadu_si128((const __m128i*)&K[4 * (i)]));		\
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);	\
+			msg = _mm_shuffle_epi32(msg, 0x0e);				\
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);	\
+		} while (0)
+
+/* transform () for NBLOCKS with the SHA extensions.  */
+static SHANI_TARGET void
+transform_shani(SHA256_CONTEXT* hd, const unsigned char* data, grub_size_t nblocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, msg, tmp, abef, cdgh;
+	__m128i m[4];
+	u32 h[8];
+
+	tmp = _mm_set_epi32(hd->h3, hd->h2, hd->h1, hd->h0);
+	state1 = _mm_set_epi32(hd->h7, hd->h6, hd->h5, hd->h4);
+	tmp = _mm_shuffle_epi32(tmp, 0xb1);
+	state1 = _mm_shuffle_epi32(state1, 0x1b);
+	/* ABEF and CDGH, the order the round instruction wants.  */
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	for (; nblocks; nblocks--, data += 64)
+	{
+		abef = state0;
+		cdgh = state1;
+		SHANI_ROUNDS(0);
+		SHANI_ROUNDS(1);
+		SHANI_ROUNDS(2);
+		SHANI_ROUNDS(3);
+		SHANI_ROUNDS(4);
+		SHANI_ROUNDS(5);
+		SHANI_ROUNDS(6);
+		SHANI_ROUNDS(7);
+		SHANI_ROUNDS(8);
+		SHANI_ROUNDS(9);
+		SHANI_ROUNDS(10);
+		SHANI_ROUNDS(11);
+		SHANI_ROUNDS(12);
+		SHANI_ROUNDS(13);
+		SHANI_ROUNDS(14);
+		SHANI_ROUNDS(15);
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i*)&h[0], state0);
+	_mm_storeu_si128((__m128i*)&h[4], state1);
+	hd->h0 = h[0];
+	hd->h1 = h[1];
+	hd->h2 = h[2];
+	hd->h3 = h[3];
+	hd->h4 = h[4];
+	hd->h5 = h[5];
+	hd->h6 = h[6];
+	hd->h7 = h[7];
+}
+#undef SHANI_ROUNDS
+
+#define ROR8(x, n) MD_ROL8((x), 32 - (n))
+
+/* One block of each of eight messages, lanes clear in MASK keep their
+   state.  */
+static GRUB_CPU_TARGET("avx2") void
+transform_avx2(__m256i st[8], const byte* const p[8], __m256i mask)
+{
+	const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+		11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4,
+		11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i w[16], v[8], t1, t2;
+	int i;
+
+	md_load8(w, p, 0);
+	md_load8(w + 8, p, 32);
+	for (i = 0; i < 16; i++)
+		w[i] = _mm256_shuffle_epi8(w[i], bswap);
+	for (i = 0; i < 8; i++)
+		v[i] = st[i];
+
+	for (i = 0; i < 64; i++)
+	{
+		if (i >= 16)
+		{
+			__m256i w2 = w[(i - 2) & 15], w15 = w[(i - 15) & 15];
+			w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], w[(i - 7) & 15]),
+				_mm256_add_epi32(
+					_mm256_xor_si256(_mm256_xor_si256(ROR8(w2, 17), ROR8(w2, 19)),
+						_mm256_srli_epi32(w2, 10)),
+					_mm256_xor_si256(_mm256_xor_si256(ROR8(w15, 7), ROR8(w15, 18)),
+						_mm256_srli_epi32(w15, 3))));
+		}
+		/* v[0..7] are a..h.  */
+		t1 = _mm256_add_epi32(_mm256_add_epi32(v[7],
+			_mm256_xor_si256(_mm256_xor_si256(ROR8(v[4], 6), ROR8(v[4], 11)), ROR8(v[4], 25))),
+			_mm256_add_epi32(
+				_mm256_xor_si256(v[6], _mm256_and_si256(v[4], _mm256_xor_si256(v[5], v[6]))),
+				_mm256_add_epi32(_mm256_set1_epi32(K[i]), w[i & 15])));
+		t2 = _mm256_add_epi32(
+			_mm256_xor_si256(_mm256_xor_si256(ROR8(v[0], 2), ROR8(v[0], 13)), ROR8(v[0], 22)),
+			_mm256_or_si256(_mm256_and_si256(v[0], v[1]),
+				_mm256_and_si256(v[2], _mm256_or_si256(v[0], v[1]))));
+		v[7] = v[6];
+		v[6] = v[5];
+		v[5] = v[4];
+		v[4] = _mm256_add_epi32(v[3], t1);
+		v[3] = v[2];
+		v[2] = v[1];
+		v[1] = v[0];
+		v[0] = _mm256_add_epi32(t1, t2);
+	}
+
+	for (i = 0; i < 8; i++)
+		st[i] = _mm256_blendv_epi8(st[i], _mm256_add_epi32(st[i], v[i]), mask);
+}
+#undef ROR8
+
+static GRUB_CPU_TARGET("avx2") void
+sha256_multi_avx2(void* const out[], const void* const in[],
+	const grub_size_t inlen[], unsigned count)
+{
+	static const u32 iv[8] =
+	{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	struct md_lanes l;
+	__m256i st[8];
+	u32 h[8][8];
+	grub_size_t b;
+	unsigned i, j;
+
+	md_lanes_init(&l, in, inlen, count, 1);
+	for (j = 0; j < 8; j++)
+		st[j] = _mm256_set1_epi32(iv[j]);
+	for (b = 0; b < l.max; b++)
+	{
+		const byte* p[8];
+		__m256i mask = md_lanes_next(&l, b, p);
+		transform_avx2(st, p, mask);
+	}
+	for (j = 0; j < 8; j++)
+		_mm256_storeu_si256((__m256i*)h[j], st[j]);
+	for (i = 0; i < count; i++)
+		for (j = 0; j < 8; j++)
+			buf_put_be32((byte*)out[i] + 4 * j, h[j][i]);
+}
+#endif
+
+/* Run NBLOCKS at DATA through the fastest transform.  */
+static void
+transform_blocks(SHA256_CONTEXT* hd, const unsigned char* data, grub_size_t nblocks)
+{
+#ifdef GRUB_CPU_X86
+	if (grub_cpu_has(SHANI_CPU))
+	{
+		transform_shani(hd, data, nblocks);
+		return;
+	}
+#endif
+	for (; nblocks; nblocks--, data += 64)
+		transform(hd, data);
+	_gcry_burn_stack(74 * 4 + 32);
+}
+
 /* Update the message digest with the contents of INBUF with length
   INLEN.  */
 static void
@@ -228,8 +414,7 @@ sha256_write(void* context, const void* inbuf_arg, grub_size_t inlen)
 	if (hd->count == 64)
 	{
 		/* flush the buffer */
-		transform(hd, hd->buf);
-		_gcry_burn_stack(74 * 4 + 32);
+		transform_blocks(hd, hd->buf, 1);
 		hd->count = 0;
 		hd->nblocks++;
 	}
@@ -244,15 +429,15 @@ sha256_write(void* context, const void* inbuf_arg, grub_size_t inlen)
 			return;
 	}
 
-	while (inlen >= 64)
+	if (inlen >= 64)
 	{
-		transform(hd, inbuf);
+		grub_size_t nblocks = inlen / 64;
+		transform_blocks(hd, inbuf, nblocks);
 		hd->count = 0;
-		hd->nblocks++;
-		inlen -= 64;
-		inbuf += 64;
+		hd->nblocks += (u32)nblocks;
+		inlen -= nblocks * 64;
+		inbuf += nblocks * 64;
 	}
-	_gcry_burn_stack(74 * 4 + 32);
 	for (; inlen && hd->count < 64; inlen--)
 		hd->buf[hd->count++] = *inbuf++;
 }
@@ -310,8 +495,7 @@ sha256_final(void* context)
 	hd->buf[61] = lsb >> 16;
 	hd->buf[62] = lsb >> 8;
 	hd->buf[63] = lsb;
-	transform(hd, hd->buf);
-	_gcry_burn_stack(74 * 4 + 32);
+	transform_blocks(hd, hd->buf, 1);
 
 	p = hd->buf;
 #ifdef WORDS_BIGENDIAN
@@ -355,9 +539,35 @@ static gcry_md_oid_spec_t oid_spec_sha256[] =
 	{ NULL },
 };
 
+/* Whole messages side by side in the AVX2 lanes.  The SHA extensions are
+   faster one message at a time.  */
+static void
+sha256_multi(void* const out[], const void* const in[],
+	const grub_size_t inlen[], unsigned count)
+{
+	SHA256_CONTEXT ctx;
+	unsigned i;
+
+#ifdef GRUB_CPU_X86
+	if (count > 1 && !grub_cpu_has(SHANI_CPU) && grub_cpu_has(GRUB_CPU_AVX2))
+	{
+		sha256_multi_avx2(out, in, inlen, count);
+		return;
+	}
+#endif
+	for (i = 0; i < count; i++)
+	{
+		sha256_init(&ctx);
+		sha256_write(&ctx, in[i], inlen[i]);
+		sha256_final(&ctx);
+		grub_memcpy(out[i], sha256_read(&ctx), 32);
+	}
+}
+
 gcry_md_spec_t _gcry_digest_spec_sha256 =
 {
 	"SHA256", asn256, DIM(asn256), oid_spec_sha256, 32,
 	sha256_init, sha256_write, sha256_final, sha256_read,
-	sizeof(SHA256_CONTEXT)
+	sizeof(SHA256_CONTEXT),
+	.hash_multi = sha256_multi
 };
@@ -20,6 +20,9 @@
 #define GRUB_GCRY_TYPES_HEADER 1
 
 #include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/crypto.h>
+#include <grub/cpuid.h>
 
 #undef WORDS_BIGENDIAN
 
@@ -108,4 +111,113 @@ static inline void buf_put_le64(void* _buf, u64 val)
 	out[0] = (byte)val;
 }
 
+/* Messages of a hash_multi, one per lane.  Each is hashed as its whole
+   64 byte blocks followed by the one or two padded blocks in TAIL.  */
+struct md_lanes
+{
+	const byte* in[GRUB_CRYPTO_MULTI_MAX];
+	grub_size_t full[GRUB_CRYPTO_MULTI_MAX];
+	grub_size_t blocks[GRUB_CRYPTO_MULTI_MAX];
+	/* Blocks of the longest message.  */
+	grub_size_t max;
+	byte tail[GRUB_CRYPTO_MULTI_MAX][128];
+};
+
+/* Lanes past COUNT are empty.  The bit count is appended big endian
+   (SHA) or little endian (MD5).  */
+static inline void md_lanes_init(struct md_lanes* l, const void* const in[],
+	const grub_size_t inlen[], unsigned count, int big_endian)
+{
+	unsigned i;
+
+	l->max = 0;
+	for (i = 0; i < GRUB_CRYPTO_MULTI_MAX; i++)
+	{
+		grub_size_t rest, pad;
+
+		l->in[i] = NULL;
+		l->full[i] = l->blocks[i] = 0;
+		if (i >= count)
+			continue;
+		l->in[i] = in[i];
+		l->full[i] = inlen[i] / 64;
+		rest = inlen[i] % 64;
+		pad = rest < 56 ? 64 : 128;
+		grub_memcpy(l->tail[i], l->in[i] + inlen[i] - rest, rest);
+		l->tail[i][rest] = 0x80;
+		grub_memset(l->tail[i] + rest + 1, 0, pad - rest - 1 - 8);
+		if (big_endian)
+			buf_put_be64(l->tail[i] + pad - 8, (u64)inlen[i] << 3);
+		else
+			buf_put_le64(l->tail[i] + pad - 8, (u64)inlen[i] << 3);
+		l->blocks[i] = l->full[i] + pad / 64;
+		if (l->blocks[i] > l->max)
+			l->max = l->blocks[i];
+	}
+}
+
+/* Block B of lane I, NULL once the lane is done.  */
+static inline const byte* md_lanes_block(const struct md_lanes* l, unsigned i,
+	grub_size_t b)
+{
+	if (b < l->full[i])
+		return l->in[i] + b * 64;
+	if (b < l->blocks[i])
+		return l->tail[i] + (b - l->full[i]) * 64;
+	return NULL;
+}
+
+#ifdef GRUB_CPU_X86
+/* Load the 32 bytes at OFS of the eight blocks P, transposed so that W[j]
+   holds word j of every lane.  */
+static inline GRUB_CPU_TARGET("avx2") void md_load8(__m256i w[8],
+	const byte* const p[8], grub_size_t ofs)
+{
+	__m256i r[8], t[8], u[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		r[i] = _mm256_loadu_si256((const __m256i*)(p[i] + ofs));
+	for (i = 0; i < 8; i += 2)
+	{
+		t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+	}
+	for (i = 0; i < 8; i += 4)
+	{
+		u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+	for (i = 0; i < 4; i++)
+	{
+		w[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+		w[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+	}
+}
+
+/* Block B of every lane, lanes that are done get a block of zeros and a
+   clear bit in the returned mask.  */
+static inline GRUB_CPU_TARGET("avx2") __m256i md_lanes_next(
+	const struct md_lanes* l, grub_size_t b, const byte* p[8])
+{
+	static const byte zero[64];
+	u32 m[8];
+	unsigned i;
+
+	for (i = 0; i < 8; i++)
+	{
+		p[i] = md_lanes_block(l, i, b);
+		m[i] = p[i] ? 0xffffffff : 0;
+		if (!p[i])
+			p[i] = zero;
+	}
+	return _mm256_loadu_si256((const __m256i*)m);
+}
+
+#define MD_ROL8(x, n) _mm256_or_si256(_mm256_slli_epi32((x), (n)), \
+	_mm256_srli_epi32((x), 32 - (n)))
+#endif
+
 #endif
@@ -0,0 +1,831 @@
+/* manifest.c - persistent per-device file manifest */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/crypto.h>
+#include <grub/file.h>
+#include <grub/hashtree.h>
+#include <grub/manifest.h>
+#include <grub/lib/crc.h>
+
+#include <grub/hostfile.h>
+
+#include <stdlib.h>
+
+/*
+ * File layout, little endian: the header, COUNT records, COUNT digest
+ * blocks of the enabled digests in bit order, then the NUL terminated
+ * paths.  CRC is the CRC32C of everything after the header.
+ */
+#define MANIFEST_MAGIC		"NKMF"
+#define MANIFEST_VERSION	1
+
+GRUB_PACKED_START
+struct manifest_header
+{
+	char magic[4];
+	grub_uint32_t version;
+	grub_uint32_t algos;
+	grub_uint32_t crc;
+	grub_uint64_t count;
+	grub_uint64_t names;
+	grub_uint64_t source_size;
+	grub_int64_t source_mtime;
+};
+GRUB_PACKED_END
+
+#define MANIFEST_MTIME		(1 << 0)
+#define MANIFEST_INODE		(1 << 1)
+
+struct manifest_rec
+{
+	/* Offset of the path in NAMES.  */
+	grub_uint32_t name;
+	grub_uint32_t flags;
+	grub_uint64_t size;
+	grub_int64_t mtime;
+	grub_uint64_t inode;
+};
+
+struct grub_manifest
+{
+	grub_uint32_t algos;
+	/* Bytes of the digests of one file.  */
+	grub_size_t mdlen;
+	grub_uint64_t source_size;
+	grub_int64_t source_mtime;
+
+	struct manifest_rec* recs;
+	grub_uint8_t* digests;
+	grub_size_t count;
+	grub_size_t alloc;
+	char* names;
+	grub_size_t names_len;
+	grub_size_t names_alloc;
+};
+
+static const struct
+{
+	grub_uint32_t algo;
+	const char* name;
+	grub_size_t mdlen;
+} manifest_algos[] =
+{
+	{ GRUB_MANIFEST_MD5, "md5", 16 },
+	{ GRUB_MANIFEST_SHA1, "sha1", 20 },
+	{ GRUB_MANIFEST_SHA256, "sha256", 32 },
+};
+
+static const gcry_md_spec_t*
+algo_spec(grub_size_t i)
+{
+	switch (manifest_algos[i].algo)
+	{
+	case GRUB_MANIFEST_MD5:
+		return GRUB_MD_MD5;
+	case GRUB_MANIFEST_SHA1:
+		return GRUB_MD_SHA1;
+	default:
+		return GRUB_MD_SHA256;
+	}
+}
+
+static grub_size_t
+algos_mdlen(grub_uint32_t algos)
+{
+	grub_size_t i, len = 0;
+
+	for (i = 0; i < ARRAY_SIZE(manifest_algos); i++)
+	{
+		if (algos & manifest_algos[i].algo)
+			len += manifest_algos[i].mdlen;
+	}
+	return len;
+}
+
+/* Offset of the digest ALGO in a digest block of ALGOS.  */
+static grub_size_t
+algo_offset(grub_uint32_t algos, grub_uint32_t algo)
+{
+	return algos_mdlen(algos & (algo - 1));
+}
+
+grub_uint32_t
+grub_manifest_algo_by_name(const char* name)
+{
+	grub_size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(manifest_algos); i++)
+	{
+		if (grub_strcasecmp(name, manifest_algos[i].name) == 0)
+			return manifest_algos[i].algo;
+	}
+	return 0;
+}
+
+grub_manifest_t
+grub_manifest_new(grub_uint32_t algos)
+{
+	grub_manifest_t manifest;
+
+	algos &= GRUB_MANIFEST_ALL;
+	if (!algos)
+	{
+		grub_error(GRUB_ERR_BAD_ARGUMENT, "no digest selected");
+		return NULL;
+	}
+	manifest = grub_zalloc(sizeof(*manifest));
+	if (!manifest)
+		return NULL;
+	manifest->algos = algos;
+	manifest->mdlen = algos_mdlen(algos);
+	return manifest;
+}
+
+static void
+manifest_clear(grub_manifest_t manifest)
+{
+	grub_free(manifest->recs);
+	grub_free(manifest->digests);
+	grub_free(manifest->names);
+	manifest->recs = NULL;
+	manifest->digests = NULL;
+	manifest->names = NULL;
+	manifest->count = manifest->alloc = 0;
+	manifest->names_len = manifest->names_alloc = 0;
+}
+
+void
+grub_manifest_free(grub_manifest_t manifest)
+{
+	if (!manifest)
+		return;
+	manifest_clear(manifest);
+	grub_free(manifest);
+}
+
+/* Append a file, its digests are left for the caller to fill.  */
+static struct manifest_rec*
+manifest_add(grub_manifest_t manifest, const char* path, grub_uint8_t** digest)
+{
+	grub_size_t len = grub_strlen(path) + 1;
+	struct manifest_rec* rec;
+
+	if (manifest->count == manifest->alloc)
+	{
+		grub_size_t alloc = manifest->alloc ? manifest->alloc * 2 : 1024;
+		struct manifest_rec* recs;
+		grub_uint8_t* digests;
+
+		recs = grub_realloc(manifest->recs, alloc * sizeof(*recs));
+		if (!recs)
+			return NULL;
+		manifest->recs = recs;
+		digests = grub_realloc(manifest->digests, alloc * manifest->mdlen);
+		if (!digests)
+			return NULL;
+		manifest->digests = digests;
+		manifest->alloc = alloc;
+	}
+	if (manifest->names_len + len > manifest->names_alloc)
+	{
+		grub_size_t alloc = manifest->names_alloc ? manifest->names_alloc * 2 : 65536;
+		char* names;
+
+		while (alloc < manifest->names_len + len)
+			alloc *= 2;
+		names = grub_realloc(manifest->names, alloc);
+		if (!names)
+			return NULL;
+		manifest->names = names;
+		manifest->names_alloc = alloc;
+	}
+	if (manifest->names_len + len > GRUB_UINT_MAX)
+	{
+		grub_error(GRUB_ERR_OUT_OF_RANGE, "manifest too large");
+		return NULL;
+	}
+
+	rec = &manifest->recs[manifest->count];
+	grub_memset(rec, 0, sizeof(*rec));
+	rec->name = (grub_uint32_t)manifest->names_len;
+	grub_memcpy(manifest->names + manifest->names_len, path, len);
+	manifest->names_len += len;
+	*digest = manifest->digests + manifest->count * manifest->mdlen;
+	manifest->count++;
+	return rec;
+}
+
+static const char*
+rec_name(grub_manifest_t manifest, grub_size_t index)
+{
+	return manifest->names + manifest->recs[index].name;
+}
+
+grub_ssize_t
+grub_manifest_find(grub_manifest_t manifest, const char* path)
+{
+	grub_size_t lo = 0, hi = manifest->count;
+
+	while (lo < hi)
+	{
+		grub_size_t mid = lo + (hi - lo) / 2;
+		int cmp = grub_strcmp(rec_name(manifest, mid), path);
+		if (cmp == 0)
+			return (grub_ssize_t)mid;
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return -1;
+}
+
+grub_uint32_t
+grub_manifest_algos(grub_manifest_t manifest)
+{
+	return manifest->algos;
+}
+
+grub_size_t
+grub_manifest_count(grub_manifest_t manifest)
+{
+	return manifest->count;
+}
+
+void
+grub_manifest_get(grub_manifest_t manifest, grub_size_t index,
+	struct grub_manifest_entry* entry)
+{
+	const struct manifest_rec* rec = &manifest->recs[index];
+
+	entry->path = rec_name(manifest, index);
+	entry->size = rec->size;
+	entry->mtimeset = !!(rec->flags & MANIFEST_MTIME);
+	entry->mtime = rec->mtime;
+	entry->inodeset = !!(rec->flags & MANIFEST_INODE);
+	entry->inode = rec->inode;
+}
+
+const grub_uint8_t*
+grub_manifest_digest(grub_manifest_t manifest, grub_size_t index, grub_uint32_t algo)
+{
+	if (!(manifest->algos & algo))
+		return NULL;
+	return manifest->digests + index * manifest->mdlen + algo_offset(manifest->algos, algo);
+}
+
+void
+grub_manifest_set_source(grub_manifest_t manifest, grub_uint64_t size, grub_int64_t mtime)
+{
+	manifest->source_size = size;
+	manifest->source_mtime = mtime;
+}
+
+int
+grub_manifest_same_source(grub_manifest_t manifest, grub_uint64_t size, grub_int64_t mtime)
+{
+	return manifest->source_size == size && manifest->source_mtime == mtime;
+}
+
+struct sort_item
+{
+	const char* name;
+	grub_size_t index;
+};
+
+static int
+callback_sort_name(const void* a, const void* b)
+{
+	return grub_strcmp(((const struct sort_item*)a)->name, ((const struct sort_item*)b)->name);
+}
+
+/* Sort the files by path and pack the paths in that order.  */
+static grub_err_t
+manifest_sort(grub_manifest_t manifest)
+{
+	struct sort_item* items;
+	struct manifest_rec* recs = NULL;
+	grub_uint8_t* digests = NULL;
+	char* names = NULL;
+	grub_size_t i, len = 0;
+
+	if (manifest->count == 0)
+		return GRUB_ERR_NONE;
+	items = grub_calloc(manifest->count, sizeof(*items));
+	recs = grub_calloc(manifest->count, sizeof(*recs));
+	digests = grub_calloc(manifest->count, manifest->mdlen);
+	names = grub_malloc(manifest->names_len);
+	if (!items || !recs || !digests || !names)
+		goto fail;
+
+	for (i = 0; i < manifest->count; i++)
+	{
+		items[i].name = rec_name(manifest, i);
+		items[i].index = i;
+	}
+	qsort(items, manifest->count, sizeof(*items), callback_sort_name);
+
+	for (i = 0; i < manifest->count; i++)
+	{
+		grub_size_t n = grub_strlen(items[i].name) + 1;
+		recs[i] = manifest->recs[items[i].index];
+		recs[i].name = (grub_uint32_t)len;
+		grub_memcpy(names + len, items[i].name, n);
+		len += n;
+		grub_memcpy(digests + i * manifest->mdlen,
+			manifest->digests + items[i].index * manifest->mdlen, manifest->mdlen);
+	}
+	grub_free(items);
+	grub_free(manifest->recs);
+	grub_free(manifest->digests);
+	grub_free(manifest->names);
+	manifest->recs = recs;
+	manifest->digests = digests;
+	manifest->names = names;
+	manifest->alloc = manifest->count;
+	manifest->names_len = manifest->names_alloc = len;
+	return GRUB_ERR_NONE;
+
+fail:
+	grub_free(items);
+	grub_free(recs);
+	grub_free(digests);
+	grub_free(names);
+	return grub_errno;
+}
+
+struct update_ctx
+{
+	grub_manifest_t old;
+	grub_manifest_t new;
+	/* Length of "(disk)", stripped from the walk paths.  */
+	grub_size_t prefix;
+	struct grub_manifest_stats* stats;
+	grub_manifest_error_hook_t error;
+	void* data;
+};
+
+static void
+rec_set(struct manifest_rec* rec, const struct grub_hashtree_entry* entry)
+{
+	rec->size = entry->size;
+	if (entry->mtimeset)
+	{
+		rec->flags |= MANIFEST_MTIME;
+		rec->mtime = entry->mtime;
+	}
+	if (entry->inodeset)
+	{
+		rec->flags |= MANIFEST_INODE;
+		rec->inode = entry->inode;
+	}
+}
+
+/* Keep the old digests of files that look unchanged.  Files with neither
+   mtime nor inode are always hashed.  */
+static int
+callback_update_filter(const struct grub_hashtree_entry* entry, void* data)
+{
+	struct update_ctx* ctx = data;
+	const char* path = entry->path + ctx->prefix;
+	const struct manifest_rec* old;
+	struct manifest_rec* rec;
+	grub_uint8_t* digest;
+	grub_ssize_t index;
+	grub_size_t i;
+
+	if ((ctx->old->algos & ctx->new->algos) != ctx->new->algos
+		|| !(entry->mtimeset || entry->inodeset))
+		return 1;
+	index = grub_manifest_find(ctx->old, path);
+	if (index < 0)
+		return 1;
+	old = &ctx->old->recs[index];
+	if (old->size != entry->size
+		|| !!(old->flags & MANIFEST_MTIME) != !!entry->mtimeset
+		|| (entry->mtimeset && old->mtime != entry->mtime)
+		|| !!(old->flags & MANIFEST_INODE) != !!entry->inodeset
+		|| (entry->inodeset && old->inode != entry->inode))
+		return 1;
+
+	rec = manifest_add(ctx->new, path, &digest);
+	if (!rec)
+	{
+		/* Hash it, the hook fails the same way and reports it.  */
+		grub_errno = GRUB_ERR_NONE;
+		return 1;
+	}
+	rec_set(rec, entry);
+	for (i = 0; i < ARRAY_SIZE(manifest_algos); i++)
+	{
+		grub_uint32_t algo = manifest_algos[i].algo;
+		if (!(ctx->new->algos & algo))
+			continue;
+		grub_memcpy(digest, grub_manifest_digest(ctx->old, index, algo), manifest_algos[i].mdlen);
+		digest += manifest_algos[i].mdlen;
+	}
+	if (ctx->stats)
+		ctx->stats->files++;
+	return 0;
+}
+
+static int
+callback_update(const struct grub_hashtree_entry* entry, void* data)
+{
+	struct update_ctx* ctx = data;
+	struct manifest_rec* rec;
+	grub_uint8_t* digest;
+
+	if (entry->digest)
+	{
+		rec = manifest_add(ctx->new, entry->path + ctx->prefix, &digest);
+		if (rec)
+		{
+			rec_set(rec, entry);
+			grub_memcpy(digest, entry->digest, ctx->new->mdlen);
+			if (ctx->stats)
+			{
+				ctx->stats->files++;
+				ctx->stats->hashed++;
+				ctx->stats->bytes_hashed += entry->size;
+			}
+			return 0;
+		}
+	}
+	if (ctx->stats)
+		ctx->stats->errors++;
+	if (ctx->error)
+		ctx->error(entry->path, entry->digest ? grub_errmsg : entry->error, ctx->data);
+	grub_errno = GRUB_ERR_NONE;
+	return 0;
+}
+
+grub_err_t
+grub_manifest_update(grub_manifest_t manifest, const char* disk,
+	grub_uint32_t algos, struct grub_manifest_stats* stats,
+	grub_manifest_error_hook_t error, void* data)
+{
+	const gcry_md_spec_t* hash[ARRAY_SIZE(manifest_algos)];
+	struct update_ctx ctx = { .old = manifest, .stats = stats, .error = error, .data = data };
+	unsigned count = 0;
+	grub_size_t i;
+	char* root;
+	grub_err_t err;
+
+	if (!algos)
+		algos = manifest->algos;
+	ctx.new = grub_manifest_new(algos);
+	if (!ctx.new)
+		return grub_errno;
+	for (i = 0; i < ARRAY_SIZE(manifest_algos); i++)
+	{
+		if (ctx.new->algos & manifest_algos[i].algo)
+			hash[count++] = algo_spec(i);
+	}
+	if (stats)
+		grub_memset(stats, 0, sizeof(*stats));
+
+	root = grub_xasprintf("(%s)/", disk);
+	if (!root)
+	{
+		grub_manifest_free(ctx.new);
+		return grub_errno;
+	}
+	ctx.prefix = grub_strlen(root) - 1;
+	err = grub_hash_tree(root, hash, count, callback_update_filter, callback_update, &ctx);
+	grub_free(root);
+	if (err == GRUB_ERR_NONE)
+		err = manifest_sort(ctx.new);
+	if (err != GRUB_ERR_NONE)
+	{
+		grub_manifest_free(ctx.new);
+		return err;
+	}
+
+	if (stats)
+	{
+		for (i = 0; i < manifest->count; i++)
+		{
+			if (grub_manifest_find(ctx.new, rec_name(manifest, i)) < 0)
+				stats->removed++;
+		}
+	}
+
+	/* Take over the new content, the source stays.  */
+	manifest_clear(manifest);
+	manifest->algos = ctx.new->algos;
+	manifest->mdlen = ctx.new->mdlen;
+	manifest->recs = ctx.new->recs;
+	manifest->digests = ctx.new->digests;
+	manifest->names = ctx.new->names;
+	manifest->count = ctx.new->count;
+	manifest->alloc = ctx.new->alloc;
+	manifest->names_len = ctx.new->names_len;
+	manifest->names_alloc = ctx.new->names_alloc;
+	grub_free(ctx.new);
+	return GRUB_ERR_NONE;
+}
+
+struct dup_item
+{
+	grub_uint64_t size;
+	const grub_uint8_t* digest;
+	grub_size_t mdlen;
+	grub_size_t index;
+};
+
+static int
+dup_cmp(const struct dup_item* a, const struct dup_item* b)
+{
+	if (a->size != b->size)
+		return a->size < b->size ? -1 : 1;
+	return grub_memcmp(a->digest, b->digest, a->mdlen);
+}
+
+static int
+callback_sort_dup(const void* a, const void* b)
+{
+	int cmp = dup_cmp(a, b);
+
+	if (cmp)
+		return cmp;
+	/* Keep each group in path order.  */
+	return ((const struct dup_item*)a)->index < ((const struct dup_item*)b)->index ? -1 : 1;
+}
+
+void
+grub_manifest_duplicates(grub_manifest_t manifest,
+	grub_manifest_dup_hook_t hook, void* data)
+{
+	struct dup_item* items;
+	grub_size_t* group;
+	grub_size_t i, j, n = 0;
+
+	items = grub_calloc(manifest->count, sizeof(*items));
+	group = grub_calloc(manifest->count, sizeof(*group));
+	if (!items || !group)
+		goto out;
+	/* Empty files are all alike and not worth reporting.  */
+	for (i = 0; i < manifest->count; i++)
+	{
+		if (manifest->recs[i].size == 0)
+			continue;
+		items[n].size = manifest->recs[i].size;
+		items[n].digest = manifest->digests + i * manifest->mdlen;
+		items[n].mdlen = manifest->mdlen;
+		items[n].index = i;
+		n++;
+	}
+	if (n > 1)
+		qsort(items, n, sizeof(*items), callback_sort_dup);
+
+	for (i = 0; i < n; i = j)
+	{
+		for (j = i + 1; j < n && dup_cmp(&items[i], &items[j]) == 0; j++)
+			;
+		if (j - i > 1)
+		{
+			grub_size_t k;
+			for (k = i; k < j; k++)
+				group[k - i] = items[k].index;
+			if (hook(manifest, group, j - i, data))
+				break;
+		}
+	}
+
+out:
+	grub_free(items);
+	grub_free(group);
+}
+
+static int
+same_content(grub_manifest_t a, grub_size_t ai, grub_manifest_t b, grub_size_t bi)
+{
+	grub_uint32_t common = a->algos & b->algos;
+	grub_size_t i;
+
+	if (a->recs[ai].size != b->recs[bi].size)
+		return 0;
+	if (!common)
+		return a->recs[ai].mtime == b->recs[bi].mtime;
+	for (i = 0; i < ARRAY_SIZE(manifest_algos); i++)
+	{
+		grub_uint32_t algo = manifest_algos[i].algo;
+		if ((common & algo) && grub_memcmp(grub_manifest_digest(a, ai, algo),
+			grub_manifest_digest(b, bi, algo), manifest_algos[i].mdlen) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+void
+grub_manifest_diff(grub_manifest_t a, grub_manifest_t b,
+	grub_manifest_diff_hook_t hook, void* data)
+{
+	grub_size_t i = 0, j = 0;
+
+	while (i < a->count || j < b->count)
+	{
+		int cmp;
+		if (i == a->count)
+			cmp = 1;
+		else if (j == b->count)
+			cmp = -1;
+		else
+			cmp = grub_strcmp(rec_name(a, i), rec_name(b, j));
+
+		if (cmp < 0)
+		{
+			if (hook(GRUB_MANIFEST_REMOVED, (grub_ssize_t)i, -1, data))
+				return;
+			i++;
+		}
+		else if (cmp > 0)
+		{
+			if (hook(GRUB_MANIFEST_ADDED, -1, (grub_ssize_t)j, data))
+				return;
+			j++;
+		}
+		else
+		{
+			if (!same_content(a, i, b, j)
+				&& hook(GRUB_MANIFEST_MODIFIED, (grub_ssize_t)i, (grub_ssize_t)j, data))
+				return;
+			i++;
+			j++;
+		}
+	}
+}
+
+/* The whole of PATH, a grub file if it starts with '(' like the manifest
+   beside an image mounted from a device, else a host file.  */
+static grub_uint8_t*
+read_file(const char* path, grub_size_t* size)
+{
+	grub_file_t file;
+	grub_uint8_t* buf;
+
+	if (path[0] != '(')
+		return grub_host_read_file(path, size);
+	file = grub_file_open(path, GRUB_FILE_TYPE_HASHLIST | GRUB_FILE_TYPE_NO_DECOMPRESS);
+	if (!file)
+		return NULL;
+	if (file->size > 0x7fffffff)
+	{
+		grub_error(GRUB_ERR_BAD_FILE_TYPE, "`%s' is too large", path);
+		grub_file_close(file);
+		return NULL;
+	}
+	buf = grub_malloc((grub_size_t)file->size + 1);
+	if (buf && grub_file_read(file, buf, (grub_size_t)file->size) != (grub_ssize_t)file->size)
+	{
+		if (grub_errno == GRUB_ERR_NONE)
+			grub_error(GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"), path);
+		grub_free(buf);
+		buf = NULL;
+	}
+	if (buf)
+		*size = (grub_size_t)file->size;
+	grub_file_close(file);
+	return buf;
+}
+
+grub_manifest_t
+grub_manifest_load(const char* path)
+{
+	struct manifest_header* hdr;
+	grub_manifest_t manifest = NULL;
+	grub_uint8_t* buf;
+	const grub_uint8_t* p;
+	grub_size_t size = 0;
+	grub_uint64_t count, names;
+	grub_uint32_t algos;
+	grub_size_t mdlen, i;
+
+	buf = read_file(path, &size);
+	if (!buf)
+		return NULL;
+	hdr = (struct manifest_header*)buf;
+	if (size < sizeof(*hdr) || grub_memcmp(hdr->magic, MANIFEST_MAGIC, 4) != 0
+		|| grub_le_to_cpu32(hdr->version) != MANIFEST_VERSION)
+		goto bad;
+	algos = grub_le_to_cpu32(hdr->algos);
+	count = grub_le_to_cpu64(hdr->count);
+	names = grub_le_to_cpu64(hdr->names);
+	mdlen = algos_mdlen(algos);
+	if ((algos & ~GRUB_MANIFEST_ALL) || !algos
+		|| count > size || names > size
+		|| sizeof(*hdr) + count * (sizeof(struct manifest_rec) + mdlen) + names != size
+		|| (names && buf[size - 1] != '\0')
+		|| grub_getcrc32c(0, buf + sizeof(*hdr), size - sizeof(*hdr)) != grub_le_to_cpu32(hdr->crc))
+		goto bad;
+
+	manifest = grub_manifest_new(algos);
+	if (!manifest)
+		goto fail;
+	manifest->source_size = grub_le_to_cpu64(hdr->source_size);
+	manifest->source_mtime = (grub_int64_t)grub_le_to_cpu64(hdr->source_mtime);
+	manifest->count = manifest->alloc = (grub_size_t)count;
+	manifest->names_len = manifest->names_alloc = (grub_size_t)names;
+	manifest->recs = grub_calloc(manifest->count + 1, sizeof(*manifest->recs));
+	manifest->digests = grub_malloc(manifest->count * mdlen + 1);
+	manifest->names = grub_malloc(manifest->names_len + 1);
+	if (!manifest->recs || !manifest->digests || !manifest->names)
+		goto fail;
+
+	p = buf + sizeof(*hdr);
+	for (i = 0; i < manifest->count; i++, p += sizeof(struct manifest_rec))
+	{
+		const struct manifest_rec* src = (const struct manifest_rec*)p;
+		struct manifest_rec* rec = &manifest->recs[i];
+		rec->name = grub_le_to_cpu32(grub_get_unaligned32(&src->name));
+		rec->flags = grub_le_to_cpu32(grub_get_unaligned32(&src->flags));
+		rec->size = grub_le_to_cpu64(grub_get_unaligned64(&src->size));
+		rec->mtime = (grub_int64_t)grub_le_to_cpu64(grub_get_unaligned64(&src->mtime));
+		rec->inode = grub_le_to_cpu64(grub_get_unaligned64(&src->inode));
+		if (rec->name >= names)
+			goto bad;
+	}
+	grub_memcpy(manifest->digests, p, manifest->count * mdlen);
+	p += manifest->count * mdlen;
+	grub_memcpy(manifest->names, p, manifest->names_len);
+	grub_free(buf);
+	return manifest;
+
+bad:
+	grub_error(GRUB_ERR_BAD_FILE_TYPE, "`%s' is not a valid manifest", path);
+fail:
+	grub_manifest_free(manifest);
+	grub_free(buf);
+	return NULL;
+}
+
+grub_err_t
+grub_manifest_save(grub_manifest_t manifest, const char* path)
+{
+	struct manifest_header hdr;
+	struct manifest_rec* recs;
+	const void* part[4];
+	grub_size_t len[4];
+	grub_uint32_t crc;
+	grub_size_t i;
+	grub_err_t err;
+
+	recs = grub_calloc(manifest->count + 1, sizeof(*recs));
+	if (!recs)
+		return grub_errno;
+	for (i = 0; i < manifest->count; i++)
+	{
+		const struct manifest_rec* rec = &manifest->recs[i];
+		recs[i].name = grub_cpu_to_le32(rec->name);
+		recs[i].flags = grub_cpu_to_le32(rec->flags);
+		recs[i].size = grub_cpu_to_le64(rec->size);
+		recs[i].mtime = (grub_int64_t)grub_cpu_to_le64((grub_uint64_t)rec->mtime);
+		recs[i].inode = grub_cpu_to_le64(rec->inode);
+	}
+
+	part[1] = recs;
+	len[1] = manifest->count * sizeof(*recs);
+	part[2] = manifest->digests;
+	len[2] = manifest->count * manifest->mdlen;
+	part[3] = manifest->names;
+	len[3] = manifest->names_len;
+	crc = 0;
+	for (i = 1; i < 4; i++)
+		crc = grub_getcrc32c(crc, part[i], len[i]);
+
+	grub_memcpy(hdr.magic, MANIFEST_MAGIC, 4);
+	hdr.version = grub_cpu_to_le32(MANIFEST_VERSION);
+	hdr.algos = grub_cpu_to_le32(manifest->algos);
+	hdr.crc = grub_cpu_to_le32(crc);
+	hdr.count = grub_cpu_to_le64(manifest->count);
+	hdr.names = grub_cpu_to_le64(manifest->names_len);
+	hdr.source_size = grub_cpu_to_le64(manifest->source_size);
+	hdr.source_mtime = (grub_int64_t)grub_cpu_to_le64((grub_uint64_t)manifest->source_mtime);
+	part[0] = &hdr;
+	len[0] = sizeof(hdr);
+
+	err = grub_host_replace_file(path, part, len, 4);
+	grub_free(recs);
+	return err;
+}
@@ -66,7 +66,7 @@
 #define RT_BIT_32(bit)         (1U << (bit))
 #define RT_BIT_64(bit)         (1ULL << (bit))
 
-#define RT_UOFFSETOF(type, member)             ((uintptr_t)&(((type *)(void *)0)->member))
+#define RT_UOFFSETOF(type, member)             ((grub_addr_t)&(((type *)(void *)0)->member))
 #define RT_SIZEOFMEMB(type, member)            (sizeof(((type *)(void *)0)->member))
 #define RT_UOFFSET_AFTER(a_Type, a_Member)     (RT_UOFFSETOF(a_Type, a_Member) + RT_SIZEOFMEMB(a_Type, a_Member))
 #define RT_FROM_MEMBER(pMem, Type, Member)      ((Type *)((grub_uint8_t *)(void *)(pMem) - RT_UOFFSETOF(Type, Member)))
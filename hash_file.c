@@ -18,17 +18,23 @@
 
 #include <nkctx.h>
 #include <lang.h>
+#include <loopback.h>
 
 #include <grub/types.h>
 #include <grub/err.h>
 #include <grub/misc.h>
+#include <grub/disk.h>
 #include <grub/file.h>
 #include <grub/crypto.h>
+#include <grub/hashtree.h>
+#include <grub/manifest.h>
+#include <grub/thread.h>
 
 #define BUF_SIZE 4096
 
 static grub_err_t
-hash_file(grub_file_t file, const gcry_md_spec_t* hash, void* result)
+hash_file(grub_file_t file, const gcry_md_spec_t* hash, void* result,
+	struct grub_progress* progress)
 {
 	void* context;
 	grub_uint8_t* readbuf;
@@ -38,7 +44,6 @@ hash_file(grub_file_t file, const gcry_md_spec_t* hash, void* result)
 	context = grub_zalloc(hash->contextsize);
 	if (!context)
 		goto fail;
-	nkctx_show_progress();
 	hash->init(context);
 	while (1)
 	{
@@ -48,23 +53,100 @@ hash_file(grub_file_t file, const gcry_md_spec_t* hash, void* result)
 		if (r == 0)
 			break;
 		hash->write(context, readbuf, r);
+		grub_atomic_add(&progress->bytes, r);
 	}
 	hash->final(context);
 	grub_memcpy(result, hash->read(context), hash->mdlen);
-	nkctx_hide_progress();
 	grub_free(readbuf);
 	grub_free(context);
 	return GRUB_ERR_NONE;
 
 fail:
-	nkctx_hide_progress();
 	grub_free(readbuf);
 	grub_free(context);
 	return grub_errno;
 }
 
+struct manifest_lookup
+{
+	grub_manifest_t manifest;
+	grub_uint32_t algo;
+	const grub_uint8_t* digest;
+};
+
+/* Take the digest of the entry if the file still has its size, mtime and
+   inode.  Files with neither are always hashed, as by the manifest update.
+   The walk never hashes anything, the caller does on a miss.  */
+static int
+callback_manifest_filter(const struct grub_hashtree_entry* entry, void* data)
+{
+	struct manifest_lookup* ctx = data;
+	const char* name = grub_strchr(entry->path, ')');
+	struct grub_manifest_entry old;
+	grub_ssize_t index;
+
+	if (!name || !(entry->mtimeset || entry->inodeset))
+		return 0;
+	index = grub_manifest_find(ctx->manifest, name + 1);
+	if (index < 0)
+		return 0;
+	grub_manifest_get(ctx->manifest, index, &old);
+	if (old.size == entry->size
+		&& !!old.mtimeset == !!entry->mtimeset && (!entry->mtimeset || old.mtime == entry->mtime)
+		&& !!old.inodeset == !!entry->inodeset && (!entry->inodeset || old.inode == entry->inode))
+		ctx->digest = grub_manifest_digest(ctx->manifest, index, ctx->algo);
+	return 0;
+}
+
+static int
+callback_manifest_hash(const struct grub_hashtree_entry* entry, void* data)
+{
+	NK_UNUSED(entry);
+	NK_UNUSED(data);
+	return 0;
+}
+
+/* Copy the digest HASH of PATH to RESULT from the manifest beside the
+   image of its loopback device.  Manifests describe whole devices, as
+   written by nkarc manifest update.  */
+static BOOL
+hash_from_manifest(const char* path, const gcry_md_spec_t* hash, void* result)
+{
+	struct manifest_lookup ctx = { .algo = grub_manifest_algo_by_name(hash->name) };
+	grub_disk_t disk = NULL;
+	char* name = NULL;
+	char* nkm = NULL;
+
+	if (!ctx.algo)
+		goto out;
+	name = grub_file_get_disk_name(path);
+	if (!name || grub_strchr(name, ','))
+		goto out;
+	disk = grub_disk_open(name);
+	if (!disk || disk->dev->id != GRUB_DISK_DEVICE_LOOPBACK_ID)
+		goto out;
+	nkm = grub_xasprintf("%s" GRUB_MANIFEST_EXT, ((struct grub_loopback*)disk->data)->file->name);
+	if (!nkm)
+		goto out;
+	ctx.manifest = grub_manifest_load(nkm);
+	if (!ctx.manifest)
+		goto out;
+	grub_hash_tree(path, &hash, 1, callback_manifest_filter, callback_manifest_hash, &ctx);
+	if (ctx.digest)
+		grub_memcpy(result, ctx.digest, hash->mdlen);
+
+out:
+	grub_manifest_free(ctx.manifest);
+	if (disk)
+		grub_disk_close(disk);
+	grub_free(nkm);
+	grub_free(name);
+	grub_errno = GRUB_ERR_NONE;
+	return ctx.digest != NULL;
+}
+
 static char*
-get_checksum(const char* opt, const char* path)
+get_checksum(const char* opt, const char* path, struct grub_progress* progress)
 {
 	char* ret = NULL;
 	grub_file_t file = NULL;
@@ -76,13 +158,20 @@ get_checksum(const char* opt, const char* path)
 		goto fail;
 	if (hash->mdlen > GRUB_CRYPTO_MAX_MDLEN)
 		goto fail;
+	GRUB_PROPERLY_ALIGNED_ARRAY(result, GRUB_CRYPTO_MAX_MDLEN);
+	if (hash_from_manifest(path, hash, result))
+		goto found;
 	file = grub_file_open(path, GRUB_FILE_TYPE_HASHLIST | GRUB_FILE_TYPE_NO_DECOMPRESS);
 	if (!file)
 		goto fail;
-	GRUB_PROPERLY_ALIGNED_ARRAY(result, GRUB_CRYPTO_MAX_MDLEN);
+	/* The Jobs window reads it while this runs, and 64-bit stores are
+	   not atomic on x86.  It starts at zero.  */
+	if (file->size != GRUB_FILE_SIZE_UNKNOWN)
+		grub_atomic_add(&progress->total_bytes, file->size);
 	grub_errno = GRUB_ERR_NONE;
-	if (hash_file(file, hash, result) != GRUB_ERR_NONE)
+	if (hash_file(file, hash, result, progress) != GRUB_ERR_NONE)
 		goto fail;
+found:
 	len = 2 * hash->mdlen + 1;
 	ret = grub_malloc(len);
 	if (!ret)
@@ -109,11 +198,71 @@ enum
 
 static char* m_ctx[M_CTX_MAX];
 
+/* A checksum being calculated, it is dropped if the window moved on to
+   another file or was closed when it is done.  */
+struct hash_job
+{
+	struct nkctx_job* job;
+	char* path;
+	const char* name;
+	grub_size_t id;
+	char* result;
+};
+
+static struct hash_job* m_job[M_CTX_MAX];
+
 static void
-nkctx_hash_init(const char* path)
+hash_job_run(struct grub_progress* progress, void* data)
 {
-	memset(m_ctx, 0, sizeof(m_ctx));
-	m_ctx[M_CTX_PATH] = grub_strdup(path);
+	struct hash_job* job = data;
+	job->result = get_checksum(job->name, job->path, progress);
+}
+
+static void
+hash_job_done(void* data, BOOL closing)
+{
+	struct hash_job* job = data;
+	if (m_job[job->id] == job)
+	{
+		m_job[job->id] = NULL;
+		if (!closing)
+		{
+			m_ctx[job->id] = job->result;
+			job->result = NULL;
+		}
+	}
+	grub_free(job->result);
+	grub_free(job->path);
+	grub_free(job);
+}
+
+static void
+start_hash(const char* desc, const char* name, grub_size_t id)
+{
+	const char* file = grub_strrchr(m_ctx[M_CTX_PATH], '/');
+	struct hash_job* job;
+	char title[64];
+
+	job = grub_zalloc(sizeof(struct hash_job));
+	if (!job)
+		goto fail;
+	job->path = grub_strdup(m_ctx[M_CTX_PATH]);
+	if (!job->path)
+		goto fail;
+	job->name = name;
+	job->id = id;
+	grub_snprintf(title, sizeof(title), "%s  %s", desc, file ? file + 1 : m_ctx[M_CTX_PATH]);
+	job->job = nkctx_job_start(title, hash_job_run, hash_job_done, job);
+	if (!job->job)
+		goto fail;
+	m_job[id] = job;
+	return;
+
+fail:
+	if (job)
+		grub_free(job->path);
+	grub_free(job);
+	grub_errno = GRUB_ERR_NONE;
 }
 
 static void
@@ -123,9 +272,19 @@ nkctx_hash_fini(void)
 	{
 		grub_free(m_ctx[i]);
 		m_ctx[i] = NULL;
+		if (m_job[i])
+			nkctx_job_cancel(m_job[i]->job);
+		m_job[i] = NULL;
 	}
 }
 
+static void
+nkctx_hash_init(const char* path)
+{
+	nkctx_hash_fini();
+	m_ctx[M_CTX_PATH] = grub_strdup(path);
+}
+
 static void
 draw_hash(struct nk_context* ctx, const char* desc, const char* name, grub_size_t id)
 {
@@ -135,8 +294,13 @@ draw_hash(struct nk_context* ctx, const char* desc, const char* name, grub_size_
 	{
 		nk_layout_row(ctx, NK_DYNAMIC, 0, 2, (float[2]) { 0.3f, 0.4f });
 		nk_spacer(ctx);
-		if (nk_button_label(ctx, GET_STR(LANG_STR_CALC)))
-			m_ctx[id] = get_checksum(name, m_ctx[M_CTX_PATH]);
+		if (m_job[id])
+		{
+			if (nk_button_label(ctx, GET_STR(LANG_STR_CANCEL)))
+				nkctx_job_cancel(m_job[id]->job);
+		}
+		else if (nk_button_label(ctx, GET_STR(LANG_STR_CALC)))
+			start_hash(desc, name, id);
 	}
 	else
 		nk_label_wrap(ctx, m_ctx[id]);
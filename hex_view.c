@@ -17,6 +17,7 @@
  */
 
 #include <nkctx.h>
+#include <file_view.h>
 
 #include <grub/types.h>
 #include <grub/misc.h>
@@ -24,101 +25,462 @@
 #include <grub/file.h>
 
 #include <lang.h>
+#include <emmintrin.h>
+#include <intrin.h>
 
-#define HEX_VIEW_STEP 0x100
+/* The rows drawn come from the windows of the file kept.  */
+#define HEX_WINDOW_SHIFT 20
+#define HEX_WINDOW_SIZE (1 << HEX_WINDOW_SHIFT)
+#define HEX_WINDOW_COUNT 4
+#define HEX_ROW 0x10
+#define HEX_PATTERN_MAX 64
+
+struct hex_view
+{
+	struct file_view file;
+	/* The search running, an older one gives up.  */
+	volatile LONG search_gen;
+	volatile LONG searching;
+	/* Offset of the match, or -1.  */
+	volatile LONG64 found;
+};
+
+struct hex_job
+{
+	struct hex_view* view;
+	LONG gen;
+	grub_off_t from;
+	grub_size_t len;
+	grub_uint8_t pattern[HEX_PATTERN_MAX];
+};
 
 static struct
 {
-	grub_file_t file;
-	grub_off_t offset;
-	grub_off_t size;
-	grub_uint8_t buf[HEX_VIEW_STEP];
+	struct hex_view* view;
+	/* Offset of the first row drawn.  */
+	grub_off_t pos;
+	/* Rows that fit the window, and the way the last move went.  */
+	grub_off_t rows;
+	BOOL backward;
+	grub_off_t mark;
+	grub_size_t mark_len;
+	BOOL searching;
+	grub_size_t search_len;
+	char goto_text[20];
+	char find_text[128];
+	char status[64];
 } m_ctx;
 
+static void
+nkctx_hex_fini(void);
+
+static void
+hex_view_release(struct file_view* file)
+{
+	free(file);
+}
+
+/* First place of PATTERN in BUF.  Sixteen places are tried at once by
+   their first and last byte, only those matching both are compared.  */
+static const grub_uint8_t*
+find_bytes(const grub_uint8_t* buf, grub_size_t size, const grub_uint8_t* pattern, grub_size_t len)
+{
+	grub_size_t i = 0;
+
+	if (len == 0 || len > size)
+		return NULL;
+	if (len == 1)
+		return memchr(buf, pattern[0], size);
+
+	const __m128i first = _mm_set1_epi8((char)pattern[0]);
+	const __m128i last = _mm_set1_epi8((char)pattern[len - 1]);
+	for (; i + len - 1 + 16 <= size; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(buf + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(buf + i + len - 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		while (mask)
+		{
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+			if (memcmp(buf + i + bit + 1, pattern + 1, len - 2) == 0)
+				return buf + i + bit;
+			mask &= mask - 1;
+		}
+	}
+	for (; i + len <= size; i++)
+	{
+		if (buf[i] == pattern[0] && memcmp(buf + i + 1, pattern + 1, len - 1) == 0)
+			return buf + i;
+	}
+	return NULL;
+}
+
+/* Read on from JOB->from a window at a time, the last LEN - 1 bytes of a
+   window are kept in front of the next one for matches across them.  */
+static void CALLBACK
+hex_search_worker(PTP_CALLBACK_INSTANCE instance, PVOID data)
+{
+	struct hex_job* job = data;
+	struct hex_view* view = job->view;
+	LONG gen = job->gen;
+	grub_uint8_t* buf = malloc(HEX_WINDOW_SIZE + HEX_PATTERN_MAX);
+	grub_file_t file = NULL;
+	grub_off_t base = job->from;
+	grub_size_t keep = 0;
+	LONG64 found = -1;
+	NK_UNUSED(instance);
+
+	if (buf)
+		file = grub_file_open(view->file.path, view->file.type);
+	if (file)
+	{
+		grub_file_seek(file, job->from);
+		while (!view->file.cancel && view->search_gen == gen)
+		{
+			const grub_uint8_t* p;
+			grub_ssize_t r = grub_file_read(file, buf + keep, HEX_WINDOW_SIZE);
+			if (r <= 0)
+				break;
+			grub_size_t n = keep + r;
+			p = find_bytes(buf, n, job->pattern, job->len);
+			if (p)
+			{
+				found = base + (p - buf);
+				break;
+			}
+			/* BUF starts at BASE.  */
+			keep = (n < job->len - 1) ? n : job->len - 1;
+			memmove(buf, buf + n - keep, keep);
+			base += n - keep;
+		}
+		grub_file_close(file);
+	}
+	grub_errno = GRUB_ERR_NONE;
+	free(buf);
+	free(job);
+
+	if (view->search_gen == gen)
+	{
+		InterlockedExchange64(&view->found, found);
+		InterlockedExchange(&view->searching, 0);
+	}
+	file_view_job_done(&view->file);
+}
+
 static void
 nkctx_hex_init(const char* path)
 {
-	m_ctx.file = grub_file_open(path, GRUB_FILE_TYPE_HEXCAT | GRUB_FILE_TYPE_NO_DECOMPRESS);
-	if (!m_ctx.file)
+	struct hex_view* view;
+	grub_file_t file;
+
+	nkctx_hex_fini();
+	file = grub_file_open(path, GRUB_FILE_TYPE_HEXCAT | GRUB_FILE_TYPE_NO_DECOMPRESS);
+	if (!file)
 	{
+		grub_errno = GRUB_ERR_NONE;
 		MessageBoxW(nk.wnd, GET_WCS(LANG_WCS_CANNOT_OPEN_FILE), GET_WCS(LANG_WCS_ERROR), MB_OK | MB_ICONERROR);
 		return;
 	}
-	m_ctx.offset = 0;
-	m_ctx.size = grub_file_size(m_ctx.file);
-	grub_memset(m_ctx.buf, 0, HEX_VIEW_STEP);
-	grub_file_read(m_ctx.file, m_ctx.buf, HEX_VIEW_STEP);
+	view = calloc(1, sizeof(struct hex_view));
+	if (!view || !file_view_init(&view->file, path, GRUB_FILE_TYPE_HEXCAT | GRUB_FILE_TYPE_NO_DECOMPRESS,
+		HEX_WINDOW_SIZE, HEX_WINDOW_COUNT, hex_view_release))
+	{
+		free(view);
+		grub_file_close(file);
+		MessageBoxW(nk.wnd, GET_WCS(LANG_WCS_OUT_OF_MEM), GET_WCS(LANG_WCS_ERROR), MB_OK | MB_ICONERROR);
+		return;
+	}
+	view->file.size = grub_file_size(file);
+	view->found = -1;
+	grub_file_close(file);
+
+	grub_memset(&m_ctx, 0, sizeof(m_ctx));
+	m_ctx.view = view;
+	m_ctx.rows = 1;
+	file_view_get_window(&view->file, 0);
 }
 
 static void
 nkctx_hex_fini(void)
 {
-	grub_file_close(m_ctx.file);
-	m_ctx.file = NULL;
-	m_ctx.offset = 0;
-	m_ctx.size = 0;
+	if (!m_ctx.view)
+		return;
+	file_view_close(&m_ctx.view->file);
+	grub_memset(&m_ctx, 0, sizeof(m_ctx));
+}
+
+/* POS as the first row drawn, as far as the rows still fit.  */
+static grub_off_t
+clamp_pos(grub_off_t pos)
+{
+	grub_off_t size = m_ctx.view->file.size;
+	grub_off_t last = size ? (size - 1) & ~(grub_off_t)(HEX_ROW - 1) : 0;
+	grub_off_t span = (m_ctx.rows - 1) * HEX_ROW;
+
+	pos &= ~(grub_off_t)(HEX_ROW - 1);
+	if (last > span && pos > last - span)
+		pos = last - span;
+	else if (last <= span)
+		pos = 0;
+	return pos;
+}
+
+/* Only moves asked for set the way the view goes.  */
+static void
+move_to(grub_off_t pos)
+{
+	pos = clamp_pos(pos);
+	m_ctx.backward = pos < m_ctx.pos;
+	m_ctx.pos = pos;
 }
 
 static void
-update_buf(int forward)
+move_by(grub_int64_t rows)
 {
-	if (!forward && m_ctx.offset >= HEX_VIEW_STEP)
-		m_ctx.offset -= HEX_VIEW_STEP;
-	else if (forward && m_ctx.offset + HEX_VIEW_STEP < m_ctx.size)
-		m_ctx.offset += HEX_VIEW_STEP;
+	grub_int64_t delta = rows * HEX_ROW;
+
+	if (delta < 0 && (grub_off_t)-delta > m_ctx.pos)
+		move_to(0);
 	else
+		move_to(m_ctx.pos + delta);
+}
+
+static void
+go_offset(const char* text)
+{
+	const char* end;
+	grub_off_t offset = grub_strtoull(text, &end, 16);
+
+	if (end == text || *end != '\0')
+	{
+		grub_strcpy(m_ctx.status, "Bad offset");
+		grub_errno = GRUB_ERR_NONE;
 		return;
-	grub_memset(m_ctx.buf, 0, HEX_VIEW_STEP);
-	grub_file_seek(m_ctx.file, m_ctx.offset);
-	grub_file_read(m_ctx.file, m_ctx.buf, HEX_VIEW_STEP);
+	}
+	if (offset >= m_ctx.view->file.size)
+	{
+		grub_strcpy(m_ctx.status, "Past the end");
+		return;
+	}
+	m_ctx.status[0] = '\0';
+	move_to(offset);
+}
+
+/* "text" in quotes, or hex bytes with any spaces between them.  */
+static grub_size_t
+parse_pattern(const char* text, grub_uint8_t* pattern)
+{
+	grub_size_t len = 0;
+
+	if (text[0] == '"')
+	{
+		for (text++; *text && *text != '"' && len < HEX_PATTERN_MAX; text++)
+			pattern[len++] = (grub_uint8_t)*text;
+		return len;
+	}
+	while (*text)
+	{
+		int hi, lo;
+		if (grub_isspace(*text))
+		{
+			text++;
+			continue;
+		}
+		hi = grub_isxdigit(text[0]) ? (grub_isdigit(text[0]) ? text[0] - '0' : grub_tolower(text[0]) - 'a' + 10) : -1;
+		lo = grub_isxdigit(text[1]) ? (grub_isdigit(text[1]) ? text[1] - '0' : grub_tolower(text[1]) - 'a' + 10) : -1;
+		if (hi < 0 || lo < 0 || len == HEX_PATTERN_MAX)
+			return 0;
+		pattern[len++] = (grub_uint8_t)(hi << 4 | lo);
+		text += 2;
+	}
+	return len;
+}
+
+/* Search from just after the last match, or from the first row drawn.  */
+static void
+find_next(const char* text)
+{
+	struct hex_view* view = m_ctx.view;
+	struct hex_job* job;
+	grub_size_t len;
+
+	if (m_ctx.searching)
+		return;
+	job = calloc(1, sizeof(struct hex_job));
+	if (!job)
+		return;
+	len = parse_pattern(text, job->pattern);
+	if (!len)
+	{
+		free(job);
+		grub_strcpy(m_ctx.status, "Bad pattern");
+		return;
+	}
+	job->len = len;
+	job->from = m_ctx.mark_len ? m_ctx.mark + 1 : m_ctx.pos;
+	job->gen = InterlockedIncrement(&view->search_gen);
+	InterlockedExchange(&view->searching, 1);
+	job->view = view;
+	if (!file_view_submit(&view->file, hex_search_worker, job))
+	{
+		free(job);
+		InterlockedExchange(&view->searching, 0);
+		grub_strcpy(m_ctx.status, "Can't search");
+		return;
+	}
+	m_ctx.searching = TRUE;
+	m_ctx.search_len = len;
+	grub_strcpy(m_ctx.status, "Searching ...");
+}
+
+static void
+poll_search(void)
+{
+	struct hex_view* view = m_ctx.view;
+	LONG64 found;
+
+	if (!m_ctx.searching || InterlockedCompareExchange(&view->searching, 0, 0))
+		return;
+	m_ctx.searching = FALSE;
+	found = InterlockedCompareExchange64(&view->found, -1, -1);
+	if (found < 0)
+	{
+		m_ctx.mark_len = 0;
+		grub_strcpy(m_ctx.status, "Not found");
+		return;
+	}
+	m_ctx.mark = found;
+	m_ctx.mark_len = m_ctx.search_len;
+	grub_snprintf(m_ctx.status, ARRAY_SIZE(m_ctx.status), "Found at %llX", (unsigned long long)found);
+	if ((grub_off_t)found < m_ctx.pos || (grub_off_t)found >= m_ctx.pos + m_ctx.rows * HEX_ROW)
+		move_to(found > HEX_ROW * 2 ? found - HEX_ROW * 2 : 0);
 }
 
 static void
-draw_row(struct nk_context* ctx, grub_off_t base)
+draw_row(struct nk_context* ctx, grub_off_t offset)
 {
-	grub_size_t i;
+	struct file_view_window* w = file_view_get_window(&m_ctx.view->file, offset);
 	struct nk_color c1 = NK_COLOR_BLUE;
-	if (base < 0xFFFFFFFFULL)
-		nk_labelf_colored(ctx, NK_TEXT_LEFT, c1, "%08llX| ", m_ctx.offset + base);
-	else
-		nk_labelf_colored(ctx, NK_TEXT_LEFT, c1, "%016llX| ", m_ctx.offset + base);
+	struct nk_color c2 = NK_COLOR_YELLOW;
+	grub_size_t i, count = 0;
+	const grub_uint8_t* p = NULL;
 	char buf[50] = { 0 };
-	for (i = 0; i < 0x10; i++)
-		grub_snprintf(buf + i * 3, 4, "%02X ", m_ctx.buf[base + i]);
+
+	if (w)
+	{
+		grub_size_t ofs = offset - w->offset;
+		p = w->data + ofs;
+		count = ofs < w->size ? w->size - ofs : 0;
+		if (count > HEX_ROW)
+			count = HEX_ROW;
+	}
+	if (m_ctx.mark_len && m_ctx.mark < offset + HEX_ROW && m_ctx.mark + m_ctx.mark_len > offset)
+		c1 = c2;
+	if (m_ctx.view->file.size > 0xFFFFFFFFULL)
+		nk_labelf_colored(ctx, NK_TEXT_LEFT, c1, "%016llX| ", offset);
+	else
+		nk_labelf_colored(ctx, NK_TEXT_LEFT, c1, "%08llX| ", offset);
+	if (!w)
+	{
+		nk_label(ctx, "...", NK_TEXT_LEFT);
+		nk_spacer(ctx);
+		return;
+	}
+	for (i = 0; i < count; i++)
+		grub_snprintf(buf + i * 3, 4, "%02X ", p[i]);
 	nk_label(ctx, buf, NK_TEXT_LEFT);
 	grub_strcpy(buf, "|");
-	for (i = 0; i < 0x10; i++)
-		buf[1 + i] = grub_isprint(m_ctx.buf[base + i]) ? m_ctx.buf[base + i] : '.';
-	buf[0x11] = 0;
+	for (i = 0; i < count; i++)
+		buf[1 + i] = grub_isprint(p[i]) ? p[i] : '.';
+	buf[1 + count] = 0;
 	nk_label(ctx, buf, NK_TEXT_LEFT);
 }
 
+static void
+draw_scrollbar(struct nk_context* ctx)
+{
+	grub_off_t last = m_ctx.view->file.size / HEX_ROW;
+	float max = (float)last;
+	float row = (float)(m_ctx.pos / HEX_ROW);
+	float step = max / 4096.0f;
+
+	if (step < 1.0f)
+		step = 1.0f;
+	nk_layout_row_dynamic(ctx, 0, 1);
+	if (nk_slider_float(ctx, 0.0f, &row, max > 0.0f ? max : 1.0f, step))
+		move_to((grub_off_t)row * HEX_ROW);
+}
+
 static void
 nkctx_hex_window(struct nk_context* ctx, float width, float height)
 {
-	if (!m_ctx.file)
+	struct nk_rect bounds;
+	float pitch;
+
+	if (!m_ctx.view)
 		return;
 	if (!nk_begin(ctx, "Hex Viewer",
 		nk_rect(2.0f, height * 0.1f, width * 0.95f, height * 0.8f),
-		NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_CLOSABLE))
+		NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_CLOSABLE | NK_WINDOW_NO_SCROLLBAR))
 	{
 		nkctx_hex_fini();
 		goto out;
 	}
+	poll_search();
 
 	nk_layout_row(ctx, NK_DYNAMIC, 0, 3, (float[3]){ nk.gui_ratio, 1.0f - 2 * nk.gui_ratio, nk.gui_ratio });
 	if (nk_button_symbol(ctx, NK_SYMBOL_TRIANGLE_LEFT))
-		update_buf(0);
-	if (m_ctx.file->name)
-		nk_label(ctx, m_ctx.file->name, NK_TEXT_LEFT);
-	else
-		nk_spacer(ctx);
+		move_by(-(grub_int64_t)m_ctx.rows);
+	nk_label(ctx, m_ctx.view->file.path, NK_TEXT_LEFT);
 	if (nk_button_symbol(ctx, NK_SYMBOL_TRIANGLE_RIGHT))
-		update_buf(1);
+		move_by(m_ctx.rows);
+
+	nk_layout_row(ctx, NK_DYNAMIC, 0, 3, (float[3]){ 0.25f, 0.45f, 0.3f });
+	if (nk_widget_is_hovered(ctx))
+		nk_tooltip(ctx, GET_STR(LANG_STR_GOTO_OFFSET));
+	if (nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD | NK_EDIT_SIG_ENTER,
+		m_ctx.goto_text, sizeof(m_ctx.goto_text), nk_filter_hex) & NK_EDIT_COMMITED)
+		go_offset(m_ctx.goto_text);
+	if (nk_widget_is_hovered(ctx))
+		nk_tooltip(ctx, GET_STR(LANG_STR_FIND_BYTES));
+	if (nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD | NK_EDIT_SIG_ENTER,
+		m_ctx.find_text, sizeof(m_ctx.find_text), nk_filter_default) & NK_EDIT_COMMITED)
+		find_next(m_ctx.find_text);
+	nk_label(ctx, m_ctx.status, NK_TEXT_LEFT);
+
+	draw_scrollbar(ctx);
 
+	/* As many rows as fit, the wheel moves three at a time.  */
 	nk_layout_row(ctx, NK_DYNAMIC, 0, 3, (float[3]){ 0.12f, 0.66f, 0.22f });
-	for (grub_size_t i = 0; i < HEX_VIEW_STEP; i += 0x10)
-		draw_row(ctx, i);
+	bounds = nk_layout_widget_bounds(ctx);
+	pitch = bounds.h + ctx->style.window.spacing.y;
+	if (pitch > 0.0f)
+	{
+		struct nk_rect region = nk_window_get_content_region(ctx);
+		grub_off_t rows = (grub_off_t)((region.y + region.h - bounds.y) / pitch);
+		m_ctx.rows = rows ? rows : 1;
+	}
+	if (nk_window_is_hovered(ctx) && ctx->input.mouse.scroll_delta.y != 0.0f)
+	{
+		move_by((grub_int64_t)(-ctx->input.mouse.scroll_delta.y * 3));
+		ctx->input.mouse.scroll_delta.y = 0.0f;
+	}
+	/* The rows may fit differently after a resize.  */
+	m_ctx.pos = clamp_pos(m_ctx.pos);
+
+	for (grub_off_t i = 0; i < m_ctx.rows; i++)
+	{
+		grub_off_t offset = m_ctx.pos + i * HEX_ROW;
+		if (offset >= m_ctx.view->file.size)
+			break;
+		draw_row(ctx, offset);
+	}
+	/* Read ahead the window the view is going to.  */
+	if (m_ctx.backward && m_ctx.pos >= HEX_WINDOW_SIZE)
+		file_view_prefetch(&m_ctx.view->file, m_ctx.pos - HEX_WINDOW_SIZE);
+	else if (!m_ctx.backward)
+		file_view_prefetch(&m_ctx.view->file, m_ctx.pos + m_ctx.rows * HEX_ROW + HEX_WINDOW_SIZE);
 
 out:
 	nk_end(ctx);
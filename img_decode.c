@@ -0,0 +1,511 @@
+/*
+ *  NkArc
+ *  Copyright (C) 2023 A1ive
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define COBJMACROS
+#include <nkctx.h>
+#include <wincodec.h>
+#include <shlwapi.h>
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/file.h>
+
+#pragma comment(lib, "windowscodecs.lib")
+
+/* A read only IStream over a grub file, decoders read only the parts of
+   the file they need instead of a copy of all of it.  */
+struct file_stream
+{
+	IStream stream;
+	volatile LONG refs;
+	grub_file_t file;
+};
+
+static HRESULT STDMETHODCALLTYPE
+stream_query_interface(IStream* This, REFIID riid, void** ppv)
+{
+	if (IsEqualIID(riid, &IID_IUnknown) || IsEqualIID(riid, &IID_ISequentialStream)
+		|| IsEqualIID(riid, &IID_IStream))
+	{
+		*ppv = This;
+		IStream_AddRef(This);
+		return S_OK;
+	}
+	*ppv = NULL;
+	return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE
+stream_add_ref(IStream* This)
+{
+	struct file_stream* p = (struct file_stream*)This;
+	return InterlockedIncrement(&p->refs);
+}
+
+static ULONG STDMETHODCALLTYPE
+stream_release(IStream* This)
+{
+	struct file_stream* p = (struct file_stream*)This;
+	LONG refs = InterlockedDecrement(&p->refs);
+
+	if (refs == 0)
+	{
+		grub_file_close(p->file);
+		free(p);
+	}
+	return refs;
+}
+
+static HRESULT STDMETHODCALLTYPE
+stream_read(IStream* This, void* pv, ULONG cb, ULONG* pcbRead)
+{
+	struct file_stream* p = (struct file_stream*)This;
+	grub_ssize_t r = grub_file_read(p->file, pv, cb);
+
+	if (r < 0)
+	{
+		grub_errno = GRUB_ERR_NONE;
+		if (pcbRead)
+			*pcbRead = 0;
+		return STG_E_READFAULT;
+	}
+	if (pcbRead)
+		*pcbRead = (ULONG)r;
+	return (ULONG)r < cb ? S_FALSE : S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+stream_write(IStream* This, const void* pv, ULONG cb, ULONG* pcbWritten)
+{
+	NK_UNUSED(This);
+	NK_UNUSED(pv);
+	NK_UNUSED(cb);
+	if (pcbWritten)
+		*pcbWritten = 0;
+	return STG_E_ACCESSDENIED;
+}
+
+static HRESULT STDMETHODCALLTYPE
+stream_seek(IStream* This, LARGE_INTEGER dlibMove, DWORD dwOrigin, ULARGE_INTEGER* plibNewPosition)
+{
+	struct file_stream* p = (struct file_stream*)This;
+	grub_off_t size = grub_file_size(p->file);
+	INT64 pos;
+
+	switch (dwOrigin)
+	{
+	case STREAM_SEEK_SET:
+		pos = dlibMove.QuadPart;
+		break;
+	case STREAM_SEEK_CUR:
+		pos = (INT64)grub_file_tell(p->file) + dlibMove.QuadPart;
+		break;
+	case STREAM_SEEK_END:
+		pos = (INT64)size + dlibMove.QuadPart;
+		break;
+	default:
+		return STG_E_INVALIDFUNCTION;
+	}
+	/* Past the end reads nothing, grub does not seek there.  */
+	if (pos < 0)
+		return STG_E_INVALIDFUNCTION;
+	if ((grub_off_t)pos > size)
+		pos = (INT64)size;
+	grub_file_seek(p->file, (grub_off_t)pos);
+	grub_errno = GRUB_ERR_NONE;
+	if (plibNewPosition)
+		plibNewPosition->QuadPart = (ULONGLONG)pos;
+	return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+stream_set_size(IStream* This, ULARGE_INTEGER libNewSize)
+{
+	NK_UNUSED(This);
+	NK_UNUSED(libNewSize);
+	return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE
+stream_copy_to(IStream* This, IStream* pstm, ULARGE_INTEGER cb,
+	ULARGE_INTEGER* pcbRead, ULARGE_INTEGER* pcbWritten)
+{
+	NK_UNUSED(This);
+	NK_UNUSED(pstm);
+	NK_UNUSED(cb);
+	NK_UNUSED(pcbRead);
+	NK_UNUSED(pcbWritten);
+	return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE
+stream_commit(IStream* This, DWORD grfCommitFlags)
+{
+	NK_UNUSED(This);
+	NK_UNUSED(grfCommitFlags);
+	return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+stream_revert(IStream* This)
+{
+	NK_UNUSED(This);
+	return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE
+stream_lock_region(IStream* This, ULARGE_INTEGER libOffset, ULARGE_INTEGER cb, DWORD dwLockType)
+{
+	NK_UNUSED(This);
+	NK_UNUSED(libOffset);
+	NK_UNUSED(cb);
+	NK_UNUSED(dwLockType);
+	return STG_E_INVALIDFUNCTION;
+}
+
+static HRESULT STDMETHODCALLTYPE
+stream_stat(IStream* This, STATSTG* pstatstg, DWORD grfStatFlag)
+{
+	struct file_stream* p = (struct file_stream*)This;
+	NK_UNUSED(grfStatFlag);
+
+	ZeroMemory(pstatstg, sizeof(STATSTG));
+	pstatstg->type = STGTY_STREAM;
+	pstatstg->cbSize.QuadPart = grub_file_size(p->file);
+	pstatstg->grfMode = STGM_READ;
+	return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+stream_clone(IStream* This, IStream** ppstm)
+{
+	NK_UNUSED(This);
+	*ppstm = NULL;
+	return E_NOTIMPL;
+}
+
+static IStreamVtbl stream_vtbl =
+{
+	.QueryInterface = stream_query_interface,
+	.AddRef = stream_add_ref,
+	.Release = stream_release,
+	.Read = stream_read,
+	.Write = stream_write,
+	.Seek = stream_seek,
+	.SetSize = stream_set_size,
+	.CopyTo = stream_copy_to,
+	.Commit = stream_commit,
+	.Revert = stream_revert,
+	.LockRegion = stream_lock_region,
+	.UnlockRegion = stream_lock_region,
+	.Stat = stream_stat,
+	.Clone = stream_clone,
+};
+
+/* The stream owns FILE, closed with the last reference.  */
+static IStream*
+file_stream_new(grub_file_t file)
+{
+	struct file_stream* p = calloc(1, sizeof(struct file_stream));
+
+	if (!p)
+	{
+		grub_file_close(file);
+		return NULL;
+	}
+	p->stream.lpVtbl = &stream_vtbl;
+	p->refs = 1;
+	p->file = file;
+	return &p->stream;
+}
+
+/* The stream must be used on one thread at a time.  */
+IStream*
+nkctx_open_stream(const char* path)
+{
+	grub_file_t file = grub_file_open(path, GRUB_FILE_TYPE_THEME | GRUB_FILE_TYPE_NO_DECOMPRESS);
+
+	if (!file)
+	{
+		grub_errno = GRUB_ERR_NONE;
+		return NULL;
+	}
+	return file_stream_new(file);
+}
+
+/* Decode the first frame of STREAM.  With FIT it is scaled to fit in
+   BOX_W x BOX_H but never up, else to the smallest power of two reduction
+   that still covers the box, the whole image if the box is 0.  WIC scales
+   while it decodes where the codec can, a JPEG scan is then never decoded
+   at full size.  */
+static BOOL
+decode_stream(IStream* stream, UINT box_w, UINT box_h, BOOL fit, struct nkctx_pixels* pixels)
+{
+	IWICImagingFactory* factory = NULL;
+	IWICBitmapDecoder* decoder = NULL;
+	IWICBitmapFrameDecode* frame = NULL;
+	IWICBitmapScaler* scaler = NULL;
+	IWICFormatConverter* converter = NULL;
+	UINT w, h, level = 0;
+	BOOL ret = FALSE;
+
+	ZeroMemory(pixels, sizeof(struct nkctx_pixels));
+	if (FAILED(CoCreateInstance(&CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER,
+		&IID_IWICImagingFactory, (void**)&factory)))
+		goto out;
+	if (FAILED(IWICImagingFactory_CreateDecoderFromStream(factory, stream, NULL,
+		WICDecodeMetadataCacheOnDemand, &decoder)))
+		goto out;
+	if (FAILED(IWICBitmapDecoder_GetFrame(decoder, 0, &frame))
+		|| FAILED(IWICBitmapFrameDecode_GetSize(frame, &w, &h)) || !w || !h)
+		goto out;
+
+	pixels->full_w = w;
+	pixels->full_h = h;
+	if (fit)
+	{
+		double scale = min(1.0, min((double)box_w / w, (double)box_h / h));
+		pixels->w = max(1, (UINT)(w * scale + 0.5));
+		pixels->h = max(1, (UINT)(h * scale + 0.5));
+	}
+	else
+	{
+		/* Half the size again while one side still covers the box, or
+		   while it is too large for a bitmap.  */
+		while (level < NKCTX_IMAGE_LEVELS - 1
+			&& ((box_w || box_h) && ((UINT64)box_w << (level + 1) <= w || (UINT64)box_h << (level + 1) <= h)
+				|| (w >> level) > NKCTX_IMAGE_MAX_SIDE || (h >> level) > NKCTX_IMAGE_MAX_SIDE))
+			level++;
+		pixels->level = level;
+		pixels->w = max(1, (w + (1U << level) - 1) >> level);
+		pixels->h = max(1, (h + (1U << level) - 1) >> level);
+	}
+	pixels->data = malloc((size_t)pixels->w * pixels->h * 4);
+	if (!pixels->data)
+		goto out;
+
+	if (FAILED(IWICImagingFactory_CreateBitmapScaler(factory, &scaler))
+		|| FAILED(IWICBitmapScaler_Initialize(scaler, (IWICBitmapSource*)frame,
+			pixels->w, pixels->h, WICBitmapInterpolationModeFant)))
+		goto out;
+	if (FAILED(IWICImagingFactory_CreateFormatConverter(factory, &converter))
+		|| FAILED(IWICFormatConverter_Initialize(converter, (IWICBitmapSource*)scaler,
+			&GUID_WICPixelFormat32bppPBGRA, WICBitmapDitherTypeNone, NULL, 0.0, WICBitmapPaletteTypeCustom)))
+		goto out;
+	if (FAILED(IWICFormatConverter_CopyPixels(converter, NULL, pixels->w * 4,
+		pixels->w * pixels->h * 4, pixels->data)))
+		goto out;
+	ret = TRUE;
+
+out:
+	if (converter)
+		IWICFormatConverter_Release(converter);
+	if (scaler)
+		IWICBitmapScaler_Release(scaler);
+	if (frame)
+		IWICBitmapFrameDecode_Release(frame);
+	if (decoder)
+		IWICBitmapDecoder_Release(decoder);
+	if (factory)
+		IWICImagingFactory_Release(factory);
+	if (!ret)
+	{
+		free(pixels->data);
+		pixels->data = NULL;
+	}
+	return ret;
+}
+
+/* Called on the thread pool.  */
+BOOL
+nkctx_decode_image(const char* path, UINT box_w, UINT box_h, struct nkctx_pixels* pixels)
+{
+	HRESULT com = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+	IStream* stream = nkctx_open_stream(path);
+	BOOL ret = FALSE;
+
+	ZeroMemory(pixels, sizeof(struct nkctx_pixels));
+	if (stream)
+	{
+		ret = decode_stream(stream, box_w, box_h, FALSE, pixels);
+		IStream_Release(stream);
+	}
+	if (SUCCEEDED(com))
+		CoUninitialize();
+	return ret;
+}
+
+static grub_uint16_t
+exif_get16(const grub_uint8_t* p, BOOL be)
+{
+	return be ? (grub_uint16_t)(p[0] << 8 | p[1]) : (grub_uint16_t)(p[1] << 8 | p[0]);
+}
+
+static grub_uint32_t
+exif_get32(const grub_uint8_t* p, BOOL be)
+{
+	return be ? (grub_uint32_t)exif_get16(p, be) << 16 | exif_get16(p + 2, be)
+		: (grub_uint32_t)exif_get16(p + 2, be) << 16 | exif_get16(p, be);
+}
+
+/* The JPEG thumbnail in IFD1 of the TIFF data in an Exif segment.  */
+static grub_uint8_t*
+exif_find_thumb(const grub_uint8_t* tiff, grub_size_t size, grub_size_t* len)
+{
+	grub_uint32_t ifd, offset = 0, length = 0;
+	grub_uint16_t count;
+	grub_uint8_t* thumb;
+	BOOL be;
+
+	if (size < 8)
+		return NULL;
+	if (tiff[0] == 'M' && tiff[1] == 'M')
+		be = TRUE;
+	else if (tiff[0] == 'I' && tiff[1] == 'I')
+		be = FALSE;
+	else
+		return NULL;
+	/* Skip IFD0 to the next one.  */
+	ifd = exif_get32(tiff + 4, be);
+	if (ifd > size - 2)
+		return NULL;
+	count = exif_get16(tiff + ifd, be);
+	if ((grub_uint64_t)ifd + 2 + 12 * count + 4 > size)
+		return NULL;
+	ifd = exif_get32(tiff + ifd + 2 + 12 * count, be);
+	if (ifd == 0 || ifd > size - 2)
+		return NULL;
+	count = exif_get16(tiff + ifd, be);
+	if ((grub_uint64_t)ifd + 2 + 12 * count > size)
+		return NULL;
+	for (grub_uint16_t i = 0; i < count; i++)
+	{
+		const grub_uint8_t* entry = tiff + ifd + 2 + 12 * i;
+		grub_uint16_t tag = exif_get16(entry, be);
+		grub_uint16_t type = exif_get16(entry + 2, be);
+		/* A SHORT value is in the first two bytes.  */
+		grub_uint32_t value = type == 3 ? exif_get16(entry + 8, be) : exif_get32(entry + 8, be);
+		if (tag == 0x0103 && value != 6)
+			return NULL;
+		if (tag == 0x0201)
+			offset = value;
+		else if (tag == 0x0202)
+			length = value;
+	}
+	if (!offset || length < 4 || (grub_uint64_t)offset + length > size
+		|| tiff[offset] != 0xFF || tiff[offset + 1] != 0xD8)
+		return NULL;
+	thumb = grub_malloc(length);
+	if (thumb)
+	{
+		grub_memcpy(thumb, tiff + offset, length);
+		*len = length;
+	}
+	return thumb;
+}
+
+/* Walk the segments ahead of the scan of a JPEG and read the Exif one
+   only, the rest of the file is not read.  */
+static grub_uint8_t*
+exif_read_thumb(grub_file_t file, grub_size_t* len)
+{
+	grub_uint8_t buf[4];
+	grub_uint8_t* seg;
+	grub_uint8_t* thumb = NULL;
+	grub_off_t pos = 2;
+
+	if (grub_file_read(file, buf, 2) != 2 || buf[0] != 0xFF || buf[1] != 0xD8)
+		return NULL;
+	for (int i = 0; i < 16; i++)
+	{
+		grub_uint16_t size;
+		grub_file_seek(file, pos);
+		if (grub_file_read(file, buf, 4) != 4 || buf[0] != 0xFF)
+			break;
+		/* Only the application segments come before the tables.  */
+		if (buf[1] < 0xE0 || buf[1] > 0xEF)
+			break;
+		size = (grub_uint16_t)(buf[2] << 8 | buf[3]);
+		if (size < 2)
+			break;
+		if (buf[1] == 0xE1 && size > 8)
+		{
+			seg = grub_malloc(size - 2);
+			if (!seg)
+				break;
+			if (grub_file_read(file, seg, size - 2) == size - 2
+				&& grub_memcmp(seg, "Exif\0\0", 6) == 0)
+				thumb = exif_find_thumb(seg + 6, size - 8, len);
+			grub_free(seg);
+			break;
+		}
+		pos += 2 + size;
+	}
+	grub_errno = GRUB_ERR_NONE;
+	return thumb;
+}
+
+/* Decode PATH to fit in BOX_W x BOX_H.  The thumbnail a camera stored in
+   a JPEG is used if there is one, only the image is decoded if not.
+   Called on the thread pool.  */
+BOOL
+nkctx_decode_thumb(const char* path, UINT box_w, UINT box_h, struct nkctx_pixels* pixels)
+{
+	HRESULT com = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+	grub_file_t file = grub_file_open(path, GRUB_FILE_TYPE_THEME | GRUB_FILE_TYPE_NO_DECOMPRESS);
+	grub_uint8_t* exif = NULL;
+	grub_size_t len = 0;
+	IStream* stream;
+	BOOL ret = FALSE;
+
+	ZeroMemory(pixels, sizeof(struct nkctx_pixels));
+	if (!file)
+	{
+		grub_errno = GRUB_ERR_NONE;
+		goto out;
+	}
+	exif = exif_read_thumb(file, &len);
+	if (exif)
+	{
+		stream = SHCreateMemStream(exif, (UINT)len);
+		if (stream)
+		{
+			ret = decode_stream(stream, box_w, box_h, TRUE, pixels);
+			IStream_Release(stream);
+		}
+		grub_free(exif);
+	}
+	if (ret)
+	{
+		grub_file_close(file);
+		goto out;
+	}
+	grub_file_seek(file, 0);
+	stream = file_stream_new(file);
+	if (stream)
+	{
+		ret = decode_stream(stream, box_w, box_h, TRUE, pixels);
+		IStream_Release(stream);
+	}
+out:
+	if (SUCCEEDED(com))
+		CoUninitialize();
+	return ret;
+}
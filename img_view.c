@@ -25,131 +25,526 @@
 #include <grub/mm.h>
 #include <grub/file.h>
 
-#define IMG_MAX_SIZE 0x4000000 // 64MB
+#include <math.h>
 
-static struct
+/* Images are decoded on the thread pool at the reduction the view needs,
+   never the whole file into memory.  The reductions decoded are kept per
+   file so that going back to an image, or zooming out again, draws at
+   once.  */
+#define IMG_CACHE_BUDGET (256U << 20)
+#define IMG_ZOOM_STEP 1.25f
+#define IMG_ZOOM_MAX 32.0f
+
+struct img_level
 {
-	char* path;
-	grub_size_t size;
+	struct nkctx_pixels pixels;
+	/* Draws from pixels.data.  */
 	struct nk_image img;
+};
+
+struct img_entry
+{
+	struct img_entry* next;
+	char* path;
+	grub_off_t size;
+	UINT full_w;
+	UINT full_h;
+	/* Levels that could not be decoded, not asked for again.  */
+	UINT failed;
+	struct img_level levels[NKCTX_IMAGE_LEVELS];
+};
+
+/* Shared with the decoder, which holds a reference while it runs.  */
+struct img_job
+{
+	volatile LONG refs;
+	volatile LONG cancel;
+	volatile LONG done;
+	char* path;
+	UINT box_w;
+	UINT box_h;
+	/* The level asked for, NKCTX_IMAGE_LEVELS before the size is known.  */
+	UINT level;
+	BOOL ok;
+	struct nkctx_pixels pixels;
+};
+
+static BOOL img_inited;
+static HANDLE img_idle;
+static volatile LONG img_pending;
+
+/* Most recently used first, only touched on the UI thread.  */
+static struct img_entry* img_cache;
+static size_t img_cache_bytes;
+
+static struct
+{
+	struct img_entry* entry;
+	struct img_job* job;
+	/* Screen pixels per image pixel, 0 to fit the view.  */
+	float zoom;
+	/* The image point drawn at the center of the view.  */
+	float cx;
+	float cy;
+	/* Scale of the last frame drawn.  */
+	float scale;
 	struct nk_rect bounds;
-	float ratio;
+	char status[64];
 } m_ctx;
 
 static void
-nkctx_image_init(const char* path)
+nkctx_image_fini(void);
+
+static void
+img_job_unref(struct img_job* job)
 {
-	void* data = NULL;
-	grub_file_t file = grub_file_open(path, GRUB_FILE_TYPE_THEME | GRUB_FILE_TYPE_NO_DECOMPRESS);
-	if (!file)
+	if (InterlockedDecrement(&job->refs) != 0)
+		return;
+	free(job->pixels.data);
+	grub_free(job->path);
+	free(job);
+}
+
+static void CALLBACK
+img_decode_worker(PTP_CALLBACK_INSTANCE instance, PVOID data)
+{
+	struct img_job* job = data;
+	NK_UNUSED(instance);
+
+	if (!job->cancel)
+		job->ok = nkctx_decode_image(job->path, job->box_w, job->box_h, &job->pixels);
+	InterlockedExchange(&job->done, 1);
+	img_job_unref(job);
+	PostMessageW(nk.wnd, WM_NULL, 0, 0);
+	if (InterlockedDecrement(&img_pending) == 0)
+		SetEvent(img_idle);
+}
+
+static void
+img_decode(UINT box_w, UINT box_h, UINT level)
+{
+	struct img_job* job;
+
+	if (!img_inited)
 	{
-		MessageBoxW(nk.wnd, GET_WCS(LANG_WCS_CANNOT_OPEN_FILE), GET_WCS(LANG_WCS_ERROR), MB_OK | MB_ICONERROR);
-		goto fail;
+		img_idle = CreateEventW(NULL, TRUE, TRUE, NULL);
+		img_inited = TRUE;
 	}
-	m_ctx.size = grub_file_size(file);
-	if (m_ctx.size > IMG_MAX_SIZE)
+	job = calloc(1, sizeof(struct img_job));
+	if (!job)
+		return;
+	job->path = grub_strdup(m_ctx.entry->path);
+	if (!job->path)
 	{
-		MessageBoxW(nk.wnd, GET_WCS(LANG_WCS_FILE_TOO_LARGE), GET_WCS(LANG_WCS_ERROR), MB_OK | MB_ICONERROR);
-		goto fail;
+		free(job);
+		return;
 	}
-	data = grub_malloc(m_ctx.size);
-	if (!data)
+	job->box_w = box_w;
+	job->box_h = box_h;
+	job->level = level;
+	job->refs = 2;
+	InterlockedIncrement(&img_pending);
+	ResetEvent(img_idle);
+	if (!TrySubmitThreadpoolCallback(img_decode_worker, job, NULL))
 	{
-		MessageBoxW(nk.wnd, GET_WCS(LANG_WCS_OUT_OF_MEM), GET_WCS(LANG_WCS_ERROR), MB_OK | MB_ICONERROR);
-		goto fail;
+		if (InterlockedDecrement(&img_pending) == 0)
+			SetEvent(img_idle);
+		job->refs = 1;
+		img_job_unref(job);
+		grub_strcpy(m_ctx.status, "Can't decode");
+		return;
 	}
-	grub_file_read(file, data, m_ctx.size);
-	m_ctx.img = nk_gdip_load_image_from_memory(data, m_ctx.size);
-	if (m_ctx.img.w == 0 || m_ctx.img.h == 0)
-		goto fail;
-	m_ctx.path = grub_strdup(path);
-	grub_free(data);
-	grub_file_close(file);
+	m_ctx.job = job;
+}
+
+static void
+img_level_free(struct img_level* level)
+{
+	if (!level->img.handle.ptr)
+		return;
+	nk_gdip_image_free(level->img);
+	free(level->pixels.data);
+	img_cache_bytes -= (size_t)level->pixels.w * level->pixels.h * 4;
+	grub_memset(level, 0, sizeof(struct img_level));
+}
+
+static void
+img_entry_free(struct img_entry* entry)
+{
+	for (int i = 0; i < NKCTX_IMAGE_LEVELS; i++)
+		img_level_free(&entry->levels[i]);
+	grub_free(entry->path);
+	free(entry);
+}
+
+/* Drop the files used longest ago, then the levels of the one shown
+   other than KEEP and the coarsest.  */
+static void
+img_cache_trim(struct img_entry* current, UINT keep)
+{
+	struct img_entry** p = &img_cache;
+	int coarsest = -1;
+
+	while (*p && img_cache_bytes > IMG_CACHE_BUDGET)
+	{
+		struct img_entry* last = *p;
+		struct img_entry** link = p;
+		for (struct img_entry** q = p; *q; q = &(*q)->next)
+		{
+			if (*q != current)
+			{
+				last = *q;
+				link = q;
+			}
+		}
+		if (last == current)
+			break;
+		*link = last->next;
+		img_entry_free(last);
+	}
+	for (int i = NKCTX_IMAGE_LEVELS - 1; i >= 0; i--)
+	{
+		if (current->levels[i].img.handle.ptr)
+		{
+			coarsest = i;
+			break;
+		}
+	}
+	for (int i = 0; i < NKCTX_IMAGE_LEVELS && img_cache_bytes > IMG_CACHE_BUDGET; i++)
+	{
+		if (i != (int)keep && i != coarsest)
+			img_level_free(&current->levels[i]);
+	}
+}
 
-	m_ctx.ratio = (float)m_ctx.img.w / (float)m_ctx.img.h;
-	m_ctx.bounds.w = (float)nk.width * 0.95f - 2 * nk.title_height;
-	m_ctx.bounds.h = (float)nk.height * 0.95f - 2 * nk.title_height;
-	if ((float)m_ctx.img.w <= m_ctx.bounds.w
-		&& (float)m_ctx.img.h <= m_ctx.bounds.h)
+static void
+img_poll(void)
+{
+	struct img_job* job = m_ctx.job;
+	struct img_entry* entry = m_ctx.entry;
+	struct img_level* level;
+
+	if (!job || !InterlockedCompareExchange(&job->done, 0, 0))
+		return;
+	m_ctx.job = NULL;
+	if (!job->ok)
 	{
-		m_ctx.bounds.w = max(m_ctx.img.w, 96) * m_ctx.ratio;
-		m_ctx.bounds.h = max(m_ctx.img.h, 96) * m_ctx.ratio;
+		entry->failed |= job->level < NKCTX_IMAGE_LEVELS ? 1U << job->level : ~0U;
+		grub_strcpy(m_ctx.status, "Can't decode");
+		img_job_unref(job);
+		return;
+	}
+	/* Another level than asked for is kept, but not asked for again.  */
+	if (job->level < NKCTX_IMAGE_LEVELS && job->level != job->pixels.level)
+		entry->failed |= 1U << job->level;
+	entry->full_w = job->pixels.full_w;
+	entry->full_h = job->pixels.full_h;
+	level = &entry->levels[job->pixels.level];
+	img_level_free(level);
+	level->pixels = job->pixels;
+	level->img = nk_gdip_load_image_from_pixels(level->pixels.data, level->pixels.w, level->pixels.h);
+	if (level->img.handle.ptr)
+	{
+		/* The level owns the pixels now.  */
+		job->pixels.data = NULL;
+		img_cache_bytes += (size_t)level->pixels.w * level->pixels.h * 4;
+		img_cache_trim(entry, job->pixels.level);
+		m_ctx.status[0] = '\0';
 	}
 	else
 	{
-		if (m_ctx.ratio > 1.0f)
-			m_ctx.bounds.h = m_ctx.bounds.w / m_ctx.ratio;
-		else
-			m_ctx.bounds.w = m_ctx.bounds.h * m_ctx.ratio;
+		grub_memset(level, 0, sizeof(struct img_level));
+		entry->failed |= 1U << job->pixels.level;
+		grub_strcpy(m_ctx.status, "Out of memory");
+	}
+	img_job_unref(job);
+}
+
+static void
+nkctx_image_init(const char* path)
+{
+	struct img_entry** p;
+	struct img_entry* entry = NULL;
+	grub_off_t size;
+	grub_file_t file;
+
+	nkctx_image_fini();
+	file = grub_file_open(path, GRUB_FILE_TYPE_THEME | GRUB_FILE_TYPE_NO_DECOMPRESS);
+	if (!file)
+	{
+		grub_errno = GRUB_ERR_NONE;
+		MessageBoxW(nk.wnd, GET_WCS(LANG_WCS_CANNOT_OPEN_FILE), GET_WCS(LANG_WCS_ERROR), MB_OK | MB_ICONERROR);
+		return;
+	}
+	size = grub_file_size(file);
+	grub_file_close(file);
+
+	/* A file of another size at the same path is not the one kept.  */
+	for (p = &img_cache; *p; p = &(*p)->next)
+	{
+		if ((*p)->size == size && grub_strcmp((*p)->path, path) == 0)
+		{
+			entry = *p;
+			*p = entry->next;
+			break;
+		}
+	}
+	if (!entry)
+	{
+		entry = calloc(1, sizeof(struct img_entry));
+		if (entry)
+			entry->path = grub_strdup(path);
+		if (!entry || !entry->path)
+		{
+			free(entry);
+			MessageBoxW(nk.wnd, GET_WCS(LANG_WCS_OUT_OF_MEM), GET_WCS(LANG_WCS_ERROR), MB_OK | MB_ICONERROR);
+			return;
+		}
+		entry->size = size;
 	}
-	m_ctx.bounds.w += 2 * nk.title_height;
-	m_ctx.bounds.h += 2 * nk.title_height;
+	entry->failed = 0;
+	entry->next = img_cache;
+	img_cache = entry;
+
+	grub_memset(&m_ctx, 0, sizeof(m_ctx));
+	m_ctx.entry = entry;
+	m_ctx.bounds.w = (float)nk.width * 0.8f;
+	m_ctx.bounds.h = (float)nk.height * 0.8f;
 	m_ctx.bounds.x = ((float)nk.width - m_ctx.bounds.w) / 2.0f;
 	m_ctx.bounds.y = ((float)nk.height - m_ctx.bounds.h) / 2.0f;
+}
 
-	return;
+static void
+nkctx_image_fini(void)
+{
+	if (m_ctx.job)
+	{
+		/* A decoder still running lets go of the job when it is done.  */
+		InterlockedExchange(&m_ctx.job->cancel, 1);
+		img_job_unref(m_ctx.job);
+	}
+	grub_memset(&m_ctx, 0, sizeof(m_ctx));
+}
 
-fail:
-	m_ctx.size = 0;
-	m_ctx.img = nk_image_id(0);
-	if (data)
-		grub_free(data);
-	if (file)
-		grub_file_close(file);
-	return;
+/* Wait for the decoders to leave grub.  */
+void
+nkctx_image_wait(void)
+{
+	if (img_inited)
+		WaitForSingleObject(img_idle, INFINITE);
+}
+
+void
+nkctx_free_image_cache(void)
+{
+	while (img_cache)
+	{
+		struct img_entry* entry = img_cache;
+		img_cache = entry->next;
+		img_entry_free(entry);
+	}
+}
+
+/* The level decoded for SCALE: each level halves the size, the finest one
+   not larger than needed.  */
+static UINT
+img_need_level(float scale)
+{
+	struct img_entry* entry = m_ctx.entry;
+	UINT level = 0, min = 0;
+
+	while ((entry->full_w >> min) > NKCTX_IMAGE_MAX_SIDE || (entry->full_h >> min) > NKCTX_IMAGE_MAX_SIDE)
+		min++;
+	while (level < NKCTX_IMAGE_LEVELS - 1 && scale * (float)(2U << level) <= 1.0f)
+		level++;
+	return level < min ? min : level;
+}
+
+/* The level kept closest to NEED, finer ones first.  */
+static struct img_level*
+img_find_level(UINT need)
+{
+	struct img_level* levels = m_ctx.entry->levels;
+
+	for (int i = need; i >= 0; i--)
+	{
+		if (levels[i].img.handle.ptr)
+			return &levels[i];
+	}
+	for (int i = need + 1; i < NKCTX_IMAGE_LEVELS; i++)
+	{
+		if (levels[i].img.handle.ptr)
+			return &levels[i];
+	}
+	return NULL;
 }
 
 static void
-nkctx_image_fini(void)
+img_clamp_center(void)
 {
-	nk_gdip_image_free(m_ctx.img);
-	m_ctx.img = nk_image_id(0);
-	grub_free(m_ctx.path);
-	m_ctx.path = NULL;
-	m_ctx.size = 0;
+	m_ctx.cx = max(0.0f, min(m_ctx.cx, (float)m_ctx.entry->full_w));
+	m_ctx.cy = max(0.0f, min(m_ctx.cy, (float)m_ctx.entry->full_h));
 }
 
+/* Zoom by STEPS around the point AT of the view.  */
 static void
-draw_image(struct nk_context* ctx, struct nk_image img, struct nk_color col)
+img_zoom(float fit, float scale, struct nk_rect area, struct nk_vec2 at, float steps)
 {
-	struct nk_window* win = ctx->current;
-	struct nk_rect bounds;
-	struct nk_rect image;
-	if (!nk_widget(&bounds, ctx))
+	float zoom = scale * powf(IMG_ZOOM_STEP, steps);
+	float dx = at.x - (area.x + area.w / 2.0f);
+	float dy = at.y - (area.y + area.h / 2.0f);
+
+	if (zoom > IMG_ZOOM_MAX)
+		zoom = IMG_ZOOM_MAX;
+	if (zoom <= fit)
+	{
+		m_ctx.zoom = 0.0f;
 		return;
-	if (m_ctx.ratio > 1.0f)
+	}
+	/* Keep the image point under AT there.  */
+	if (m_ctx.zoom == 0.0f)
 	{
-		image.w = bounds.w;
-		image.h = bounds.w / m_ctx.ratio;
-		image.x = bounds.x;
-		image.y = bounds.y + (bounds.h - image.h) / 2.0f;
+		m_ctx.cx = (float)m_ctx.entry->full_w / 2.0f;
+		m_ctx.cy = (float)m_ctx.entry->full_h / 2.0f;
+	}
+	m_ctx.cx += dx / scale - dx / zoom;
+	m_ctx.cy += dy / scale - dy / zoom;
+	m_ctx.zoom = zoom;
+	img_clamp_center();
+}
+
+/* Draw the part of LEVEL inside AREA only, the whole image at a large
+   zoom does not fit the coordinates of a draw command.  */
+static void
+draw_image(struct nk_context* ctx, struct nk_rect area, struct img_level* level, float scale)
+{
+	struct img_entry* entry = m_ctx.entry;
+	struct nk_rect image, vis;
+	struct nk_image sub;
+	float ratio = (float)level->pixels.w / (float)entry->full_w;
+	float sx, sy, sw, sh;
+
+	image.w = (float)entry->full_w * scale;
+	image.h = (float)entry->full_h * scale;
+	if (m_ctx.zoom == 0.0f)
+	{
+		image.x = area.x + (area.w - image.w) / 2.0f;
+		image.y = area.y + (area.h - image.h) / 2.0f;
 	}
 	else
 	{
-		image.w = bounds.h * m_ctx.ratio;
-		image.h = bounds.h;
-		image.x = bounds.x + (bounds.w - image.w) / 2.0f;
-		image.y = bounds.y;
+		image.x = area.x + area.w / 2.0f - m_ctx.cx * scale;
+		image.y = area.y + area.h / 2.0f - m_ctx.cy * scale;
 	}
-	nk_draw_image(&win->buffer, image, &img, col);
+	vis.x = max(area.x, image.x);
+	vis.y = max(area.y, image.y);
+	vis.w = min(area.x + area.w, image.x + image.w) - vis.x;
+	vis.h = min(area.y + area.h, image.y + image.h) - vis.y;
+	if (vis.w < 1.0f || vis.h < 1.0f)
+		return;
+
+	sx = (vis.x - image.x) / scale * ratio;
+	sy = (vis.y - image.y) / scale * ratio;
+	sw = max(1.0f, vis.w / scale * ratio);
+	sh = max(1.0f, vis.h / scale * ratio);
+	sub = nk_subimage_handle(level->img.handle, (nk_ushort)level->pixels.w, (nk_ushort)level->pixels.h,
+		nk_rect(sx, sy, min(sw, (float)level->pixels.w - sx), min(sh, (float)level->pixels.h - sy)));
+	if (!sub.region[2] || !sub.region[3])
+		return;
+	nk_draw_image(&ctx->current->buffer, vis, &sub, nk_rgb(255, 255, 255));
 }
 
 static void
 nkctx_image_window(struct nk_context* ctx, float width, float height)
 {
-	if (m_ctx.img.w == 0 || m_ctx.img.h == 0)
+	struct img_entry* entry = m_ctx.entry;
+	struct img_level* level = NULL;
+	struct nk_rect area;
+	const struct nk_input* in = &ctx->input;
+	float fit, scale;
+	UINT need;
+
+	if (!entry)
 		return;
 
 	if (!nk_begin(ctx, "Image Viewer", m_ctx.bounds,
-		NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_CLOSABLE))
+		NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_CLOSABLE | NK_WINDOW_NO_SCROLLBAR))
 	{
 		nkctx_image_fini();
 		goto out;
 	}
+	m_ctx.bounds = nk_window_get_bounds(ctx);
+	img_poll();
 
-	nk_layout_row_dynamic(ctx, m_ctx.bounds.h - 2 * nk.title_height, 1);
+	nk_layout_row_begin(ctx, NK_DYNAMIC, 0, 3);
+	nk_layout_row_push(ctx, 0.15f);
+	if (nk_button_label(ctx, "Fit"))
+		m_ctx.zoom = 0.0f;
+	nk_layout_row_push(ctx, 0.15f);
+	if (nk_button_label(ctx, "1:1") && entry->full_w)
+	{
+		if (m_ctx.zoom == 0.0f)
+		{
+			m_ctx.cx = (float)entry->full_w / 2.0f;
+			m_ctx.cy = (float)entry->full_h / 2.0f;
+		}
+		m_ctx.zoom = 1.0f;
+	}
+	nk_layout_row_push(ctx, 0.70f);
+	if (entry->full_w)
+		nk_labelf(ctx, NK_TEXT_LEFT, "%ux%u %.0f%% %s", entry->full_w, entry->full_h,
+			m_ctx.scale * 100.0f, m_ctx.status);
+	else
+		nk_label(ctx, m_ctx.status, NK_TEXT_LEFT);
+	nk_layout_row_end(ctx);
 
-	draw_image(ctx, m_ctx.img, nk_rgb(255, 255, 255));
+	nk_layout_row_dynamic(ctx, max(1.0f, m_ctx.bounds.h - 3 * nk.title_height), 1);
+	if (!nk_widget(&area, ctx))
+		goto out;
+
+	if (!entry->full_w)
+	{
+		/* The size is not known before the first decode, ask for the view.  */
+		if (!m_ctx.job && !entry->failed)
+			img_decode((UINT)area.w, (UINT)area.h, NKCTX_IMAGE_LEVELS);
+		nk_draw_text(&ctx->current->buffer, area, entry->failed ? "Can't decode" : "Loading ...",
+			entry->failed ? 12 : 11, ctx->style.font, nk.table[NK_COLOR_WINDOW], nk.table[NK_COLOR_TEXT]);
+		goto out;
+	}
+
+	fit = min(area.w / (float)entry->full_w, area.h / (float)entry->full_h);
+	scale = m_ctx.zoom == 0.0f ? fit : m_ctx.zoom;
+
+	if (nk_input_is_mouse_hovering_rect(in, area))
+	{
+		if (in->mouse.scroll_delta.y != 0.0f)
+		{
+			img_zoom(fit, scale, area, in->mouse.pos, in->mouse.scroll_delta.y);
+			scale = m_ctx.zoom == 0.0f ? fit : m_ctx.zoom;
+		}
+		else if (m_ctx.zoom != 0.0f && nk_input_is_mouse_down(in, NK_BUTTON_LEFT)
+			&& nk_input_has_mouse_click_down_in_rect(in, NK_BUTTON_LEFT, area, nk_true))
+		{
+			m_ctx.cx -= in->mouse.delta.x / scale;
+			m_ctx.cy -= in->mouse.delta.y / scale;
+			img_clamp_center();
+		}
+	}
+
+	/* Draw what is kept while a finer level is decoded.  */
+	need = img_need_level(scale);
+	m_ctx.scale = scale;
+	level = img_find_level(need);
+	if (!m_ctx.job && !(entry->failed & (1U << need))
+		&& (!level || level->pixels.level > need))
+	{
+		img_decode(max(1, entry->full_w >> need), max(1, entry->full_h >> need), need);
+	}
+	if (m_ctx.job && !level)
+		nk_draw_text(&ctx->current->buffer, area, "Loading ...", 11,
+			ctx->style.font, nk.table[NK_COLOR_WINDOW], nk.table[NK_COLOR_TEXT]);
+	if (level)
+		draw_image(ctx, area, level, scale);
 
 out:
 	nk_end(ctx);
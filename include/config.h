@@ -1,9 +1,11 @@
 #pragma once
 
+#if defined(_MSC_VER)
 #pragma warning(disable: 4146)	// "unary minus operator applied to unsigned type, result still unsigned"
 #pragma warning(disable: 4244)	// "Conversion from X to Y, possible loss of data"
 #pragma warning(disable: 4267)	// "Conversion from X to Y, possible loss of data"
 #pragma warning(disable: 4334)	// "Result of 32-bit shift implicitly converted to 64 bits"
+#endif
 
 #if defined(_M_X64) || defined(__x86_64__)
 #define GRUB_TARGET_CPU "x86_64"
@@ -34,8 +36,17 @@
 #define N_(x) x
 #define _(x) x
 
+#if defined(_MSC_VER)
 #define __attribute__(x)
 #define __attribute(x)
+#define GRUB_THREAD_LOCAL __declspec(thread)
+#else
+// SAL annotations and __pragma used by the headers
+#define _Printf_format_string_
+#define _Check_return_
+#define __pragma(x) _Pragma(#x)
+#define GRUB_THREAD_LOCAL _Thread_local
+#endif
 
 #define GRUB_MOD_LICENSE(x)
 
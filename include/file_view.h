@@ -0,0 +1,92 @@
+/*
+ *  NkArc
+ *  Copyright (C) 2023 A1ive
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <nkctx.h>
+
+#include <grub/types.h>
+#include <grub/file.h>
+
+/* A file shown by a viewer, read in aligned windows on the thread pool.
+   The viewer embeds it first in its own view, which is shared with the
+   workers: each holds a reference while it runs.  */
+
+enum
+{
+	FILE_VIEW_EMPTY,
+	FILE_VIEW_LOADING,
+	FILE_VIEW_READY,
+	FILE_VIEW_FAILED,
+};
+
+/* Written only by its loader while it is FILE_VIEW_LOADING.  */
+struct file_view_window
+{
+	volatile LONG state;
+	grub_off_t offset;
+	grub_size_t size;
+	ULONGLONG used;
+	grub_uint8_t* data;
+};
+
+struct file_view
+{
+	volatile LONG refs;
+	volatile LONG cancel;
+	char* path;
+	enum grub_file_type type;
+	grub_off_t size;
+	grub_size_t window_size;
+	unsigned window_count;
+	/* The members below are used by the UI thread only.  */
+	ULONGLONG clock;
+	struct file_view_window* windows;
+	/* Frees the view holding this one, after the windows went.  */
+	void (*release)(struct file_view* view);
+};
+
+/* Returns FALSE if out of memory, nothing is kept then.  */
+BOOL
+file_view_init(struct file_view* view, const char* path, enum grub_file_type type,
+	grub_size_t window_size, unsigned window_count, void (*release)(struct file_view* view));
+
+void
+file_view_unref(struct file_view* view);
+
+/* Cancel the workers and drop the reference of the viewer.  */
+void
+file_view_close(struct file_view* view);
+
+/* Run FUNC (JOB) on the thread pool with a reference to VIEW.  If it
+   can't be started, FALSE is returned and JOB is left to the caller.  */
+BOOL
+file_view_submit(struct file_view* view, PTP_SIMPLE_CALLBACK func, void* job);
+
+/* Called by a worker of VIEW as it leaves, after freeing its job.  */
+void
+file_view_job_done(struct file_view* view);
+
+/* The window holding OFFSET if it is read, else it is queued and NULL
+   returned.  */
+struct file_view_window*
+file_view_get_window(struct file_view* view, grub_off_t offset);
+
+/* Read ahead the window holding OFFSET, if it is in the file.  */
+void
+file_view_prefetch(struct file_view* view, grub_off_t offset);
@@ -0,0 +1,57 @@
+/* cpuid.h - instruction set extensions of the running processor */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_CPUID_HEADER
+#define GRUB_CPUID_HEADER	1
+
+#include <grub/types.h>
+#include <grub/symbol.h>
+
+/* GRUB_CPU_X86 is set where the x86 intrinsics can be used.  Functions
+   that use them are marked GRUB_CPU_TARGET ("...") with the extensions
+   they need, and may only be called once grub_cpu_features () says the
+   processor has them.  */
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define GRUB_CPU_X86	1
+#define GRUB_CPU_TARGET(x)
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define GRUB_CPU_X86	1
+#define GRUB_CPU_TARGET(x)	__attribute__((target(x)))
+#endif
+
+#define GRUB_CPU_SSSE3	(1 << 0)
+#define GRUB_CPU_SSE41	(1 << 1)
+#define GRUB_CPU_SSE42	(1 << 2)
+#define GRUB_CPU_PCLMUL	(1 << 3)
+/* Set only if the OS saves the YMM registers as well.  */
+#define GRUB_CPU_AVX2	(1 << 4)
+#define GRUB_CPU_SHA	(1 << 5)
+
+/* GRUB_CPU_* flags of the processor, 0 on other architectures.  */
+grub_uint32_t EXPORT_FUNC(grub_cpu_features) (void);
+
+static inline int
+grub_cpu_has(grub_uint32_t features)
+{
+	return (grub_cpu_features() & features) == features;
+}
+
+#endif /* ! GRUB_CPUID_HEADER */
@@ -82,6 +82,8 @@ enum gcry_cipher_modes
 #define GRUB_CRYPTO_MAX_MDLEN 64
 #define GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE 16
 #define GRUB_CRYPTO_MAX_MD_CONTEXT_SIZE 256
+/* Messages a gcry_md_spec_t hash_multi takes at once.  */
+#define GRUB_CRYPTO_MULTI_MAX 8
 
 /* Type for the cipher_setkey function.  */
 typedef gcry_err_code_t(*gcry_cipher_setkey_t) (void* c,
@@ -167,6 +169,10 @@ typedef struct gcry_md_spec
 	grub_size_t contextsize; /* allocate this amount of context */
 	/* Block size, needed for HMAC.  */
 	grub_size_t blocksize;
+	/* Hash COUNT <= GRUB_CRYPTO_MULTI_MAX whole messages side by side,
+	   IN[i] of INLEN[i] bytes into OUT[i].  Optional.  */
+	void (*hash_multi) (void* const out[], const void* const in[],
+		const grub_size_t inlen[], unsigned count);
 #ifdef GRUB_UTIL
 	const char* modname;
 #endif
@@ -294,6 +300,12 @@ grub_crypto_xor(void* out, const void* in1, const void* in2, grub_size_t size)
 void
 grub_crypto_hash(const gcry_md_spec_t* hash, void* out, const void* in, grub_size_t inlen);
 
+/* grub_crypto_hash for COUNT messages, faster for many small ones of
+   about the same size.  */
+void
+grub_crypto_hash_multi(const gcry_md_spec_t* hash, void* const out[],
+	const void* const in[], const grub_size_t inlen[], grub_size_t count);
+
 const gcry_md_spec_t*
 grub_crypto_lookup_md_by_name(const char* name);
 
@@ -328,7 +340,7 @@ void _gcry_burn_stack(int bytes);
 #define wipememory2(_ptr,_set,_len) \
 	do { \
 		volatile char *_vptr=(volatile char *)(_ptr); \
-		size_t _vlen=(_len); \
+		grub_size_t _vlen=(_len); \
 		while(_vlen) { *_vptr=(_set); _vptr++; _vlen--; } \
 	} while(0)
 #define wipememory(_ptr,_len) wipememory2(_ptr,0,_len)
@@ -39,6 +39,8 @@ enum grub_disk_dev_id
 	GRUB_DISK_DEVICE_CRYPTODISK_ID,
 	GRUB_DISK_DEVICE_PROCFS_ID,
 	GRUB_DISK_DEVICE_UEFI_ID,
+	GRUB_DISK_DEVICE_HOSTDISK_ID,
+	GRUB_DISK_DEVICE_HOST_ID,
 };
 
 struct grub_disk;
@@ -142,6 +144,9 @@ typedef struct grub_disk* grub_disk_t;
  /* The maximum number of disk caches.  */
 #define GRUB_DISK_CACHE_NUM	1021
 
+ /* The number of locks guarding the disk cache.  */
+#define GRUB_DISK_CACHE_SHARDS	16
+
 /*
  * The maximum number of disks in an mdraid device.
  *
@@ -228,6 +233,11 @@ grub_err_t EXPORT_FUNC(grub_disk_read) (grub_disk_t disk,
 	grub_off_t offset,
 	grub_size_t size,
 	void* buf);
+grub_err_t EXPORT_FUNC(grub_disk_read_nocache) (grub_disk_t disk,
+	grub_disk_addr_t sector,
+	grub_off_t offset,
+	grub_size_t size,
+	void* buf);
 grub_err_t grub_disk_write(grub_disk_t disk,
 	grub_disk_addr_t sector,
 	grub_off_t offset,
@@ -243,7 +253,6 @@ struct grub_disk_cache
 	unsigned long disk_id;
 	grub_disk_addr_t sector;
 	char* data;
-	int lock;
 };
 
 extern struct grub_disk_cache EXPORT_VAR(grub_disk_cache_table)[GRUB_DISK_CACHE_NUM];
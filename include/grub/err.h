@@ -20,7 +20,9 @@
 #ifndef GRUB_ERR_HEADER
 #define GRUB_ERR_HEADER	1
 
+#ifdef _MSC_VER
 #include <sal.h>
+#endif
 #include <grub/symbol.h>
 
 #define GRUB_MAX_ERRMSG		256
@@ -73,7 +75,8 @@ typedef enum
 	GRUB_ERR_NET_NO_DOMAIN,
 	GRUB_ERR_EOF,
 	GRUB_ERR_BAD_SIGNATURE,
-	GRUB_ERR_BAD_FIRMWARE
+	GRUB_ERR_BAD_FIRMWARE,
+	GRUB_ERR_CANCELLED
 }
 grub_err_t;
 
@@ -83,8 +86,9 @@ struct grub_error_saved
   char errmsg[GRUB_MAX_ERRMSG];
 };
 
-extern grub_err_t EXPORT_VAR(grub_errno);
-extern char EXPORT_VAR(grub_errmsg)[GRUB_MAX_ERRMSG];
+/* Each thread has its own error state, see <grub/thread.h>.  */
+extern GRUB_THREAD_LOCAL grub_err_t EXPORT_VAR(grub_errno);
+extern GRUB_THREAD_LOCAL char EXPORT_VAR(grub_errmsg)[GRUB_MAX_ERRMSG];
 
 grub_err_t EXPORT_FUNC(grub_error) (grub_err_t n, _Printf_format_string_ const char *fmt, ...);
 _Noreturn
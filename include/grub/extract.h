@@ -0,0 +1,119 @@
+/* extract.h - copy files and directory trees to the host */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_EXTRACT_HEADER
+#define GRUB_EXTRACT_HEADER	1
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/symbol.h>
+
+/*
+ * One walker thread lists the source trees into a queue of files, creating
+ * the target directories as it goes.  Reader threads open the queued files
+ * and fill buffers from a fixed pool, writer threads write the buffers to
+ * the host.  Memory stays at BUFFERS * BUFFER_SIZE however large the
+ * files are, and a slow filter only holds up the readers.
+ *
+ * Symlinks are skipped.  Files and directories get the mtime of their
+ * source.  Files that failed or were cut off by a cancel are removed.
+ *
+ * Holes the filesystem or filter reports are not read, the output file
+ * gets a hole there as well.
+ *
+ * With a store, every file is also kept once by its SHA-256 in the store
+ * directory and later copies of the same data become links to it, so
+ * extracting many similar images writes each unique file once.  Files
+ * whose size and first block the store has never seen are written while
+ * they are hashed.  The others are hashed first and only written if no
+ * stored copy matches.  Links are reflinks where the host filesystem can
+ * share extents, otherwise hardlinks that share the mtime of the first
+ * copy and must not be modified in place.  The store has to be on the
+ * same volume as the destination.
+ */
+
+struct grub_extract_item
+{
+	/* "(dev)/path" of a file or directory.  */
+	const char* src;
+	/* Host path it is copied to, UTF-8.  */
+	const char* dest;
+};
+
+struct grub_extract_stats
+{
+	/* Files found by the walk so far, WALK_DONE is set once it is
+	   complete.  */
+	grub_uint64_t total_files;
+	int walk_done;
+	/* Files written completely, directories created, bytes written.  */
+	grub_uint64_t files;
+	grub_uint64_t dirs;
+	grub_uint64_t bytes;
+	/* Bytes left as holes instead of written.  */
+	grub_uint64_t holes;
+	grub_uint64_t skipped;
+	grub_uint64_t errors;
+	/* Files linked to the store instead of written, and their size.  */
+	grub_uint64_t linked;
+	grub_uint64_t linked_bytes;
+	grub_uint64_t elapsed_us;
+	int cancelled;
+};
+
+/* Called on the thread that runs grub_extract () at every progress
+   interval, return nonzero to cancel.  */
+typedef int (*grub_extract_progress_t) (const struct grub_extract_stats* stats, void* data);
+
+/* Called for every failed file or directory, on the worker thread that
+   hit it.  Calls are serialized.  */
+typedef void (*grub_extract_error_t) (const char* path, const char* msg, void* data);
+
+/* Also leave holes where a block that was read is all zeros.  */
+#define GRUB_EXTRACT_ZEROS	(1 << 0)
+/* Copy virtual disks and compressed files as the disk or data they hold.  */
+#define GRUB_EXTRACT_EXPAND	(1 << 1)
+
+struct grub_extract_options
+{
+	/* Zero picks the default for any of these.  */
+	unsigned readers;
+	unsigned writers;
+	unsigned buffers;
+	grub_size_t buffer_size;
+	unsigned interval_ms;
+	/* GRUB_EXTRACT_* flags.  */
+	unsigned flags;
+	/* Host directory of the content store, NULL to copy every file.  */
+	const char* store;
+
+	grub_extract_progress_t progress;
+	grub_extract_error_t error;
+	void* data;
+};
+
+/* Copy COUNT items and wait until they are done.  STATS receives the final
+   counters.  Fails if anything failed or the copy was cancelled.  The
+   grub_file_progress of the calling thread, if any, gets the bytes and
+   files written and cancels the copy as well.  */
+grub_err_t
+EXPORT_FUNC(grub_extract) (const struct grub_extract_item* items, grub_size_t count,
+	const struct grub_extract_options* options, struct grub_extract_stats* stats);
+
+#endif /* ! GRUB_EXTRACT_HEADER */
@@ -155,11 +155,6 @@ struct grub_file
 	grub_off_t offset;
 	grub_off_t progress_offset;
 
-	/* Progress info. */
-	grub_uint64_t last_progress_time;
-	grub_off_t last_progress_offset;
-	grub_uint64_t estimated_speed;
-
 	/* The file size.  */
 	grub_off_t size;
 
@@ -179,6 +174,22 @@ typedef struct grub_file* grub_file_t;
 
 extern grub_disk_read_hook_t EXPORT_VAR(grub_file_progress_hook);
 
+/* Progress of a long operation and the way to cancel it.  The thread that
+   runs the operation points grub_file_progress at it, reads on that thread
+   then fail with GRUB_ERR_CANCELLED between blocks once CANCEL is set by
+   any thread.  The counters are kept by the operation, a total is zero
+   while it is not known.  */
+struct grub_progress
+{
+	volatile grub_uint64_t bytes;
+	volatile grub_uint64_t total_bytes;
+	volatile grub_uint64_t items;
+	volatile grub_uint64_t total_items;
+	volatile int cancel;
+};
+
+extern GRUB_THREAD_LOCAL struct grub_progress* EXPORT_VAR(grub_file_progress);
+
 /* Filters with lower ID are executed first.  */
 typedef enum grub_file_filter_id
 {
@@ -224,6 +235,10 @@ grub_file_t EXPORT_FUNC(grub_file_open) (const char* name, enum grub_file_type t
 grub_ssize_t EXPORT_FUNC(grub_file_read) (grub_file_t file, void* buf,
 	grub_size_t len);
 grub_off_t EXPORT_FUNC(grub_file_seek) (grub_file_t file, grub_off_t offset);
+grub_err_t EXPORT_FUNC(grub_file_map) (grub_file_t file, grub_off_t offset,
+	grub_off_t* pos, grub_size_t* len);
+grub_err_t EXPORT_FUNC(grub_file_hole) (grub_file_t file, grub_off_t offset,
+	grub_size_t* len, int* hole);
 grub_err_t EXPORT_FUNC(grub_file_close) (grub_file_t file);
 
 /* Return value of grub_file_size() in case file size is unknown. */
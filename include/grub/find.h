@@ -0,0 +1,106 @@
+/* find.h - search a directory tree by name, size and time */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_FIND_HEADER
+#define GRUB_FIND_HEADER	1
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/symbol.h>
+
+/*
+ * The tree is walked breadth first by up to GRUB_FIND_MAX_THREADS threads,
+ * each with its own handle on the disk.  Every name seen is kept in an
+ * index of the tree, the last GRUB_FIND_MAX_INDEX complete indexes are
+ * kept so that searching the same tree, or a directory inside it, again
+ * needs no walk.  An index is bound to the identity of its disk, a
+ * loopback device mounted again is walked again.
+ */
+#define GRUB_FIND_MAX_THREADS	8
+#define GRUB_FIND_MAX_INDEX	4
+
+/* PATTERN is an extended regular expression matched anywhere in the name,
+   not a glob matched against the whole name.  */
+#define GRUB_FIND_REGEX		(1 << 0)
+#define GRUB_FIND_NOCASE	(1 << 1)
+#define GRUB_FIND_FILES		(1 << 2)
+#define GRUB_FIND_DIRS		(1 << 3)
+/* Use MIN_SIZE and MAX_SIZE, files are opened to get their size.  */
+#define GRUB_FIND_SIZE		(1 << 4)
+/* Use MIN_MTIME and MAX_MTIME, entries without a time are left out.  */
+#define GRUB_FIND_MTIME		(1 << 5)
+/* Report the size of every file found, opening it if needed.  */
+#define GRUB_FIND_STAT		(1 << 6)
+/* Walk the tree even if an index of it is kept.  */
+#define GRUB_FIND_REBUILD	(1 << 7)
+
+struct grub_find_options
+{
+	/* A glob with *, ? and [...], or a regular expression with
+	   GRUB_FIND_REGEX.  NULL matches every name.  */
+	const char* pattern;
+	unsigned flags;
+	grub_uint64_t min_size;
+	grub_uint64_t max_size;
+	grub_int64_t min_mtime;
+	grub_int64_t max_mtime;
+	/* Walker threads, 0 for one per processor.  */
+	unsigned threads;
+	/* Polled by the walkers, nonzero stops the search.  May be NULL.  */
+	const volatile int* cancel;
+};
+
+struct grub_find_entry
+{
+	/* "(dev)/dir/name", directories end with '/'.  */
+	const char* path;
+	const char* name;
+	int dir;
+	int sizeset;
+	grub_uint64_t size;
+	int mtimeset;
+	grub_int64_t mtime;
+};
+
+struct grub_find_stats
+{
+	grub_uint64_t dirs;
+	grub_uint64_t entries;
+	grub_uint64_t matches;
+	/* The search was answered by a kept index.  */
+	int indexed;
+};
+
+/* Called on the thread of grub_find for each match, in the order they are
+   found.  Return nonzero to stop.  */
+typedef int (*grub_find_hook_t) (const struct grub_find_entry* entry, void* data);
+
+/* Search the directory PATH, "(dev)/dir", and everything under it.  STATS
+   may be NULL.  Only a bad pattern or PATH itself failing fails the
+   call, directories that can't be read are skipped.  */
+grub_err_t
+EXPORT_FUNC(grub_find) (const char* path, const struct grub_find_options* options,
+	grub_find_hook_t hook, void* data, struct grub_find_stats* stats);
+
+/* Drop the indexes of the device DISK and of its partitions, or all of them
+   if DISK is NULL.  */
+void
+EXPORT_FUNC(grub_find_flush) (const char* disk);
+
+#endif /* ! GRUB_FIND_HEADER */
@@ -43,6 +43,18 @@ typedef int (*grub_fs_dir_hook_t) (const char* filename,
 	const struct grub_dirhook_info* info,
 	void* data);
 
+/* Magic bytes at a fixed position from the start of the filesystem.  */
+struct grub_fs_signature
+{
+	grub_uint32_t offset;
+	grub_uint32_t len;
+	const char* magic;
+};
+
+/* Size of the area read once by grub_fs_probe to match signatures.  It
+   covers the superblocks up to reiserfs and btrfs at 64 KiB.  */
+#define GRUB_FS_PROBE_SIZE	0x11000
+
 /* Filesystem descriptor.  */
 struct grub_fs
 {
@@ -78,6 +90,29 @@ struct grub_fs
 
 	/* Get writing time of filesystem. */
 	grub_err_t(*fs_mtime) (grub_disk_t disk, grub_int64_t* timebuf);
+
+	/* Map the byte OFFSET of FILE to the byte position *POS on FILE->disk.
+	   On entry *LEN is the wanted length, on return it is the length of the
+	   contiguous extent starting at OFFSET.  Optional, fails if the data is
+	   not stored verbatim (compressed, resident, sparse).  */
+	grub_err_t(*fs_map) (struct grub_file* file, grub_off_t offset,
+		grub_off_t* pos, grub_size_t* len);
+
+	/* Tell whether the byte OFFSET of FILE lies in a hole, a run that is
+	   not stored and reads as zeros.  On entry *LEN is the wanted length,
+	   on return it is the length of the run that is all hole or all data.
+	   Optional, files without it are all data.  */
+	grub_err_t(*fs_hole) (struct grub_file* file, grub_off_t offset,
+		grub_size_t* len, int* hole);
+
+	/* Magic numbers of the filesystem, terminated by an entry with zero
+	   LEN.  If any of them lies inside the probe area, at least one must
+	   match before fs_dir is tried.  Optional.  */
+	const struct grub_fs_signature* fs_signatures;
+
+	/* Cheap check of the first SIZE bytes of DISK in SB.  Return zero if
+	   DISK can't hold this filesystem.  Optional.  */
+	int(*fs_detect) (grub_disk_t disk, const grub_uint8_t* sb, grub_size_t size);
 };
 typedef struct grub_fs* grub_fs_t;
 
@@ -101,5 +136,7 @@ grub_fs_unregister(grub_fs_t fs)
 #define FOR_FILESYSTEMS(var) FOR_LIST_ELEMENTS((var), (grub_fs_list))
 
 grub_fs_t EXPORT_FUNC(grub_fs_probe) (grub_disk_t disk);
+void EXPORT_FUNC(grub_fs_probe_invalidate) (unsigned long dev_id,
+	unsigned long disk_id);
 
 #endif /* ! GRUB_FS_HEADER */
@@ -88,4 +88,25 @@ EXPORT_FUNC(grub_fshelp_read_file) (grub_disk_t disk, grub_fshelp_node_t node,
 	grub_off_t filesize, int log2blocksize,
 	grub_disk_addr_t blocks_start);
 
+/* Map the byte POS of the file NODE to the byte position *DISK_POS on
+   the disk.  *LEN is shortened to the length of the contiguous extent.
+   Sparse blocks are reported as GRUB_ERR_BAD_FS.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_map_file) (grub_fshelp_node_t node,
+	grub_off_t pos, grub_off_t* disk_pos, grub_size_t* len,
+	grub_disk_addr_t(*get_block) (grub_fshelp_node_t node,
+		grub_disk_addr_t block),
+	grub_off_t filesize, int log2blocksize,
+	grub_disk_addr_t blocks_start);
+
+/* Tell whether the byte POS of the file NODE lies in a hole, blocks
+   GET_BLOCK returns as 0.  *LEN is shortened to the run of blocks that are
+   all holes or all data.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_hole) (grub_fshelp_node_t node,
+	grub_off_t pos, grub_size_t* len, int* hole,
+	grub_disk_addr_t(*get_block) (grub_fshelp_node_t node,
+		grub_disk_addr_t block),
+	grub_off_t filesize, int log2blocksize);
+
 #endif /* ! GRUB_FSHELP_HEADER */
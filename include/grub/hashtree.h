@@ -0,0 +1,70 @@
+/* hashtree.h - hash every file of a directory tree */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_HASHTREE_HEADER
+#define GRUB_HASHTREE_HEADER	1
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/symbol.h>
+#include <grub/crypto.h>
+
+/*
+ * The tree is listed breadth first.  Files up to GRUB_HASHTREE_SMALL bytes
+ * are read whole and collected, then hashed several at a time with
+ * grub_crypto_hash_multi, shortest first so that the lanes stay busy.
+ * Larger files are hashed as they are read.  Symlinks are skipped.
+ */
+#define GRUB_HASHTREE_SMALL	(64 * 1024)
+/* Digests computed in one walk.  */
+#define GRUB_HASHTREE_MAX_HASH	4
+
+struct grub_hashtree_entry
+{
+	/* "(dev)/path" of the file.  */
+	const char* path;
+	grub_uint64_t size;
+	int mtimeset;
+	grub_int64_t mtime;
+	int inodeset;
+	grub_uint64_t inode;
+	/* The digests in the order of the hashes, each HASH[i]->mdlen bytes.
+	   NULL if the file or directory PATH could not be read.  */
+	const grub_uint8_t* digest;
+	/* Why it could not be read.  */
+	const char* error;
+};
+
+/* Called for every file, return nonzero to stop.  */
+typedef int (*grub_hashtree_hook_t) (const struct grub_hashtree_entry* entry, void* data);
+
+/* Called once a file is opened, before it is read, with DIGEST and ERROR
+   NULL.  Return zero to leave the file out.  */
+typedef int (*grub_hashtree_filter_t) (const struct grub_hashtree_entry* entry, void* data);
+
+/* Hash the file PATH, or every file under the directory PATH, with the
+   COUNT <= GRUB_HASHTREE_MAX_HASH hashes HASH.  FILTER may be NULL.  Files
+   that fail are passed to HOOK as well, only PATH itself not being found
+   fails the call.  */
+grub_err_t
+EXPORT_FUNC(grub_hash_tree) (const char* path,
+	const gcry_md_spec_t* const hash[], unsigned count,
+	grub_hashtree_filter_t filter, grub_hashtree_hook_t hook, void* data);
+
+#endif /* ! GRUB_HASHTREE_HEADER */
@@ -0,0 +1,38 @@
+/* hostfile.h - whole host files */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_HOSTFILE_HEADER
+#define GRUB_HOSTFILE_HEADER	1
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/symbol.h>
+
+/* The whole host file PATH, UTF-8, in a new buffer of *SIZE bytes plus
+   one.  Fails with GRUB_ERR_FILE_NOT_FOUND if it is missing.  */
+grub_uint8_t*
+EXPORT_FUNC(grub_host_read_file) (const char* path, grub_size_t* size);
+
+/* Write the COUNT parts to PATH.tmp and move it over PATH, so PATH is
+   either the old or the complete new file.  */
+grub_err_t
+EXPORT_FUNC(grub_host_replace_file) (const char* path, const void* const part[],
+	const grub_size_t len[], unsigned count);
+
+#endif /* ! GRUB_HOSTFILE_HEADER */
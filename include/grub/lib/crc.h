@@ -22,6 +22,11 @@
 
 #include <grub/types.h>
 
-grub_uint32_t grub_getcrc32c(grub_uint32_t crc, const void* buf, int size);
+/* Continue the CRC whose final value is CRC over SIZE bytes at BUF, start
+   with 0 (or any seed the format wants).  */
+grub_uint32_t grub_getcrc32(grub_uint32_t crc, const void* buf, grub_size_t size);
+grub_uint32_t grub_getcrc32c(grub_uint32_t crc, const void* buf, grub_size_t size);
+/* CRC-64/XZ, the one used by xz and crc64 in hashsum.  */
+grub_uint64_t grub_getcrc64(grub_uint64_t crc, const void* buf, grub_size_t size);
 
 #endif /* ! GRUB_CRC_H */
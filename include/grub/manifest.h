@@ -0,0 +1,156 @@
+/* manifest.h - persistent per-device file manifest */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_MANIFEST_HEADER
+#define GRUB_MANIFEST_HEADER	1
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/symbol.h>
+
+/*
+ * A manifest lists every file of a device with its size, mtime, inode and
+ * digests, sorted by path.  It is kept in a host file, normally the image
+ * name with GRUB_MANIFEST_EXT appended, and refreshed by hashing only the
+ * files whose size, mtime or inode changed since.
+ */
+#define GRUB_MANIFEST_EXT	".nkm"
+
+/* Digests a manifest may hold, stored in this order.  */
+#define GRUB_MANIFEST_MD5	(1 << 0)
+#define GRUB_MANIFEST_SHA1	(1 << 1)
+#define GRUB_MANIFEST_SHA256	(1 << 2)
+#define GRUB_MANIFEST_ALL	0x7
+
+typedef struct grub_manifest* grub_manifest_t;
+
+struct grub_manifest_entry
+{
+	/* "/dir/file" on the device.  */
+	const char* path;
+	grub_uint64_t size;
+	int mtimeset;
+	grub_int64_t mtime;
+	int inodeset;
+	grub_uint64_t inode;
+};
+
+struct grub_manifest_stats
+{
+	grub_uint64_t files;
+	/* Files hashed, the others were taken from the old manifest.  */
+	grub_uint64_t hashed;
+	grub_uint64_t bytes_hashed;
+	grub_uint64_t removed;
+	grub_uint64_t errors;
+};
+
+enum grub_manifest_change
+{
+	GRUB_MANIFEST_ADDED,
+	GRUB_MANIFEST_REMOVED,
+	GRUB_MANIFEST_MODIFIED,
+};
+
+/* Called for each group of COUNT > 1 files with the same size and
+   digests, INDEX are entries of the manifest.  Return nonzero to stop.  */
+typedef int (*grub_manifest_dup_hook_t) (grub_manifest_t manifest,
+	const grub_size_t* index, grub_size_t count, void* data);
+
+/* Called for each path that differs, A_INDEX or B_INDEX is -1 for files
+   only in the other manifest.  Return nonzero to stop.  */
+typedef int (*grub_manifest_diff_hook_t) (enum grub_manifest_change change,
+	grub_ssize_t a_index, grub_ssize_t b_index, void* data);
+
+/* Called for files that could not be hashed.  */
+typedef void (*grub_manifest_error_hook_t) (const char* path, const char* msg, void* data);
+
+/* An empty manifest with the digests ALGOS.  */
+grub_manifest_t
+EXPORT_FUNC(grub_manifest_new) (grub_uint32_t algos);
+
+/* Read the host file PATH, or the grub file PATH if it starts with '('.
+   Fails with GRUB_ERR_FILE_NOT_FOUND if it is missing and
+   GRUB_ERR_BAD_FILE_TYPE if it is damaged.  */
+grub_manifest_t
+EXPORT_FUNC(grub_manifest_load) (const char* path);
+
+/* Write to the host file PATH, the old file is replaced only once the new
+   one is complete.  */
+grub_err_t
+EXPORT_FUNC(grub_manifest_save) (grub_manifest_t manifest, const char* path);
+
+void
+EXPORT_FUNC(grub_manifest_free) (grub_manifest_t manifest);
+
+/* Identity of the image the manifest describes, so that it can be trusted
+   without looking at the files while the image is unchanged.  */
+void
+EXPORT_FUNC(grub_manifest_set_source) (grub_manifest_t manifest,
+	grub_uint64_t size, grub_int64_t mtime);
+
+int
+EXPORT_FUNC(grub_manifest_same_source) (grub_manifest_t manifest,
+	grub_uint64_t size, grub_int64_t mtime);
+
+/* Walk every file of the device DISK and replace the entries of MANIFEST
+   with the files found.  Files whose size, mtime and inode match their old
+   entry keep its digests, the others are hashed with the digests ALGOS.
+   STATS and ERROR may be NULL.  */
+grub_err_t
+EXPORT_FUNC(grub_manifest_update) (grub_manifest_t manifest, const char* disk,
+	grub_uint32_t algos, struct grub_manifest_stats* stats,
+	grub_manifest_error_hook_t error, void* data);
+
+grub_uint32_t
+EXPORT_FUNC(grub_manifest_algos) (grub_manifest_t manifest);
+
+grub_size_t
+EXPORT_FUNC(grub_manifest_count) (grub_manifest_t manifest);
+
+/* Entry INDEX, valid until MANIFEST changes.  */
+void
+EXPORT_FUNC(grub_manifest_get) (grub_manifest_t manifest, grub_size_t index,
+	struct grub_manifest_entry* entry);
+
+/* The digest ALGO, a single GRUB_MANIFEST_* bit, of entry INDEX or NULL if
+   the manifest has no such digest.  */
+const grub_uint8_t*
+EXPORT_FUNC(grub_manifest_digest) (grub_manifest_t manifest, grub_size_t index,
+	grub_uint32_t algo);
+
+/* Index of the file PATH, "/dir/file", or -1.  */
+grub_ssize_t
+EXPORT_FUNC(grub_manifest_find) (grub_manifest_t manifest, const char* path);
+
+/* The GRUB_MANIFEST_* bit of the hash NAME, or 0.  */
+grub_uint32_t
+EXPORT_FUNC(grub_manifest_algo_by_name) (const char* name);
+
+void
+EXPORT_FUNC(grub_manifest_duplicates) (grub_manifest_t manifest,
+	grub_manifest_dup_hook_t hook, void* data);
+
+/* Files are compared with the digests both manifests have, or with their
+   size and mtime if they have none in common.  */
+void
+EXPORT_FUNC(grub_manifest_diff) (grub_manifest_t a, grub_manifest_t b,
+	grub_manifest_diff_hook_t hook, void* data);
+
+#endif /* ! GRUB_MANIFEST_HEADER */
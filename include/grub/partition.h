@@ -80,6 +80,12 @@ int EXPORT_FUNC(grub_partition_iterate) (struct grub_disk* disk,
 	grub_partition_iterate_hook_t hook,
 	void* hook_data);
 char* EXPORT_FUNC(grub_partition_get_name) (const grub_partition_t partition);
+/* Drop the cached partition tables of a removed disk.  */
+void EXPORT_FUNC(grub_partition_cache_invalidate) (unsigned long dev_id,
+	unsigned long disk_id);
+/* Drop all cached partition tables.  Physical disks keep their id when
+   they are repartitioned or swapped, so this is done on refresh.  */
+void EXPORT_FUNC(grub_partition_cache_flush) (void);
 
 extern grub_partition_map_t EXPORT_VAR(grub_partition_map_list);
 
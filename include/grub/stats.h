@@ -0,0 +1,66 @@
+/* stats.h - I/O counters exported through procfs */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_STATS_HEADER
+#define GRUB_STATS_HEADER	1
+
+#include <grub/types.h>
+#include <grub/symbol.h>
+#include <grub/err.h>
+#include <grub/time.h>
+
+struct grub_disk;
+struct grub_fs;
+
+enum grub_stats_cache_event
+{
+	GRUB_STATS_CACHE_HIT,
+	GRUB_STATS_CACHE_MISS,
+	GRUB_STATS_CACHE_EVICT,
+	GRUB_STATS_CACHE_EVENTS
+};
+
+/* Filesystem and filter operations.  Times include the layers below, so a
+   filter read also counts the reads of the file it wraps.  */
+enum grub_stats_fs_op
+{
+	GRUB_STATS_FS_MOUNT,	/* grub_fs_probe detecting this filesystem.  */
+	GRUB_STATS_FS_OPEN,	/* Path lookup, or header parsing of a filter.  */
+	GRUB_STATS_FS_READ,
+	GRUB_STATS_FS_OPS
+};
+
+#define grub_stats_start() grub_get_time_us()
+
+/* A grub_disk_read call of SIZE bytes.  */
+void EXPORT_FUNC(grub_stats_disk_request) (struct grub_disk* disk, grub_size_t size);
+/* A read from the device driver started at START.  */
+void EXPORT_FUNC(grub_stats_disk_read) (struct grub_disk* disk,
+	grub_disk_addr_t sector, grub_size_t size, grub_uint64_t start, grub_err_t err);
+/* Free the counters of a removed disk for reuse.  */
+void EXPORT_FUNC(grub_stats_disk_remove) (unsigned long dev_id,
+	unsigned long disk_id);
+void EXPORT_FUNC(grub_stats_cache) (enum grub_stats_cache_event event);
+void EXPORT_FUNC(grub_stats_fs) (const struct grub_fs* fs, enum grub_stats_fs_op op,
+	grub_uint64_t bytes, grub_uint64_t start);
+
+/* Keep the last ENTRIES device reads in (proc)/trace, 0 turns it off.  */
+grub_err_t EXPORT_FUNC(grub_stats_trace) (unsigned entries);
+
+#endif /* ! GRUB_STATS_HEADER */
@@ -0,0 +1,95 @@
+/* thread.h - locking primitives for the shared grub core */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2023  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_THREAD_HEADER
+#define GRUB_THREAD_HEADER	1
+
+/*
+ * Threading contract.
+ *
+ * - Modules are registered and unregistered by grub_module_init() and
+ *   grub_module_fini() only, while no other thread is using grub.  The
+ *   device, partition map, filesystem and filter tables are read-only in
+ *   between.
+ * - grub_errno, grub_errmsg and the error stack are per thread.  An error
+ *   raised on a worker thread must be reported from that thread.
+ * - grub_disk_t and grub_file_t handles belong to the thread that opened
+ *   them.  Different threads may open and read the same device or file at
+ *   the same time through their own handles.
+ * - The disk cache, the filesystem probe cache, the loopback list and the
+ *   diskfilter arrays are guarded internally.  A loopback device stays
+ *   alive until its last disk handle is closed, even after it was deleted.
+ * - Mutexes are recursive, a thread may re-enter a guarded module while
+ *   iterating it.  Never wait for another thread while holding one.
+ */
+
+#include <grub/types.h>
+#include <grub/symbol.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+/* A zero-filled mutex is unlocked, so static mutexes need no initializer.  */
+struct grub_mutex
+{
+#ifdef _WIN32
+	void* lock;	/* SRWLOCK */
+#else
+	pthread_mutex_t lock;
+#endif
+	volatile grub_addr_t owner;
+	unsigned depth;
+};
+typedef struct grub_mutex grub_mutex_t;
+
+void EXPORT_FUNC(grub_mutex_lock) (grub_mutex_t* mutex);
+void EXPORT_FUNC(grub_mutex_unlock) (grub_mutex_t* mutex);
+
+/* Add V to *P atomically and return the new value.  */
+grub_uint64_t EXPORT_FUNC(grub_atomic_add) (volatile grub_uint64_t* p, grub_uint64_t v);
+
+/* A zero-filled condition variable is ready to use as well.  */
+struct grub_cond
+{
+#ifdef _WIN32
+	void* cond;	/* CONDITION_VARIABLE */
+#else
+	pthread_cond_t cond;
+#endif
+};
+typedef struct grub_cond grub_cond_t;
+
+/* Wait for COND with MUTEX held exactly once by the caller, MUTEX is held
+   again on return.  Wakeups may be spurious, so wait in a loop.  */
+void EXPORT_FUNC(grub_cond_wait) (grub_cond_t* cond, grub_mutex_t* mutex);
+void EXPORT_FUNC(grub_cond_signal) (grub_cond_t* cond);
+void EXPORT_FUNC(grub_cond_broadcast) (grub_cond_t* cond);
+
+typedef struct grub_thread* grub_thread_t;
+
+/* Run FUNC(DATA) on a new thread, returns NULL and sets grub_errno if the
+   thread can't be created.  Every thread must be joined.  */
+grub_thread_t EXPORT_FUNC(grub_thread_create) (void (*func) (void* data), void* data);
+void EXPORT_FUNC(grub_thread_join) (grub_thread_t thread);
+
+/* Number of processors available to this process, at least 1.  */
+unsigned EXPORT_FUNC(grub_cpu_count) (void);
+
+#endif /* ! GRUB_THREAD_HEADER */
@@ -31,6 +31,8 @@ grub_cpu_idle(void)
 
 void EXPORT_FUNC(grub_millisleep) (grub_uint32_t ms);
 grub_uint64_t EXPORT_FUNC(grub_get_time_ms) (void);
+/* Monotonic wall clock in microseconds, for measuring intervals.  */
+grub_uint64_t EXPORT_FUNC(grub_get_time_us) (void);
 
 static __inline void
 grub_sleep(grub_uint32_t s)
@@ -28,6 +28,12 @@ enum
 	LANG_STR_CALC,
 	LANG_STR_NO_DECOMP,
 	LANG_STR_MOUNT,
+	LANG_STR_SEARCH,
+	LANG_STR_GOTO_OFFSET,
+	LANG_STR_FIND_BYTES,
+	LANG_STR_THUMBNAILS,
+	LANG_STR_VIEW_TEXT,
+	LANG_STR_GOTO_LINE,
 
 	LANG_STRMAX
 };
@@ -44,6 +50,8 @@ enum
 	LANG_WCS_CANNOT_OPEN_FILE,
 	LANG_WCS_FILE_TOO_LARGE,
 	LANG_WCS_OUT_OF_MEM,
+	LANG_WCS_CANCELLED,
+	LANG_WCS_EXTRACT_SUMMARY,
 
 	LANG_WCSMAX
 };
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <grub/err.h>
+#include <grub/thread.h>
 
 struct grub_file;
 
@@ -28,6 +29,14 @@ struct grub_loopback
 	struct grub_file* file;
 	struct grub_loopback* next;
 	unsigned long id;
+	/* Forward mapped extents straight to the disk holding the file.  */
+	int passthrough;
+	/* Open disk handles, the device is freed when the last one is closed
+	   after grub_loopback_delete().  */
+	unsigned refcnt;
+	int deleted;
+	/* Serializes access to FILE.  */
+	grub_mutex_t lock;
 };
 
 grub_err_t
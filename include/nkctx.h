@@ -93,15 +93,17 @@ enum nkctx_file_type
 	NKCTX_FILE_TEXT,
 };
 
+/* An entry of the directory nk.path, see nkctx_get_file_path.  */
 struct nkctx_file
 {
-	char* name;
-	char* path;
-	char human_size[12];
-	char time[20];
+	/* Kept in the string pool of the listing.  */
+	const char* name;
+	UINT64 size;
+	INT64 mtime;
+	BOOL sizeset;
+	BOOL mtimeset;
 	BOOL is_dir;
 	BOOL selected;
-	UINT64 size;
 	WORD icon;
 	enum nkctx_file_type type;
 };
@@ -129,10 +131,6 @@ typedef struct _NK_GUI_CTX
 
 	char status[512];
 
-	BOOL progress;
-	WCHAR progress_info[96];
-	HWND progress_wnd;
-
 	char* path;
 	DWORD disk_count;
 	DWORD disk_index;
@@ -140,9 +138,6 @@ typedef struct _NK_GUI_CTX
 	DWORD file_count;
 	DWORD dir_count;
 	struct nkctx_file* files;
-
-	DWORD copy_size;
-	char* copy_buf;
 } NK_GUI_CTX;
 extern NK_GUI_CTX nk;
 
@@ -169,18 +164,51 @@ nkctx_unset_path(void);
 void
 nkctx_enum_disk(void);
 
+void
+nkctx_enum_disk_select(const char* name);
+
+void
+nkctx_enum_disk_poll(void);
+
+void
+nkctx_enum_disk_wait(void);
+
 void
 nkctx_free_disk(void);
 
 void
 nkctx_enum_file(const char* dir);
 
+void
+nkctx_refresh_file(void);
+
+void
+nkctx_search_file(const char* pattern, unsigned flags);
+
+void
+nkctx_enum_file_poll(void);
+
+void
+nkctx_enum_file_wait(void);
+
 void
 nkctx_free_file(void);
 
+void
+nkctx_drop_file_cache(const char* disk);
+
 BOOL
 nkctx_is_hidden_file(const char* filename);
 
+const char*
+nkctx_get_file_path(const struct nkctx_file* info);
+
+void
+nkctx_get_file_size(const struct nkctx_file* info, char* buf, size_t len);
+
+void
+nkctx_get_file_time(const struct nkctx_file* info, char* buf, size_t len);
+
 struct nkctx_window
 {
 	void (*init)(const char* path);
@@ -193,6 +221,56 @@ extern struct nkctx_window nkctx_mount;
 extern struct nkctx_window nkctx_disk_info;
 extern struct nkctx_window nkctx_hex;
 extern struct nkctx_window nkctx_image;
+extern struct nkctx_window nkctx_text;
+
+void
+nkctx_file_view_wait(void);
+
+void
+nkctx_image_wait(void);
+
+void
+nkctx_free_image_cache(void);
+
+/* Reductions by a power of two an image is decoded at, and the largest
+   side decoded.  */
+#define NKCTX_IMAGE_LEVELS 16
+#define NKCTX_IMAGE_MAX_SIDE 8192
+
+/* 32bpp premultiplied BGRA, W * 4 bytes a row.  */
+struct nkctx_pixels
+{
+	UINT w;
+	UINT h;
+	UINT full_w;
+	UINT full_h;
+	UINT level;
+	BYTE* data;
+};
+
+struct IStream*
+nkctx_open_stream(const char* path);
+
+BOOL
+nkctx_decode_image(const char* path, UINT box_w, UINT box_h, struct nkctx_pixels* pixels);
+
+/* The box thumbnails are made to fit.  */
+#define NKCTX_THUMB_SIZE 128
+
+BOOL
+nkctx_decode_thumb(const char* path, UINT box_w, UINT box_h, struct nkctx_pixels* pixels);
+
+void
+nkctx_thumb_frame(void);
+
+struct nk_image
+nkctx_get_thumb(const struct nkctx_file* info);
+
+void
+nkctx_thumb_wait(void);
+
+void
+nkctx_free_thumb_cache(void);
 
 void
 nkctx_main_window(struct nk_context* ctx, float width, float height);
@@ -200,16 +278,27 @@ nkctx_main_window(struct nk_context* ctx, float width, float height);
 BOOL
 nkctx_about_popup(struct nk_context* ctx, float width, float height);
 
+struct grub_progress;
+struct nkctx_job;
+
+struct nkctx_job*
+nkctx_job_start(const char* title,
+	void (*run)(struct grub_progress* progress, void* data),
+	void (*done)(void* data, BOOL closing), void* data);
+
 void
-nkctx_show_progress(void);
+nkctx_job_cancel(struct nkctx_job* job);
 
 void
-nkctx_hide_progress(void);
+nkctx_job_window(struct nk_context* ctx, float width, float height);
+
+void
+nkctx_job_wait(void);
 
 BOOL
 nkctx_extract_file(LPCWSTR target_dir, const char* source_file);
 
-void
+BOOL
 nkctx_extract_dir(LPCWSTR target_dir);
 
 WCHAR*
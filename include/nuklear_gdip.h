@@ -33,6 +33,7 @@ NK_API void nk_gdip_shutdown(void);
 /* image */
 NK_API struct nk_image nk_gdip_load_image_from_file(const WCHAR* filename);
 NK_API struct nk_image nk_gdip_load_image_from_memory(const void* membuf, nk_uint membufSize);
+NK_API struct nk_image nk_gdip_load_image_from_pixels(void* pixels, int w, int h);
 NK_API void nk_gdip_image_free(struct nk_image image);
 
 #endif
@@ -149,6 +150,12 @@ typedef enum {
     UnitMillimeter
 } Unit;
 
+typedef INT PixelFormat;
+#define PixelFormat32bppPARGB 0x000E200B
+
+typedef struct GpImageAttributes GpImageAttributes;
+typedef BOOL (CALLBACK *DrawImageAbort)(VOID *);
+
 typedef struct {
     FLOAT X;
     FLOAT Y;
@@ -195,6 +202,14 @@ GdipCreateBitmapFromGraphics(INT width,
                              GpGraphics* target,
                              GpBitmap** bitmap);
 
+GpStatus WINGDIPAPI
+GdipCreateBitmapFromScan0(INT width,
+                          INT height,
+                          INT stride,
+                          PixelFormat format,
+                          BYTE* scan0,
+                          GpBitmap** bitmap);
+
 GpStatus WINGDIPAPI
 GdipDisposeImage(GpImage *image);
 
@@ -378,6 +393,13 @@ GpStatus WINGDIPAPI
 GdipDrawImageRectI(GpGraphics *graphics, GpImage *image, INT x, INT y, 
                    INT width, INT height);
 
+GpStatus WINGDIPAPI
+GdipDrawImageRectRectI(GpGraphics *graphics, GpImage *image,
+                       INT dstx, INT dsty, INT dstwidth, INT dstheight,
+                       INT srcx, INT srcy, INT srcwidth, INT srcheight,
+                       Unit srcUnit, GDIPCONST GpImageAttributes* imageAttributes,
+                       DrawImageAbort callback, VOID * callbackData);
+
 GpStatus WINGDIPAPI
 GdipMeasureString(
     GpGraphics               *graphics,
@@ -629,7 +651,13 @@ nk_gdip_draw_image(short x, short y, unsigned short w, unsigned short h,
     struct nk_image img, struct nk_color col)
 {
     GpImage *image = img.handle.ptr;
-    GdipDrawImageRectI(gdip.memory, image, x, y, w, h);
+    /* a subimage draws only its region */
+    if (img.region[2] && img.region[3])
+        GdipDrawImageRectRectI(gdip.memory, image, x, y, w, h,
+            img.region[0], img.region[1], img.region[2], img.region[3],
+            UnitPixel, NULL, NULL, NULL);
+    else
+        GdipDrawImageRectI(gdip.memory, image, x, y, w, h);
 }
 
 static void
@@ -683,6 +711,17 @@ nk_gdip_load_image_from_memory(const void *membuf, nk_uint membufSize)
     return nk_gdip_image_to_nk(image);
 }
 
+/* The bitmap draws from PIXELS, 32bpp premultiplied BGRA rows of W
+   pixels, which must be kept until the image is freed. */
+struct nk_image
+nk_gdip_load_image_from_pixels(void *pixels, int w, int h)
+{
+    GpBitmap *bitmap;
+    if (GdipCreateBitmapFromScan0(w, h, w * 4, PixelFormat32bppPARGB, pixels, &bitmap))
+        return nk_image_id(0);
+    return nk_gdip_image_to_nk(bitmap);
+}
+
 void
 nk_gdip_image_free(struct nk_image image)
 {
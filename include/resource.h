@@ -2,8 +2,6 @@
 //
 #define IDI_MAIN_ICON                   101
 
-#define IDD_PROG_DIALOG                 105
-
 #define IDR_PNG_MIN                     110
 
 #define IDR_PNG_ARC                     110
@@ -41,5 +39,3 @@
 #define IDR_PNG_WIN                     142
 
 #define IDR_PNG_MAX                     143
-
-#define IDC_PROG_TEXT                   1001
@@ -0,0 +1,274 @@
+/*
+ *  NkArc
+ *  Copyright (C) 2023 A1ive
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <nkctx.h>
+#include <lang.h>
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/thread.h>
+
+/* Long operations run on the thread pool, each with an entry in the Jobs
+   window.  Workers only touch the progress of their job, the list and
+   everything else belong to the UI thread.  A timer keeps the window
+   redrawn while any job runs.  */
+#define JOB_TIMER_ID 0x4A4F
+#define JOB_TIMER_MS 250
+/* How often the throughput is sampled.  */
+#define JOB_SPEED_MS 500
+
+struct nkctx_job
+{
+	struct nkctx_job* next;
+	char title[64];
+	struct grub_progress progress;
+	void (*run)(struct grub_progress* progress, void* data);
+	void (*done)(void* data, BOOL closing);
+	void* data;
+	volatile LONG finished;
+	/* The members below are used by the UI thread only.  */
+	ULONGLONG start;
+	ULONGLONG sample_time;
+	grub_uint64_t sample_bytes;
+	/* Bytes per second.  */
+	grub_uint64_t speed;
+};
+
+static BOOL job_inited;
+static HANDLE job_idle;
+static volatile LONG job_pending;
+static struct nkctx_job* job_list;
+
+/* 64-bit loads are not atomic on x86.  */
+static grub_uint64_t
+job_load(volatile grub_uint64_t* p)
+{
+	return grub_atomic_add(p, 0);
+}
+
+static void CALLBACK
+job_worker(PTP_CALLBACK_INSTANCE instance, PVOID data)
+{
+	struct nkctx_job* job = data;
+
+	CallbackMayRunLong(instance);
+	grub_file_progress = &job->progress;
+	job->run(&job->progress, job->data);
+	grub_file_progress = NULL;
+	grub_errno = GRUB_ERR_NONE;
+	/* JOB may be freed from here on.  */
+	InterlockedExchange(&job->finished, TRUE);
+	PostMessageW(nk.wnd, WM_NULL, 0, 0);
+	if (InterlockedDecrement(&job_pending) == 0)
+		SetEvent(job_idle);
+}
+
+/* Run RUN (PROGRESS, DATA) on a worker under TITLE.  Reads in it fail
+   once the job is cancelled.  DONE (DATA, CLOSING) is called on the UI
+   thread after RUN returned and must free DATA, CLOSING is set if NkArc
+   is exiting.  Returns NULL if the job can't be started, DATA is left to
+   the caller then.  */
+struct nkctx_job*
+nkctx_job_start(const char* title,
+	void (*run)(struct grub_progress* progress, void* data),
+	void (*done)(void* data, BOOL closing), void* data)
+{
+	struct nkctx_job* job;
+
+	if (!job_inited)
+	{
+		job_idle = CreateEventW(NULL, TRUE, TRUE, NULL);
+		job_inited = TRUE;
+	}
+	job = calloc(1, sizeof(struct nkctx_job));
+	if (!job)
+		return NULL;
+	grub_strncpy(job->title, title, sizeof(job->title) - 1);
+	job->run = run;
+	job->done = done;
+	job->data = data;
+	job->start = GetTickCount64();
+	job->sample_time = job->start;
+
+	InterlockedIncrement(&job_pending);
+	ResetEvent(job_idle);
+	if (!TrySubmitThreadpoolCallback(job_worker, job, NULL))
+	{
+		if (InterlockedDecrement(&job_pending) == 0)
+			SetEvent(job_idle);
+		free(job);
+		return NULL;
+	}
+	job->next = job_list;
+	job_list = job;
+	SetTimer(nk.wnd, JOB_TIMER_ID, JOB_TIMER_MS, NULL);
+	return job;
+}
+
+/* JOB stays valid until its DONE was called.  */
+void
+nkctx_job_cancel(struct nkctx_job* job)
+{
+	job->progress.cancel = 1;
+}
+
+/* Finish the jobs whose workers returned.  */
+static void
+job_poll(void)
+{
+	struct nkctx_job** pp = &job_list;
+	BOOL removed = FALSE;
+
+	while (*pp)
+	{
+		struct nkctx_job* job = *pp;
+		if (!job->finished)
+		{
+			pp = &job->next;
+			continue;
+		}
+		*pp = job->next;
+		job->done(job->data, FALSE);
+		free(job);
+		removed = TRUE;
+	}
+	if (removed && !job_list)
+		KillTimer(nk.wnd, JOB_TIMER_ID);
+}
+
+static void
+get_job_info(struct nkctx_job* job, char* buf, size_t len)
+{
+	ULONGLONG now = GetTickCount64();
+	grub_uint64_t bytes = job_load(&job->progress.bytes);
+	grub_uint64_t total_bytes = job_load(&job->progress.total_bytes);
+	grub_uint64_t items = job_load(&job->progress.items);
+	grub_uint64_t total_items = job_load(&job->progress.total_items);
+	grub_uint64_t eta = 0;
+	size_t n = 0;
+
+	if (now - job->sample_time >= JOB_SPEED_MS)
+	{
+		grub_uint64_t speed = grub_divmod64((bytes - job->sample_bytes) * 1000ULL,
+			now - job->sample_time, 0);
+		job->speed = job->speed ? (job->speed + speed) >> 1 : speed;
+		job->sample_time = now;
+		job->sample_bytes = bytes;
+	}
+
+	if (job->progress.cancel)
+	{
+		grub_snprintf(buf, len, "Cancelling ...");
+		return;
+	}
+	if (items || total_items)
+	{
+		if (total_items)
+			n += grub_snprintf(buf + n, len - n, "%llu / %llu  ",
+				(unsigned long long)items, (unsigned long long)total_items);
+		else
+			n += grub_snprintf(buf + n, len - n, "%llu  ", (unsigned long long)items);
+	}
+	/* grub_get_human_size () returns the same buffer every time.  */
+	n += grub_snprintf(buf + n, len - n, "%s",
+		grub_get_human_size(bytes, GRUB_HUMAN_SIZE_NORMAL));
+	if (total_bytes)
+		n += grub_snprintf(buf + n, len - n, " / %s",
+			grub_get_human_size(total_bytes, GRUB_HUMAN_SIZE_NORMAL));
+	/* GRUB_HUMAN_SIZE_SPEED takes hundredths of bytes per second.  */
+	n += grub_snprintf(buf + n, len - n, "  %s",
+		grub_get_human_size(job->speed * 100ULL, GRUB_HUMAN_SIZE_SPEED));
+
+	if (total_bytes > bytes && job->speed)
+		eta = grub_divmod64(total_bytes - bytes, job->speed, 0);
+	else if (total_items > items && items)
+		eta = grub_divmod64((now - job->start) * (total_items - items), items * 1000ULL, 0);
+	if (eta)
+		grub_snprintf(buf + n, len - n, "  ETA %llu:%02llu:%02llu",
+			(unsigned long long)(eta / 3600), (unsigned long long)(eta / 60 % 60),
+			(unsigned long long)(eta % 60));
+}
+
+static void
+draw_job(struct nk_context* ctx, struct nkctx_job* job)
+{
+	grub_uint64_t total_bytes = job_load(&job->progress.total_bytes);
+	grub_uint64_t total_items = job_load(&job->progress.total_items);
+	nk_size permille = 0;
+	char info[192];
+
+	/* nk_size may be 32 bits wide.  */
+	if (total_bytes)
+		permille = (nk_size)grub_divmod64(job_load(&job->progress.bytes) * 1000ULL, total_bytes, 0);
+	else if (total_items)
+		permille = (nk_size)grub_divmod64(job_load(&job->progress.items) * 1000ULL, total_items, 0);
+	if (permille > 1000)
+		permille = 1000;
+	get_job_info(job, info, sizeof(info));
+
+	nk_layout_row_dynamic(ctx, 0, 1);
+	nk_label(ctx, job->title, NK_TEXT_LEFT);
+	nk_layout_row(ctx, NK_DYNAMIC, 0, 2, (float[2]) { 0.75f, 0.25f });
+	nk_prog(ctx, permille, 1000, nk_false);
+	if (nk_button_label(ctx, GET_STR(LANG_STR_CANCEL)))
+		nkctx_job_cancel(job);
+	nk_layout_row_dynamic(ctx, 0, 1);
+	nk_label(ctx, info, NK_TEXT_LEFT);
+}
+
+void
+nkctx_job_window(struct nk_context* ctx, float width, float height)
+{
+	struct nkctx_job* job;
+
+	job_poll();
+	if (!job_list)
+		return;
+	if (!nk_begin(ctx, "Jobs",
+		nk_rect(width * 0.5f, height * 0.65f, width * 0.48f, height * 0.3f),
+		NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_MINIMIZABLE | NK_WINDOW_TITLE))
+		goto out;
+
+	for (job = job_list; job; job = job->next)
+		draw_job(ctx, job);
+
+out:
+	nk_end(ctx);
+}
+
+/* Cancel every job and wait for the workers to leave grub.  */
+void
+nkctx_job_wait(void)
+{
+	struct nkctx_job* job;
+
+	if (!job_inited)
+		return;
+	for (job = job_list; job; job = job->next)
+		nkctx_job_cancel(job);
+	WaitForSingleObject(job_idle, INFINITE);
+	while (job_list)
+	{
+		job = job_list;
+		job_list = job->next;
+		job->done(job->data, TRUE);
+		free(job);
+	}
+}
@@ -47,6 +47,12 @@ static const char* lang_en_us[LANG_STRMAX] =
 	u8"CALC",
 	u8"No decompress",
 	u8"Mount",
+	u8"Search, re: for a regular expression",
+	u8"Go to offset (hex)",
+	u8"Find hex bytes, or \"text\"",
+	u8"Thumbnails",
+	u8"View Text",
+	u8"Go to line",
 };
 
 static const wchar_t* langw_en_us[LANG_WCSMAX] =
@@ -59,6 +65,8 @@ static const wchar_t* langw_en_us[LANG_WCSMAX] =
 	L"CANNOT OPEN FILE",
 	L"FILE TOO LARGE",
 	L"OUT OF MEMORY",
+	L"CANCELLED",
+	L"%llu files, %llu folders, %ls in %llu.%llu s (%ls)",
 };
 
 static const char* lang_zh_cn[LANG_STRMAX] =
@@ -89,6 +97,12 @@ static const char* lang_zh_cn[LANG_STRMAX] =
 	u8"计算",
 	u8"不解压",
 	u8"挂载",
+	u8"搜索，re: 开头为正则表达式",
+	u8"跳转到偏移 (十六进制)",
+	u8"查找十六进制字节，或 \"文本\"",
+	u8"缩略图",
+	u8"查看文本",
+	u8"跳转到行",
 };
 
 static const wchar_t* langw_zh_cn[LANG_WCSMAX] =
@@ -101,6 +115,8 @@ static const wchar_t* langw_zh_cn[LANG_WCSMAX] =
 	L"无法打开文件",
 	L"文件过大",
 	L"内存不足",
+	L"已取消",
+	L"%llu 个文件，%llu 个文件夹，%ls，用时 %llu.%llu 秒（%ls）",
 };
 
 static const char* lang_zh_tw[LANG_STRMAX] =
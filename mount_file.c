@@ -23,6 +23,7 @@
 #include <grub/types.h>
 #include <grub/misc.h>
 #include <grub/mm.h>
+#include <grub/err.h>
 
 #define MAX_LOOPBACK_NAME 16
 
@@ -63,22 +64,67 @@ name_filter(const struct nk_text_edit* box, nk_rune unicode)
 	return nk_false;
 }
 
+/* A mount running as a job, the disks are listed again once it is
+   done.  */
+struct mount_job
+{
+	char* path;
+	int decompress;
+	char name[MAX_LOOPBACK_NAME];
+	grub_err_t err;
+	char errmsg[GRUB_MAX_ERRMSG];
+};
+
 static void
-mount_file(void)
+mount_job_run(struct grub_progress* progress, void* data)
 {
-	grub_loopback_add(m_ctx.name, m_ctx.path, m_ctx.decompress);
-	m_ctx.id++;
-	nkctx_free_disk();
-	nkctx_enum_disk();
-	for (struct nkctx_disk* info = nk.disks; info; info = info->next)
+	struct mount_job* job = data;
+
+	NK_UNUSED(progress);
+	job->err = grub_loopback_add(job->name, job->path, job->decompress);
+	if (job->err)
+		grub_strcpy(job->errmsg, grub_errmsg);
+}
+
+static void
+mount_job_done(void* data, BOOL closing)
+{
+	struct mount_job* job = data;
+	if (!closing && job->err)
+		grub_snprintf(nk.status, ARRAY_SIZE(nk.status), "Can't mount %s: %s", job->path, job->errmsg);
+	else if (!closing)
 	{
-		if (grub_strcmp(m_ctx.name, info->name) != 0)
-			continue;
-		nk.disk_index = info->index;
-		nkctx_enum_file(info->path);
-		break;
+		nkctx_free_disk();
+		nkctx_enum_disk();
+		nkctx_enum_disk_select(job->name);
 	}
-	nkctx_mount_fini();
+	grub_free(job->path);
+	grub_free(job);
+}
+
+static void
+mount_file(void)
+{
+	struct mount_job* job;
+	char title[64];
+
+	job = grub_zalloc(sizeof(struct mount_job));
+	if (!job)
+		goto fail;
+	job->path = m_ctx.path;
+	job->decompress = m_ctx.decompress;
+	grub_strcpy(job->name, m_ctx.name);
+	grub_snprintf(title, sizeof(title), "Mount  %s", m_ctx.name);
+	if (!nkctx_job_start(title, mount_job_run, mount_job_done, job))
+		goto fail;
+	/* The job has the path now.  */
+	m_ctx.path = NULL;
+	m_ctx.id++;
+	return;
+
+fail:
+	grub_free(job);
+	grub_errno = GRUB_ERR_NONE;
 }
 
 static void
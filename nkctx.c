@@ -27,39 +27,11 @@
 
 NK_GUI_CTX nk;
 
-#define COPY_SIZE 65536 // 64K
-
 #define REGION_MASK_LEFT    (1 << 0)
 #define REGION_MASK_RIGHT   (1 << 1)
 #define REGION_MASK_TOP     (1 << 2)
 #define REGION_MASK_BOTTOM  (1 << 3)
 
-static INT_PTR CALLBACK
-nkctx_proc_progress(HWND dlg, UINT message, WPARAM wparam, LPARAM lparam)
-{
-	UNREFERENCED_PARAMETER(lparam);
-	switch (message)
-	{
-	case WM_INITDIALOG:
-		return (INT_PTR)TRUE;
-	}
-	return (INT_PTR)FALSE;
-}
-
-void
-nkctx_show_progress(void)
-{
-	nk.progress = TRUE;
-	ShowWindow(nk.progress_wnd, SW_SHOW);
-}
-
-void
-nkctx_hide_progress(void)
-{
-	nk.progress = FALSE;
-	ShowWindow(nk.progress_wnd, SW_HIDE);
-}
-
 static LRESULT CALLBACK
 nkctx_window_proc(HWND wnd, UINT msg, WPARAM wparam, LPARAM lparam)
 {
@@ -208,9 +180,6 @@ nkctx_init(HINSTANCE inst,
 	nk.font_size = font_size;
 	nk.lang = GetUserDefaultUILanguage();
 
-	nk.copy_size = COPY_SIZE;
-	nk.copy_buf = grub_malloc(nk.copy_size);
-
 	nk.wc.style = CS_DBLCLKS;
 	nk.wc.lpfnWndProc = nkctx_window_proc;
 	nk.wc.hInstance = inst;
@@ -234,9 +203,6 @@ nkctx_init(HINSTANCE inst,
 	for (WORD i = 0; i < ARRAY_SIZE(nk.image); i++)
 		nk.image[i] = load_png(i + IDR_PNG_MIN);
 
-	nk.progress_wnd = CreateDialogParamW(nk.inst, MAKEINTRESOURCE(IDD_PROG_DIALOG), nk.wnd, nkctx_proc_progress, 0);
-	ShowWindow(nk.progress_wnd, SW_HIDE);
-
 	grub_module_init();
 	nk.path = NULL;
 	nkctx_enum_disk();
@@ -278,12 +244,16 @@ nkctx_loop(void)
 
 		/* GUI */
 		//set_style(nk.ctx);
+		nkctx_enum_disk_poll();
+		nkctx_enum_file_poll();
 		nkctx_main_window(nk.ctx, (float)nk.width, (float)nk.height);
 		nkctx_hash.window(nk.ctx, (float)nk.width, (float)nk.height);
 		nkctx_mount.window(nk.ctx, (float)nk.width, (float)nk.height);
 		nkctx_disk_info.window(nk.ctx, (float)nk.width, (float)nk.height);
 		nkctx_hex.window(nk.ctx, (float)nk.width, (float)nk.height);
 		nkctx_image.window(nk.ctx, (float)nk.width, (float)nk.height);
+		nkctx_text.window(nk.ctx, (float)nk.width, (float)nk.height);
+		nkctx_job_window(nk.ctx, (float)nk.width, (float)nk.height);
 
 		/* Draw */
 		nk_gdip_render(NK_ANTI_ALIASING_ON, nk.table[NK_COLOR_WINDOW]);
@@ -293,17 +263,29 @@ nkctx_loop(void)
 _Noreturn void
 nkctx_fini(int code)
 {
+	/* Thumbnail workers hold no bitmaps, but the cache does.  */
+	nkctx_thumb_wait();
+	nkctx_free_thumb_cache();
 	for (WORD i = 0; i < ARRAY_SIZE(nk.image); i++)
 		nk_gdip_image_free(nk.image[i]);
+	nkctx_image.fini();
+	nkctx_free_image_cache();
 	nk_gdipfont_del(nk.font);
 	nk_gdip_shutdown();
 	UnregisterClassW(nk.wc.lpszClassName, nk.wc.hInstance);
 	nkctx_free_file();
 	nkctx_free_disk();
 	nkctx_unset_path();
+	/* Pool workers must be out of the grub core before it goes away.  */
+	nkctx_enum_disk_wait();
+	nkctx_enum_file_wait();
+	nkctx_hex.fini();
+	nkctx_text.fini();
+	nkctx_file_view_wait();
+	nkctx_image_wait();
+	nkctx_job_wait();
 	grub_module_fini();
 	free(nk.path);
-	free(nk.copy_buf);
 	CoUninitialize();
 	exit(code);
 }
@@ -0,0 +1,15 @@
+#include <grub/types.h>
+#include <grub/lib/crc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+static unsigned long long ref64(unsigned long long crc,const unsigned char*p,size_t n){crc=~crc;for(size_t i=0;i<n;i++){crc^=p[i];for(int k=0;k<8;k++)crc=(crc>>1)^((crc&1)?0xC96C5795D7870F42ULL:0);}return ~crc;}
+static unsigned ref32(unsigned crc,unsigned poly,const unsigned char*p,size_t n){crc=~crc;for(size_t i=0;i<n;i++){crc^=p[i];for(int k=0;k<8;k++)crc=(crc>>1)^((crc&1)?poly:0);}return ~crc;}
+int main(){unsigned char*b=malloc(70000);srand(1);for(int i=0;i<70000;i++)b[i]=rand();int bad=0;
+for(int it=0;it<3000;it++){size_t off=rand()%64,n=rand()%(it<1000?300:65000);unsigned s=rand();
+ if(grub_getcrc32(s,b+off,n)!=ref32(s,0xEDB88320u,b+off,n)){bad++;if(bad<5)printf("crc32 bad off=%zu n=%zu\n",off,n);}
+ if(grub_getcrc32c(s,b+off,n)!=ref32(s,0x82F63B78u,b+off,n)){bad++;if(bad<5)printf("crc32c bad off=%zu n=%zu got %08x want %08x\n",off,n,grub_getcrc32c(s,b+off,n),ref32(s,0x82F63B78u,b+off,n));}
+ unsigned long long s64=((unsigned long long)rand()<<32)|rand();
+ if(grub_getcrc64(s64,b+off,n)!=ref64(s64,b+off,n)){bad++;if(bad<5)printf("crc64 bad off=%zu n=%zu\n",off,n);}
+}
+printf("bad=%d\n",bad);}
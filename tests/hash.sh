@@ -0,0 +1,48 @@
+#!/bin/sh
+# Hash a file of an image with the digests a manifest can't hold, with
+# and without a manifest beside the image, and check the results.
+#
+#   hash.sh NKARC WORKDIR
+#
+# Exits with 77, skipped for ctest, when mke2fs is missing.
+
+set -u
+
+if [ $# -ne 2 ]; then
+	echo "Usage: $0 NKARC WORKDIR" >&2
+	exit 1
+fi
+NKARC=$1
+WORK=$2
+
+if ! command -v mke2fs >/dev/null 2>&1; then
+	echo "skip: mke2fs not found" >&2
+	exit 77
+fi
+
+export E2FSPROGS_FAKE_TIME=1700000000
+
+rm -rf "$WORK"
+mkdir -p "$WORK/tree/a" || exit 1
+printf 'hello\n' > "$WORK/tree/a/r.txt" || exit 1
+mke2fs -q -t ext4 -d "$WORK/tree" "$WORK/disk.img" 4M >/dev/null || exit 1
+
+check() {
+	out=$("$NKARC" -i "$WORK/disk.img" hash -a "$1" "(hd0)/a/r.txt") || {
+		echo "hash -a $1 failed" >&2
+		exit 1
+	}
+	if [ "$out" != "$2  (hd0)/a/r.txt" ]; then
+		echo "hash -a $1: got '$out', expected $2" >&2
+		exit 1
+	fi
+}
+
+for pass in plain manifest; do
+	check crc32 363a3020
+	check adler32 084b021f
+	check sha256 5891b5b522d5df086d0ff0b110fbd9d21bb4fc7163af34d08286a2e846f6be03
+	if [ $pass = plain ]; then
+		"$NKARC" -i "$WORK/disk.img" manifest update hd0 2>/dev/null || exit 1
+	fi
+done
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Read every file of an image with several threads at once, directly and
+# through a loopback device on a file of the image, and compare the
+# digests with those of a single-threaded pass.
+#
+#   stress.sh NKARC NKBENCH WORKDIR
+#
+# Exits with 77, skipped for ctest, when mke2fs is missing.
+
+set -u
+
+if [ $# -ne 3 ]; then
+	echo "Usage: $0 NKARC NKBENCH WORKDIR" >&2
+	exit 1
+fi
+NKARC=$1
+NKBENCH=$2
+WORK=$3
+
+if ! command -v mke2fs >/dev/null 2>&1; then
+	echo "skip: mke2fs not found" >&2
+	exit 77
+fi
+
+export E2FSPROGS_FAKE_TIME=1700000000
+
+rm -rf "$WORK"
+mkdir -p "$WORK/outer" || exit 1
+"$NKBENCH" gen "$WORK/tree" -n 1000 -s 4 || exit 1
+# The same tree inside an image on the image.
+mke2fs -q -t ext4 -d "$WORK/tree" "$WORK/outer/inner.img" 16M >/dev/null || exit 1
+cp -R "$WORK/tree/." "$WORK/outer/" || exit 1
+mke2fs -q -t ext4 -d "$WORK/outer" "$WORK/outer.img" 48M >/dev/null || exit 1
+
+"$NKARC" -i "$WORK/outer.img" -l "inner=(hd0)/inner.img" \
+	stress -j 8 "(hd0)/" "(inner)/"
@@ -0,0 +1,711 @@
+/*
+ *  NkArc
+ *  Copyright (C) 2023 A1ive
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <nkctx.h>
+#include <file_view.h>
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/file.h>
+
+#include <lang.h>
+#include <emmintrin.h>
+#include <intrin.h>
+
+/* The file is indexed on the thread pool while it is shown: the offset of
+   every TEXT_MARK_LINES-th line is kept, and when there are TEXT_MARK_MAX
+   of them every other one is dropped and the step doubled.  The index
+   stays the same size for any file, a line is found from the mark before
+   it.  The rows drawn come from the windows of the file kept.  */
+#define TEXT_WINDOW_SHIFT 18
+#define TEXT_WINDOW_SIZE (1 << TEXT_WINDOW_SHIFT)
+#define TEXT_WINDOW_COUNT 8
+#define TEXT_CHUNK_SIZE (1 << 20)
+#define TEXT_MARK_LINES 64
+#define TEXT_MARK_MAX 16384
+/* Bytes of a line shown, the rest is cut.  */
+#define TEXT_LINE_MAX 1024
+#define TEXT_TAB 4
+
+enum
+{
+	TEXT_UTF8,
+	TEXT_UTF16LE,
+	TEXT_LATIN1,
+};
+
+static const char* text_enc_name[] = { "UTF-8", "UTF-16LE", "Latin-1" };
+
+struct text_view
+{
+	struct file_view file;
+	/* Past the byte order mark.  */
+	grub_off_t start;
+	int enc;
+	/* The members below are under the lock.  */
+	SRWLOCK lock;
+	grub_off_t* marks;
+	DWORD mark_count;
+	grub_uint64_t mark_lines;
+	grub_uint64_t lines;
+	grub_off_t indexed;
+	BOOL done;
+};
+
+static struct
+{
+	struct text_view* view;
+	/* The first line drawn, and a line whose offset is known.  */
+	grub_uint64_t top;
+	grub_uint64_t known;
+	grub_off_t known_offset;
+	grub_uint64_t rows;
+	BOOL backward;
+	char goto_text[24];
+	char status[64];
+} m_ctx;
+
+static void
+nkctx_text_fini(void);
+
+static void
+text_view_release(struct file_view* file)
+{
+	struct text_view* view = (struct text_view*)file;
+
+	free(view->marks);
+	free(view);
+}
+
+/* Keep OFFSET, the start of line SEEN, if it is the next mark.  */
+static void
+add_mark(struct text_view* view, grub_uint64_t seen, grub_off_t offset, grub_uint64_t* next)
+{
+	AcquireSRWLockExclusive(&view->lock);
+	if (view->mark_count == TEXT_MARK_MAX)
+	{
+		for (DWORD i = 0; i < TEXT_MARK_MAX / 2; i++)
+			view->marks[i] = view->marks[i * 2];
+		view->mark_count = TEXT_MARK_MAX / 2;
+		view->mark_lines *= 2;
+	}
+	if (seen == view->mark_count * view->mark_lines)
+		view->marks[view->mark_count++] = offset;
+	*next = view->mark_count * view->mark_lines;
+	ReleaseSRWLockExclusive(&view->lock);
+}
+
+/* Count the newlines of BUF at BASE sixteen bytes at a time, a UTF-16
+   newline is a whole code unit.  SEEN is the count before BUF.  */
+static void
+index_chunk(struct text_view* view, const grub_uint8_t* buf, grub_size_t len,
+	grub_off_t base, grub_uint64_t* seen, grub_uint64_t* next)
+{
+	grub_size_t unit = view->enc == TEXT_UTF16LE ? 2 : 1;
+	const __m128i nl8 = _mm_set1_epi8('\n');
+	const __m128i nl16 = _mm_set1_epi16(0x000A);
+	grub_size_t i = 0;
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(buf + i));
+		unsigned mask;
+		if (unit == 2)
+			mask = _mm_movemask_epi8(_mm_cmpeq_epi16(v, nl16)) & 0x5555;
+		else
+			mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl8));
+		while (mask)
+		{
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+			mask &= mask - 1;
+			if (++*seen == *next)
+				add_mark(view, *seen, base + i + bit + unit, next);
+		}
+	}
+	for (; i + unit <= len; i += unit)
+	{
+		if (buf[i] == '\n' && (unit == 1 || buf[i + 1] == 0) && ++*seen == *next)
+			add_mark(view, *seen, base + i + unit, next);
+	}
+}
+
+static void CALLBACK
+text_index_worker(PTP_CALLBACK_INSTANCE instance, PVOID data)
+{
+	struct text_view* view = data;
+	grub_uint8_t* buf = malloc(TEXT_CHUNK_SIZE);
+	grub_file_t file = NULL;
+	grub_off_t base = view->start;
+	grub_uint64_t seen = 0, next = TEXT_MARK_LINES;
+	NK_UNUSED(instance);
+
+	if (buf)
+		file = grub_file_open(view->file.path, view->file.type);
+	if (file)
+	{
+		grub_file_seek(file, base);
+		while (!view->file.cancel)
+		{
+			grub_ssize_t r = grub_file_read(file, buf, TEXT_CHUNK_SIZE);
+			if (r <= 0)
+				break;
+			index_chunk(view, buf, r, base, &seen, &next);
+			base += r;
+			AcquireSRWLockExclusive(&view->lock);
+			view->lines = seen + 1;
+			view->indexed = base;
+			ReleaseSRWLockExclusive(&view->lock);
+			PostMessageW(nk.wnd, WM_NULL, 0, 0);
+		}
+		grub_file_close(file);
+	}
+	grub_errno = GRUB_ERR_NONE;
+	free(buf);
+
+	AcquireSRWLockExclusive(&view->lock);
+	view->done = TRUE;
+	ReleaseSRWLockExclusive(&view->lock);
+	file_view_job_done(&view->file);
+}
+
+/* The bytes read at OFFSET up to the end of their window, NULL while they
+   are read.  */
+static const grub_uint8_t*
+get_bytes(grub_off_t offset, grub_size_t* avail)
+{
+	grub_off_t base = offset & ~(grub_off_t)(TEXT_WINDOW_SIZE - 1);
+	struct file_view_window* w = file_view_get_window(&m_ctx.view->file, base);
+
+	if (!w)
+		return NULL;
+	*avail = offset - base < w->size ? w->size - (offset - base) : 0;
+	return w->data + (offset - base);
+}
+
+/* The start of the line after the one at OFFSET, the size after the last
+   one, or -1 while the bytes are read.  */
+static grub_int64_t
+next_line(grub_off_t offset)
+{
+	struct text_view* view = m_ctx.view;
+	grub_size_t unit = view->enc == TEXT_UTF16LE ? 2 : 1;
+
+	while (offset < view->file.size)
+	{
+		grub_size_t avail, i;
+		const grub_uint8_t* p = get_bytes(offset, &avail);
+		if (!p)
+			return -1;
+		if (avail < unit)
+			break;
+		if (unit == 1)
+		{
+			const grub_uint8_t* q = memchr(p, '\n', avail);
+			if (q)
+				return offset + (q - p) + 1;
+		}
+		else
+		{
+			for (i = 0; i + 2 <= avail; i += 2)
+			{
+				if (p[i] == '\n' && p[i + 1] == 0)
+					return offset + i + 2;
+			}
+		}
+		offset += avail & ~(unit - 1);
+	}
+	return view->file.size;
+}
+
+/* The offset of LINE, or -1 while the bytes before it are read.  The
+   known line is moved on as far as it gets, a line far from a mark is
+   reached in a few frames rather than thrashing the windows.  */
+static grub_int64_t
+line_offset(grub_uint64_t line)
+{
+	struct text_view* view = m_ctx.view;
+	grub_uint64_t mark;
+	grub_off_t offset;
+
+	AcquireSRWLockShared(&view->lock);
+	mark = line / view->mark_lines;
+	if (mark >= view->mark_count)
+		mark = view->mark_count - 1;
+	offset = view->marks[mark];
+	mark *= view->mark_lines;
+	ReleaseSRWLockShared(&view->lock);
+
+	if (m_ctx.known <= line && m_ctx.known >= mark)
+	{
+		mark = m_ctx.known;
+		offset = m_ctx.known_offset;
+	}
+	while (mark < line)
+	{
+		grub_int64_t next = next_line(offset);
+		if (next < 0)
+			return -1;
+		if ((grub_off_t)next >= m_ctx.view->file.size)
+			break;
+		mark++;
+		offset = next;
+		m_ctx.known = mark;
+		m_ctx.known_offset = offset;
+	}
+	return offset;
+}
+
+/* Copy up to LEN bytes at OFFSET, fewer if a window is being read.  */
+static grub_size_t
+copy_bytes(grub_off_t offset, grub_uint8_t* buf, grub_size_t len)
+{
+	grub_size_t done = 0;
+
+	while (done < len)
+	{
+		grub_size_t avail;
+		const grub_uint8_t* p = get_bytes(offset + done, &avail);
+		if (!p || avail == 0)
+			break;
+		if (avail > len - done)
+			avail = len - done;
+		memcpy(buf + done, p, avail);
+		done += avail;
+	}
+	return done;
+}
+
+static grub_size_t
+put_utf8(char* out, grub_uint32_t c)
+{
+	if (c < 0x80)
+	{
+		out[0] = (char)c;
+		return 1;
+	}
+	if (c < 0x800)
+	{
+		out[0] = (char)(0xC0 | c >> 6);
+		out[1] = (char)(0x80 | (c & 0x3F));
+		return 2;
+	}
+	if (c < 0x10000)
+	{
+		out[0] = (char)(0xE0 | c >> 12);
+		out[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+		out[2] = (char)(0x80 | (c & 0x3F));
+		return 3;
+	}
+	out[0] = (char)(0xF0 | c >> 18);
+	out[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+	out[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+	out[3] = (char)(0x80 | (c & 0x3F));
+	return 4;
+}
+
+/* The code point of the UTF-8 sequence at P, or -1 if it is not one.  */
+static int
+get_utf8(const grub_uint8_t* p, grub_size_t len, grub_uint32_t* c)
+{
+	int n;
+	grub_uint32_t min;
+
+	if (p[0] < 0x80)
+	{
+		*c = p[0];
+		return 1;
+	}
+	if ((p[0] & 0xE0) == 0xC0)
+		n = 2, min = 0x80, *c = p[0] & 0x1F;
+	else if ((p[0] & 0xF0) == 0xE0)
+		n = 3, min = 0x800, *c = p[0] & 0x0F;
+	else if ((p[0] & 0xF8) == 0xF0)
+		n = 4, min = 0x10000, *c = p[0] & 0x07;
+	else
+		return -1;
+	if ((grub_size_t)n > len)
+		return -1;
+	for (int i = 1; i < n; i++)
+	{
+		if ((p[i] & 0xC0) != 0x80)
+			return -1;
+		*c = *c << 6 | (p[i] & 0x3F);
+	}
+	if (*c < min || *c > 0x10FFFF || (*c >= 0xD800 && *c <= 0xDFFF))
+		return -1;
+	return n;
+}
+
+/* Decode a line to UTF-8 for drawing.  Tabs are spaces, other controls
+   and bytes that are not text are shown as '?'.  */
+static void
+decode_line(const grub_uint8_t* p, grub_size_t len, int enc, char* out, grub_size_t size)
+{
+	grub_size_t i = 0, o = 0;
+
+	while (i < len && o + 4 < size)
+	{
+		grub_uint32_t c;
+		int n;
+		switch (enc)
+		{
+		case TEXT_UTF16LE:
+			if (i + 2 > len)
+				goto done;
+			c = p[i] | p[i + 1] << 8;
+			n = 2;
+			if (c >= 0xD800 && c <= 0xDBFF && i + 4 <= len)
+			{
+				grub_uint32_t lo = p[i + 2] | p[i + 3] << 8;
+				if (lo >= 0xDC00 && lo <= 0xDFFF)
+				{
+					c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+					n = 4;
+				}
+			}
+			if (c >= 0xD800 && c <= 0xDFFF)
+				c = '?';
+			break;
+		case TEXT_LATIN1:
+			c = p[i];
+			n = 1;
+			break;
+		default:
+			n = get_utf8(p + i, len - i, &c);
+			if (n < 0)
+			{
+				c = '?';
+				n = 1;
+			}
+		}
+		i += n;
+		if (c == '\t')
+		{
+			for (int t = 0; t < TEXT_TAB && o + 1 < size; t++)
+				out[o++] = ' ';
+			continue;
+		}
+		if (c == '\r' || c == '\n')
+			continue;
+		if (c < 0x20 || c == 0x7F)
+			c = '?';
+		o += put_utf8(out + o, c);
+	}
+done:
+	out[o] = '\0';
+}
+
+/* A byte order mark, else UTF-8 if the start of the file is valid UTF-8,
+   else Latin-1.  */
+static void
+detect_encoding(struct text_view* view, grub_file_t file)
+{
+	grub_uint8_t buf[4096];
+	grub_ssize_t len = grub_file_read(file, buf, sizeof(buf));
+	grub_ssize_t i = 0;
+
+	grub_errno = GRUB_ERR_NONE;
+	view->enc = TEXT_UTF8;
+	if (len >= 3 && buf[0] == 0xEF && buf[1] == 0xBB && buf[2] == 0xBF)
+	{
+		view->start = 3;
+		return;
+	}
+	if (len >= 2 && buf[0] == 0xFF && buf[1] == 0xFE)
+	{
+		view->enc = TEXT_UTF16LE;
+		view->start = 2;
+		return;
+	}
+	while (i < len)
+	{
+		grub_uint32_t c;
+		int n = get_utf8(buf + i, len - i, &c);
+		if (n < 0)
+		{
+			/* A sequence cut by the end of the sample is not wrong.  */
+			if (len == sizeof(buf) && len - i < 4)
+				break;
+			view->enc = TEXT_LATIN1;
+			break;
+		}
+		i += n;
+	}
+}
+
+static void
+nkctx_text_init(const char* path)
+{
+	struct text_view* view;
+	grub_file_t file;
+
+	nkctx_text_fini();
+	file = grub_file_open(path, GRUB_FILE_TYPE_CAT | GRUB_FILE_TYPE_NO_DECOMPRESS);
+	if (!file)
+	{
+		grub_errno = GRUB_ERR_NONE;
+		MessageBoxW(nk.wnd, GET_WCS(LANG_WCS_CANNOT_OPEN_FILE), GET_WCS(LANG_WCS_ERROR), MB_OK | MB_ICONERROR);
+		return;
+	}
+	view = calloc(1, sizeof(struct text_view));
+	if (view)
+		view->marks = malloc(TEXT_MARK_MAX * sizeof(grub_off_t));
+	if (!view || !view->marks || !file_view_init(&view->file, path, GRUB_FILE_TYPE_CAT | GRUB_FILE_TYPE_NO_DECOMPRESS,
+		TEXT_WINDOW_SIZE, TEXT_WINDOW_COUNT, text_view_release))
+	{
+		if (view)
+			free(view->marks);
+		free(view);
+		grub_file_close(file);
+		MessageBoxW(nk.wnd, GET_WCS(LANG_WCS_OUT_OF_MEM), GET_WCS(LANG_WCS_ERROR), MB_OK | MB_ICONERROR);
+		return;
+	}
+	view->file.size = grub_file_size(file);
+	detect_encoding(view, file);
+	grub_file_close(file);
+	InitializeSRWLock(&view->lock);
+	view->marks[0] = view->start;
+	view->mark_count = 1;
+	view->mark_lines = TEXT_MARK_LINES;
+	view->lines = 1;
+
+	grub_memset(&m_ctx, 0, sizeof(m_ctx));
+	m_ctx.view = view;
+	m_ctx.known_offset = view->start;
+	m_ctx.rows = 1;
+
+	if (!file_view_submit(&view->file, text_index_worker, view))
+	{
+		/* Lines are still found from the start, only slower.  */
+		view->done = TRUE;
+		grub_strcpy(m_ctx.status, "Can't index");
+	}
+}
+
+static void
+nkctx_text_fini(void)
+{
+	if (!m_ctx.view)
+		return;
+	file_view_close(&m_ctx.view->file);
+	grub_memset(&m_ctx, 0, sizeof(m_ctx));
+}
+
+static grub_uint64_t
+get_lines(BOOL* done, grub_off_t* indexed)
+{
+	struct text_view* view = m_ctx.view;
+	grub_uint64_t lines;
+
+	AcquireSRWLockShared(&view->lock);
+	lines = view->lines;
+	if (done)
+		*done = view->done;
+	if (indexed)
+		*indexed = view->indexed;
+	ReleaseSRWLockShared(&view->lock);
+	/* Lines past those indexed may still be shown once they are known.  */
+	return lines > m_ctx.known + 1 ? lines : m_ctx.known + 1;
+}
+
+/* LINE as the first row drawn, as far as the rows still fit.  */
+static grub_uint64_t
+clamp_top(grub_uint64_t line)
+{
+	grub_uint64_t lines = get_lines(NULL, NULL);
+
+	if (line + m_ctx.rows > lines)
+		line = lines > m_ctx.rows ? lines - m_ctx.rows : 0;
+	return line;
+}
+
+/* Only moves asked for set the way the view goes.  */
+static void
+move_to(grub_uint64_t line)
+{
+	line = clamp_top(line);
+	m_ctx.backward = line < m_ctx.top;
+	m_ctx.top = line;
+}
+
+static void
+move_by(grub_int64_t rows)
+{
+	if (rows < 0 && (grub_uint64_t)-rows > m_ctx.top)
+		move_to(0);
+	else
+		move_to(m_ctx.top + rows);
+}
+
+static void
+go_line(const char* text)
+{
+	const char* end;
+	grub_uint64_t line = grub_strtoull(text, &end, 10);
+	BOOL done;
+
+	if (end == text || *end != '\0' || line == 0)
+	{
+		grub_strcpy(m_ctx.status, "Bad line");
+		grub_errno = GRUB_ERR_NONE;
+		return;
+	}
+	if (line > get_lines(&done, NULL))
+	{
+		grub_strcpy(m_ctx.status, done ? "Past the end" : "Not indexed yet");
+		return;
+	}
+	m_ctx.status[0] = '\0';
+	move_to(line - 1);
+}
+
+static void
+draw_scrollbar(struct nk_context* ctx, grub_uint64_t lines)
+{
+	float max = (float)(lines > 0 ? lines - 1 : 0);
+	float row = (float)m_ctx.top;
+	float step = max / 4096.0f;
+
+	if (step < 1.0f)
+		step = 1.0f;
+	nk_layout_row_dynamic(ctx, 0, 1);
+	if (nk_slider_float(ctx, 0.0f, &row, max > 0.0f ? max : 1.0f, step))
+		move_to((grub_uint64_t)row);
+}
+
+/* Returns the offset of the next row, or -1 if this one is not read yet.  */
+static grub_int64_t
+draw_row(struct nk_context* ctx, grub_uint64_t line, grub_off_t offset)
+{
+	static grub_uint8_t buf[TEXT_LINE_MAX];
+	static char text[TEXT_LINE_MAX * 4];
+	struct nk_color c1 = NK_COLOR_BLUE;
+	grub_int64_t next = next_line(offset);
+	grub_size_t len;
+
+	nk_labelf_colored(ctx, NK_TEXT_RIGHT, c1, "%llu ", (unsigned long long)line + 1);
+	if (next < 0)
+	{
+		nk_label(ctx, "...", NK_TEXT_LEFT);
+		return -1;
+	}
+	len = (grub_size_t)(next - offset);
+	if (len > TEXT_LINE_MAX)
+		len = TEXT_LINE_MAX;
+	len = copy_bytes(offset, buf, len);
+	decode_line(buf, len, m_ctx.view->enc, text, sizeof(text));
+	nk_label(ctx, text, NK_TEXT_LEFT);
+	return next;
+}
+
+static void
+nkctx_text_window(struct nk_context* ctx, float width, float height)
+{
+	struct text_view* view = m_ctx.view;
+	struct nk_rect bounds;
+	grub_uint64_t lines;
+	grub_off_t indexed;
+	grub_int64_t top, offset;
+	float pitch;
+	BOOL done;
+
+	if (!view)
+		return;
+	if (!nk_begin(ctx, "Text Viewer",
+		nk_rect(width * 0.025f, height * 0.1f, width * 0.95f, height * 0.8f),
+		NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_CLOSABLE | NK_WINDOW_NO_SCROLLBAR))
+	{
+		nkctx_text_fini();
+		goto out;
+	}
+	lines = get_lines(&done, &indexed);
+
+	nk_layout_row(ctx, NK_DYNAMIC, 0, 3, (float[3]){ nk.gui_ratio, 1.0f - 2 * nk.gui_ratio, nk.gui_ratio });
+	if (nk_button_symbol(ctx, NK_SYMBOL_TRIANGLE_LEFT))
+		move_by(-(grub_int64_t)m_ctx.rows);
+	nk_label(ctx, view->file.path, NK_TEXT_LEFT);
+	if (nk_button_symbol(ctx, NK_SYMBOL_TRIANGLE_RIGHT))
+		move_by(m_ctx.rows);
+
+	nk_layout_row(ctx, NK_DYNAMIC, 0, 4, (float[4]){ 0.2f, 0.15f, 0.35f, 0.3f });
+	if (nk_widget_is_hovered(ctx))
+		nk_tooltip(ctx, GET_STR(LANG_STR_GOTO_LINE));
+	if (nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD | NK_EDIT_SIG_ENTER,
+		m_ctx.goto_text, sizeof(m_ctx.goto_text), nk_filter_decimal) & NK_EDIT_COMMITED)
+		go_line(m_ctx.goto_text);
+	nk_label(ctx, text_enc_name[view->enc], NK_TEXT_LEFT);
+	if (done)
+		nk_labelf(ctx, NK_TEXT_LEFT, "%llu / %llu",
+			(unsigned long long)m_ctx.top + 1, (unsigned long long)lines);
+	else
+		nk_labelf(ctx, NK_TEXT_LEFT, "%llu / %llu+ (%llu%%)",
+			(unsigned long long)m_ctx.top + 1, (unsigned long long)lines,
+			view->file.size ? (unsigned long long)(indexed * 100 / view->file.size) : 100ULL);
+	nk_label(ctx, m_ctx.status, NK_TEXT_LEFT);
+
+	draw_scrollbar(ctx, lines);
+
+	/* As many rows as fit, the wheel moves three at a time.  */
+	nk_layout_row(ctx, NK_DYNAMIC, 0, 2, (float[2]){ 0.1f, 0.9f });
+	bounds = nk_layout_widget_bounds(ctx);
+	pitch = bounds.h + ctx->style.window.spacing.y;
+	if (pitch > 0.0f)
+	{
+		struct nk_rect region = nk_window_get_content_region(ctx);
+		grub_uint64_t rows = (grub_uint64_t)((region.y + region.h - bounds.y) / pitch);
+		m_ctx.rows = rows ? rows : 1;
+	}
+	if (nk_window_is_hovered(ctx) && ctx->input.mouse.scroll_delta.y != 0.0f)
+	{
+		move_by((grub_int64_t)(-ctx->input.mouse.scroll_delta.y * 3));
+		ctx->input.mouse.scroll_delta.y = 0.0f;
+	}
+	/* The rows may fit differently after a resize.  */
+	m_ctx.top = clamp_top(m_ctx.top);
+
+	top = offset = line_offset(m_ctx.top);
+	if (offset < 0)
+	{
+		nk_label(ctx, "", NK_TEXT_LEFT);
+		nk_label(ctx, "Loading ...", NK_TEXT_LEFT);
+		goto out;
+	}
+	for (grub_uint64_t i = 0; i < m_ctx.rows && offset >= 0; i++)
+	{
+		if ((grub_off_t)offset >= view->file.size && (i > 0 || view->file.size > view->start))
+			break;
+		offset = draw_row(ctx, m_ctx.top + i, offset);
+	}
+	/* Read ahead the window the view is going to.  */
+	if (m_ctx.backward && top >= TEXT_WINDOW_SIZE)
+		file_view_prefetch(&view->file, top - TEXT_WINDOW_SIZE);
+	else if (offset >= 0 && !m_ctx.backward)
+		file_view_prefetch(&view->file, offset + TEXT_WINDOW_SIZE);
+
+out:
+	nk_end(ctx);
+}
+
+struct nkctx_window nkctx_text =
+{
+	.init = nkctx_text_init,
+	.fini = nkctx_text_fini,
+	.window = nkctx_text_window,
+};
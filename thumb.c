@@ -0,0 +1,339 @@
+/*
+ *  NkArc
+ *  Copyright (C) 2023 A1ive
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <nkctx.h>
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+
+/* Thumbnails are kept by path, size and time for as long as NkArc runs,
+   going back to a directory or a search over it shows them at once.  They
+   are made by a few workers of the thread pool, those asked for by the
+   last frame drawn first.  */
+#define THUMB_HASH_SIZE 1024
+#define THUMB_CACHE_MAX 1024
+#define THUMB_WORKERS 4
+
+enum
+{
+	THUMB_EMPTY,
+	THUMB_QUEUED,
+	THUMB_LOADING,
+	THUMB_READY,
+	THUMB_FAILED,
+};
+
+struct thumb
+{
+	struct thumb* hash_next;
+	struct thumb* prev;
+	struct thumb* next;
+	struct thumb* queue_next;
+	char* path;
+	UINT64 size;
+	INT64 mtime;
+	int state;
+	/* The frame that asked for it last.  */
+	ULONG frame;
+	struct nkctx_pixels pixels;
+	struct nk_image img;
+};
+
+static BOOL thumb_inited;
+static CRITICAL_SECTION thumb_lock;
+static HANDLE thumb_idle;
+static volatile LONG thumb_pending;
+
+/* The members below are under thumb_lock.  */
+static struct thumb* thumb_hash[THUMB_HASH_SIZE];
+/* Most recently used first.  */
+static struct thumb* thumb_head;
+static struct thumb* thumb_tail;
+static struct thumb* thumb_queue;
+static DWORD thumb_count;
+static LONG thumb_running;
+static ULONG thumb_frame;
+static BOOL thumb_stop;
+
+static grub_uint32_t
+thumb_hash_key(const char* path, UINT64 size, INT64 mtime)
+{
+	grub_uint32_t h = 2166136261U;
+
+	for (; *path; path++)
+		h = (h ^ (grub_uint8_t)*path) * 16777619U;
+	h = (h ^ (grub_uint32_t)size) * 16777619U;
+	h = (h ^ (grub_uint32_t)mtime) * 16777619U;
+	return h % THUMB_HASH_SIZE;
+}
+
+static void
+thumb_unlink(struct thumb* t)
+{
+	if (t->prev)
+		t->prev->next = t->next;
+	else
+		thumb_head = t->next;
+	if (t->next)
+		t->next->prev = t->prev;
+	else
+		thumb_tail = t->prev;
+	t->prev = t->next = NULL;
+}
+
+static void
+thumb_push_front(struct thumb* t)
+{
+	t->next = thumb_head;
+	if (thumb_head)
+		thumb_head->prev = t;
+	thumb_head = t;
+	if (!thumb_tail)
+		thumb_tail = t;
+}
+
+static void
+thumb_free(struct thumb* t)
+{
+	nk_gdip_image_free(t->img);
+	free(t->pixels.data);
+	grub_free(t->path);
+	free(t);
+}
+
+/* Drop those used longest ago that no worker holds and no frame showed
+   lately.  */
+static void
+thumb_evict(void)
+{
+	struct thumb* t = thumb_tail;
+
+	while (t && thumb_count > THUMB_CACHE_MAX)
+	{
+		struct thumb* prev = t->prev;
+		if (t->state != THUMB_QUEUED && t->state != THUMB_LOADING && t->frame + 1 < thumb_frame)
+		{
+			struct thumb** pp = &thumb_hash[thumb_hash_key(t->path, t->size, t->mtime)];
+			while (*pp != t)
+				pp = &(*pp)->hash_next;
+			*pp = t->hash_next;
+			thumb_unlink(t);
+			thumb_free(t);
+			thumb_count--;
+		}
+		t = prev;
+	}
+}
+
+/* The one asked for by the latest frame, the first asked for of those as
+   the queue is newest first.  Those the view has left behind are dropped,
+   they are asked for again when they are shown.  */
+static struct thumb*
+thumb_pick(void)
+{
+	struct thumb** pp = &thumb_queue;
+	struct thumb** pick = NULL;
+	struct thumb* t;
+
+	while (*pp)
+	{
+		t = *pp;
+		if (thumb_stop || t->frame + 1 < thumb_frame)
+		{
+			*pp = t->queue_next;
+			t->state = THUMB_EMPTY;
+			continue;
+		}
+		if (!pick || t->frame >= (*pick)->frame)
+			pick = pp;
+		pp = &t->queue_next;
+	}
+	if (!pick)
+		return NULL;
+	t = *pick;
+	*pick = t->queue_next;
+	t->state = THUMB_LOADING;
+	return t;
+}
+
+static void CALLBACK
+thumb_worker(PTP_CALLBACK_INSTANCE instance, PVOID data)
+{
+	NK_UNUSED(instance);
+	NK_UNUSED(data);
+
+	for (;;)
+	{
+		struct nkctx_pixels pixels;
+		struct thumb* t;
+		BOOL ok;
+
+		EnterCriticalSection(&thumb_lock);
+		t = thumb_pick();
+		if (!t)
+		{
+			thumb_running--;
+			LeaveCriticalSection(&thumb_lock);
+			break;
+		}
+		LeaveCriticalSection(&thumb_lock);
+
+		/* T stays while it is loading.  */
+		ok = nkctx_decode_thumb(t->path, NKCTX_THUMB_SIZE, NKCTX_THUMB_SIZE, &pixels);
+
+		EnterCriticalSection(&thumb_lock);
+		t->pixels = pixels;
+		t->state = ok ? THUMB_READY : THUMB_FAILED;
+		LeaveCriticalSection(&thumb_lock);
+		PostMessageW(nk.wnd, WM_NULL, 0, 0);
+	}
+	if (InterlockedDecrement(&thumb_pending) == 0)
+		SetEvent(thumb_idle);
+}
+
+/* Called under thumb_lock.  */
+static void
+thumb_start_worker(void)
+{
+	if (thumb_running >= THUMB_WORKERS)
+		return;
+	thumb_running++;
+	InterlockedIncrement(&thumb_pending);
+	ResetEvent(thumb_idle);
+	if (!TrySubmitThreadpoolCallback(thumb_worker, NULL, NULL))
+	{
+		thumb_running--;
+		if (InterlockedDecrement(&thumb_pending) == 0)
+			SetEvent(thumb_idle);
+	}
+}
+
+/* Start a frame of thumbnails, those not asked for again in it are no
+   longer shown.  */
+void
+nkctx_thumb_frame(void)
+{
+	if (!thumb_inited)
+		return;
+	EnterCriticalSection(&thumb_lock);
+	thumb_frame++;
+	LeaveCriticalSection(&thumb_lock);
+}
+
+/* The thumbnail of INFO, an image without a handle while it is made or if
+   it cannot be.  */
+struct nk_image
+nkctx_get_thumb(const struct nkctx_file* info)
+{
+	const char* path = nkctx_get_file_path(info);
+	struct nk_image img = nk_image_id(0);
+	struct thumb** bucket;
+	struct thumb* t;
+
+	if (!thumb_inited)
+	{
+		InitializeCriticalSection(&thumb_lock);
+		thumb_idle = CreateEventW(NULL, TRUE, TRUE, NULL);
+		thumb_inited = TRUE;
+	}
+	EnterCriticalSection(&thumb_lock);
+	if (thumb_stop)
+		goto out;
+	bucket = &thumb_hash[thumb_hash_key(path, info->size, info->mtime)];
+	for (t = *bucket; t; t = t->hash_next)
+	{
+		if (t->size == info->size && t->mtime == info->mtime && strcmp(t->path, path) == 0)
+			break;
+	}
+	if (t)
+		thumb_unlink(t);
+	else
+	{
+		t = calloc(1, sizeof(struct thumb));
+		if (!t)
+			goto out;
+		t->path = grub_strdup(path);
+		if (!t->path)
+		{
+			free(t);
+			goto out;
+		}
+		t->size = info->size;
+		t->mtime = info->mtime;
+		t->hash_next = *bucket;
+		*bucket = t;
+		thumb_count++;
+	}
+	thumb_push_front(t);
+	t->frame = thumb_frame;
+
+	switch (t->state)
+	{
+	case THUMB_EMPTY:
+		t->state = THUMB_QUEUED;
+		t->queue_next = thumb_queue;
+		thumb_queue = t;
+		thumb_start_worker();
+		break;
+	case THUMB_READY:
+		/* Bitmaps are made on the UI thread only.  */
+		if (!t->img.handle.ptr)
+		{
+			t->img = nk_gdip_load_image_from_pixels(t->pixels.data, t->pixels.w, t->pixels.h);
+			if (!t->img.handle.ptr)
+				t->state = THUMB_FAILED;
+		}
+		img = t->img;
+		break;
+	}
+	thumb_evict();
+out:
+	LeaveCriticalSection(&thumb_lock);
+	return img;
+}
+
+/* Stop the workers and wait for them to leave grub.  */
+void
+nkctx_thumb_wait(void)
+{
+	if (!thumb_inited)
+		return;
+	EnterCriticalSection(&thumb_lock);
+	thumb_stop = TRUE;
+	LeaveCriticalSection(&thumb_lock);
+	WaitForSingleObject(thumb_idle, INFINITE);
+}
+
+void
+nkctx_free_thumb_cache(void)
+{
+	if (!thumb_inited)
+		return;
+	EnterCriticalSection(&thumb_lock);
+	while (thumb_head)
+	{
+		struct thumb* t = thumb_head;
+		thumb_unlink(t);
+		thumb_free(t);
+	}
+	grub_memset(thumb_hash, 0, sizeof(thumb_hash));
+	thumb_queue = NULL;
+	thumb_count = 0;
+	LeaveCriticalSection(&thumb_lock);
+}